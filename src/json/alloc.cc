@@ -10,6 +10,7 @@ extern "C" {
 }
 
 void *dom_alloc(size_t size) {
+    MemoryCategoryScope scope(MEMORY_CATEGORY_NODES, true);
     void *ptr = memory_alloc(size);
     // actually allocated size may not be same as the requested size
     size_t real_size = memory_allocsize(ptr);
@@ -18,6 +19,7 @@ void *dom_alloc(size_t size) {
 }
 
 void dom_free(void *ptr) {
+    MemoryCategoryScope scope(MEMORY_CATEGORY_NODES, true);
     size_t size = memory_allocsize(ptr);
     memory_free(ptr);
     jsonstats_decrement_used_mem(size);
@@ -32,6 +34,7 @@ void *dom_realloc(void *orig_ptr, size_t new_size) {
     }
     if (orig_ptr == nullptr) return dom_alloc(new_size);
 
+    MemoryCategoryScope scope(MEMORY_CATEGORY_NODES, true);
     size_t orig_size = memory_allocsize(orig_ptr);
     void *new_ptr = memory_realloc(orig_ptr, new_size);
     // actually allocated size may not be same as the requested size
@@ -0,0 +1,127 @@
+#include "json/arena.h"
+#include "json/alloc.h"
+#include <cstring>
+#include <new>
+
+extern "C" {
+#define VALKEYMODULE_EXPERIMENTAL_API
+#include <./include/valkeymodule.h>
+}
+
+thread_local DocArena *DocArena::currentArena = nullptr;
+
+// Round up the requested size to the size of the chunk that holds it, including the header
+static inline size_t chunk_size(size_t size) {
+    return (size + 8 /* header */ + 7) & ~size_t(7);
+}
+
+DocArena::DocArena() : blocks(nullptr), numBlocks(0), capacity(0), footprint(0), bump(nullptr), bumpEnd(nullptr) {
+    for (size_t i = 0; i < kNumClasses; ++i) freeLists[i] = nullptr;
+}
+
+DocArena *DocArena::create() {
+    return new (dom_alloc(sizeof(DocArena))) DocArena();
+}
+
+void DocArena::destroy(DocArena *arena) {
+    if (arena == nullptr) return;
+    for (size_t i = 0; i < arena->numBlocks; ++i) dom_free(arena->blocks[i].begin);
+    if (arena->blocks) dom_free(arena->blocks);
+    arena->~DocArena();
+    dom_free(arena);
+}
+
+/**
+ * Put the unused rest of a block on the free lists, so that it isn't lost when a new block is started.
+ */
+void DocArena::retire(char *p, char *end) {
+    while (size_t(end - p) >= 2 * kGranularity) {
+        size_t size = size_t(end - p);
+        if (size > kMaxChunkSize + kHeaderSize) size = kMaxChunkSize + kHeaderSize;
+        size &= ~(kGranularity - 1);
+        memcpy(p, &size, sizeof(size));
+        void *chunk = p + kHeaderSize;
+        *static_cast<void **>(chunk) = freeLists[size / kGranularity];
+        freeLists[size / kGranularity] = chunk;
+        p += size;
+    }
+}
+
+void DocArena::addBlock(size_t size) {
+    MemoryCategoryScope scope(MEMORY_CATEGORY_NODES);  // Whatever the chunk that needed the block is for
+    if (numBlocks == capacity) {
+        capacity = capacity ? 2 * capacity : 4;
+        blocks = static_cast<Block *>(dom_realloc(blocks, capacity * sizeof(Block)));
+    }
+    char *begin = static_cast<char *>(dom_alloc(size));
+    // Insertion sort by address, there're only a few blocks per document
+    size_t i = numBlocks;
+    while (i > 0 && blocks[i - 1].begin > begin) {
+        blocks[i] = blocks[i - 1];
+        --i;
+    }
+    blocks[i].begin = begin;
+    blocks[i].end = begin + size;
+    numBlocks++;
+    footprint += size;
+    retire(bump, bumpEnd);
+    bump = begin;
+    bumpEnd = begin + size;
+}
+
+void *DocArena::allocate(size_t size) {
+    if (size == 0 || size > kMaxChunkSize) return nullptr;
+    size_t csize = chunk_size(size);
+    void *chunk = freeLists[csize / kGranularity];
+    if (chunk) {
+        freeLists[csize / kGranularity] = *static_cast<void **>(chunk);
+        return chunk;
+    }
+    if (size_t(bumpEnd - bump) < csize) {
+        size_t block_size = footprint < kMinBlockSize ? kMinBlockSize : footprint;
+        addBlock(block_size > kMaxBlockSize ? kMaxBlockSize : block_size);
+    }
+    memcpy(bump, &csize, sizeof(csize));
+    chunk = bump + kHeaderSize;
+    bump += csize;
+    return chunk;
+}
+
+bool DocArena::owns(const void *ptr) const {
+    const char *p = static_cast<const char *>(ptr);
+    // Find the last block that begins at or before p
+    size_t lo = 0, hi = numBlocks;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (blocks[mid].begin <= p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 && p < blocks[lo - 1].end;
+}
+
+void DocArena::free(void *ptr) {
+    size_t csize;
+    memcpy(&csize, static_cast<char *>(ptr) - kHeaderSize, sizeof(csize));
+    ValkeyModule_Assert(csize >= 2 * kGranularity && csize <= kMaxChunkSize + kHeaderSize);
+    *static_cast<void **>(ptr) = freeLists[csize / kGranularity];
+    freeLists[csize / kGranularity] = ptr;
+}
+
+void *DocArena::reallocate(void *ptr, size_t new_size) {
+    size_t csize;
+    memcpy(&csize, static_cast<char *>(ptr) - kHeaderSize, sizeof(csize));
+    size_t usable = csize - kHeaderSize;
+    if (new_size == 0) {
+        free(ptr);
+        return nullptr;
+    }
+    if (new_size <= usable && chunk_size(new_size) == csize) return ptr;
+    void *new_ptr = allocate(new_size);
+    if (new_ptr == nullptr) new_ptr = dom_alloc(new_size);
+    memcpy(new_ptr, ptr, new_size < usable ? new_size : usable);
+    free(ptr);
+    return new_ptr;
+}
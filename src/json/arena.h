@@ -0,0 +1,102 @@
+/**
+ * Per-document arena for the small allocations of a document's tree: array element buffers, member vectors,
+ * hashtables, long strings and doubles. Instead of going to dom_alloc one by one, they are bump-allocated out of a
+ * chain of larger blocks owned by the document, and freed chunks are put on per-size free lists for reuse.
+ *
+ * The arena is selected through a thread-local "current arena", installed with a DocArenaScope by every dom
+ * function that allocates or frees memory of a document. The RapidJsonAllocator consults it on every call:
+ *
+ *   Malloc  - small sizes come from the current arena, larger ones from dom_alloc.
+ *   Free    - pointers inside one of the current arena's blocks go back to its free lists, anything else to
+ *             dom_free. So values allocated outside of the arena can still be moved into the document.
+ *
+ * The one rule is that memory allocated from an arena must be freed while that arena is current. The dom layer
+ * guarantees that by installing the scope at the top of each function, before any JParser or Selector local.
+ *
+ * Memory accounting is unchanged from the point of view of the JSON layer: blocks are allocated with dom_alloc,
+ * so jsonstats_begin_track_mem/jsonstats_end_track_mem see a document grow by whole blocks. Chunks freed into the
+ * free lists stay charged to the document until it's freed, or re-compacted by DocumentType_Defrag, which copies
+ * it into a fresh arena.
+ */
+#ifndef VALKEYJSONMODULE_ARENA_H_
+#define VALKEYJSONMODULE_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class DocArena {
+ public:
+    static const size_t kMaxChunkSize = 256;          // Larger allocations aren't taken from the arena
+    static const size_t kMinBlockSize = 1024;         // First block, doubles with the footprint of the arena
+    static const size_t kMaxBlockSize = 64 * 1024;
+
+    static DocArena *create();
+    static void destroy(DocArena *arena);
+
+    /**
+     * Allocate a chunk, returns nullptr if the size is 0 or larger than kMaxChunkSize.
+     */
+    void *allocate(size_t size);
+
+    /**
+     * Is this pointer in one of the blocks of this arena?
+     */
+    bool owns(const void *ptr) const;
+
+    /**
+     * Release/resize a chunk, ptr must be owned by this arena. reallocate may return memory that's not from the
+     * arena, when the new size is too large for it.
+     */
+    void free(void *ptr);
+    void *reallocate(void *ptr, size_t new_size);
+
+    size_t getFootprint() const { return footprint; }   // Total size of the blocks
+    size_t getNumBlocks() const { return numBlocks; }
+
+    /**
+     * The arena installed by the innermost DocArenaScope of this thread, nullptr if none.
+     */
+    static DocArena *current() { return currentArena; }
+
+ private:
+    friend class DocArenaScope;
+    static thread_local DocArena *currentArena;
+
+    struct Block {
+        char *begin;
+        char *end;
+    };
+
+    static const size_t kHeaderSize = 8;               // Chunk size, in front of each chunk
+    static const size_t kGranularity = 8;
+    static const size_t kNumClasses = (kMaxChunkSize + kHeaderSize) / kGranularity + 1;
+
+    DocArena();
+    void addBlock(size_t size);
+    void retire(char *p, char *end);
+
+    Block *blocks;           // Sorted by address, for owns()
+    size_t numBlocks;
+    size_t capacity;
+    size_t footprint;
+    char *bump;              // Free space at the end of the newest block
+    char *bumpEnd;
+    void *freeLists[kNumClasses];  // Indexed by chunk size / kGranularity, linked through the first word
+};
+
+/**
+ * Install a document's arena as the current one for the lifetime of the object. A null arena is installed as
+ * well, so that nested scopes of documents without an arena bypass the arena of the enclosing one.
+ */
+class DocArenaScope {
+ public:
+    explicit DocArenaScope(DocArena *arena) : saved(DocArena::currentArena) { DocArena::currentArena = arena; }
+    ~DocArenaScope() { DocArena::currentArena = saved; }
+
+ private:
+    DocArenaScope(const DocArenaScope&) = delete;
+    DocArenaScope& operator=(const DocArenaScope&) = delete;
+    DocArena *saved;
+};
+
+#endif  // VALKEYJSONMODULE_ARENA_H_
@@ -0,0 +1,225 @@
+#include "json/doc_index.h"
+#include "json/selector.h"
+#include "json/stats.h"
+#include <cstring>
+
+#define STATIC /* decorator for static functions, remove so that backtrace symbols include these */
+
+/**
+ * Charge the memory allocated or freed within the lifetime of the object to the document, see doc_index.h.
+ */
+class IndexMemoryScope {
+ public:
+    explicit IndexMemoryScope(JDocument *_doc) : doc(_doc), begin_val(jsonstats_begin_track_mem()) {}
+    ~IndexMemoryScope() {
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        if (delta == 0) return;
+        size_t orig_doc_size = dom_get_doc_size(doc);
+        size_t new_doc_size = static_cast<size_t>(static_cast<int64_t>(orig_doc_size) + delta);
+        dom_set_doc_size(doc, new_doc_size);
+        jsonstats_update_stats_on_resize(doc, orig_doc_size, new_doc_size);
+        jsonstats_untrack_mem(delta);
+    }
+
+ private:
+    JDocument *doc;
+    int64_t begin_val;
+};
+
+/**
+ * The hash key of a value. Values that are equal according to the == of filters (Selector::evalOp) have the same
+ * key: numbers are keyed by their value as a double, true and false by their type. Objects and arrays, which are
+ * never equal to anything, have no key.
+ */
+STATIC bool index_key(const JValue &v, jsn::string &key) {
+    key.clear();
+    if (v.IsNull()) {
+        key = "n";
+    } else if (v.IsTrue()) {
+        key = "t";
+    } else if (v.IsFalse()) {
+        key = "f";
+    } else if (v.IsString()) {
+        key.reserve(1 + v.GetStringLength());
+        key.append("s").append(v.GetString(), v.GetStringLength());
+    } else if (v.IsNumber()) {
+        double d = v.GetDouble();
+        if (d == 0) d = 0;  // -0.0 == 0.0
+        key.append("d").append(reinterpret_cast<const char *>(&d), sizeof(d));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+STATIC void index_elements(DocIndex *index, size_t first) {
+    jsn::string key;
+    const JValue &array = *index->array;
+    for (size_t i = first; i < array.Size(); i++) {
+        const JValue &e = array[i];
+        if (!e.IsObject()) continue;
+        auto it = e.FindMember(index->member);
+        if (it == e.MemberEnd() || !index_key(it->value, key)) continue;
+        index->positions[key].push_back(static_cast<int64_t>(i));
+    }
+}
+
+/**
+ * Resolve the path of an index. Returns the array, or nullptr if the path doesn't select exactly one array.
+ */
+STATIC const JValue *resolve_index_path(JDocument *doc, const jsn::string &path, jsn::string &pointer,
+                                        JsonUtilCode &rc) {
+    Selector selector;
+    rc = selector.getValues(doc->GetJValue(), path.c_str());
+    if (rc != JSONUTIL_SUCCESS) return nullptr;
+    if (selector.getResultSet().size() != 1) {
+        rc = JSONUTIL_JSON_PATH_NOT_EXIST;
+        return nullptr;
+    }
+    const Selector::ValueInfo &vInfo = selector.getResultSet()[0];
+    if (!vInfo.first->IsArray()) {
+        rc = JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
+        return nullptr;
+    }
+    pointer = selector.getPath(vInfo);
+    return vInfo.first;
+}
+
+/**
+ * (Re)build an index of the given array. Called within an IndexMemoryScope.
+ */
+STATIC void build_index(DocIndex *index, const JValue *array) {
+    // Drop the old table rather than clearing it, so that its buckets are given back too
+    jsn::unordered_map<jsn::string, jsn::vector<int64_t>>().swap(index->positions);
+    index->array = array;
+    index_elements(index, 0);
+}
+
+JsonUtilCode dom_index_create(JDocument *doc, const char *json_path, const char *member) {
+    for (DocIndex *index = doc->GetIndexes(); index != nullptr; index = index->next) {
+        if (index->path == json_path && index->member == member) return JSONUTIL_SUCCESS;
+    }
+
+    IndexMemoryScope scope(doc);
+    jsn::string path(json_path);
+    jsn::string pointer;
+    JsonUtilCode rc;
+    const JValue *array = resolve_index_path(doc, path, pointer, rc);
+    if (array == nullptr) return rc;
+
+    DocIndex *index = new DocIndex();
+    index->path = std::move(path);
+    index->member = member;
+    index->pointer = std::move(pointer);
+    build_index(index, array);
+    index->next = doc->GetIndexes();
+    doc->Ext().indexes = index;
+    return JSONUTIL_SUCCESS;
+}
+
+bool dom_index_drop(JDocument *doc, const char *json_path, const char *member) {
+    if (doc->GetIndexes() == nullptr) return false;
+    for (DocIndex **p = &doc->Ext().indexes; *p != nullptr; p = &(*p)->next) {
+        DocIndex *index = *p;
+        if (index->path == json_path && index->member == member) {
+            IndexMemoryScope scope(doc);
+            *p = index->next;
+            delete index;
+            doc->ReleaseUnusedExt();
+            return true;
+        }
+    }
+    return false;
+}
+
+void dom_index_list(const JDocument *doc, jsn::vector<IndexInfo> &infos) {
+    infos.clear();
+    for (const DocIndex *index = doc->GetIndexes(); index != nullptr; index = index->next) {
+        infos.push_back({index->path, index->member, index->array == nullptr,
+                         index->array == nullptr ? 0 : index->positions.size()});
+    }
+}
+
+void dom_index_free_all(JDocument *doc) {
+    while (doc->GetIndexes() != nullptr) {
+        DocIndex *index = doc->GetIndexes();
+        doc->ext->indexes = index->next;
+        delete index;
+    }
+}
+
+void dom_index_copy(JDocument *dst, const JDocument *src) {
+    if (src->GetIndexes() == nullptr) return;
+    DocIndex **tail = &dst->Ext().indexes;
+    for (const DocIndex *index = src->GetIndexes(); index != nullptr; index = index->next) {
+        DocIndex *copy = new DocIndex();
+        copy->path = index->path;
+        copy->member = index->member;
+        copy->array = nullptr;
+        copy->next = nullptr;
+        *tail = copy;
+        tail = &copy->next;
+    }
+}
+
+/**
+ * Is one of the two json pointers the other one, or a prefix of it, at a '/'?
+ */
+STATIC bool pointers_overlap(const jsn::string &a, const jsn::string &b) {
+    const jsn::string &shorter = a.length() <= b.length() ? a : b;
+    const jsn::string &longer = a.length() <= b.length() ? b : a;
+    if (longer.compare(0, shorter.length(), shorter) != 0) return false;
+    return longer.length() == shorter.length() || longer[shorter.length()] == '/';
+}
+
+/**
+ * Do the two json pointers have the same parent, i.e., are they siblings, or the same value?
+ */
+STATIC bool pointers_share_parent(const jsn::string &a, const jsn::string &b) {
+    size_t a_parent = a.rfind('/');
+    size_t b_parent = b.rfind('/');
+    if (a_parent == jsn::string::npos || a_parent != b_parent) return false;
+    return a.compare(0, a_parent, b, 0, b_parent) == 0;
+}
+
+void dom_index_invalidate(JDocument *doc, const jsn::string &pointer, const JValue *appended) {
+    for (DocIndex *index = doc->GetIndexes(); index != nullptr; index = index->next) {
+        if (index->array == nullptr) continue;
+        if (appended != nullptr && index->array == appended && index->pointer == pointer) continue;
+        // Inserting or deleting a sibling moves the array's JValue within their parent, e.g., when the members
+        // after a deleted one are shifted down or an object hashtable is rehashed, so it may no longer be at
+        // index->array. Entries are kept until the rebuild.
+        if (pointers_overlap(index->pointer, pointer) || pointers_share_parent(index->pointer, pointer)) {
+            index->array = nullptr;
+        }
+    }
+}
+
+void dom_index_append(JDocument *doc, const JValue &array, size_t first) {
+    for (DocIndex *index = doc->GetIndexes(); index != nullptr; index = index->next) {
+        if (index->array == &array) index_elements(index, first);
+    }
+}
+
+const jsn::vector<int64_t> *dom_index_lookup(JDocument *doc, const JValue &array, const std::string_view &member,
+                                             const JValue &value) {
+    static const jsn::vector<int64_t> none;
+    for (DocIndex *index = doc->GetIndexes(); index != nullptr; index = index->next) {
+        if (index->array != nullptr && index->array != &array) continue;
+        if (std::string_view(index->member) != member) continue;
+        if (index->array == nullptr) {
+            // Stale, rebuild it on the array its path selects now, which may or may not be this one
+            IndexMemoryScope scope(doc);
+            JsonUtilCode rc;
+            const JValue *indexed = resolve_index_path(doc, index->path, index->pointer, rc);
+            if (indexed == nullptr) continue;
+            build_index(index, indexed);
+            if (indexed != &array) continue;
+        }
+        jsn::string key;
+        if (!index_key(value, key)) return &none;
+        auto it = index->positions.find(key);
+        return it == index->positions.end() ? &none : &it->second;
+    }
+    return nullptr;
+}
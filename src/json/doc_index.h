@@ -0,0 +1,40 @@
+/**
+ * Secondary indexes on arrays of objects, created with JSON.INDEX CREATE <key> <path> <member>. An index maps each
+ * value of one member of the array's elements to the positions of the elements that have it, so that equality
+ * filters such as $.orders[?(@.id==12345)] look up their candidates instead of scanning the whole array. Candidates
+ * are still checked with the filter's own comparison, so an index never changes the result of a query.
+ *
+ * Keeping indexes fresh:
+ *   Writes tell the indexes of the document where they write, see dom_index_invalidate, before they touch anything.
+ *   An index whose array is at, above or below that path, or is a sibling of the value at that path, is marked
+ *   stale: inserting or deleting a sibling may move the array's JValue within the parent. Appending to the indexed array itself
+ *   updates the index in place (dom_index_append). A stale index is rebuilt by the next filter query on its array,
+ *   so a run of writes costs one rebuild, not one per write.
+ *
+ * Memory accounting:
+ *   Index memory is charged to the document size. Building, rebuilding and dropping an index may happen in the
+ *   middle of any command, including reads, so they charge or credit the document themselves and take the memory
+ *   out of the memory tracking of the command (jsonstats_untrack_mem). Incremental appends happen inside the
+ *   tracking of the write command, which charges them like every other allocation of the write.
+ *
+ * Indexes live in memory only. They are not saved in RDB or AOF, copies of a document (COPY, defrag) get them as
+ * stale indexes to be rebuilt on use.
+ */
+#ifndef VALKEYJSONMODULE_JSON_DOC_INDEX_H_
+#define VALKEYJSONMODULE_JSON_DOC_INDEX_H_
+
+#include "json/dom.h"
+
+struct DocIndex {
+    jsn::string path;          // the JSONPath given to JSON.INDEX CREATE, which selects the array
+    jsn::string member;        // the indexed member of the elements
+    jsn::string pointer;       // json pointer of the array as of the last build, for dom_index_invalidate
+    const JValue *array;       // the indexed array, nullptr while the index is stale
+    jsn::unordered_map<jsn::string, jsn::vector<int64_t>> positions;  // member value (see index_key) -> positions
+    DocIndex *next;
+
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
+#endif  // VALKEYJSONMODULE_JSON_DOC_INDEX_H_
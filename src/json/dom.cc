@@ -3,10 +3,14 @@
 #include "json/stats.h"
 #include "json/selector.h"
 #include <cstring>
+#include <cinttypes>
+#include <chrono>
 #include <memory>
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <algorithm>
+#include <limits>
 #include "json/rapidjson_includes.h"
 
 #define STATIC /* decorator for static functions, remove so that backtrace symbols include these */
@@ -52,11 +56,13 @@ JValue& dom_get_value(JDocument &doc) {
 }
 
 JParser& JParser::Parse(const char *json, size_t len) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_INPUT_PARSE);
     int64_t begin_val = jsonstats_begin_track_mem();
     RJParser::Parse(json, len);
     int64_t delta = jsonstats_end_track_mem(begin_val);
     ValkeyModule_Assert(delta >= 0);
     allocated_size = static_cast<size_t>(delta);
+    jsonstats_count_packed_arrays(GetPackedArrays(), GetPackedElements());
     return *this;
 }
 
@@ -69,13 +75,190 @@ jsn::string validate(const JDocument *doc) {
     return jsn::string(s.c_str(), s.length());
 }
 
-STATIC JDocument *create_doc() {
-    return new JDocument();
+STATIC JDocument *create_doc(bool with_arena = json_is_doc_arena_enabled()) {
+    JDocument *doc = new JDocument();
+    if (with_arena) doc->Ext().arena = DocArena::create();
+    return doc;
 }
 
+/**
+ * Release the cached serialization of the document. Every write calls this when it modifies the document, inside
+ * the memory tracking of the write command, which credits the freed memory back to the document size.
+ */
+STATIC void invalidate_serialized_root(JDocument *doc) {
+    if (doc->GetSerializedRoot()) {
+        dom_free(doc->GetSerializedRoot());
+        doc->ext->serialized_root = nullptr;
+        doc->ReleaseUnusedExt();
+    }
+}
+
+/**
+ * Mark the secondary indexes that the values selected for a write may affect as stale, see doc_index.h. Called
+ * before the write modifies the document, as the paths of the values refer to member names in the document.
+ */
+STATIC void invalidate_indexes(JDocument *doc, Selector &selector) {
+    if (doc->GetIndexes() == nullptr) return;
+    for (auto &vInfo : selector.getResultSet()) dom_index_invalidate(doc, selector.getPath(vInfo));
+}
+
+/**
+ * Copy-on-write sharing of trees, see dom_copy. A shared copy starts out as an alias of the tree of its source: the
+ * JValues of both documents hold the same bits, so reads work on either one without knowing. The documents sharing a
+ * tree form a ring through next_sharer. Every write calls unshare_doc before it selects anything, which gives the
+ * document a private copy of the tree and takes it out of the ring. The tree itself is released by the last document
+ * of the ring, which is private by then. The rings are only changed on the main thread, documents freed by the
+ * lazyfree thread are handed over to it, see dom_was_shared.
+ *
+ * Memory accounting:
+ *   The memory of the shared tree is charged to one document of the ring, the one with a shared_charge, the others
+ *   are charged for what they own. A document leaving the ring hands the charge on to the next one. Like index memory,
+ *   see doc_index.h, this can happen in the middle of any command, so the documents are charged directly and the
+ *   memory is taken out of the memory tracking of the command.
+ */
+STATIC void alias_tree(JDocument *dst, const JDocument *src) {
+    memcpy(static_cast<void *>(&dst->GetJValue()), static_cast<const void *>(&src->GetJValue()), sizeof(JValue));
+}
+
+/* Make the document null without releasing the tree, which belongs to the other documents of the ring. */
+STATIC void drop_tree_alias(JDocument *doc) {
+    JValue null;
+    memcpy(static_cast<void *>(&doc->GetJValue()), static_cast<const void *>(&null), sizeof(JValue));
+}
+
+STATIC void charge_doc(JDocument *doc, const int64_t delta) {
+    if (delta == 0) return;
+    size_t orig_doc_size = dom_get_doc_size(doc);
+    size_t new_doc_size = static_cast<size_t>(std::max(static_cast<int64_t>(orig_doc_size) + delta, int64_t(0)));
+    dom_set_doc_size(doc, new_doc_size);
+    jsonstats_update_stats_on_resize(doc, orig_doc_size, new_doc_size);
+}
+
+/* The optional state of the source of a copy, allocated if need be and charged to the source, not the copy. */
+STATIC JDocumentExt &source_ext(const JDocument *doc) {
+    if (doc->ext == nullptr) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        doc->Ext();
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        charge_doc(const_cast<JDocument *>(doc), delta);
+        jsonstats_untrack_mem(delta);
+    }
+    return *doc->ext;
+}
+
+/**
+ * The memory of the tree of a document that's about to be shared: the size of the document, less what it owns
+ * besides the tree. Documents with secondary indexes are never shared, so that's the document itself, its optional
+ * state and its cached serialization.
+ */
+STATIC size_t tree_charge(const JDocument *doc) {
+    size_t own = memory_allocsize(const_cast<JDocument *>(doc));
+    if (doc->ext) own += memory_allocsize(doc->ext);
+    if (doc->GetSerializedRoot()) own += memory_allocsize(doc->GetSerializedRoot());
+    return doc->size > own ? doc->size - own : 0;
+}
+
+/**
+ * Take the document out of its ring, handing the charge of the tree, if it has it, on to the next document.
+ * @return the charge the document had, to be credited to it by the caller.
+ */
+STATIC size_t leave_ring(JDocument *doc) {
+    JDocument *prev = doc;
+    while (prev->GetNextSharer() != doc) prev = prev->GetNextSharer();
+    JDocument *heir = doc->GetNextSharer();
+    prev->ext->next_sharer = prev == heir ? nullptr : heir;
+    doc->ext->next_sharer = nullptr;
+
+    size_t charge = doc->ext->shared_charge;
+    doc->ext->shared_charge = 0;
+    if (charge != 0) {
+        charge_doc(heir, static_cast<int64_t>(charge));
+        heir->ext->shared_charge = charge;
+    }
+    // The last document of the ring owns the tree, and is charged for it already
+    if (heir->GetNextSharer() == nullptr) heir->ext->shared_charge = 0;
+    return charge;
+}
+
+/**
+ * Give a document sharing its tree a private copy of it. Called by every write before it looks at the document.
+ */
+STATIC void unshare_doc(JDocument *doc) {
+    if (doc->GetNextSharer() == nullptr) return;
+    int64_t begin_val = jsonstats_begin_track_mem();
+    {
+        JValue copy;
+        copy.CopyFrom(doc->GetJValue(), allocator);
+        drop_tree_alias(doc);
+        doc->SetJValue(copy);
+    }
+    // Indexes built while shared point into the tree of the ring
+    if (doc->GetIndexes() != nullptr) dom_index_invalidate(doc, jsn::string());
+    size_t charge = leave_ring(doc);
+    int64_t delta = jsonstats_end_track_mem(begin_val);
+    charge_doc(doc, delta - static_cast<int64_t>(charge));
+    jsonstats_untrack_mem(delta);
+}
+
+bool dom_is_shared(const JDocument *doc) {
+    return doc->GetNextSharer() != nullptr;
+}
+
+bool dom_was_shared(const JDocument *doc) {
+    return doc->ext != nullptr && doc->ext->was_shared;
+}
+
+/**
+ * Compression of cold documents, see dom_compress_doc. A compressed tree is the binary RDB encoding of the document,
+ * see store_binary_JValue, behind a header. As with unshare_doc, documents are compressed and inflated outside of
+ * the commands that write them, so the document is charged directly.
+ */
+struct CompressedTree {
+    size_t length;       // length of the encoding, which follows the header
+    size_t tree_size;    // memory of the tree when it was compressed, for the compression ratio
+    char *bytes() { return reinterpret_cast<char *>(this + 1); }
+    const char *bytes() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+STATIC CompressedTree *alloc_compressed(const size_t length, const size_t tree_size) {
+    CompressedTree *c = static_cast<CompressedTree *>(dom_alloc(sizeof(CompressedTree) + length));
+    c->length = length;
+    c->tree_size = tree_size;
+    jsonstats_add_compressed(tree_size, length);
+    return c;
+}
+
+STATIC void free_compressed(JDocument *doc) {
+    CompressedTree *c = doc->GetCompressed();
+    if (c == nullptr) return;
+    jsonstats_remove_compressed(c->tree_size, c->length);
+    dom_free(c);
+    doc->ext->compressed = nullptr;
+    doc->ReleaseUnusedExt();
+}
+
+// A temporary, private tree of a compressed document, for callbacks that have to walk it. Free with dom_free_doc.
+STATIC JDocument *decode_compressed(const JDocument *doc);
+
 void dom_free_doc(JDocument *doc) {
     ValkeyModule_Assert(doc != nullptr);
-    delete doc;
+    invalidate_serialized_root(doc);
+    free_compressed(doc);
+    dom_index_free_all(doc);
+    if (doc->GetNextSharer() != nullptr) {
+        // The tree stays with the rest of the ring
+        leave_ring(doc);
+        drop_tree_alias(doc);
+    }
+    DocArena *arena = doc->GetArena();
+    delete doc->ext;
+    {
+        // The tree is still walked to release the member names in the KeyTable, and whatever isn't in the arena.
+        // Chunks in the arena are just put on its free lists, and then the blocks are released all at once.
+        DocArenaScope arena_scope(arena);
+        delete doc;
+    }
+    DocArena::destroy(arena);
 }
 
 size_t dom_get_doc_size(const JDocument *doc) {
@@ -94,19 +277,31 @@ void dom_set_bucket_id(JDocument *doc, const uint32_t bucket_id) {
     doc->bucket_id = bucket_id;
 }
 
-JsonUtilCode dom_parse(ValkeyModuleCtx *ctx, const char *json_buf, const size_t buf_len, JDocument **doc) {
-    *doc = nullptr;
+/**
+ * Parse into an empty document. The document is created first, so that the parser allocates from its arena.
+ */
+STATIC JsonUtilCode parse_into_doc(ValkeyModuleCtx *ctx, const char *json_buf, const size_t buf_len, JDocument *doc) {
+    DocArenaScope arena_scope(doc->GetArena());
     JParser parser;
     if (parser.Parse(json_buf, buf_len).HasParseError()) {
         return parser.GetParseErrorCode();
     }
     CHECK_DOCUMENT_SIZE_LIMIT(ctx, size_t(0), parser.GetJValueSize())
-    *doc = create_doc();
-    (*doc)->SetJValue(parser.GetJValue());
+    doc->SetJValue(parser.GetJValue());
     jsonstats_update_max_depth_ever_seen(parser.GetMaxDepth());
     return JSONUTIL_SUCCESS;
 }
 
+JsonUtilCode dom_parse(ValkeyModuleCtx *ctx, const char *json_buf, const size_t buf_len, JDocument **doc) {
+    *doc = create_doc();
+    JsonUtilCode rc = parse_into_doc(ctx, json_buf, buf_len, *doc);
+    if (rc != JSONUTIL_SUCCESS) {
+        dom_free_doc(*doc);
+        *doc = nullptr;
+    }
+    return rc;
+}
+
 STATIC bool has_custom_format(const PrintFormat *format) {
     return (format != nullptr && (format->indent != nullptr || format->space != nullptr || format->newline != nullptr));
 }
@@ -116,6 +311,7 @@ STATIC bool has_custom_format(const PrintFormat *format) {
  */
 STATIC void serialize_value(const JValue &val, size_t initialLevel, const PrintFormat *format,
                             rapidjson::StringBuffer &oss) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_SERIALIZATION);
     size_t max_depth = 0;
     rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(oss);
     if (has_custom_format(format)) {
@@ -132,6 +328,7 @@ STATIC void serialize_value(const JValue &val, size_t initialLevel, const PrintF
 }
 
 STATIC void serialize_value(const JValue &val, size_t initialLevel, const PrintFormat *format, ReplyBuffer& oss) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_SERIALIZATION);
     size_t max_depth = 0;
     rapidjson::PrettyWriter<ReplyBuffer> writer(oss);
     if (has_custom_format(format)) {
@@ -155,29 +352,168 @@ void dom_serialize_value(const JValue &val, const PrintFormat *format, rapidjson
     serialize_value(val, 0, format, oss);
 }
 
-JsonUtilCode dom_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, const char *new_val_json,
-                           size_t new_val_size, const bool is_create_only, const bool is_update_only) {
+struct PreparedSet {
+    JDocument *doc;
+    Selector selector;
+    JParser new_val;
+
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
+STATIC JsonUtilCode prepare_set_path(JDocument *doc, const char *json_path, const bool is_create_only,
+                                     const bool is_update_only, Selector &selector) {
     if (is_create_only && is_update_only) return JSONUTIL_NX_XX_SHOULD_BE_MUTUALLY_EXCLUSIVE;
 
-    Selector selector;
-    JsonUtilCode rc = selector.prepareSetValues(doc->GetJValue(), json_path);
+    JsonUtilCode rc = selector.prepareSetValues(*doc, json_path);
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     if (is_create_only && selector.hasUpdates()) return JSONUTIL_NX_XX_CONDITION_NOT_SATISFIED;
     if (is_update_only && selector.hasInserts()) return JSONUTIL_NX_XX_CONDITION_NOT_SATISFIED;
+    return JSONUTIL_SUCCESS;
+}
+
+STATIC JsonUtilCode check_set_limits(ValkeyModuleCtx *ctx, JDocument *doc, Selector &selector, JParser &new_val) {
+    CHECK_DOCUMENT_PATH_LIMIT(ctx, selector, new_val)
+    CHECK_DOCUMENT_SIZE_LIMIT(ctx, doc->size, new_val.GetJValueSize())
+    return JSONUTIL_SUCCESS;
+}
+
+STATIC JsonUtilCode prepare_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path,
+                                      const char *new_val_json, size_t new_val_size, const bool is_create_only,
+                                      const bool is_update_only, Selector &selector, JParser &new_val) {
+    JsonUtilCode rc = prepare_set_path(doc, json_path, is_create_only, is_update_only, selector);
+    if (rc != JSONUTIL_SUCCESS) return rc;
 
-    JParser new_val;
     if (new_val.Parse(new_val_json, new_val_size).HasParseError()) {
         return new_val.GetParseErrorCode();
     }
+    return check_set_limits(ctx, doc, selector, new_val);
+}
 
-    CHECK_DOCUMENT_PATH_LIMIT(ctx, selector, new_val)
-    CHECK_DOCUMENT_SIZE_LIMIT(ctx, doc->size, new_val.GetJValueSize())
+JsonUtilCode dom_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, const char *new_val_json,
+                           size_t new_val_size, const bool is_create_only, const bool is_update_only) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
+    Selector selector;
+    JParser new_val;
+    JsonUtilCode rc = prepare_set_value(ctx, doc, json_path, new_val_json, new_val_size, is_create_only,
+                                        is_update_only, selector, new_val);
+    if (rc != JSONUTIL_SUCCESS) return rc;
 
+    invalidate_serialized_root(doc);
     selector.commit(new_val);
     return JSONUTIL_SUCCESS;
 }
 
+JsonUtilCode dom_prepare_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path,
+                                   const char *new_val_json, size_t new_val_len, const bool is_create_only,
+                                   const bool is_update_only, PreparedSet **prepared) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
+    PreparedSet *p = new PreparedSet();
+    p->doc = doc;
+    JsonUtilCode rc = prepare_set_value(ctx, doc, json_path, new_val_json, new_val_len, is_create_only,
+                                        is_update_only, p->selector, p->new_val);
+    if (rc != JSONUTIL_SUCCESS) {
+        delete p;
+        return rc;
+    }
+    *prepared = p;
+    return JSONUTIL_SUCCESS;
+}
+
+void dom_commit_set_value(PreparedSet *prepared) {
+    JDocument *doc = prepared->doc;
+    {
+        DocArenaScope arena_scope(doc->GetArena());
+        invalidate_serialized_root(doc);
+        prepared->selector.commit(prepared->new_val);
+    }
+    delete prepared;
+}
+
+void dom_free_prepared_set(PreparedSet *prepared) {
+    delete prepared;
+}
+
+struct ParsedValue {
+    JParser parser;
+
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
+JsonUtilCode dom_parse_detached(const char *json, size_t len, ParsedValue **parsed) {
+    ParsedValue *p = new ParsedValue();
+    if (p->parser.Parse(json, len).HasParseError()) {
+        JsonUtilCode rc = p->parser.GetParseErrorCode();
+        delete p;
+        return rc;
+    }
+    *parsed = p;
+    return JSONUTIL_SUCCESS;
+}
+
+size_t dom_get_parsed_value_size(const ParsedValue *parsed) {
+    return parsed->parser.GetAllocatedSize();
+}
+
+void dom_free_parsed_value(ParsedValue *parsed) {
+    delete parsed;
+}
+
+JsonUtilCode dom_parse_from(ValkeyModuleCtx *ctx, ParsedValue *parsed, JDocument **doc) {
+    CHECK_DOCUMENT_SIZE_LIMIT(ctx, size_t(0), parsed->parser.GetJValueSize())
+    *doc = create_doc();
+    (*doc)->SetJValue(parsed->parser.GetJValue());
+    jsonstats_update_max_depth_ever_seen(parsed->parser.GetMaxDepth());
+    return JSONUTIL_SUCCESS;
+}
+
+JsonUtilCode dom_set_parsed_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, ParsedValue *parsed,
+                                  const bool is_create_only, const bool is_update_only) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
+    Selector selector;
+    JsonUtilCode rc = prepare_set_path(doc, json_path, is_create_only, is_update_only, selector);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+    rc = check_set_limits(ctx, doc, selector, parsed->parser);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+
+    invalidate_serialized_root(doc);
+    selector.commit(parsed->parser);
+    // What's left is either a value replaced by the new one, or the new value if it was copied to several paths:
+    // free it here, as dom_set_value does, so that the caller sees it
+    parsed->parser.GetJValue().SetNull();
+    return JSONUTIL_SUCCESS;
+}
+
+JsonUtilCode dom_merge_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, const char *patch_json,
+                             size_t patch_len) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
+    JParser patch;
+    if (patch.Parse(patch_json, patch_len).HasParseError()) return patch.GetParseErrorCode();
+
+    Selector selector;
+    if (patch.GetJValue().IsNull() && !jsonutil_is_root_path(json_path)) {
+        // A null patch removes the values, as it removes a member of an object being merged into
+        size_t num_vals_deleted;
+        JsonUtilCode rc = selector.deleteValues(*doc, json_path, num_vals_deleted);
+        if (rc == JSONUTIL_SUCCESS && num_vals_deleted > 0) invalidate_serialized_root(doc);
+        return rc == JSONUTIL_JSON_PATH_NOT_EXIST ? JSONUTIL_SUCCESS : rc;
+    }
+
+    JsonUtilCode rc = selector.prepareSetValues(*doc, json_path);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+    CHECK_DOCUMENT_PATH_LIMIT(ctx, selector, patch)
+    CHECK_DOCUMENT_SIZE_LIMIT(ctx, doc->size, patch.GetJValueSize())
+
+    invalidate_serialized_root(doc);
+    return selector.commitMerge(patch.GetJValue());
+}
+
 template<typename OutputBuffer>
 STATIC void PutString(OutputBuffer& oss, const char *str) {
     while (*str) oss.Put(*str++);
@@ -190,6 +526,105 @@ STATIC void PutEscapedString(OutputBuffer& oss, const char *str) {
     serialize_value(tmp, 0, nullptr, oss);
 }
 
+// Documents smaller than this are serialized without a size estimate, growing the buffer is cheap for them.
+#define RESERVE_MIN_DOCUMENT_SIZE (64 * 1024)
+
+STATIC size_t count_digits(uint64_t v) {
+    size_t n = 1;
+    while (v >= 10) {
+        v /= 10;
+        n++;
+    }
+    return n;
+}
+
+STATIC size_t safe_strlen(const char *str) {
+    return str ? strlen(str) : 0;
+}
+
+/**
+ * Walk the value tree and add up the length of its serialized form. The result is exact for compact format,
+ * except that escaped characters in strings are counted as one byte each.
+ */
+STATIC size_t estimate_value_size(const JValue &val, size_t level, size_t newline, size_t indent, size_t space) {
+    switch (val.GetType()) {
+        case rapidjson::kNullType:
+        case rapidjson::kTrueType:
+            return 4;
+        case rapidjson::kFalseType:
+            return 5;
+        case rapidjson::kStringType:
+            return val.GetStringLength() + 2;
+        case rapidjson::kNumberType:
+            if (val.IsDouble()) {
+                char buf[BUF_SIZE_DOUBLE_JSON];
+                rapidjson::SizeType len;
+                val.GetDoubleString(buf, len);
+                return len;
+            }
+            if (val.IsUint64()) return count_digits(val.GetUint64());
+            return 1 + count_digits(0 - static_cast<uint64_t>(val.GetInt64()));
+        case rapidjson::kArrayType: {
+            if (val.Empty()) return 2;
+            // brackets, commas, a newline and indentation before every element and the closing bracket
+            size_t size = 2 + (val.Size() - 1) + (val.Size() + 1) * newline +
+                          val.Size() * (level + 1) * indent + level * indent;
+            for (auto &e : val.GetArray()) size += estimate_value_size(e, level + 1, newline, indent, space);
+            return size;
+        }
+        case rapidjson::kObjectType: {
+            if (val.ObjectEmpty()) return 2;
+            size_t size = 2 + (val.MemberCount() - 1) + (val.MemberCount() + 1) * newline +
+                          val.MemberCount() * ((level + 1) * indent + 3 + space) + level * indent;
+            for (auto &m : val.GetObject()) {
+                size += m.name.GetStringLength() + estimate_value_size(m.value, level + 1, newline, indent, space);
+            }
+            return size;
+        }
+        default:
+            return 0;
+    }
+}
+
+const char *dom_get_serialized_root(JDocument *doc, size_t &len) {
+    // The cache holds the length followed by the text
+    if (doc->GetSerializedRoot() == nullptr) {
+        rapidjson::StringBuffer oss;
+        oss.Reserve(dom_estimate_serialized_size(*doc, nullptr, 1) + 2);
+        oss.Put('[');
+        serialize_value(*doc, 1, nullptr, oss);
+        oss.Put(']');
+        size_t length = oss.GetLength();
+        char *root = static_cast<char *>(dom_alloc(sizeof(size_t) + length));
+        memcpy(root, &length, sizeof(size_t));
+        memcpy(root + sizeof(size_t), oss.GetString(), length);
+        doc->Ext().serialized_root = root;
+    }
+    const char *root = doc->GetSerializedRoot();
+    memcpy(&len, root, sizeof(size_t));
+    return root + sizeof(size_t);
+}
+
+size_t dom_estimate_serialized_size(const JValue &val, const PrintFormat *format, size_t initialLevel) {
+    if (!has_custom_format(format)) return estimate_value_size(val, initialLevel, 0, 0, 0);
+    return estimate_value_size(val, initialLevel, safe_strlen(format->newline), safe_strlen(format->indent),
+                               safe_strlen(format->space));
+}
+
+/**
+ * Reserve the output buffer for the serialized values upfront, so that a large reply is written into a
+ * single allocation instead of being copied every time the buffer grows.
+ */
+template<typename T>
+STATIC void reserve_for_values(const JDocument *doc, const jsn::vector<JValue*> &values, size_t initialLevel,
+                               const PrintFormat *format, T &oss) {
+    if (doc->size < RESERVE_MIN_DOCUMENT_SIZE) return;
+    // enclosing array brackets and commas
+    size_t size = 2 + values.size();
+    for (auto v : values) size += dom_estimate_serialized_size(*v, format, initialLevel);
+    oss.Reserve(size);
+}
+
 // Build stringified JSON array directly from a vector of values.
 template<typename T>
 STATIC void build_json_array(const jsn::vector<JValue*> &values, const PrintFormat *format, T &oss) {
@@ -209,10 +644,9 @@ template STATIC void build_json_array(const jsn::vector<JValue*> &values, const
 template STATIC void build_json_array(const jsn::vector<JValue*> &values, const PrintFormat *format,
         rapidjson::StringBuffer &oss);
 
-template<typename T>
-JsonUtilCode dom_get_value_as_str(JDocument *doc, const char *json_path, const PrintFormat *format,
-                                  T &oss, const bool update_stats) {
-    Selector selector;
+JsonUtilCode dom_select_values(JDocument *doc, const char *json_path, Selector &selector,
+                               jsn::vector<JValue*> &values) {
+    values.clear();
     JsonUtilCode rc = selector.getValues(*doc, json_path);
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -220,33 +654,52 @@ JsonUtilCode dom_get_value_as_str(JDocument *doc, const char *json_path, const P
         if (selector.isSyntaxError(rc)) return rc;
     }
 
-    jsn::vector<JValue*> values;
     selector.getSelectedValues(values);
 
     // If legacy path, return either the first value, or NONEXISTENT error if no value is found.
     if (selector.isLegacyJsonPathSyntax()) {
-        if (values.empty()) {
-            return JSONUTIL_JSON_PATH_NOT_EXIST;
-        } else {
-            serialize_value(*values[0], 0, format, oss);
-            // update stats
-            if (update_stats) jsonstats_update_stats_on_read(oss.GetLength());
-            return JSONUTIL_SUCCESS;
-        }
+        if (values.empty()) return JSONUTIL_JSON_PATH_NOT_EXIST;
+        values.resize(1);
     }
+    return JSONUTIL_SUCCESS;
+}
 
-    // v2 path: return an array of values.
-    if (values.empty()) {
-        // return an empty array
+template<typename T>
+void dom_serialize_selected_values(const JDocument *doc, const jsn::vector<JValue*> &values,
+                                   const bool is_legacy_path, const PrintFormat *format, T &oss,
+                                   const bool update_stats) {
+    reserve_for_values(doc, values, is_legacy_path ? 0 : 1, format, oss);
+    if (is_legacy_path) {
+        serialize_value(*values[0], 0, format, oss);
+    } else if (values.empty()) {
+        // v2 path: return an empty array
         oss.Put('[');
         oss.Put(']');
     } else {
-        // Multiple values are returned to the client as a JSON array.
+        // v2 path: multiple values are returned to the client as a JSON array.
         build_json_array(values, format, oss);
     }
 
     // update stats
     if (update_stats) jsonstats_update_stats_on_read(oss.GetLength());
+}
+
+template void dom_serialize_selected_values(const JDocument *doc, const jsn::vector<JValue*> &values,
+                                            const bool is_legacy_path, const PrintFormat *format, ReplyBuffer &oss,
+                                            const bool update_stats);
+template void dom_serialize_selected_values(const JDocument *doc, const jsn::vector<JValue*> &values,
+                                            const bool is_legacy_path, const PrintFormat *format,
+                                            rapidjson::StringBuffer &oss, const bool update_stats);
+
+template<typename T>
+JsonUtilCode dom_get_value_as_str(JDocument *doc, const char *json_path, const PrintFormat *format,
+                                  T &oss, const bool update_stats) {
+    Selector selector;
+    jsn::vector<JValue*> values;
+    JsonUtilCode rc = dom_select_values(doc, json_path, selector, values);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+
+    dom_serialize_selected_values(doc, values, selector.isLegacyJsonPathSyntax(), format, oss, update_stats);
     return JSONUTIL_SUCCESS;
 }
 
@@ -291,32 +744,63 @@ STATIC void appendPathAndValues(const char *key, const jsn::vector<JValue*> &val
     if (has_format && format->newline) PutString(oss, format->newline);
 }
 
+STATIC void selectPathValue(void *arg, int path, JValue &value) {
+    (*static_cast<jsn::vector<jsn::vector<JValue*>> *>(arg))[path].push_back(&value);
+}
+
+/**
+ * The paths share a single walk of the document, see PathTrie. Those outside the trie, and legacy paths that select
+ * nothing, for the error code, are evaluated by the Selector.
+ */
+STATIC JsonUtilCode selectMultiPaths(JDocument *doc, const char **paths, const int num_paths, const bool is_v2path,
+                                     jsn::vector<jsn::vector<JValue*>> &selected) {
+    PathTrie trie(paths, num_paths, is_v2path);
+    selected.assign(num_paths, jsn::vector<JValue*>());
+    trie.select(doc->GetJValue(), selectPathValue, &selected);
+    const jsn::vector<int> &others = trie.getOthers();
+    auto other = others.begin();
+
+    Selector selector(is_v2path);
+    JsonUtilCode rc;
+    for (int i = 0; i < num_paths; i++) {
+        jsn::vector<JValue*> &values = selected[i];
+        bool in_trie = (other == others.end() || *other != i);
+        if (!in_trie) ++other;
+        if (!in_trie || (!is_v2path && values.empty())) {
+            rc = selector.getValues(*doc, paths[i]);
+            if (rc != JSONUTIL_SUCCESS) {
+                if (!is_v2path) return rc;
+                // For v2 path, return error code only if it's a syntax error.
+                if (selector.isSyntaxError(rc)) return rc;
+            }
+            selector.getSelectedValues(values);
+        }
+
+        if (!is_v2path) {  // legacy path
+            if (values.empty()) return JSONUTIL_JSON_PATH_NOT_EXIST;
+            values.resize(1);
+        }
+    }
+    return JSONUTIL_SUCCESS;
+}
+
 STATIC JsonUtilCode buildJsonForMultiPaths(JDocument *doc, const char **paths, const int num_paths,
                                            const bool is_v2path, const PrintFormat *format,
                                            ReplyBuffer &oss) {
     bool has_format = has_custom_format(format);
-    Selector selector(is_v2path);
-    JsonUtilCode rc;
+    jsn::vector<jsn::vector<JValue*>> selected;
+    JsonUtilCode rc = selectMultiPaths(doc, paths, num_paths, is_v2path, selected);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+
     oss.Put('{');
     if (has_format && format->newline) PutString(oss, format->newline);
     for (int i = 0; i < num_paths; i++) {
-        rc = selector.getValues(*doc, paths[i]);
-        if (rc != JSONUTIL_SUCCESS) {
-            if (!is_v2path) return rc;
-            // For v2 path, return error code only if it's a syntax error.
-            if (selector.isSyntaxError(rc)) return rc;
-        }
-
-        jsn::vector<JValue*> values;
-        selector.getSelectedValues(values);
-
+        jsn::vector<JValue*> &values = selected[i];
         if (!is_v2path) {  // legacy path
-            if (values.empty()) {
-                return JSONUTIL_JSON_PATH_NOT_EXIST;
-            } else {
-                appendPathAndValue(paths[i], *values[0], (i == num_paths - 1), has_format, format, oss);
-            }
+            reserve_for_values(doc, values, 1, format, oss);
+            appendPathAndValue(paths[i], *values[0], (i == num_paths - 1), has_format, format, oss);
         } else {
+            reserve_for_values(doc, values, 2, format, oss);
             appendPathAndValues(paths[i], values, (i == num_paths - 1), has_format, format, oss);
         }
     }
@@ -352,8 +836,13 @@ JsonUtilCode dom_get_values_as_str(JDocument *doc, const char **paths, const int
 }
 
 JsonUtilCode dom_delete_value(JDocument *doc, const char *json_path, size_t &num_vals_deleted) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     Selector selector;
-    return selector.deleteValues(doc->GetJValue(), json_path, num_vals_deleted);
+    JsonUtilCode rc = selector.deleteValues(*doc, json_path, num_vals_deleted);
+    // Nothing is deleted unless the path is valid, so the cache is only released on success
+    if (rc == JSONUTIL_SUCCESS && num_vals_deleted > 0) invalidate_serialized_root(doc);
+    return rc;
 }
 
 // check if there is at least one number value
@@ -366,9 +855,11 @@ STATIC bool has_number_value(jsn::vector<JValue*> &values) {
 
 JsonUtilCode dom_increment_by(JDocument *doc, const char *json_path, const JValue *incr_by,
                               jsn::vector<double> &out_vals, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     out_vals.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), json_path);
+    JsonUtilCode rc = selector.getValues(*doc, json_path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -383,6 +874,8 @@ JsonUtilCode dom_increment_by(JDocument *doc, const char *json_path, const JValu
         if (!has_number_value(values)) return JSONUTIL_JSON_ELEMENT_NOT_NUMBER;
     }
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &val : selector.getUniqueResultSet()) {
         if (val.first->IsNumber()) {
             if (val.first->IsInt64() && incr_by->IsInt64()) {
@@ -399,9 +892,7 @@ JsonUtilCode dom_increment_by(JDocument *doc, const char *json_path, const JValu
             double res;
             rc = jsonutil_add_double(val.first->GetDouble(), incr_by->GetDouble(), &res);
             if (rc != JSONUTIL_SUCCESS) return rc;
-            char double_string[BUF_SIZE_DOUBLE_JSON];
-            size_t len = jsonutil_double_to_string(res, double_string, sizeof(double_string));
-            val.first->SetDouble(double_string, len, allocator);
+            val.first->SetDouble(res);  // Kept in binary, formatted when it's serialized
 
             out_vals.push_back(res);
         } else {
@@ -414,9 +905,11 @@ JsonUtilCode dom_increment_by(JDocument *doc, const char *json_path, const JValu
 
 JsonUtilCode dom_multiply_by(JDocument *doc, const char *json_path, const JValue *mult_by,
                              jsn::vector<double> &out_vals, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     out_vals.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), json_path);
+    JsonUtilCode rc = selector.getValues(*doc, json_path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -431,6 +924,8 @@ JsonUtilCode dom_multiply_by(JDocument *doc, const char *json_path, const JValue
         if (!has_number_value(values)) return JSONUTIL_JSON_ELEMENT_NOT_NUMBER;
     }
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &val : selector.getUniqueResultSet()) {
         if (val.first->IsNumber()) {
             double res;
@@ -440,9 +935,7 @@ JsonUtilCode dom_multiply_by(JDocument *doc, const char *json_path, const JValue
             if (jsonutil_is_int64(res)) {
                 val.first->SetInt64(static_cast<int64_t>(res));
             } else {
-                char double_string[BUF_SIZE_DOUBLE_JSON];
-                size_t len = jsonutil_double_to_string(res, double_string, sizeof(double_string));
-                val.first->SetDouble(double_string, len, allocator);
+                val.first->SetDouble(res);
             }
 
             out_vals.push_back(res);
@@ -462,9 +955,11 @@ STATIC bool has_boolean_value(jsn::vector<JValue*> &values) {
 }
 
 JsonUtilCode dom_toggle(JDocument *doc, const char *path, jsn::vector<int> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -483,6 +978,8 @@ JsonUtilCode dom_toggle(JDocument *doc, const char *path, jsn::vector<int> &vec,
         if (!has_boolean_value(values)) return JSONUTIL_JSON_ELEMENT_NOT_BOOL;
     }
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsBool()) {
             bool res = v.first->GetBool();
@@ -507,7 +1004,7 @@ STATIC bool has_string_value(jsn::vector<JValue*> &values) {
 JsonUtilCode dom_string_length(JDocument *doc, const char *path, jsn::vector<size_t> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -538,9 +1035,11 @@ JsonUtilCode dom_string_length(JDocument *doc, const char *path, jsn::vector<siz
 
 JsonUtilCode dom_string_append(JDocument *doc, const char *path, const char *json, const size_t json_len,
                                jsn::vector<size_t> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -560,6 +1059,8 @@ JsonUtilCode dom_string_append(JDocument *doc, const char *path, const char *jso
     if (appendVal.Parse(json, json_len).HasParseError()) return appendVal.GetParseErrorCode();
     if (!appendVal.GetJValue().IsString()) return JSONUTIL_VALUE_NOT_STRING;
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     jsn::string str_append = jsn::string(appendVal.GetString());
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsString()) {
@@ -584,7 +1085,7 @@ STATIC bool has_object_value(jsn::vector<JValue*> &values) {
 JsonUtilCode dom_object_length(JDocument *doc, const char *path, jsn::vector<size_t> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -617,7 +1118,7 @@ JsonUtilCode dom_object_keys(JDocument *doc, const char *path,
                              jsn::vector<jsn::vector<jsn::string>> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -659,7 +1160,7 @@ STATIC bool has_array_value(jsn::vector<JValue*> &values) {
 JsonUtilCode dom_array_length(JDocument *doc, const char *path, jsn::vector<size_t> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -691,9 +1192,11 @@ JsonUtilCode dom_array_length(JDocument *doc, const char *path, jsn::vector<size
 JsonUtilCode dom_array_append(ValkeyModuleCtx *ctx, JDocument *doc, const char *path,
                               const char **jsons, size_t *json_lens, const size_t num_values,
                               jsn::vector<size_t> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -720,14 +1223,21 @@ JsonUtilCode dom_array_append(ValkeyModuleCtx *ctx, JDocument *doc, const char *
     }
     CHECK_DOCUMENT_SIZE_LIMIT(ctx, doc->size, totalJValueSize)
 
+    invalidate_serialized_root(doc);
+    if (doc->GetIndexes() != nullptr) {
+        // An index of an array that's only appended to is updated rather than rebuilt
+        for (auto &v : selector.getResultSet()) dom_index_invalidate(doc, selector.getPath(v), v.first);
+    }
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsArray()) {
+            size_t first = v.first->Size();
             for (size_t i=0; i < num_values; i++) {
                 // Need to make a copy of the value because after the first call of JValue::PushBack,
                 // the object is moved and can no longer be pushed into anther array.
                 JValue copy(appendVals[i], allocator);
                 v.first->PushBack(copy, allocator);
             }
+            if (doc->GetIndexes() != nullptr) dom_index_append(doc, *v.first, first);
             vec.push_back(v.first->Size());
         } else {
             vec.push_back(SIZE_MAX);  // indicates non-array value
@@ -753,9 +1263,11 @@ STATIC void internal_array_pop(JValue &arrVal, int64_t index, jsn::vector<rapidj
 
 JsonUtilCode dom_array_pop(JDocument *doc, const char *path, int64_t index,
                            jsn::vector<rapidjson::StringBuffer> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -770,6 +1282,8 @@ JsonUtilCode dom_array_pop(JDocument *doc, const char *path, int64_t index,
         if (!has_array_value(values)) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
     }
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &v : selector.getUniqueResultSet()) {
         rapidjson::StringBuffer oss;
         if (v.first->IsArray()) {
@@ -798,6 +1312,16 @@ STATIC JsonUtilCode internal_array_insert(JValue &arrVal, jsn::vector<JParser> &
     // If index is size, we are appending to the array.
     if (index < 0 || index > static_cast<int64_t>(size)) return JSONUTIL_INDEX_OUT_OF_ARRAY_BOUNDARIES;
 
+    if (index == 0 && size > 0) {
+        // Inserting at the front of a large array takes the gap in front of its elements, see JValue::PushFront
+        for (size_t i = num_values; i > 0; i--) {
+            JValue copy(insertVals[i - 1].GetJValue(), allocator);
+            arrVal.PushFront(copy, allocator);
+        }
+        vec.push_back(arrVal.Size());
+        return JSONUTIL_SUCCESS;
+    }
+
     // append num_values empty values
     for (size_t i=0; i < num_values; i++) {
         JValue empty;
@@ -824,9 +1348,11 @@ STATIC JsonUtilCode internal_array_insert(JValue &arrVal, jsn::vector<JParser> &
 JsonUtilCode dom_array_insert(ValkeyModuleCtx *ctx, JDocument *doc, const char *path, int64_t index,
                               const char **jsons, size_t *json_lens, const size_t num_values,
                               jsn::vector<size_t> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -853,6 +1379,8 @@ JsonUtilCode dom_array_insert(ValkeyModuleCtx *ctx, JDocument *doc, const char *
     }
     CHECK_DOCUMENT_SIZE_LIMIT(ctx, doc->size, totalJValueSize)
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsArray()) {
             rc = internal_array_insert(*v.first, insertVals, num_values, index, vec);
@@ -894,9 +1422,11 @@ STATIC void internal_array_trim(JValue &arrVal, int64_t start, int64_t stop, jsn
 
 JsonUtilCode dom_array_trim(JDocument *doc, const char *path, int64_t start, int64_t stop,
                             jsn::vector<size_t> &vec, bool &is_v2_path) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) return rc;
 
@@ -911,6 +1441,8 @@ JsonUtilCode dom_array_trim(JDocument *doc, const char *path, int64_t start, int
         if (!has_array_value(values)) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
     }
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsArray()) {
             internal_array_trim(*v.first, start, stop, vec);
@@ -922,11 +1454,15 @@ JsonUtilCode dom_array_trim(JDocument *doc, const char *path, int64_t start, int
 }
 
 JsonUtilCode dom_clear(JDocument *doc, const char *path, size_t &elements_cleared) {
+    unshare_doc(doc);
+    DocArenaScope arena_scope(doc->GetArena());
     elements_cleared = 0;
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     if (rc != JSONUTIL_SUCCESS) return rc;
 
+    invalidate_serialized_root(doc);
+    invalidate_indexes(doc, selector);
     for (auto &v : selector.getUniqueResultSet()) {
         if (v.first->IsArray()) {
             if (!v.first->Empty()) {
@@ -1012,7 +1548,7 @@ JsonUtilCode dom_array_index_of(JDocument *doc, const char *path, const char *sc
                                 jsn::vector<int64_t> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -1051,7 +1587,7 @@ JsonUtilCode dom_array_index_of(JDocument *doc, const char *path, const char *sc
 JsonUtilCode dom_value_type(JDocument *doc, const char *path, jsn::vector<jsn::string> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -1162,7 +1698,7 @@ STATIC void dom_reply_with_resp_internal(ValkeyModuleCtx *ctx, const JValue& val
 
 JsonUtilCode dom_reply_with_resp(ValkeyModuleCtx *ctx, JDocument *doc, const char *path) {
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
         // For v2 path, return error code only if it's a syntax error.
@@ -1180,6 +1716,7 @@ JsonUtilCode dom_reply_with_resp(ValkeyModuleCtx *ctx, JDocument *doc, const cha
         }
     }
 
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (selector.isV2Path) ValkeyModule_ReplyWithArray(ctx, selector.getResultSet().size());
 
     for (auto &v : selector.getResultSet()) {
@@ -1188,6 +1725,90 @@ JsonUtilCode dom_reply_with_resp(ValkeyModuleCtx *ctx, JDocument *doc, const cha
     return JSONUTIL_SUCCESS;
 }
 
+/*
+ * Reply with a value as RESP3 types, returns the number of bytes of strings and member names, plus 8 per number and
+ * 1 per other value, for the read histogram.
+ */
+STATIC size_t reply_with_resp3_value(ValkeyModuleCtx *ctx, const JValue &val) {
+    switch (val.GetType()) {
+        case rapidjson::kObjectType: {
+            size_t bytes = 1;
+            ValkeyModule_ReplyWithMap(ctx, val.MemberCount());
+            for (auto &m : val.GetObject()) {
+                ValkeyModule_ReplyWithStringBuffer(ctx, m.name.GetString(), m.name.GetStringLength());
+                bytes += m.name.GetStringLength() + reply_with_resp3_value(ctx, m.value);
+            }
+            return bytes;
+        }
+        case rapidjson::kArrayType: {
+            size_t bytes = 1;
+            ValkeyModule_ReplyWithArray(ctx, val.Size());
+            for (auto &e : val.GetArray()) bytes += reply_with_resp3_value(ctx, e);
+            return bytes;
+        }
+        case rapidjson::kNullType:
+            ValkeyModule_ReplyWithNull(ctx);
+            return 1;
+        case rapidjson::kTrueType:
+        case rapidjson::kFalseType:
+            ValkeyModule_ReplyWithBool(ctx, val.IsTrue() ? 1 : 0);
+            return 1;
+        case rapidjson::kNumberType:
+            if (val.IsInt64()) {
+                ValkeyModule_ReplyWithLongLong(ctx, val.GetInt64());
+            } else if (val.IsUint64()) {
+                // Above INT64_MAX
+                char str[24];
+                int len = snprintf(str, sizeof(str), "%" PRIu64, val.GetUint64());
+                ValkeyModule_ReplyWithBigNumber(ctx, str, len);
+            } else {
+                ValkeyModule_ReplyWithDouble(ctx, val.GetDouble());
+            }
+            return 8;
+        case rapidjson::kStringType:
+            ValkeyModule_ReplyWithStringBuffer(ctx, val.GetString(), val.GetStringLength());
+            return val.GetStringLength();
+        default:
+            ValkeyModule_Assert(false);
+            return 0;
+    }
+}
+
+/* Reply with values selected by dom_select_values: the first one for a legacy path, an array of them otherwise. */
+STATIC size_t reply_with_resp3_values(ValkeyModuleCtx *ctx, const jsn::vector<JValue*> &values,
+                                      const bool is_legacy_path) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
+    if (is_legacy_path) return reply_with_resp3_value(ctx, *values[0]);
+    size_t bytes = 0;
+    ValkeyModule_ReplyWithArray(ctx, values.size());
+    for (auto v : values) bytes += reply_with_resp3_value(ctx, *v);
+    return bytes;
+}
+
+JsonUtilCode dom_reply_with_resp3(ValkeyModuleCtx *ctx, JDocument *doc, const char **paths, const int num_paths) {
+    size_t bytes = 0;
+    if (num_paths == 1) {
+        Selector selector;
+        jsn::vector<JValue*> values;
+        JsonUtilCode rc = dom_select_values(doc, paths[0], selector, values);
+        if (rc != JSONUTIL_SUCCESS) return rc;
+        bytes = reply_with_resp3_values(ctx, values, selector.isLegacyJsonPathSyntax());
+    } else {
+        // Every path is selected before anything is replied, the reply can't be taken back
+        bool is_v2path = Selector::has_at_least_one_v2path(paths, num_paths);
+        jsn::vector<jsn::vector<JValue*>> selected;
+        JsonUtilCode rc = selectMultiPaths(doc, paths, num_paths, is_v2path, selected);
+        if (rc != JSONUTIL_SUCCESS) return rc;
+        ValkeyModule_ReplyWithMap(ctx, num_paths);
+        for (int i = 0; i < num_paths; i++) {
+            ValkeyModule_ReplyWithStringBuffer(ctx, paths[i], strlen(paths[i]));
+            bytes += reply_with_resp3_values(ctx, selected[i], !is_v2path);
+        }
+    }
+    jsonstats_update_stats_on_read(bytes);
+    return JSONUTIL_SUCCESS;
+}
+
 STATIC size_t mem_size_internal(const JValue& v) {
     size_t size = sizeof(v);  // data structure size
     if (v.IsString()) {
@@ -1219,7 +1840,7 @@ JsonUtilCode dom_mem_size(JDocument *doc, const char *path, jsn::vector<size_t>
     }
 
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -1261,7 +1882,7 @@ STATIC size_t num_fields_internal(JValue& v) {
 JsonUtilCode dom_num_fields(JDocument *doc, const char *path, jsn::vector<size_t> &vec, bool &is_v2_path) {
     vec.clear();
     Selector selector;
-    JsonUtilCode rc = selector.getValues(doc->GetJValue(), path);
+    JsonUtilCode rc = selector.getValues(*doc, path);
     is_v2_path = selector.isV2Path;
     if (rc != JSONUTIL_SUCCESS) {
         if (selector.isLegacyJsonPathSyntax()) return rc;
@@ -1297,17 +1918,49 @@ STATIC void find_path_depth_internal(JValue& v, size_t d, size_t *max_depth) {
 
 void dom_path_depth(JDocument *doc, size_t *depth) {
     *depth = 0;
+    if (doc->GetCompressed()) {
+        // Measured without inflating, a key scan shouldn't warm up every document
+        JDocument *tree = decode_compressed(doc);
+        find_path_depth_internal(tree->GetJValue(), 0, depth);
+        dom_free_doc(tree);
+        return;
+    }
     find_path_depth_internal(doc->GetJValue(), 0, depth);
 }
 
 /*
  * Make a copy of this document
  */
-JDocument *dom_copy(const JDocument *src) {
+JDocument *dom_copy(const JDocument *src, const bool share) {
     int64_t begin_val = jsonstats_begin_track_mem();
 
-    JDocument *dst = create_doc();
-    dst->CopyFrom(*src, allocator);
+    JDocument *dst;
+    if (const CompressedTree *c = src->GetCompressed()) {
+        // The copy is just as cold
+        dst = create_doc(false);
+        dst->Ext().compressed = alloc_compressed(c->length, c->tree_size);
+        memcpy(dst->ext->compressed->bytes(), c->bytes(), c->length);
+    } else if (share && src->GetArena() == nullptr && src->GetIndexes() == nullptr) {
+        // Join the ring of the source, or start one. The copy is charged for the JDocument and its optional state.
+        JDocumentExt &src_ext = source_ext(src);
+        dst = create_doc(false);
+        if (src_ext.next_sharer == nullptr) {
+            src_ext.shared_charge = tree_charge(src);
+            src_ext.next_sharer = const_cast<JDocument *>(src);
+            src_ext.was_shared = true;
+        }
+        alias_tree(dst, src);
+        dst->Ext().next_sharer = src_ext.next_sharer;
+        dst->ext->was_shared = true;
+        src_ext.next_sharer = dst;
+    } else {
+        dst = create_doc(src->GetArena() != nullptr);
+        {
+            DocArenaScope arena_scope(dst->GetArena());
+            dst->CopyFrom(*src, allocator);
+        }
+        dom_index_copy(dst, src);
+    }
 
     int64_t delta = jsonstats_end_track_mem(begin_val);
     ValkeyModule_Assert(delta > 0);
@@ -1316,6 +1969,156 @@ JDocument *dom_copy(const JDocument *src) {
     return dst;
 }
 
+// Number of values visited between checks of ValkeyModule_DefragShouldStop, which reads the clock
+#define DEFRAG_CHECK_INTERVAL 64
+
+/*
+ * Where an incremental defrag stopped. Valkey defrags one document at a time, so a single one is enough.
+ * The cursor handed to Valkey identifies the saved path, so a stale one is never resumed.
+ */
+static struct {
+    const JDocument *doc = nullptr;
+    unsigned long cursor = 0;
+    jsn::vector<size_t> path;      // Index of the child being visited at every level, from the root
+} defrag_resume;
+static unsigned long defrag_cursor_seq = 0;
+
+struct DefragMover {
+    ValkeyModuleDefragCtx *ctx;
+    const DocArena *arena;
+    size_t bytes_moved;
+    int64_t size_delta;           // in case the allocator moved something into a different size class
+
+    void *operator()(void *ptr) {
+        if (ptr == nullptr || (arena != nullptr && arena->owns(ptr))) return nullptr;
+        size_t size = memory_allocsize(ptr);
+        void *new_ptr = ValkeyModule_DefragAlloc(ctx, ptr);
+        if (new_ptr == nullptr) return nullptr;
+        size_t new_size = memory_allocsize(new_ptr);
+        bytes_moved += new_size;
+        size_delta += static_cast<int64_t>(new_size) - static_cast<int64_t>(size);
+        return new_ptr;
+    }
+};
+
+struct DefragFrame {
+    JValue *v;
+    size_t next;                  // Index of the next child to visit
+    JValue::MemberIterator m;     // The same child, for objects
+};
+
+STATIC size_t defrag_num_children(const JValue &v) {
+    if (v.IsArray()) return v.Size();
+    if (v.IsObject()) return v.MemberCount();
+    return 0;
+}
+
+STATIC DefragFrame defrag_frame(JValue *v, size_t next) {
+    DefragFrame f = {v, 0, JValue::MemberIterator()};
+    if (v->IsObject()) f.m = v->MemberBegin();
+    size_t n = defrag_num_children(*v);
+    for (; f.next < next && f.next < n; f.next++) {
+        if (v->IsObject()) ++f.m;
+    }
+    return f;
+}
+
+STATIC JValue &defrag_child(DefragFrame &f) {
+    return f.v->IsArray() ? (*f.v)[f.next] : f.m->value;
+}
+
+STATIC void defrag_advance(DefragFrame &f) {
+    f.next++;
+    if (f.v->IsObject()) ++f.m;
+}
+
+STATIC void defrag_charge(JDocument *doc, const DefragMover &move) {
+    if (move.size_delta > 0) {
+        jsonstats_increment_used_mem(move.size_delta);
+    } else if (move.size_delta < 0) {
+        jsonstats_decrement_used_mem(-move.size_delta);
+    }
+    dom_set_doc_size(doc, static_cast<size_t>(static_cast<int64_t>(dom_get_doc_size(doc)) + move.size_delta));
+}
+
+bool dom_defrag(ValkeyModuleDefragCtx *ctx, JDocument **doc, size_t &bytes_moved) {
+    bytes_moved = 0;
+    DefragMover move = {ctx, (*doc)->GetArena(), 0, 0};
+    if ((*doc)->GetCompressed()) {
+        // Three allocations, the document, its optional state and its encoding, done in one go
+        if (defrag_resume.doc == *doc) defrag_resume.doc = nullptr;
+        if (void *p = move(*doc)) *doc = static_cast<JDocument *>(p);
+        if (void *p = move((*doc)->ext)) (*doc)->ext = static_cast<JDocumentExt *>(p);
+        if (void *p = move((*doc)->ext->compressed)) (*doc)->ext->compressed = static_cast<CompressedTree *>(p);
+        defrag_charge(*doc, move);
+        bytes_moved = move.bytes_moved;
+        return true;
+    }
+    // Indexes point to the arrays they index, which may move
+    if ((*doc)->GetIndexes() != nullptr) dom_index_invalidate(*doc, jsn::string());
+    unsigned long cursor = 0;
+    ValkeyModule_DefragCursorGet(ctx, &cursor);
+
+    jsn::vector<DefragFrame> stack;
+    if (cursor == 0 || cursor != defrag_resume.cursor || *doc != defrag_resume.doc || defrag_resume.path.empty()) {
+        // From the top: the document, its optional state, its cached serialization and the buffers of the root
+        if (void *p = move(*doc)) *doc = static_cast<JDocument *>(p);
+        if (void *p = move((*doc)->ext)) (*doc)->ext = static_cast<JDocumentExt *>(p);
+        if (void *p = move((*doc)->GetSerializedRoot())) (*doc)->ext->serialized_root = static_cast<char *>(p);
+        (*doc)->MoveBuffers(move);
+        stack.push_back(defrag_frame(*doc, 0));
+    } else {
+        // Descend along the saved path, as far as it still exists
+        stack.push_back(defrag_frame(*doc, defrag_resume.path[0]));
+        for (size_t i = 1; i < defrag_resume.path.size(); ++i) {
+            DefragFrame &f = stack.back();
+            if (f.next >= defrag_num_children(*f.v)) break;
+            JValue &child = defrag_child(f);
+            if (defrag_num_children(child) == 0) break;
+            stack.push_back(defrag_frame(&child, defrag_resume.path[i]));
+        }
+    }
+
+    size_t visited = 0;
+    bool done = true;
+    while (!stack.empty()) {
+        DefragFrame &f = stack.back();
+        if (f.next >= defrag_num_children(*f.v)) {
+            stack.pop_back();
+            if (!stack.empty()) defrag_advance(stack.back());
+            continue;
+        }
+        JValue &child = defrag_child(f);
+        child.MoveBuffers(move);
+        if (defrag_num_children(child) > 0) {
+            stack.push_back(defrag_frame(&child, 0));  // f is invalid from here on
+        } else {
+            defrag_advance(f);
+        }
+        if (++visited % DEFRAG_CHECK_INTERVAL == 0 && ValkeyModule_DefragShouldStop(ctx)) {
+            done = false;
+            break;
+        }
+    }
+
+    if (done) {
+        defrag_resume.doc = nullptr;
+        defrag_resume.cursor = 0;
+        jsn::vector<size_t>().swap(defrag_resume.path);  // Don't hold on to memory between defrag cycles
+    } else {
+        defrag_resume.doc = *doc;
+        defrag_resume.cursor = ++defrag_cursor_seq;
+        if (defrag_resume.cursor == 0) defrag_resume.cursor = ++defrag_cursor_seq;  // 0 means "start over"
+        defrag_resume.path.clear();
+        for (auto &f : stack) defrag_resume.path.push_back(f.next);
+        ValkeyModule_DefragCursorSet(ctx, defrag_resume.cursor);
+    }
+
+    defrag_charge(*doc, move);
+    bytes_moved = move.bytes_moved;
+    return done;
+}
+
 /*
  * RDB File Format.
  *
@@ -1380,8 +2183,186 @@ STATIC void store_JValue(ValkeyModuleIO *rdb, const JValue *val) {
     }
 }
 
+/*
+ * Binary RDB File Format (encoding version 4).
+ *
+ * The whole document is saved as a single RDB string buffer that contains a pre-order walk of the
+ * tree. Lengths and counts are LEB128 varints. Because member and element counts precede the
+ * children, the loader builds each object/array with exactly sized storage and never has to
+ * re-tokenize numbers or strings.
+ *
+ *   document                : flags byte, [dictionary], value
+ *   NULL, FALSE, TRUE       : tag
+ *   INT                     : tag, zigzag varint
+ *   UINT                    : tag, varint (only used for values above INT64_MAX)
+ *   DOUBLE                  : tag, varint length, text of the double
+ *   STRING, STRING_NOESCAPE : tag, varint length, bytes
+ *   ARRAY                   : tag, varint count, count * value
+ *   OBJECT                  : tag, varint count, count * (key, value)
+ *   key                     : varint (length << 1 | noescape), bytes     (without dictionary)
+ *                           : varint id                                  (with dictionary)
+ *   dictionary              : varint count, count * (key, varint occurrences)
+ *
+ * Keys carry their noescape bit so that they can be handed to the KeyTable as-is. When the
+ * key dictionary is enabled (json.rdb-key-dictionary), every distinct member name is written once
+ * along with the number of times it's used in the document, and the loader obtains all of the
+ * references for a name with a single KeyTable operation.
+ */
+enum binary_flags {
+    JSON_BINFLAG_KEY_DICTIONARY = 0x01
+};
+
+enum binary_tags {
+    JSON_BINTAG_NULL            = 0x00,
+    JSON_BINTAG_FALSE           = 0x01,
+    JSON_BINTAG_TRUE            = 0x02,
+    JSON_BINTAG_INT             = 0x03,
+    JSON_BINTAG_UINT            = 0x04,
+    JSON_BINTAG_DOUBLE          = 0x05,
+    JSON_BINTAG_STRING          = 0x06,
+    JSON_BINTAG_STRING_NOESCAPE = 0x07,
+    JSON_BINTAG_ARRAY           = 0x08,
+    JSON_BINTAG_OBJECT          = 0x09
+};
+
+STATIC void binary_put_varint(rapidjson::StringBuffer &oss, uint64_t v) {
+    while (v >= 0x80) {
+        oss.Put(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    oss.Put(static_cast<char>(v));
+}
+
+STATIC void binary_put_bytes(rapidjson::StringBuffer &oss, const char *p, size_t len) {
+    if (len) memcpy(oss.Push(len), p, len);
+}
+
+STATIC void binary_put_key(rapidjson::StringBuffer &oss, const KeyTable_Handle &h) {
+    size_t len = h.GetStringLength();
+    binary_put_varint(oss, (static_cast<uint64_t>(len) << 1) | (h.IsNoescape() ? 1 : 0));
+    binary_put_bytes(oss, h.GetString(), len);
+}
+
+/*
+ * Per-document dictionary of member names. Ids are assigned in order of first appearance.
+ */
+struct KeyDictionary {
+    struct Entry {
+        const KeyTable_Handle *handle;
+        uint64_t occurrences;
+    };
+    jsn::vector<Entry> entries;
+    jsn::unordered_map<size_t, uint64_t> ids;  // Keyed by KeyTable_Handle::GetIdentity
+
+    void collect(const JValue &val) {
+        if (val.IsObject()) {
+            for (auto m = val.MemberBegin(); m != val.MemberEnd(); ++m) {
+                auto result = ids.emplace(m->name.GetIdentity(), entries.size());
+                if (result.second) {
+                    entries.push_back(Entry{&m->name, 1});
+                } else {
+                    entries[result.first->second].occurrences++;
+                }
+                collect(m->value);
+            }
+        } else if (val.IsArray()) {
+            for (size_t i = 0; i < val.Size(); ++i) {
+                collect(val[i]);
+            }
+        }
+    }
+
+    void store(rapidjson::StringBuffer &oss) const {
+        binary_put_varint(oss, entries.size());
+        for (auto &e : entries) {
+            binary_put_key(oss, *e.handle);
+            binary_put_varint(oss, e.occurrences);
+        }
+    }
+
+    uint64_t getId(const KeyTable_Handle &h) const { return ids.find(h.GetIdentity())->second; }
+};
+
+//
+// save a JValue in binary format, recurse as required for object and array
+//
+STATIC void store_binary_JValue(rapidjson::StringBuffer &oss, const JValue &val, const KeyDictionary *dict) {
+    if (val.IsNull()) {
+        oss.Put(JSON_BINTAG_NULL);
+    } else if (val.IsString()) {
+        oss.Put(val.IsNoescape() ? JSON_BINTAG_STRING_NOESCAPE : JSON_BINTAG_STRING);
+        binary_put_varint(oss, val.GetStringLength());
+        binary_put_bytes(oss, val.GetString(), val.GetStringLength());
+    } else if (val.IsNumber()) {
+        if (val.IsDouble()) {
+            oss.Put(JSON_BINTAG_DOUBLE);
+            char buf[BUF_SIZE_DOUBLE_JSON];
+            rapidjson::SizeType len;
+            const char *str = val.GetDoubleString(buf, len);
+            binary_put_varint(oss, len);
+            binary_put_bytes(oss, str, len);
+        } else if (val.IsInt64()) {
+            int64_t i = val.GetInt64();
+            oss.Put(JSON_BINTAG_INT);
+            binary_put_varint(oss, (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+        } else {
+            oss.Put(JSON_BINTAG_UINT);
+            binary_put_varint(oss, val.GetUint64());
+        }
+    } else if (val.IsFalse()) {
+        oss.Put(JSON_BINTAG_FALSE);
+    } else if (val.IsTrue()) {
+        oss.Put(JSON_BINTAG_TRUE);
+    } else if (val.IsObject()) {
+        oss.Put(JSON_BINTAG_OBJECT);
+        binary_put_varint(oss, val.MemberCount());
+        for (auto m = val.MemberBegin(); m != val.MemberEnd(); ++m) {
+            if (dict) {
+                binary_put_varint(oss, dict->getId(m->name));
+            } else {
+                binary_put_key(oss, m->name);
+            }
+            store_binary_JValue(oss, m->value, dict);
+        }
+    } else if (val.IsArray()) {
+        oss.Put(JSON_BINTAG_ARRAY);
+        binary_put_varint(oss, val.Size());
+        for (size_t i = 0; i < val.Size(); ++i) {
+            store_binary_JValue(oss, val[i], dict);
+        }
+    } else {
+        ValkeyModule_Assert(false);
+    }
+}
+
 void dom_save(const JDocument *doc, ValkeyModuleIO *rdb, int encver) {
+    if (const CompressedTree *c = doc->GetCompressed()) {
+        // The encoding of a compressed document is what version 4 saves, flags byte and all
+        if (encver == 4) {
+            ValkeyModule_SaveStringBuffer(rdb, c->bytes(), c->length);
+        } else {
+            JDocument *tree = decode_compressed(doc);
+            dom_save(tree, rdb, encver);
+            dom_free_doc(tree);
+        }
+        return;
+    }
     switch (encver) {
+        case 4: {
+            rapidjson::StringBuffer oss;
+            if (json_is_rdb_key_dictionary_enabled()) {
+                KeyDictionary dict;
+                dict.collect(*doc);
+                oss.Put(JSON_BINFLAG_KEY_DICTIONARY);
+                dict.store(oss);
+                store_binary_JValue(oss, *doc, &dict);
+            } else {
+                oss.Put(0);
+                store_binary_JValue(oss, *doc, nullptr);
+            }
+            ValkeyModule_SaveStringBuffer(rdb, oss.GetString(), oss.GetLength());
+            break;
+        }
         case 3: {
             rapidjson::StringBuffer oss;
             serialize_value(*(doc), 0, nullptr, oss);
@@ -1509,10 +2490,290 @@ JValue rdbLoadJValue(load_params *params) {
     }
 }
 
+/*
+ * Decoder for the binary format. It's used as a generator for JParser::Populate, i.e., it drives the
+ * same SAX handler that the text parser drives, but without any tokenizing. Every read is bounds
+ * checked, a truncated or malformed buffer results in JSONUTIL_INVALID_RDB_FORMAT.
+ */
+class BinaryDecoder {
+ public:
+    BinaryDecoder(const char *buf, size_t len, bool _hasDictionary, bool _ignoreDepthLimit = false) :
+        cur(buf), end(buf + len), status(JSONUTIL_SUCCESS), hasDictionary(_hasDictionary),
+        ignoreDepthLimit(_ignoreDepthLimit) {}
+
+    //
+    // Release any dictionary references that weren't consumed, i.e., a failed load.
+    //
+    ~BinaryDecoder() {
+        for (auto &e : dict) {
+            if (e.remaining == 0) continue;
+            while (--e.remaining) {
+                KeyTable_Handle h = keyTable->splitHandle(e.handle);
+                keyTable->destroyHandle(h);
+            }
+            keyTable->destroyHandle(e.handle);
+        }
+    }
+
+    bool operator()(RJParser &handler) {
+        if (hasDictionary && !decodeDictionary()) return false;
+        if (!decodeValue(handler)) return false;
+        if (cur != end) return fail(JSONUTIL_INVALID_RDB_FORMAT);
+        for (auto &e : dict) {
+            if (e.remaining != 0) return fail(JSONUTIL_INVALID_RDB_FORMAT);
+        }
+        return true;
+    }
+
+    JsonUtilCode getStatus() const { return status; }
+
+ private:
+    struct DictEntry {
+        KeyTable_Handle handle;     // Holds "remaining" references
+        uint64_t remaining;
+    };
+    const char *cur;
+    const char *end;
+    JsonUtilCode status;
+    bool hasDictionary;
+    bool ignoreDepthLimit;      // for documents that were within the limit when they were encoded
+    jsn::vector<DictEntry> dict;
+
+    bool fail(JsonUtilCode rc) {
+        if (status == JSONUTIL_SUCCESS) status = rc;
+        return false;
+    }
+
+    bool getVarint(uint64_t *v) {
+        uint64_t result = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (cur == end) return fail(JSONUTIL_INVALID_RDB_FORMAT);
+            uint8_t byte = static_cast<uint8_t>(*cur++);
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                *v = result;
+                return true;
+            }
+        }
+        return fail(JSONUTIL_INVALID_RDB_FORMAT);
+    }
+
+    // Get a length that is followed by that many bytes
+    bool getLength(uint64_t len, rapidjson::SizeType *out) {
+        if (len > static_cast<uint64_t>(end - cur) || len > std::numeric_limits<rapidjson::SizeType>::max())
+            return fail(JSONUTIL_INVALID_RDB_FORMAT);
+        *out = static_cast<rapidjson::SizeType>(len);
+        return true;
+    }
+
+    // Get a count of children, each child takes at least one byte
+    bool getCount(rapidjson::SizeType *out) {
+        uint64_t count;
+        return getVarint(&count) && getLength(count, out);
+    }
+
+    bool decodeDictionary() {
+        rapidjson::SizeType count;
+        if (!getCount(&count)) return false;
+        dict.reserve(count);
+        for (rapidjson::SizeType i = 0; i < count; ++i) {
+            uint64_t v, occurrences;
+            rapidjson::SizeType len;
+            if (!getVarint(&v) || !getLength(v >> 1, &len)) return false;
+            const char *key = cur;
+            cur += len;
+            if (!getVarint(&occurrences)) return false;
+            // Every occurrence takes at least one byte
+            if (occurrences == 0 || occurrences > static_cast<uint64_t>(end - cur))
+                return fail(JSONUTIL_INVALID_RDB_FORMAT);
+            dict.push_back(DictEntry{keyTable->makeHandle(key, len, (v & 1) != 0, occurrences), occurrences});
+        }
+        return true;
+    }
+
+    bool decodeKey(RJParser &handler) {
+        uint64_t v;
+        if (!getVarint(&v)) return false;
+        if (hasDictionary) {
+            if (v >= dict.size() || dict[v].remaining == 0) return fail(JSONUTIL_INVALID_RDB_FORMAT);
+            DictEntry &e = dict[v];
+            if (--e.remaining == 0) return handler.Key(e.handle);
+            KeyTable_Handle h = keyTable->splitHandle(e.handle);
+            return handler.Key(h);
+        }
+        rapidjson::SizeType len;
+        if (!getLength(v >> 1, &len)) return false;
+        const char *key = cur;
+        cur += len;
+        return handler.Key(key, len, true, (v & 1) != 0);
+    }
+
+    bool decodeValue(RJParser &handler) {
+        if (cur == end) return fail(JSONUTIL_INVALID_RDB_FORMAT);
+        uint8_t tag = static_cast<uint8_t>(*cur++);
+        switch (tag) {
+            case JSON_BINTAG_NULL:
+                return handler.Null();
+            case JSON_BINTAG_FALSE:
+                return handler.Bool(false);
+            case JSON_BINTAG_TRUE:
+                return handler.Bool(true);
+            case JSON_BINTAG_INT: {
+                uint64_t v;
+                if (!getVarint(&v)) return false;
+                return handler.Int64(static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1));
+            }
+            case JSON_BINTAG_UINT: {
+                uint64_t v;
+                if (!getVarint(&v)) return false;
+                return handler.Uint64(v);
+            }
+            case JSON_BINTAG_DOUBLE:
+            case JSON_BINTAG_STRING:
+            case JSON_BINTAG_STRING_NOESCAPE: {
+                uint64_t v;
+                rapidjson::SizeType len;
+                if (!getVarint(&v) || !getLength(v, &len)) return false;
+                const char *str = cur;
+                cur += len;
+                if (tag == JSON_BINTAG_DOUBLE) return handler.RawNumber(str, len, true);
+                return handler.String(str, len, true, tag == JSON_BINTAG_STRING_NOESCAPE);
+            }
+            case JSON_BINTAG_ARRAY: {
+                rapidjson::SizeType count;
+                if (!getCount(&count)) return false;
+                if (!handler.StartArray() && !ignoreDepthLimit) return fail(JSONUTIL_DOCUMENT_PATH_LIMIT_EXCEEDED);
+                for (rapidjson::SizeType i = 0; i < count; ++i) {
+                    if (!decodeValue(handler)) return false;
+                }
+                return handler.EndArray(count);
+            }
+            case JSON_BINTAG_OBJECT: {
+                rapidjson::SizeType count;
+                if (!getCount(&count)) return false;
+                if (!handler.StartObject() && !ignoreDepthLimit) return fail(JSONUTIL_DOCUMENT_PATH_LIMIT_EXCEEDED);
+                for (rapidjson::SizeType i = 0; i < count; ++i) {
+                    if (!decodeKey(handler) || !decodeValue(handler)) return false;
+                }
+                return handler.EndObject(count);
+            }
+            default:
+                return fail(JSONUTIL_INVALID_RDB_FORMAT);
+        }
+    }
+};
+
+STATIC JsonUtilCode load_binary_document(ValkeyModuleIO *rdb, const char *buf, size_t buf_len, JDocument **doc) {
+    if (buf_len == 0 || (buf[0] & ~JSON_BINFLAG_KEY_DICTIONARY) != 0) {
+        ValkeyModule_LogIOError(rdb, "error", "Unsupported binary document flags");
+        return JSONUTIL_INVALID_RDB_FORMAT;
+    }
+    BinaryDecoder decoder(buf + 1, buf_len - 1, (buf[0] & JSON_BINFLAG_KEY_DICTIONARY) != 0);
+    JDocument *new_doc = create_doc();
+    {
+        DocArenaScope arena_scope(new_doc->GetArena());
+        JParser parser;
+        parser.Populate(decoder);
+        if (decoder.getStatus() == JSONUTIL_SUCCESS) {
+            new_doc->SetJValue(parser.GetJValue());
+            jsonstats_update_max_depth_ever_seen(parser.GetMaxDepth());
+            jsonstats_count_packed_arrays(parser.GetPackedArrays(), parser.GetPackedElements());
+        }
+    }
+    if (decoder.getStatus() != JSONUTIL_SUCCESS) {
+        ValkeyModule_LogIOError(rdb, "error", "Invalid binary document: %s",
+                                jsonutil_code_to_message(decoder.getStatus()));
+        dom_free_doc(new_doc);
+        return decoder.getStatus();
+    }
+    *doc = new_doc;
+    return JSONUTIL_SUCCESS;
+}
+
+/*
+ * Decode a compressed tree into an empty document, in its arena. The encoding was made from a valid document, so
+ * decoding can't fail, not even if json.max-path-limit was lowered since.
+ */
+STATIC void decode_tree(const CompressedTree *c, JDocument *dst) {
+    const char *buf = c->bytes();
+    BinaryDecoder decoder(buf + 1, c->length - 1, (buf[0] & JSON_BINFLAG_KEY_DICTIONARY) != 0, true);
+    DocArenaScope arena_scope(dst->GetArena());
+    JParser parser;
+    parser.Populate(decoder);
+    ValkeyModule_Assert(decoder.getStatus() == JSONUTIL_SUCCESS);
+    dst->SetJValue(parser.GetJValue());
+}
+
+STATIC JDocument *decode_compressed(const JDocument *doc) {
+    JDocument *tree = create_doc(false);
+    decode_tree(doc->GetCompressed(), tree);
+    return tree;
+}
+
+bool dom_compress_doc(JDocument *doc) {
+    if (doc->GetCompressed() || doc->GetNextSharer() != nullptr || doc->GetIndexes() != nullptr) return false;
+    size_t tree_size = tree_charge(doc);
+    int64_t begin_val = jsonstats_begin_track_mem();
+    {
+        // Always with a dictionary, member names repeat in the documents that are worth compressing
+        rapidjson::StringBuffer oss;
+        KeyDictionary dict;
+        dict.collect(*doc);
+        oss.Put(JSON_BINFLAG_KEY_DICTIONARY);
+        dict.store(oss);
+        store_binary_JValue(oss, *doc, &dict);
+        if (sizeof(CompressedTree) + oss.GetLength() >= tree_size) return false;
+        CompressedTree *c = alloc_compressed(oss.GetLength(), tree_size);
+        memcpy(c->bytes(), oss.GetString(), oss.GetLength());
+        doc->Ext().compressed = c;
+    }
+    invalidate_serialized_root(doc);
+    DocArena *arena = doc->GetArena();
+    {
+        DocArenaScope arena_scope(arena);
+        doc->GetJValue().SetNull();
+    }
+    DocArena::destroy(arena);
+    doc->ext->arena = nullptr;
+    int64_t delta = jsonstats_end_track_mem(begin_val);
+    charge_doc(doc, delta);
+    jsonstats_untrack_mem(delta);
+    return true;
+}
+
+void dom_inflate_doc(JDocument *doc) {
+    if (doc->GetCompressed() == nullptr) return;
+    auto start = std::chrono::steady_clock::now();
+    int64_t begin_val = jsonstats_begin_track_mem();
+    if (json_is_doc_arena_enabled()) doc->Ext().arena = DocArena::create();
+    decode_tree(doc->GetCompressed(), doc);
+    free_compressed(doc);
+    int64_t delta = jsonstats_end_track_mem(begin_val);
+    charge_doc(doc, delta);
+    jsonstats_untrack_mem(delta);
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    jsonstats_count_inflate(static_cast<uint64_t>(nanos.count()));
+}
+
+bool dom_is_compressed(const JDocument *doc) {
+    return doc->GetCompressed() != nullptr;
+}
+
 JsonUtilCode dom_load(JDocument **doc, ValkeyModuleIO *ctx, int encver) {
     *doc = nullptr;
     ValkeyModule_Log(nullptr, "debug", "Begin dom_load, encver:%d", encver);
     switch (encver) {
+        case 4: {
+            //
+            // Binary encoding, see store_binary_JValue
+            //
+            size_t buf_len;
+            char *buf = ValkeyModule_LoadStringBuffer(ctx, &buf_len);
+            if (!buf) return JSONUTIL_INVALID_RDB_FORMAT;
+            JsonUtilCode rc = load_binary_document(ctx, buf, buf_len, doc);
+            ValkeyModule_Free(buf);
+            return rc;
+        }
         case 3: {
             //
             // New encoding, data is stored as wire-format JSON
@@ -1605,6 +2866,12 @@ STATIC void compute_digest(ValkeyModuleDigest *ctx, const JValue& v) {
 }
 
 void dom_compute_digest(ValkeyModuleDigest *ctx, const JDocument *doc) {
+    if (doc->GetCompressed()) {
+        JDocument *tree = decode_compressed(doc);
+        compute_digest(ctx, tree->GetJValue());
+        dom_free_doc(tree);
+        return;
+    }
     compute_digest(ctx, doc->GetJValue());
 }
 
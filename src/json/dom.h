@@ -33,14 +33,19 @@
 #include <string>
 #include "json/util.h"
 #include "json/alloc.h"
+#include "json/arena.h"
 #include "json/rapidjson_includes.h"
+#include "json/latency.h"
 
 class ReplyBuffer : public rapidjson::StringBuffer {
  public:
     ReplyBuffer(ValkeyModuleCtx *_ctx, bool) : rapidjson::StringBuffer(), ctx(_ctx) {}
     ReplyBuffer() : rapidjson::StringBuffer(), ctx(nullptr) {}
     void Initialize(ValkeyModuleCtx *_ctx, bool) { ctx = _ctx; }
-    void Reply() { ValkeyModule_ReplyWithStringBuffer(ctx, GetString(), GetLength()); }
+    void Reply() {
+        JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
+        ValkeyModule_ReplyWithStringBuffer(ctx, GetString(), GetLength());
+    }
 
  private:
     ValkeyModuleCtx *ctx;
@@ -56,21 +61,38 @@ extern "C" {
  * memory allocated by the underlying RapidJSON library can be correctly reported to Valkey engine. The class
  * is passed into rapidjson::GenericDocument and rapidjson::GenericValue as template, which is the way to tell
  * RapidJSON to use a custom allocator.
+ *
+ * Small allocations are taken from the arena of the document being worked on, if it has one, see arena.h.
  */
 class RapidJsonAllocator {
  public:
     RapidJsonAllocator();
 
     void *Malloc(size_t size) {
+        DocArena *arena = DocArena::current();
+        if (arena) {
+            void *ptr = arena->allocate(size);
+            if (ptr) return ptr;
+        }
         return dom_alloc(size);
     }
 
     void *Realloc(void *originalPtr, size_t /*originalSize*/, size_t newSize) {
+        DocArena *arena = DocArena::current();
+        if (arena) {
+            if (originalPtr == nullptr) return Malloc(newSize);
+            if (arena->owns(originalPtr)) return arena->reallocate(originalPtr, newSize);
+        }
         return dom_realloc(originalPtr, newSize);
     }
 
     static void Free(void *ptr) RAPIDJSON_NOEXCEPT {
-        dom_free(ptr);
+        DocArena *arena = DocArena::current();
+        if (arena && arena->owns(ptr)) {
+            arena->free(ptr);
+        } else {
+            dom_free(ptr);
+        }
     }
 
     bool operator==(const RapidJsonAllocator&) const RAPIDJSON_NOEXCEPT {
@@ -107,7 +129,8 @@ class RapidJsonAllocator {
  * JDocument            This is the only object visible external to the dom layer. Externally, a
  *                      JDocument is the Valkey data type for this module, i.e., the Valkey dictionary
  *                      contains this pointer. Externally, this is an opaque data structure.
- *                      Internally, it's implemented as a JValue plus a size and bucket number. The
+ *                      Internally, it's implemented as a JValue plus a size and bucket number, and
+ *                      a pointer to the state only some documents have (JDocumentExt). The
  *                      size is maintained as the memory size of the entire tree of JValues
  *                      contained by the JDocument.
  */
@@ -118,17 +141,61 @@ typedef RJValue JValue;
 
 extern RapidJsonAllocator allocator;
 
+struct DocIndex;
+struct CompressedTree;
+struct JDocument;
+
+/**
+ * The state only some documents have: a cached serialization, an arena, secondary indexes, sharing with copies or
+ * compression. A JDocument allocates it the first time it needs any of it, and gives it back once it has none of
+ * it left, so documents that don't need it only pay for a pointer. A document that has been in a ring of sharers
+ * keeps it until it's freed, see dom_was_shared.
+ */
+struct JDocumentExt {
+    JDocumentExt() : serialized_root(nullptr), arena(nullptr), indexes(nullptr), next_sharer(nullptr),
+                     shared_charge(0), was_shared(false), compressed(nullptr) {}
+    char *serialized_root; // cached serialization of the root, see dom_get_serialized_root. Released on writes.
+    DocArena *arena;       // arena for the tree of JValues, nullptr if the tree uses dom_alloc. See arena.h
+    DocIndex *indexes;     // secondary indexes created with JSON.INDEX, nullptr if none. See doc_index.h
+    // Copy-on-write sharing of the tree with copies of the document, see dom_copy
+    JDocument *next_sharer;  // next document in the ring of those sharing the tree, nullptr if private
+    size_t shared_charge;    // memory of the shared tree, charged to one document of the ring, 0 on others
+    bool was_shared;         // has been in a ring, see dom_was_shared
+    CompressedTree *compressed;  // encoding of the tree of a cold document, nullptr if inflated. See dom_compress_doc
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
 /**
  * A JDocument privately inherits from JValue. You must use the GetJValue() member
  * to access the underlying JValue. This improves readability at the usage point.
  */
 struct JDocument : JValue {
-    JDocument() : JValue(), size(0), bucket_id(0) {}
+    JDocument() : JValue(), size(0), bucket_id(0), ext(nullptr) {}
     JValue& GetJValue() { return *this; }
     const JValue& GetJValue() const { return *this; }
     void SetJValue(JValue& rhs) { *static_cast<JValue *>(this) = rhs; }
+    // The optional state, as a document without any has it
+    char *GetSerializedRoot() const { return ext ? ext->serialized_root : nullptr; }
+    DocArena *GetArena() const { return ext ? ext->arena : nullptr; }
+    DocIndex *GetIndexes() const { return ext ? ext->indexes : nullptr; }
+    JDocument *GetNextSharer() const { return ext ? ext->next_sharer : nullptr; }
+    CompressedTree *GetCompressed() const { return ext ? ext->compressed : nullptr; }
+    // The optional state to change, allocated if need be. Copying a document changes that of the source too.
+    JDocumentExt& Ext() const {
+        if (ext == nullptr) ext = new JDocumentExt();
+        return *ext;
+    }
+    // Called where some of it is released, within the memory tracking of the document, like its allocation
+    void ReleaseUnusedExt() {
+        if (ext == nullptr || ext->serialized_root || ext->arena || ext->indexes || ext->was_shared ||
+            ext->compressed) return;
+        delete ext;
+        ext = nullptr;
+    }
     size_t size:56;        // Size of this document, maintained by the JSON layer, not here.
     size_t bucket_id:8;    // document histogram's bucket id. maintained by JSON layer, not here
+    mutable JDocumentExt *ext;  // optional state, nullptr until needed
     void *operator new(size_t size) { return dom_alloc(size); }
     void operator delete(void *ptr) { return dom_free(ptr); }
 
@@ -158,6 +225,8 @@ struct JParser : RJParser {
     using RJParser::ParseStream;
     using RJParser::HasParseError;
     using RJParser::GetMaxDepth;
+    using RJParser::GetPackedArrays;
+    using RJParser::GetPackedElements;
     // Access the contained JValue
     JValue& GetJValue() { return *this; }
     //
@@ -188,6 +257,8 @@ struct JParser : RJParser {
     // destination when we actually move the value out.
     //
     size_t GetJValueSize() const { return allocated_size + sizeof(RJValue); }
+    // Memory allocated by the parse, i.e., what moving the value out adds to the destination
+    size_t GetAllocatedSize() const { return allocated_size; }
 
  private:
     size_t allocated_size;
@@ -240,6 +311,23 @@ void dom_serialize(JDocument *doc, const PrintFormat *format, rapidjson::StringB
   */
 void dom_serialize_value(const JValue &val, const PrintFormat *format, rapidjson::StringBuffer &oss);
 
+/**
+ * Get the compact serialization of the whole document wrapped in a JSON array, i.e., the reply of
+ * "JSON.GET key $". The reply of "JSON.GET key ." is the same text without the first and the last character.
+ * The text is built on first use and cached with the document until the next write to it. The cache is allocated
+ * through dom_alloc, the caller should track memory around the call and charge the delta to the document size.
+ * @param len - OUTPUT, length of the returned text, which is not null terminated.
+ */
+const char *dom_get_serialized_root(JDocument *doc, size_t &len);
+
+/**
+ * Estimate the length of the serialized value by walking the value tree, without serializing it.
+ * The estimate is exact for compact format, except that escaped characters in strings count as one byte.
+ * @param format - format the value will be serialized with, NULL for compact format.
+ * @param initialLevel - nesting level of the value in the output, which determines its indentation.
+ */
+size_t dom_estimate_serialized_size(const JValue &val, const PrintFormat *format, size_t initialLevel = 0);
+
 /**
  * Get the root value of the document.
  */
@@ -260,6 +348,59 @@ inline JsonUtilCode dom_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const ch
     return dom_set_value(ctx, doc, json_path, new_val_json, strlen(new_val_json), is_create_only, is_update_only);
 }
 
+/* A set of a value at a path that has been validated, but not applied yet. See dom_prepare_set_value. */
+struct PreparedSet;
+
+/* The first stage of dom_set_value: check the path and the limits, and parse the new value, without modifying the
+ * document. The prepared set must be passed to either dom_commit_set_value or dom_free_prepared_set, and nothing
+ * else may modify the document in between.
+ * @param prepared - OUTPUT parameter, only set on success.
+ * @return JSONUTIL_SUCCESS for success, other code for failure, the same as dom_set_value.
+ */
+JsonUtilCode dom_prepare_set_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path,
+                                   const char *new_val_json, size_t new_val_len, const bool is_create_only,
+                                   const bool is_update_only, PreparedSet **prepared);
+
+/* Apply a prepared set to its document, and free it. */
+void dom_commit_set_value(PreparedSet *prepared);
+
+/* Free a prepared set, leaving its document untouched. */
+void dom_free_prepared_set(PreparedSet *prepared);
+
+/* A value parsed on its own, not part of any document yet. See dom_parse_detached. */
+struct ParsedValue;
+
+/* Parse a value outside of any document. Unlike the other dom functions, it may be called off the main thread,
+ * e.g., for a large JSON.SET, so it only checks the parser recursion depth: the path and size limits are checked
+ * when the value is put into a document, by dom_parse_from or dom_set_parsed_value. The memory of the value isn't
+ * seen by jsonstats_begin_track_mem/jsonstats_end_track_mem on the thread using it, the caller must add
+ * dom_get_parsed_value_size to the size of the document it goes into.
+ * @param parsed - OUTPUT parameter, only set on success, to be freed with dom_free_parsed_value.
+ */
+JsonUtilCode dom_parse_detached(const char *json, size_t len, ParsedValue **parsed);
+
+/* Bytes allocated by a parsed value. */
+size_t dom_get_parsed_value_size(const ParsedValue *parsed);
+
+/* Free a parsed value, which is empty once it has been put into a document. */
+void dom_free_parsed_value(ParsedValue *parsed);
+
+/* Same as dom_parse, with a parsed value. The value is moved into the new document. */
+JsonUtilCode dom_parse_from(ValkeyModuleCtx *ctx, ParsedValue *parsed, JDocument **doc);
+
+/* Same as dom_set_value, with a parsed value. On success the value is moved into the document, or copied to every
+ * path and freed, and the parsed value is left empty. */
+JsonUtilCode dom_set_parsed_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, ParsedValue *parsed,
+                                  const bool is_create_only = false, const bool is_update_only = false);
+
+/* Merge a JSON merge patch (RFC 7396) into the values at the path, in place. Members the patch sets to null are
+ * removed, the others are replaced or created. A path that doesn't exist is created, as dom_set_value does, and a
+ * null patch at a path other than the root removes the values at the path.
+ * @return JSONUTIL_SUCCESS for success, other code for failure.
+ */
+JsonUtilCode dom_merge_value(ValkeyModuleCtx *ctx, JDocument *doc, const char *json_path, const char *patch_json,
+                             size_t patch_len);
+
 
 
 /* Get JSON value at the path.
@@ -275,6 +416,34 @@ template<typename T>
 JsonUtilCode dom_get_value_as_str(JDocument *doc, const char *json_path, const PrintFormat *format,
                                   T &oss, const bool update_stats = true);
 
+class Selector;
+
+/* Select the JSON values at the path without serializing them, the first half of dom_get_value_as_str.
+ * This lets a caller evaluate the same path on many documents with one selector, and check every outcome
+ * before serializing any of them, e.g., JSON.MGET. Returns the same error codes as dom_get_value_as_str.
+ *
+ * @param selector - selector to evaluate the path with, may be reused across calls for the same path.
+ * @param values - OUTPUT parameter, the single value at a legacy path, or all values at a v2 path.
+ *        The pointers are valid until the document is modified.
+ * @return JSONUTIL_SUCCESS for success, other code for failure.
+ */
+JsonUtilCode dom_select_values(JDocument *doc, const char *json_path, Selector &selector,
+                               jsn::vector<JValue*> &values);
+
+/* Serialize values selected by dom_select_values, the second half of dom_get_value_as_str.
+ * For large documents the output buffer is reserved once from dom_estimate_serialized_size.
+ *
+ * @param doc - document the values were selected from.
+ * @param is_legacy_path - selector.isLegacyJsonPathSyntax() of the selector that selected the values.
+ * @param format - controls format of returned JSON string.
+ *        if NULL, return JSON in compact format (no space, no indent, no newline).
+ * @param oss - output stream
+ */
+template<typename T>
+void dom_serialize_selected_values(const JDocument *doc, const jsn::vector<JValue*> &values,
+                                   const bool is_legacy_path, const PrintFormat *format, T &oss,
+                                   const bool update_stats = true);
+
 /* Get JSON values at multiple paths. Values at multiple paths will be aggregated into a JSON object,
  * in which each path is a key.
  * If the path is invalid, the method will return error code JSONUTIL_INVALID_JSON_PATH.
@@ -448,6 +617,17 @@ JsonUtilCode dom_value_type(JDocument *doc, const char *path, jsn::vector<jsn::s
  */
 JsonUtilCode dom_reply_with_resp(ValkeyModuleCtx *ctx, JDocument *doc, const char *path);
 
+/* Reply with the values at one or more paths as native RESP3 types, built straight from the tree, for
+ * JSON.GET FORMAT RESP3. Objects are RESP3 Maps and arrays RESP3 Arrays, both with exact lengths, null is the
+ * RESP3 Null, booleans are RESP3 Booleans, integers are RESP Integers, or RESP3 Big Numbers above INT64_MAX,
+ * doubles are RESP3 Doubles and strings are RESP Bulk Strings. RESP2 clients get the RESP2 downgrades of those.
+ *
+ * A legacy path replies with its value, a v2 path with an array of its values. Multiple paths reply with a Map
+ * of path to reply, all paths are selected before the reply begins. Returns the same error codes as
+ * dom_get_values_as_str, nothing is replied on failure.
+ */
+JsonUtilCode dom_reply_with_resp3(ValkeyModuleCtx *ctx, JDocument *doc, const char **paths, const int num_paths);
+
 /* Get memory size of a JSON value.
  * @param vec, OUTPUT parameter, vector of memory size.
  * @return JSONUTIL_SUCCESS if success. Other codes indicate failure.
@@ -466,8 +646,112 @@ JsonUtilCode dom_num_fields(JDocument *doc, const char *path, jsn::vector<size_t
  */
 void dom_path_depth(JDocument *doc, size_t *depth);
 
-/* Duplicate a JSON value. */
-JDocument *dom_copy(const JDocument *source);
+/*
+ * Duplicate a JSON value. With share, the copy shares the tree of the source until either one is written, which
+ * makes the copy O(1). Documents in an arena or with secondary indexes are always copied in full, as is everything
+ * with share false, e.g., copies made to move memory around.
+ */
+JDocument *dom_copy(const JDocument *source, const bool share = true);
+
+/* Whether the document shares its tree with copies of it, see dom_copy. */
+bool dom_is_shared(const JDocument *doc);
+
+/*
+ * Whether the document has ever shared its tree, i.e., may still be in a ring of documents sharing it. The rings
+ * are only linked and unlinked on the main thread, which may unlink a document freed by another thread. Unlike
+ * dom_is_shared, this doesn't change once the document is out of the keyspace, so any thread can read it.
+ */
+bool dom_was_shared(const JDocument *doc);
+
+/*
+ * Compression of cold documents. A compressed document holds the binary RDB encoding of its tree, with a key
+ * dictionary, in place of the tree, whose JValues and member names are released. Its size is then the size of the
+ * encoding. Commands must inflate a document before they look at it, the callbacks (save, copy, digest, defrag and
+ * free) work on compressed documents as they are.
+ *
+ * There is no general purpose codec, e.g., LZ4 or zstd, over the encoding. The encoding alone is a third to a fifth
+ * of the tree of documents of repeated objects, e.g., 20KB for the 72KB tree of 500 small orders.
+ */
+
+/*
+ * Compress a document. Documents that share their tree or have secondary indexes are left alone.
+ * @return true if the document was compressed by this call.
+ */
+bool dom_compress_doc(JDocument *doc);
+
+/*
+ * Inflate a compressed document back to a tree, in an arena if json.doc-arena is enabled. Does nothing if the
+ * document isn't compressed. The document is charged for the difference, as with dom_compress_doc.
+ */
+void dom_inflate_doc(JDocument *doc);
+
+bool dom_is_compressed(const JDocument *doc);
+
+/*
+ * Defragment a document in place, one allocation at a time: the document itself, its cached serialization, and the
+ * element/member buffers and strings of every value are moved with ValkeyModule_DefragAlloc. The walk checks
+ * ValkeyModule_DefragShouldStop as it goes, and when told to stop records where it is in the defrag cursor, so the
+ * next call resumes there. The document may be modified between calls, its values are then visited at most twice
+ * or not at all, which is harmless. Memory in the document's arena and member names in the KeyTable are not moved.
+ * Requires memory traps to be disabled, trapped pointers aren't what ValkeyModule_Alloc returned.
+ * @param doc - IN/OUT, the document, which may be moved itself
+ * @param bytes_moved - OUTPUT, bytes moved by this call
+ * @return true if the document is done, false if the walk stopped early and needs another call
+ */
+bool dom_defrag(ValkeyModuleDefragCtx *ctx, JDocument **doc, size_t &bytes_moved);
+
+/*
+ * Secondary indexes on arrays of objects, see doc_index.h.
+ */
+
+/*
+ * Create an index on a member of the elements of an array, and build it.
+ * @param json_path - path that selects exactly one array.
+ * @return JSONUTIL_SUCCESS if the index was created or already exists, JSONUTIL_JSON_PATH_NOT_EXIST if the path
+ *         doesn't select exactly one value, JSONUTIL_JSON_ELEMENT_NOT_ARRAY if the value is not an array.
+ */
+JsonUtilCode dom_index_create(JDocument *doc, const char *json_path, const char *member);
+
+/*
+ * Drop an index.
+ * @return true if the index existed.
+ */
+bool dom_index_drop(JDocument *doc, const char *json_path, const char *member);
+
+/*
+ * Information about an index, for JSON.INDEX LIST.
+ */
+struct IndexInfo {
+    jsn::string path;
+    jsn::string member;
+    bool stale;
+    size_t distinct_values;   // 0 while stale
+};
+void dom_index_list(const JDocument *doc, jsn::vector<IndexInfo> &infos);
+
+/*
+ * Release all indexes of a document, and copy the definitions of the indexes of one document to another one. Copied
+ * indexes are stale, they are built on first use.
+ */
+void dom_index_free_all(JDocument *doc);
+void dom_index_copy(JDocument *dst, const JDocument *src);
+
+/*
+ * Must be called by every write before it modifies the document, with the json pointer of every value it replaces,
+ * modifies or deletes, or of the container it adds members or elements to. Marks the indexes the write may affect
+ * as stale. If the write only appends elements to the array appended, an index of exactly that array is kept, the
+ * write then calls dom_index_append once it's done.
+ */
+void dom_index_invalidate(JDocument *doc, const jsn::string &pointer, const JValue *appended = nullptr);
+void dom_index_append(JDocument *doc, const JValue &array, size_t first);
+
+/*
+ * Look up the positions of the elements of an array whose member equals value, rebuilding a stale index first.
+ * @return the positions in ascending order, which may include elements that don't match, or nullptr if the array
+ *         has no index on the member.
+ */
+const jsn::vector<int64_t> *dom_index_lookup(JDocument *doc, const JValue &array, const std::string_view &member,
+                                             const JValue &value);
 
 /*
  * The dom_save and dom_load support the ability to save and load a single JSON document
@@ -491,6 +775,7 @@ JDocument *dom_copy(const JDocument *source);
  * save a document into rdb format.
  * @param source JSON document to be saved
  * @param rdb rdb file context
+ * @param encver encoding version, 4 is binary, 3 is JSON text and 0 is the legacy node by node format
  */
 void dom_save(const JDocument *source, ValkeyModuleIO *rdb, int encver);
 
@@ -15,7 +15,7 @@
  * 4. The first line of every command handler should be: "ValkeyModule_AutoMemory(ctx);". This is for enabling
  *    auto memory management for the command.
  * 5. Every write command must support replication. Call "ValkeyModule_ReplicateVerbatim(ctx)" to tell Valkey to
- *    replicate the command.
+ *    replicate the command, or PathWriteReplicator::replicate for a write at a path, see json.replicate-effects.
  * 6. Any write command that increases total memory utilization, should be created using "write deny-oom" flags.
  *    e.g., JSON.SET should be defined as "write deny-oom", while JSON.DEL does not need "deny-oom" as it can't
  *    increase the total memory.
@@ -33,15 +33,25 @@
 #include "json/alloc.h"
 #include "json/stats.h"
 #include "json/memory.h"
+#include "json/selector.h"
 #include "./include/valkeymodule.h"
 #include <string>
+#include <string_view>
 #include <memory>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #define MODULE_VERSION 10201
 #define MODULE_NAME "json"
 #define DOCUMENT_TYPE_NAME "ReJSON-RL"
-#define DOCUMENT_TYPE_ENCODING_VERSION 3   /* Currently support 1 or 3 */
+#define DOCUMENT_TYPE_ENCODING_VERSION 4   /* Currently support 0, 3 or 4 */
 
 #define ERRMSG_JSON_DOCUMENT_NOT_FOUND "NONEXISTENT JSON document is not found"
 #define ERRMSG_NEW_VALKEY_KEY_PATH_NOT_ROOT "SYNTAXERR A new Valkey key's path must be root"
@@ -69,8 +79,39 @@ static size_t config_max_recursive_descent_tokens = DEFAULT_MAX_RECURSIVE_DESCEN
 #define DEFAULT_MAX_QUERY_STRING_SIZE (128 * 1024)  // 128KB
 static size_t config_max_query_string_size = DEFAULT_MAX_QUERY_STRING_SIZE;
 
+#define DEFAULT_RDB_KEY_DICTIONARY 0
+static int config_rdb_key_dictionary = DEFAULT_RDB_KEY_DICTIONARY;
+
+#define DEFAULT_PATH_CACHE_SIZE 256
+static size_t config_path_cache_size = DEFAULT_PATH_CACHE_SIZE;
+
+#define DEFAULT_ROOT_CACHE_MIN_SIZE 0  // Disabled
+static size_t config_root_cache_min_size = DEFAULT_ROOT_CACHE_MIN_SIZE;
+
+#define DEFAULT_DOC_ARENA 0
+static int config_doc_arena = DEFAULT_DOC_ARENA;
+
+#define DEFAULT_REPLICATE_EFFECTS 0
+static int config_replicate_effects = DEFAULT_REPLICATE_EFFECTS;
+
+#define DEFAULT_AOF_REWRITE_CHUNK_SIZE (64 * 1024 * 1024)  // 64MB
+static size_t config_aof_rewrite_chunk_size = DEFAULT_AOF_REWRITE_CHUNK_SIZE;
+
+#define DEFAULT_ASYNC_PARSE_MIN_SIZE 0  // Disabled
+static size_t config_async_parse_min_size = DEFAULT_ASYNC_PARSE_MIN_SIZE;
+
+#define DEFAULT_COMPRESS_MIN_SIZE 0  // Disabled
+static size_t config_compress_min_size = DEFAULT_COMPRESS_MIN_SIZE;
+
+#define DEFAULT_COMPRESS_IDLE_SECONDS 3600
+static size_t config_compress_idle_seconds = DEFAULT_COMPRESS_IDLE_SECONDS;
+
+#define DEFAULT_SHORTEST_DOUBLES 0  // %.17g, as before
+static int config_shortest_doubles = DEFAULT_SHORTEST_DOUBLES;
+
 #define DEFAULT_KEY_TABLE_SHARDS 32768
 #define DEFAULT_HASH_TABLE_MIN_SIZE 64
+#define DEFAULT_HASH_TABLE_MIN_GROUPED_SIZE 1024
 KeyTable *keyTable = nullptr;
 rapidjson::HashTableFactors rapidjson::hashTableFactors;
 rapidjson::HashTableStats   rapidjson::hashTableStats;
@@ -101,6 +142,50 @@ size_t json_get_max_query_string_size() {
     return config_max_query_string_size;
 }
 
+bool json_is_rdb_key_dictionary_enabled() {
+    return config_rdb_key_dictionary == 1;
+}
+
+size_t json_get_path_cache_size() {
+    return config_path_cache_size;
+}
+
+size_t json_get_root_cache_min_size() {
+    return config_root_cache_min_size;
+}
+
+bool json_is_doc_arena_enabled() {
+    return config_doc_arena == 1;
+}
+
+bool json_is_replicate_effects_enabled() {
+    return config_replicate_effects == 1;
+}
+
+size_t json_get_aof_rewrite_chunk_size() {
+    return config_aof_rewrite_chunk_size;
+}
+
+size_t json_get_async_parse_min_size() {
+    return config_async_parse_min_size;
+}
+
+size_t json_get_compress_min_size() {
+    return config_compress_min_size;
+}
+
+size_t json_get_compress_idle_seconds() {
+    return config_compress_idle_seconds;
+}
+
+bool json_is_shortest_doubles_enabled() {
+    return config_shortest_doubles == 1;
+}
+
+void json_set_shortest_doubles_enabled(bool enabled) {
+    config_shortest_doubles = enabled ? 1 : 0;
+}
+
 #define CHECK_DOCUMENT_SIZE_LIMIT(ctx, new_doc_size) \
 if (!(ValkeyModule_GetContextFlags(ctx) & VALKEYMODULE_CTX_FLAGS_REPLICATED) && \
     json_get_max_document_size() > 0 && (new_doc_size > json_get_max_document_size())) { \
@@ -172,6 +257,68 @@ STATIC JsonUtilCode verify_doc_key(ValkeyModuleCtx *ctx, ValkeyModuleString *rmK
     return JSONUTIL_SUCCESS;
 }
 
+/* Get the document of a document key, inflating it if it's compressed, see compress_scan_timer.
+ */
+STATIC JDocument *get_document(ValkeyModuleKey *key) {
+    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    dom_inflate_doc(doc);
+    return doc;
+}
+
+/* Replicates a write to a single key at a path. By default, and for paths with only member and index steps, the
+ * command is replicated verbatim. With json.replicate-effects, a path that may select several values, or has to be
+ * searched for, is replicated as its effects instead: a JSON.DEL of every value deleted and a JSON.SET of the final
+ * value at every path written, both at definite paths, so that replicas and AOF replay do work in proportion to the
+ * changes rather than evaluating the path again. Replicas then notify json.set and json.del keyspace events.
+ *
+ * The changes are recorded from construction on, so the replicator must be created before the write.
+ */
+class PathWriteReplicator {
+ public:
+    explicit PathWriteReplicator(const char *path)
+            : recorder(json_is_replicate_effects_enabled() && !Selector::isDefinitePath(path) ?
+                       new JsonEffectRecorder() : nullptr)
+    {}
+
+    void replicate(ValkeyModuleCtx *ctx, ValkeyModuleString *key_str, ValkeyModuleKey *key) {
+        if (recorder == nullptr) {
+            ValkeyModule_ReplicateVerbatim(ctx);
+            return;
+        }
+        JDocument *doc = get_document(key);
+        for (auto &path : recorder->deleted) ValkeyModule_Replicate(ctx, "JSON.DEL", "sc", key_str, path.c_str());
+
+        // Sorted, a path comes after the paths of the values it is within, whose JSON.SET replicates it too
+        std::vector<std::string> &updated = recorder->updated;
+        std::sort(updated.begin(), updated.end());
+        std::unordered_set<std::string_view> written;
+        for (auto &pointer : updated) {
+            if (is_within_written(pointer, written)) continue;
+            written.insert(pointer);
+            jsn::string json_path;
+            jsn::string ptr(pointer.c_str(), pointer.length());
+            JValue *value = Selector::resolvePointer(dom_get_value(*doc), ptr, json_path);
+            if (value == nullptr) continue;  // removed by the write
+            rapidjson::StringBuffer oss;
+            dom_serialize_value(*value, nullptr, oss);
+            ValkeyModule_Replicate(ctx, "JSON.SET", "scb", key_str, json_path.c_str(), oss.GetString(),
+                                   oss.GetLength());
+        }
+    }
+
+ private:
+    static bool is_within_written(const std::string &pointer, const std::unordered_set<std::string_view> &written) {
+        if (written.count(std::string_view()) > 0) return true;  // the root
+        for (size_t i = 1; i <= pointer.length(); i++) {
+            if ((i == pointer.length() || pointer[i] == '/') &&
+                written.count(std::string_view(pointer.data(), i)) > 0) return true;
+        }
+        return false;
+    }
+
+    std::unique_ptr<JsonEffectRecorder> recorder;
+};
+
 /* Fetch JSON at a single path.
  * If the document key does not exist, the command will return null without an error.
  * If the key is not a document key, the command will return error code JSONUTIL_NOT_A_DOCUMENT_KEY.
@@ -189,12 +336,63 @@ STATIC JsonUtilCode fetch_json(ValkeyModuleCtx *ctx, ValkeyModuleString *rmKey,
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // fetch value at the path
     return dom_get_value_as_str(doc, path, format, oss);
 }
 
+/* Reply with the values at the paths as native RESP3 types, for JSON.GET FORMAT RESP3. */
+STATIC JsonUtilCode reply_with_resp3(ValkeyModuleCtx *ctx, ValkeyModuleString *rmKey, const char **paths,
+                                     const int num_paths) {
+    ValkeyModuleKey *key;
+    JsonUtilCode rc = verify_doc_key(ctx, rmKey, &key, true);
+    if (rc != JSONUTIL_SUCCESS) return rc;
+    return dom_reply_with_resp3(ctx, get_document(key), paths, num_paths);
+}
+
+/* Reply to "JSON.GET key", "JSON.GET key ." or "JSON.GET key $" from the serialization cached with the document.
+ * Only documents of at least json.root-cache-min-size bytes are cached, the cache is disabled if that is 0.
+ * The memory of a newly built cache is charged to the document.
+ *
+ * @return true if the reply is sent, false if the caller should fetch the JSON the regular way.
+ */
+STATIC bool reply_with_serialized_root(ValkeyModuleCtx *ctx, ValkeyModuleString *rmKey, const char *path,
+                                       const PrintFormat *format) {
+    size_t min_size = json_get_root_cache_min_size();
+    if (min_size == 0 || format->newline || format->space || format->indent) return false;
+    if (strcmp(path, ".") != 0 && strcmp(path, "$") != 0) return false;
+
+    ValkeyModuleKey *key;
+    if (verify_doc_key(ctx, rmKey, &key, true) != JSONUTIL_SUCCESS) return false;
+    JDocument *doc = get_document(key);
+    size_t orig_doc_size = dom_get_doc_size(doc);
+    if (orig_doc_size < min_size) return false;
+
+    jsonstats_count_root_cache(doc->GetSerializedRoot() != nullptr);
+    // begin tracking memory
+    int64_t begin_val = jsonstats_begin_track_mem();
+    size_t len;
+    const char *json = dom_get_serialized_root(doc, len);
+    // end tracking memory
+    int64_t delta = jsonstats_end_track_mem(begin_val);
+    if (delta != 0) {
+        size_t new_doc_size = orig_doc_size + delta;
+        dom_set_doc_size(doc, new_doc_size);
+        jsonstats_update_stats_on_resize(doc, orig_doc_size, new_doc_size);
+    }
+
+    // The cached text is the v2 reply, the legacy reply is the same without the enclosing brackets
+    if (*path == '.') {
+        json++;
+        len -= 2;
+    }
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
+    ValkeyModule_ReplyWithStringBuffer(ctx, json, len);
+    jsonstats_update_stats_on_read(len);
+    return true;
+}
+
 /* Fetch JSON at multiple paths. Values at multiple paths will be aggregated into a JSON object,
  * in which each path is a key.
  * If the document key does not exist, the command will return null without an error.
@@ -213,7 +411,7 @@ STATIC JsonUtilCode fetch_json_multi_paths(ValkeyModuleCtx *ctx, ValkeyModuleStr
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // fetch values at the path
     return dom_get_values_as_str(doc, paths, num_paths, format, oss);
@@ -258,10 +456,25 @@ STATIC JsonUtilCode parseSetCmdArgs(ValkeyModuleString **argv, const int argc, S
     return JSONUTIL_SUCCESS;
 }
 
+/* Parse the reply format of "FORMAT <STRING|RESP3>". */
+STATIC JsonUtilCode parseReplyFormat(ValkeyModuleString *arg, bool *resp3) {
+    const char *token = ValkeyModule_StringPtrLen(arg, nullptr);
+    if (!strcasecmp(token, "STRING")) {
+        *resp3 = false;
+    } else if (!strcasecmp(token, "RESP3")) {
+        *resp3 = true;
+    } else {
+        return JSONUTIL_COMMAND_SYNTAX_ERROR;
+    }
+    return JSONUTIL_SUCCESS;
+}
+
 STATIC JsonUtilCode parseGetCmdArgs(ValkeyModuleString **argv, const int argc, ValkeyModuleString **key,
-                                    PrintFormat *format, ValkeyModuleString ***paths, int *num_paths) {
+                                    PrintFormat *format, bool *resp3, ValkeyModuleString ***paths,
+                                    int *num_paths) {
     *key = nullptr;
     memset(format, 0, sizeof(PrintFormat));
+    *resp3 = false;
     *paths = nullptr;
     *num_paths = 0;
 
@@ -274,13 +487,13 @@ STATIC JsonUtilCode parseGetCmdArgs(ValkeyModuleString **argv, const int argc, V
     ValkeyModuleString **first_path = nullptr;
 
     // Process the remaining arguments and verify that all path arguments are positioned at the end.
-    // If an arg is not one of 4 options (NEWLINE/SPACE/INDENT/NOESCAPE), treat it as path argument,
-    // increment the path count, and continue. Whenever one of the 4 options is found, check the path count.
+    // If an arg is not one of 5 options (NEWLINE/SPACE/INDENT/FORMAT/NOESCAPE), treat it as path argument,
+    // increment the path count, and continue. Whenever one of the 5 options is found, check the path count.
     // If it is > 0, which means there is at least one path argument in the middle (not at the end), then
     // exit the loop and return an error code.
     //
-    // If the argument is one of NEWLINE/SPACE/INDENT but it is the last argument, return with error, because
-    // the argument requires a following argument.
+    // If the argument is one of NEWLINE/SPACE/INDENT/FORMAT but it is the last argument, return with error,
+    // because the argument requires a following argument.
     while (i < argc) {
         const char *token = ValkeyModule_StringPtrLen(argv[i], nullptr);
         if (!strcasecmp(token, "NEWLINE")) {
@@ -292,6 +505,10 @@ STATIC JsonUtilCode parseGetCmdArgs(ValkeyModuleString **argv, const int argc, V
         } else if (!strcasecmp(token, "INDENT")) {
             if (i == argc - 1) return JSONUTIL_COMMAND_SYNTAX_ERROR;
             format->indent = ValkeyModule_StringPtrLen(argv[++i], nullptr);
+        } else if (!strcasecmp(token, "FORMAT")) {
+            if (i == argc - 1) return JSONUTIL_COMMAND_SYNTAX_ERROR;
+            JsonUtilCode rc = parseReplyFormat(argv[++i], resp3);
+            if (rc != JSONUTIL_SUCCESS) return rc;
         } else if (!strcasecmp(token, "NOESCAPE")) {
             // NOESCAPE is only for legacy compatibility and is noop.
         } else {
@@ -302,6 +519,9 @@ STATIC JsonUtilCode parseGetCmdArgs(ValkeyModuleString **argv, const int argc, V
         ++i;
     }
 
+    // NEWLINE/SPACE/INDENT format JSON text, a RESP3 reply has none
+    if (*resp3 && (format->newline || format->space || format->indent)) return JSONUTIL_COMMAND_SYNTAX_ERROR;
+
     *paths = first_path;
     *num_paths = path_count;
     return JSONUTIL_SUCCESS;
@@ -534,18 +754,12 @@ STATIC JsonUtilCode parseMemoryOrFieldsSubCmdArgs(ValkeyModuleCtx *ctx, ValkeyMo
 
 /* ============================= Command Handlers =========================== */
 
-int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
-    ValkeyModule_AutoMemory(ctx);
-
-    SetCmdArgs args;
-    JsonUtilCode rc = parseSetCmdArgs(argv, argc, &args);
-    if (rc != JSONUTIL_SUCCESS) {
-        if (rc == JSONUTIL_WRONG_NUM_ARGS)
-            return ValkeyModule_WrongArity(ctx);
-        else
-            return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
-    }
-
+/**
+ * Set the value of a JSON.SET, parsed by the command itself or, for a large value, already parsed by a worker
+ * thread, see AsyncSet.
+ */
+STATIC int setValue(ValkeyModuleCtx *ctx, const SetCmdArgs &args, ParsedValue *parsed) {
+    JsonUtilCode rc;
     // verify valkey keys
     ValkeyModuleKey *key = static_cast<ValkeyModuleKey*>(ValkeyModule_OpenKey(ctx, args.key,
                                                                            VALKEYMODULE_READ | VALKEYMODULE_WRITE));
@@ -567,17 +781,23 @@ int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
             return ValkeyModule_ReplyWithNull(ctx);
     }
 
+    PathWriteReplicator replicator(args.path);
     // begin tracking memory
     int64_t begin_val = jsonstats_begin_track_mem();
 
     if (is_root_path) {  // root doc
         // parse incoming JSON string
         JDocument *doc;
-        rc = dom_parse(ctx, args.json, args.json_len, &doc);
+        if (parsed) {
+            rc = dom_parse_from(ctx, parsed, &doc);
+        } else {
+            rc = dom_parse(ctx, args.json, args.json_len, &doc);
+        }
         if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
         // end tracking memory
         int64_t delta = jsonstats_end_track_mem(begin_val);
+        if (parsed) delta += dom_get_parsed_value_size(parsed);
         size_t doc_size = dom_get_doc_size(doc) + delta;
         dom_set_doc_size(doc, doc_size);
 
@@ -598,11 +818,16 @@ int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
         jsonstats_update_stats_on_insert(doc, true, 0, doc_size, doc_size);
     } else {
         // fetch doc object from Valkey dict
-        JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+        JDocument *doc = get_document(key);
         if (doc == nullptr) return ValkeyModule_ReplyWithError(ctx, ERRMSG_JSON_DOCUMENT_NOT_FOUND);
 
         size_t orig_doc_size = dom_get_doc_size(doc);
-        rc = dom_set_value(ctx, doc, args.path, args.json, args.json_len, args.is_create_only, args.is_update_only);
+        if (parsed) {
+            rc = dom_set_parsed_value(ctx, doc, args.path, parsed, args.is_create_only, args.is_update_only);
+        } else {
+            rc = dom_set_value(ctx, doc, args.path, args.json, args.json_len, args.is_create_only,
+                               args.is_update_only);
+        }
         if (rc != JSONUTIL_SUCCESS) {
             if (rc == JSONUTIL_NX_XX_CONDITION_NOT_SATISFIED)
                 return ValkeyModule_ReplyWithNull(ctx);
@@ -611,6 +836,7 @@ int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
 
         // end tracking memory
         int64_t delta = jsonstats_end_track_mem(begin_val);
+        if (parsed) delta += dom_get_parsed_value_size(parsed);
         size_t new_doc_size = dom_get_doc_size(doc) + delta;
         dom_set_doc_size(doc, new_doc_size);
 
@@ -619,19 +845,361 @@ int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
     }
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, args.key, key);
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.set", args.key);
     return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+/**
+ * A JSON.SET of a value of at least json.async-parse-min-size bytes doesn't parse it on the main thread. The client
+ * is blocked while one of a few worker threads parses the value with dom_parse_detached, and the value is set when
+ * the client is unblocked, back on the main thread: the key, the path, NX/XX and the limits are checked then, against
+ * the document as it is at that point, which is also when the command is replicated. The memory of the parsed value
+ * is added to the document's size, see dom_get_parsed_value_size.
+ *
+ * Clients that can't be blocked, in MULTI, scripts, or replicated commands, parse in place. A client that disconnects
+ * before its value is parsed doesn't set it.
+ */
+#define ASYNC_PARSE_THREADS 2
+
+struct AsyncSet {
+    explicit AsyncSet(ValkeyModuleString *_json)
+            : bc(nullptr), json(_json), json_str(nullptr), json_len(0), parsed(nullptr), rc(JSONUTIL_SUCCESS) {
+        ValkeyModule_RetainString(nullptr, json);
+        json_str = ValkeyModule_StringPtrLen(json, &json_len);
+    }
+    ~AsyncSet() {
+        if (parsed) dom_free_parsed_value(parsed);
+        ValkeyModule_FreeString(nullptr, json);
+    }
+    ValkeyModuleBlockedClient *bc;
+    ValkeyModuleString *json;   // argument of the command, retained until the set is freed
+    const char *json_str;
+    size_t json_len;
+    ParsedValue *parsed;        // set by the worker thread, nullptr if the value doesn't parse
+    JsonUtilCode rc;
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
+class AsyncParsePool {
+ public:
+    void submit(AsyncSet *set) {
+        std::call_once(started, [this] {
+            for (int i = 0; i < ASYNC_PARSE_THREADS; i++) std::thread(&AsyncParsePool::run, this).detach();
+        });
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(set);
+        }
+        ready.notify_one();
+    }
+
+ private:
+    void run() {
+        while (true) {
+            AsyncSet *set;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return !queue.empty(); });
+                set = queue.front();
+                queue.pop_front();
+            }
+            set->rc = dom_parse_detached(set->json_str, set->json_len, &set->parsed);
+            ValkeyModule_UnblockClient(set->bc, set);
+        }
+    }
+    std::once_flag started;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<AsyncSet *> queue;
+};
+
+static AsyncParsePool asyncParsePool;
+
+STATIC int async_set_reply(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    ValkeyModule_AutoMemory(ctx);
+    AsyncSet *set = static_cast<AsyncSet*>(ValkeyModule_GetBlockedClientPrivateData(ctx));
+    if (set->rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(set->rc));
+    SetCmdArgs args;
+    parseSetCmdArgs(argv, argc, &args);  // checked when the command was called
+    return setValue(ctx, args, set->parsed);
+}
+
+STATIC void async_set_free(ValkeyModuleCtx *ctx, void *privdata) {
+    VALKEYMODULE_NOT_USED(ctx);
+    delete static_cast<AsyncSet*>(privdata);
+}
+
+int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_SET);
+    ValkeyModule_AutoMemory(ctx);
+
+    SetCmdArgs args;
+    JsonUtilCode rc = parseSetCmdArgs(argv, argc, &args);
+    if (rc != JSONUTIL_SUCCESS) {
+        if (rc == JSONUTIL_WRONG_NUM_ARGS)
+            return ValkeyModule_WrongArity(ctx);
+        else
+            return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+    }
+
+    size_t async_min_size = json_get_async_parse_min_size();
+    int no_async = VALKEYMODULE_CTX_FLAGS_DENY_BLOCKING | VALKEYMODULE_CTX_FLAGS_REPLICATED |
+                   VALKEYMODULE_CTX_FLAGS_LOADING;
+    if (async_min_size > 0 && args.json_len >= async_min_size && !(ValkeyModule_GetContextFlags(ctx) & no_async)) {
+        AsyncSet *set = new AsyncSet(argv[3]);
+        set->bc = ValkeyModule_BlockClient(ctx, async_set_reply, nullptr, async_set_free, 0);
+        asyncParsePool.submit(set);
+        return VALKEYMODULE_OK;
+    }
+    return setValue(ctx, args, nullptr);
+}
+
+/* One key of JSON.MSET. Its writes are validated before any of them is applied: a single write to an existing
+ * document is prepared against it, see dom_prepare_set_value. Anything else, i.e., setting the root or writing the
+ * key more than once, goes to a staged document that replaces the one in the keyspace once all writes are valid.
+ */
+typedef struct {
+    ValkeyModuleString *name;
+    ValkeyModuleKey *key;
+    JDocument *doc;          // the document in the keyspace, nullptr if the key doesn't exist
+    JDocument *staged;       // the document replacing it, or nullptr
+    PreparedSet *prepared;   // the single write to doc, if it isn't staged
+    size_t writes;           // number of writes to the key
+    size_t json_len;         // total length of the values written
+    int64_t prepared_delta;  // memory allocated by preparing the write, the new value above all, to charge to doc
+} MSetKey;
+
+STATIC void free_mset_keys(std::vector<MSetKey> &keys) {
+    for (MSetKey &k : keys) {
+        if (k.staged != nullptr) dom_free_doc(k.staged);
+        if (k.prepared != nullptr) dom_free_prepared_set(k.prepared);
+        k.staged = nullptr;
+        k.prepared = nullptr;
+    }
+}
+
+/* Apply a write of JSON.MSET to the staged document of its key, with the same memory accounting as JSON.SET.
+ */
+STATIC JsonUtilCode mset_staged_write(ValkeyModuleCtx *ctx, MSetKey &k, const char *path, const char *json,
+                                      const size_t json_len) {
+    JsonUtilCode rc;
+    if (jsonutil_is_root_path(path)) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        JDocument *doc;
+        rc = dom_parse(ctx, json, json_len, &doc);
+        if (rc != JSONUTIL_SUCCESS) return rc;
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        dom_set_doc_size(doc, dom_get_doc_size(doc) + delta);
+        if (k.staged != nullptr) dom_free_doc(k.staged);
+        k.staged = doc;
+    } else {
+        // the copy accounts for its own size. It's a full copy, as it's about to be written anyway.
+        if (k.staged == nullptr) k.staged = dom_copy(k.doc, false);
+        int64_t begin_val = jsonstats_begin_track_mem();
+        rc = dom_set_value(ctx, k.staged, path, json, json_len);
+        if (rc != JSONUTIL_SUCCESS) return rc;
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        dom_set_doc_size(k.staged, dom_get_doc_size(k.staged) + delta);
+    }
+    return JSONUTIL_SUCCESS;
+}
+
+int Command_JsonMSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_MSET);
+    ValkeyModule_AutoMemory(ctx);
+
+    // we need one or more (key, path, value) triples
+    if (argc < 4 || (argc - 1) % 3 != 0) return ValkeyModule_WrongArity(ctx);
+
+    // open every key once, verify its type, and count its writes
+    std::vector<MSetKey> keys;
+    std::vector<size_t> key_of_write;
+    std::unordered_map<std::string_view, size_t> index;
+    for (int i = 1; i < argc; i += 3) {
+        size_t len;
+        const char *name = ValkeyModule_StringPtrLen(argv[i], &len);
+        auto it = index.find(std::string_view(name, len));
+        if (it == index.end()) {
+            ValkeyModuleKey *key = static_cast<ValkeyModuleKey*>(ValkeyModule_OpenKey(ctx, argv[i],
+                                                                           VALKEYMODULE_READ | VALKEYMODULE_WRITE));
+            int type = ValkeyModule_KeyType(key);
+            if (type != VALKEYMODULE_KEYTYPE_EMPTY && ValkeyModule_ModuleTypeGetType(key) != DocumentType) {
+                return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(JSONUTIL_NOT_A_DOCUMENT_KEY));
+            }
+            JDocument *doc = nullptr;
+            if (type != VALKEYMODULE_KEYTYPE_EMPTY) {
+                doc = get_document(key);
+                if (doc == nullptr) return ValkeyModule_ReplyWithError(ctx, ERRMSG_JSON_DOCUMENT_NOT_FOUND);
+            }
+            it = index.emplace(std::string_view(name, len), keys.size()).first;
+            keys.push_back(MSetKey{argv[i], key, doc, nullptr, nullptr, 0, 0, 0});
+        }
+        keys[it->second].writes++;
+        key_of_write.push_back(it->second);
+    }
+
+    // validate every write, without modifying the keyspace
+    for (int i = 1, w = 0; i < argc; i += 3, w++) {
+        MSetKey &k = keys[key_of_write[w]];
+        const char *path = ValkeyModule_StringPtrLen(argv[i + 1], nullptr);
+        size_t json_len;
+        const char *json = ValkeyModule_StringPtrLen(argv[i + 2], &json_len);
+        k.json_len += json_len;
+
+        JsonUtilCode rc;
+        if (k.doc == nullptr && k.staged == nullptr && !jsonutil_is_root_path(path)) {
+            free_mset_keys(keys);
+            return ValkeyModule_ReplyWithError(ctx, ERRMSG_NEW_VALKEY_KEY_PATH_NOT_ROOT);
+        } else if (k.staged == nullptr && k.writes == 1 && !jsonutil_is_root_path(path)) {
+            int64_t begin_val = jsonstats_begin_track_mem();
+            rc = dom_prepare_set_value(ctx, k.doc, path, json, json_len, false, false, &k.prepared);
+            k.prepared_delta = jsonstats_end_track_mem(begin_val);
+        } else {
+            rc = mset_staged_write(ctx, k, path, json, json_len);
+        }
+        if (rc != JSONUTIL_SUCCESS) {
+            free_mset_keys(keys);
+            return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+        }
+    }
+
+    // apply all of them, which can't fail
+    for (MSetKey &k : keys) {
+        if (k.staged != nullptr) {
+            size_t doc_size = dom_get_doc_size(k.staged);
+            ValkeyModule_ModuleTypeSetValue(k.key, DocumentType, k.staged);
+            jsonstats_update_stats_on_insert(k.staged, true, 0, doc_size, doc_size);
+            k.staged = nullptr;
+        } else {
+            size_t orig_doc_size = dom_get_doc_size(k.doc);
+            int64_t begin_val = jsonstats_begin_track_mem();
+            dom_commit_set_value(k.prepared);
+            k.prepared = nullptr;
+            int64_t delta = jsonstats_end_track_mem(begin_val) + k.prepared_delta;
+            size_t new_doc_size = dom_get_doc_size(k.doc) + delta;
+            dom_set_doc_size(k.doc, new_doc_size);
+            jsonstats_update_stats_on_update(k.doc, orig_doc_size, new_doc_size, k.json_len);
+        }
+    }
+
+    // replicate the command as a whole
+    ValkeyModule_ReplicateVerbatim(ctx);
+    for (MSetKey &k : keys) {
+        ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.mset", k.name);
+    }
+    return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+int Command_JsonMerge(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_MERGE);
+    ValkeyModule_AutoMemory(ctx);
+
+    // we need exactly 4 arguments
+    if (argc != 4) return ValkeyModule_WrongArity(ctx);
+
+    ValkeyModuleString *key_str = argv[1];
+    const char *path = ValkeyModule_StringPtrLen(argv[2], nullptr);
+    size_t patch_len;
+    const char *patch = ValkeyModule_StringPtrLen(argv[3], &patch_len);
+
+    // verify valkey keys
+    ValkeyModuleKey *key = static_cast<ValkeyModuleKey*>(ValkeyModule_OpenKey(ctx, key_str,
+                                                                           VALKEYMODULE_READ | VALKEYMODULE_WRITE));
+    int type = ValkeyModule_KeyType(key);
+    if (type != VALKEYMODULE_KEYTYPE_EMPTY && ValkeyModule_ModuleTypeGetType(key) != DocumentType) {
+        return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(JSONUTIL_NOT_A_DOCUMENT_KEY));
+    }
+
+    PathWriteReplicator replicator(path);
+    // begin tracking memory
+    int64_t begin_val = jsonstats_begin_track_mem();
+
+    if (type == VALKEYMODULE_KEYTYPE_EMPTY) {
+        if (!jsonutil_is_root_path(path))
+            return ValkeyModule_ReplyWithError(ctx, ERRMSG_NEW_VALKEY_KEY_PATH_NOT_ROOT);
+
+        // merging into nothing drops the nulls of the patch
+        JDocument *doc;
+        JsonUtilCode rc = dom_parse(ctx, "null", 4, &doc);
+        if (rc == JSONUTIL_SUCCESS) rc = dom_merge_value(ctx, doc, path, patch, patch_len);
+        if (rc != JSONUTIL_SUCCESS) {
+            if (doc != nullptr) dom_free_doc(doc);
+            return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+        }
+
+        // end tracking memory
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        size_t doc_size = dom_get_doc_size(doc) + delta;
+        dom_set_doc_size(doc, doc_size);
+
+        // set Valkey key
+        ValkeyModule_ModuleTypeSetValue(key, DocumentType, doc);
+
+        // update stats
+        jsonstats_update_stats_on_insert(doc, true, 0, doc_size, doc_size);
+    } else {
+        // fetch doc object from Valkey dict
+        JDocument *doc = get_document(key);
+        if (doc == nullptr) return ValkeyModule_ReplyWithError(ctx, ERRMSG_JSON_DOCUMENT_NOT_FOUND);
+
+        size_t orig_doc_size = dom_get_doc_size(doc);
+        JsonUtilCode rc = dom_merge_value(ctx, doc, path, patch, patch_len);
+        if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+
+        // end tracking memory
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        size_t new_doc_size = dom_get_doc_size(doc) + delta;
+        dom_set_doc_size(doc, new_doc_size);
+
+        // update stats
+        jsonstats_update_stats_on_update(doc, orig_doc_size, new_doc_size, patch_len);
+    }
+
+    // replicate the command
+    replicator.replicate(ctx, key_str, key);
+    ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.merge", key_str);
+    return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/* Collect the path arguments of JSON.GET found by parseGetCmdArgs, skipping the options among them. */
+STATIC void collect_get_paths(ValkeyModuleString **paths, const int num_paths, const char **cstr_paths) {
+    int format_args_offset = 0;
+    for (int i = 0; i < num_paths; i++) {
+        const char *token = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
+        // no need to check on the first one, we already know it's pointing to the right place
+        bool look_for_formatting = i > 0;
+
+        // we already know from parseGetCmdArgs that we're going to find another path eventually
+        while (look_for_formatting) {
+            look_for_formatting = false;
+            if (!strcasecmp(token, "NEWLINE") || !strcasecmp(token, "SPACE") || !strcasecmp(token, "INDENT") ||
+                !strcasecmp(token, "FORMAT")) {
+                format_args_offset += 2;
+                look_for_formatting = true;
+            } else if (!strcasecmp(token, "NOESCAPE")) {
+                format_args_offset++;
+                look_for_formatting = true;
+            }
+            if (look_for_formatting) {
+                token = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
+            }
+        }
+        cstr_paths[i] = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
+    }
+}
+
 int Command_JsonGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_GET);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
     PrintFormat format;
+    bool resp3;
     ValkeyModuleString **paths;
     int num_paths;
-    JsonUtilCode rc = parseGetCmdArgs(argv, argc, &key_str, &format, &paths, &num_paths);
+    JsonUtilCode rc = parseGetCmdArgs(argv, argc, &key_str, &format, &resp3, &paths, &num_paths);
     if (rc != JSONUTIL_SUCCESS) {
         if (rc == JSONUTIL_WRONG_NUM_ARGS)
             return ValkeyModule_WrongArity(ctx);
@@ -639,9 +1207,27 @@ int Command_JsonGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
             return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
     }
 
+    // serve the whole document from the cache, if enabled
+    if (num_paths <= 1 && !resp3) {
+        const char *cstr_path = (num_paths == 0 ? "." : ValkeyModule_StringPtrLen(paths[0], nullptr));
+        if (reply_with_serialized_root(ctx, key_str, cstr_path, &format)) return VALKEYMODULE_OK;
+    }
+
     // fetch json
     ReplyBuffer oss(ctx, true);
-    if (num_paths == 0) {
+    if (resp3) {
+        const char *root = ".";
+        const char *cstr_path = (num_paths == 0 ? root : ValkeyModule_StringPtrLen(paths[0], nullptr));
+        if (num_paths <= 1) {
+            rc = reply_with_resp3(ctx, key_str, &cstr_path, 1);
+        } else {
+            const char **cstr_paths = static_cast<const char **>(ValkeyModule_PoolAlloc(ctx,
+                                                                                       num_paths * sizeof(const char*)));
+            collect_get_paths(paths, num_paths, cstr_paths);
+            rc = reply_with_resp3(ctx, key_str, cstr_paths, num_paths);
+        }
+        if (rc == JSONUTIL_SUCCESS) return VALKEYMODULE_OK;
+    } else if (num_paths == 0) {
         // default to the root path
         rc = fetch_json(ctx, key_str, ".", &format, oss);
     } else if (num_paths == 1) {
@@ -650,28 +1236,7 @@ int Command_JsonGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
     } else {
         const char **cstr_paths = static_cast<const char **>(ValkeyModule_PoolAlloc(ctx,
                                                                                    num_paths * sizeof(const char*)));
-        int format_args_offset = 0;
-        for (int i = 0; i < num_paths; i++) {
-            const char *token = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
-            // no need to check on the first one, we already know it's pointing to the right place
-            bool look_for_formatting = i > 0;
-
-            // we already know from parseGetCmdArgs that we're going to find another path eventually
-            while (look_for_formatting) {
-                look_for_formatting = false;
-                if (!strcasecmp(token, "NEWLINE") || !strcasecmp(token, "SPACE") || !strcasecmp(token, "INDENT")) {
-                    format_args_offset += 2;
-                    look_for_formatting = true;
-                } else if (!strcasecmp(token, "NOESCAPE")) {
-                    format_args_offset++;
-                    look_for_formatting = true;
-                }
-                if (look_for_formatting) {
-                    token = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
-                }
-            }
-            cstr_paths[i] = ValkeyModule_StringPtrLen(paths[i+format_args_offset], nullptr);
-        }
+        collect_get_paths(paths, num_paths, cstr_paths);
         rc = fetch_json_multi_paths(ctx, key_str, cstr_paths, num_paths, &format, oss);
     }
 
@@ -688,6 +1253,7 @@ int Command_JsonGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
 }
 
 int Command_JsonMGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_MGET);
     ValkeyModule_AutoMemory(ctx);
 
     // we need at least 3 arguments
@@ -696,30 +1262,43 @@ int Command_JsonMGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     int num_keys = argc - 2;
     const char *path = ValkeyModule_StringPtrLen(argv[argc-1], nullptr);
 
-    // create a vector of string streams to store JSON per key
-    jsn::vector<ReplyBuffer> vec(num_keys);
+    // First pass: evaluate the path on every document with one selector, so that the path is resolved once and
+    // an error can still fail the whole command before anything is replied. Only pointers to the selected values
+    // are kept, serialization is deferred to the second pass.
+    Selector selector;
+    jsn::vector<jsn::vector<JValue*>> values(num_keys);
+    jsn::vector<JDocument*> docs(num_keys, nullptr);  // nullptr means the key is replied with null
     for (int i=0; i < num_keys; i++) {
-        vec[i].Initialize(ctx, false);
-        JsonUtilCode rc = fetch_json(ctx, argv[i + 1], path, nullptr, vec[i]);
+        ValkeyModuleKey *key;
+        JsonUtilCode rc = verify_doc_key(ctx, argv[i + 1], &key, true);
+        if (rc == JSONUTIL_SUCCESS) {
+            JDocument *doc = get_document(key);
+            rc = dom_select_values(doc, path, selector, values[i]);
+            if (rc == JSONUTIL_SUCCESS) docs[i] = doc;
+        }
         if (rc != JSONUTIL_SUCCESS && rc != JSONUTIL_DOCUMENT_KEY_NOT_FOUND &&
             rc != JSONUTIL_INVALID_JSON_PATH && rc != JSONUTIL_JSON_PATH_NOT_EXIST) {
             return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
         }
     }
 
-    // return array of bulk strings to client
+    // Second pass: stream the array of bulk strings to client, serializing one key at a time into a single buffer.
     ValkeyModule_ReplyWithArray(ctx, num_keys);
+    ReplyBuffer oss(ctx, false);
     for (int i=0; i < num_keys; i++) {
-        if (vec[i].GetLength() == 0) {
+        if (docs[i] == nullptr) {
             ValkeyModule_ReplyWithNull(ctx);
         } else {
-            vec[i].Reply();
+            oss.Clear();
+            dom_serialize_selected_values(docs[i], values[i], selector.isLegacyJsonPathSyntax(), nullptr, oss);
+            oss.Reply();
         }
     }
     return VALKEYMODULE_OK;
 }
 
 int Command_JsonDel(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_DEL);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -762,13 +1341,14 @@ int Command_JsonDel(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking memory
     int64_t begin_val = jsonstats_begin_track_mem();
 
     // delete value at path
+    PathWriteReplicator replicator(path);
     size_t num_vals_deleted;
     rc = dom_delete_value(doc, path, num_vals_deleted);
 
@@ -790,7 +1370,7 @@ int Command_JsonDel(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
     jsonstats_update_stats_on_delete(doc, false, orig_doc_size, new_doc_size, abs(delta));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.del", key_str);
     return ValkeyModule_ReplyWithLongLong(ctx, num_vals_deleted);
@@ -800,6 +1380,7 @@ int Command_JsonDel(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
  * A helper method to send a reply to the client for JSON.NUMINCRBY or JSON.NUMMULTBY.
  */
 STATIC void reply_numincrby_nummultby(jsn::vector<double> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the last updated number value.
         for (auto it = vec.rbegin(); it != vec.rend(); it++) {
@@ -832,6 +1413,7 @@ STATIC void reply_numincrby_nummultby(jsn::vector<double> &vec, const bool is_v2
 }
 
 int Command_JsonNumIncrBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_NUMINCRBY);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -848,16 +1430,17 @@ int Command_JsonNumIncrBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // increment the value at path
     jsn::vector<double> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_increment_by(doc, path, &jvalue, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.numincrby", key_str);
 
@@ -867,6 +1450,7 @@ int Command_JsonNumIncrBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
 }
 
 int Command_JsonNumMultBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_NUMMULTBY);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -883,16 +1467,17 @@ int Command_JsonNumMultBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // multiply the value at path
     jsn::vector<double> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_multiply_by(doc, path, &jvalue, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.nummultby", key_str);
 
@@ -905,6 +1490,7 @@ int Command_JsonNumMultBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
  * A helper method to send a reply to the client for JSON.STRLEN and JSON.OBJLEN.
  */
 STATIC void reply_strlen_objlen(jsn::vector<size_t> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         for (auto it = vec.begin(); it != vec.end(); it++) {
@@ -931,6 +1517,7 @@ STATIC void reply_strlen_objlen(jsn::vector<size_t> &vec, const bool is_v2_path,
 }
 
 int Command_JsonStrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_STRLEN);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -949,7 +1536,7 @@ int Command_JsonStrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get string lengths
     jsn::vector<size_t> vec;
@@ -965,6 +1552,7 @@ int Command_JsonStrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
  * A helper method to send a reply to the client for JSON.STRAPPEND.
  */
 STATIC void reply_strappend(jsn::vector<size_t> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the last updated string's length.
         for (auto it = vec.rbegin(); it != vec.rend(); it++) {
@@ -991,6 +1579,7 @@ STATIC void reply_strappend(jsn::vector<size_t> &vec, const bool is_v2_path, Val
 }
 
 int Command_JsonStrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_STRAPPEND);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1008,7 +1597,7 @@ int Command_JsonStrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
     CHECK_DOCUMENT_SIZE_LIMIT(ctx, orig_doc_size + json_len)
 
@@ -1018,6 +1607,7 @@ int Command_JsonStrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     // do string append
     jsn::vector<size_t> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_string_append(doc, path, json, json_len, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
@@ -1030,7 +1620,7 @@ int Command_JsonStrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     jsonstats_update_stats_on_update(doc, orig_doc_size, new_doc_size, json_len);
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.strappend", key_str);
 
@@ -1042,6 +1632,7 @@ int Command_JsonStrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
  * A helper method to send a reply to the client for JSON.TOGGLE.
  */
 STATIC void reply_toggle(jsn::vector<int> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         for (auto it = vec.begin(); it != vec.end(); it++) {
@@ -1072,6 +1663,7 @@ STATIC void reply_toggle(jsn::vector<int> &vec, const bool is_v2_path, ValkeyMod
 }
 
 int Command_JsonToggle(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_TOGGLE);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1090,16 +1682,17 @@ int Command_JsonToggle(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // toggle the boolean value at this path
     jsn::vector<int> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_toggle(doc, path, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.toggle", key_str);
 
@@ -1108,6 +1701,7 @@ int Command_JsonToggle(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
 }
 
 int Command_JsonObjLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_OBJLEN);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1126,7 +1720,7 @@ int Command_JsonObjLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get object length
     jsn::vector<size_t> vec;
@@ -1142,6 +1736,7 @@ int Command_JsonObjLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
  * A helper method to send a reply to the client for JSON.OBJKEYS.
  */
 STATIC void reply_objkeys(jsn::vector<jsn::vector<jsn::string>> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return an array of keys.
         // If there are multiple objects, return the keys of the first object.
@@ -1178,6 +1773,7 @@ STATIC void reply_objkeys(jsn::vector<jsn::vector<jsn::string>> &vec, const bool
 }
 
 int Command_JsonObjKeys(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_OBJKEYS);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1196,7 +1792,7 @@ int Command_JsonObjKeys(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get object keys
     jsn::vector<jsn::vector<jsn::string>> vec;
@@ -1216,6 +1812,7 @@ int Command_JsonObjKeys(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
  * A helper method to send a reply to the client for some array commands.
  */
 STATIC void reply_array_command(jsn::vector<size_t> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         for (auto it = vec.begin(); it != vec.end(); it++) {
@@ -1242,6 +1839,7 @@ STATIC void reply_array_command(jsn::vector<size_t> &vec, const bool is_v2_path,
 }
 
 int Command_JsonArrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRLEN);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1260,7 +1858,7 @@ int Command_JsonArrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get array length
     jsn::vector<size_t> vec;
@@ -1273,6 +1871,7 @@ int Command_JsonArrLen(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
 }
 
 int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRAPPEND);
     ValkeyModule_AutoMemory(ctx);
 
     ArrAppendCmdArgs args;
@@ -1289,7 +1888,7 @@ int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking memory
@@ -1298,6 +1897,7 @@ int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     // do array append
     jsn::vector<size_t> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(args.path);
     rc = dom_array_append(ctx, doc, args.path, args.jsons, args.json_len_arr, args.num_values, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
@@ -1310,7 +1910,7 @@ int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     jsonstats_update_stats_on_update(doc, orig_doc_size, new_doc_size, args.total_json_len);
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, args.key, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.arrappend", args.key);
 
@@ -1322,6 +1922,7 @@ int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
  * A helper method to send a reply to the client for JSON.ARRPOP.
  */
 STATIC void reply_arrpop(jsn::vector<rapidjson::StringBuffer> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         for (auto it = vec.begin(); it != vec.end(); it++) {
@@ -1345,6 +1946,7 @@ STATIC void reply_arrpop(jsn::vector<rapidjson::StringBuffer> &vec, const bool i
 }
 
 int Command_JsonArrPop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRPOP);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1363,7 +1965,7 @@ int Command_JsonArrPop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking memory
@@ -1372,6 +1974,7 @@ int Command_JsonArrPop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     // do array pop
     jsn::vector<rapidjson::StringBuffer> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_array_pop(doc, path, index, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) {
         if (rc == JSONUTIL_EMPTY_JSON_ARRAY) return ValkeyModule_ReplyWithNull(ctx);
@@ -1387,7 +1990,7 @@ int Command_JsonArrPop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
     jsonstats_update_stats_on_delete(doc, false, orig_doc_size, new_doc_size, abs(delta));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.arrpop", key_str);
 
@@ -1396,6 +1999,7 @@ int Command_JsonArrPop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc
 }
 
 int Command_JsonArrInsert(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRINSERT);
     ValkeyModule_AutoMemory(ctx);
 
     ArrInsertCmdArgs args;
@@ -1412,7 +2016,7 @@ int Command_JsonArrInsert(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking
@@ -1421,6 +2025,7 @@ int Command_JsonArrInsert(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     // do array insert
     jsn::vector<size_t> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(args.path);
     rc = dom_array_insert(ctx, doc, args.path, args.index, args.jsons, args.json_len_arr, args.num_values,
                           vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
@@ -1434,7 +2039,7 @@ int Command_JsonArrInsert(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
     jsonstats_update_stats_on_insert(doc, false, orig_doc_size, new_doc_size, args.total_json_len);
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, args.key, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.arrinsert", args.key);
 
@@ -1443,6 +2048,7 @@ int Command_JsonArrInsert(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int a
 }
 
 int Command_JsonArrTrim(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRTRIM);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1462,7 +2068,7 @@ int Command_JsonArrTrim(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking memory
@@ -1471,6 +2077,7 @@ int Command_JsonArrTrim(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
     // do array trim
     jsn::vector<size_t> vec;
     bool is_v2_path;
+    PathWriteReplicator replicator(path);
     rc = dom_array_trim(doc, path, start, stop, vec, is_v2_path);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
@@ -1483,7 +2090,7 @@ int Command_JsonArrTrim(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
     jsonstats_update_stats_on_delete(doc, false, orig_doc_size, new_doc_size, abs(delta));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.arrtrim", key_str);
 
@@ -1492,6 +2099,7 @@ int Command_JsonArrTrim(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int arg
 }
 
 int Command_JsonClear(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_CLEAR);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1510,7 +2118,7 @@ int Command_JsonClear(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // begin tracking memory
@@ -1518,6 +2126,7 @@ int Command_JsonClear(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
 
     // do element clear
     size_t elements_cleared;
+    PathWriteReplicator replicator(path);
     rc = dom_clear(doc, path, elements_cleared);
     if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
 
@@ -1530,7 +2139,7 @@ int Command_JsonClear(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     jsonstats_update_stats_on_delete(doc, false, orig_doc_size, new_doc_size, abs(delta));
 
     // replicate the command
-    ValkeyModule_ReplicateVerbatim(ctx);
+    replicator.replicate(ctx, key_str, key);
 
     ValkeyModule_NotifyKeyspaceEvent(ctx, VALKEYMODULE_NOTIFY_GENERIC, "json.clear", key_str);
     return ValkeyModule_ReplyWithLongLong(ctx, static_cast<long long>(elements_cleared));
@@ -1540,6 +2149,7 @@ int Command_JsonClear(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
  * A helper method to send a reply to the client for JSON.ARRINDEX.
  */
 STATIC void reply_arrindex(jsn::vector<int64_t> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         for (auto it = vec.begin(); it != vec.end(); it++) {
@@ -1566,6 +2176,7 @@ STATIC void reply_arrindex(jsn::vector<int64_t> &vec, const bool is_v2_path, Val
 }
 
 int Command_JsonArrIndex(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_ARRINDEX);
     ValkeyModule_AutoMemory(ctx);
 
     ArrIndexCmdArgs args;
@@ -1582,7 +2193,7 @@ int Command_JsonArrIndex(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int ar
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // do array index of
     jsn::vector<int64_t> vec;
@@ -1599,6 +2210,7 @@ int Command_JsonArrIndex(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int ar
  * A helper method to send a reply to the client for JSON.TYPE.
  */
 STATIC int reply_type(jsn::vector<jsn::string> &vec, const bool is_v2_path, ValkeyModuleCtx *ctx) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY);
     if (!is_v2_path) {
         // Legacy path: return a single value, which is the first value.
         if (vec.empty()) {
@@ -1619,6 +2231,7 @@ STATIC int reply_type(jsn::vector<jsn::string> &vec, const bool is_v2_path, Valk
 }
 
 int Command_JsonType(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_TYPE);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1637,7 +2250,7 @@ int Command_JsonType(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get type of the value
     jsn::vector<jsn::string> vec;
@@ -1653,6 +2266,7 @@ int Command_JsonType(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
 }
 
 int Command_JsonResp(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    JsonCommandTimer timer(JSONSTATS_CMD_RESP);
     ValkeyModule_AutoMemory(ctx);
 
     ValkeyModuleString *key_str;
@@ -1671,7 +2285,7 @@ int Command_JsonResp(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     }
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // reply with RESP protocol
     rc = dom_reply_with_resp(ctx, doc, path);
@@ -1689,7 +2303,7 @@ STATIC JsonUtilCode processMemorySubCmd(ValkeyModuleCtx *ctx, ValkeyModuleString
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // compute memory size of the JSON element
     return dom_mem_size(doc, path, vec, is_v2_path, default_path);
@@ -1704,7 +2318,7 @@ STATIC JsonUtilCode processFieldsSubCmd(ValkeyModuleCtx *ctx, ValkeyModuleString
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get number of fields for the value
     return dom_num_fields(doc, path, vec, is_v2_path);
@@ -1719,80 +2333,199 @@ STATIC JsonUtilCode processDepthSubCmd(ValkeyModuleCtx *ctx, ValkeyModuleString
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     // fetch doc object from Valkey dict
-    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    JDocument *doc = get_document(key);
 
     // get max path depth of the doc
     dom_path_depth(doc, depth);
     return JSONUTIL_SUCCESS;
 }
 
-struct MaxDepthKey {
-    MaxDepthKey() : max_depth(0), keyname() {}
-    size_t max_depth;
+/**
+ * MAX-DEPTH-KEY and MAX-SIZE-KEY scan the keyspace of the selected database in batches of KEY_SCAN_BATCH keys, one
+ * batch per event loop iteration, with the client blocked until the scan is done. Other clients are served between
+ * batches, so a scan of a large keyspace takes a while but doesn't stall the server. Keys written while the scan is
+ * running are measured as of when the scan gets to them. Where the client can't be blocked, e.g., in MULTI or in a
+ * script, the whole scan runs in place, as before.
+ */
+size_t KEY_SCAN_BATCH = 1000;
+
+struct MaxKeyScan {
+    enum Measure { DEPTH, SIZE };
+    explicit MaxKeyScan(Measure _measure)
+            : measure(_measure), batch(0), max_value(0), keyname(), cursor(ValkeyModule_ScanCursorCreate()),
+              db(0), bc(nullptr) {}
+    ~MaxKeyScan() { ValkeyModule_ScanCursorDestroy(cursor); }
+    Measure measure;
+    size_t batch;                       // keys measured in the current batch
+    size_t max_value;
     jsn::string keyname;
+    ValkeyModuleScanCursor *cursor;
+    int db;                             // database being scanned, timer callbacks start out in database 0
+    ValkeyModuleBlockedClient *bc;      // nullptr if the scan runs in place
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
 };
 
-STATIC void scan_max_depth_key_callback(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, ValkeyModuleKey *key,
-                                        void *privdata) {
+STATIC void scan_max_key_callback(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, ValkeyModuleKey *key,
+                                  void *privdata) {
     VALKEYMODULE_NOT_USED(ctx);
+    MaxKeyScan *scan = static_cast<MaxKeyScan*>(privdata);
+    scan->batch++;
     if (ValkeyModule_ModuleTypeGetType(key) == DocumentType) {
         JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
-        size_t depth = 0;
-        dom_path_depth(doc, &depth);
-        MaxDepthKey *mdk = static_cast<MaxDepthKey*>(privdata);
-        if (depth > mdk->max_depth) {
-            mdk->max_depth = depth;
+        size_t value = 0;
+        if (scan->measure == MaxKeyScan::DEPTH) {
+            dom_path_depth(doc, &value);
+        } else {
+            value = dom_get_doc_size(doc);
+        }
+        if (value > scan->max_value) {
+            scan->max_value = value;
             const char *s = ValkeyModule_StringPtrLen(keyname, nullptr);
-            mdk->keyname = jsn::string(s);
+            scan->keyname = jsn::string(s);
         }
     }
 }
 
-STATIC void processMaxDepthKeySubCmd(ValkeyModuleCtx *ctx, MaxDepthKey *mdk) {
-    // scan keys
-    ValkeyModuleScanCursor *cursor = ValkeyModule_ScanCursorCreate();
-    while (ValkeyModule_Scan(ctx, cursor, scan_max_depth_key_callback, mdk)) {}
-    ValkeyModule_ScanCursorDestroy(cursor);
+/**
+ * Scan the next batch of keys. Returns false when the scan is done.
+ */
+STATIC bool scan_max_key_batch(ValkeyModuleCtx *ctx, MaxKeyScan *scan) {
+    scan->batch = 0;
+    while (scan->batch < KEY_SCAN_BATCH) {
+        if (!ValkeyModule_Scan(ctx, scan->cursor, scan_max_key_callback, scan)) return false;
+    }
+    return true;
+}
+
+STATIC void reply_max_key(ValkeyModuleCtx *ctx, const MaxKeyScan *scan) {
+    ValkeyModule_ReplyWithArray(ctx, 2);
+    ValkeyModule_ReplyWithLongLong(ctx, scan->max_value);
+    ValkeyModule_ReplyWithSimpleString(ctx, scan->keyname.c_str());
 }
 
-struct MaxSizeKey {
-    MaxSizeKey() : max_size(0), keyname() {}
-    size_t max_size;
-    jsn::string keyname;
-};
+STATIC void scan_max_key_timer(ValkeyModuleCtx *ctx, void *data) {
+    MaxKeyScan *scan = static_cast<MaxKeyScan*>(data);
+    ValkeyModule_SelectDb(ctx, scan->db);
+    if (scan_max_key_batch(ctx, scan)) {
+        ValkeyModule_CreateTimer(ctx, 0, scan_max_key_timer, scan);
+    } else {
+        ValkeyModule_UnblockClient(scan->bc, scan);
+    }
+}
+
+STATIC int scan_max_key_reply(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    VALKEYMODULE_NOT_USED(argv);
+    VALKEYMODULE_NOT_USED(argc);
+    reply_max_key(ctx, static_cast<MaxKeyScan*>(ValkeyModule_GetBlockedClientPrivateData(ctx)));
+    return VALKEYMODULE_OK;
+}
+
+STATIC void scan_max_key_free(ValkeyModuleCtx *ctx, void *privdata) {
+    VALKEYMODULE_NOT_USED(ctx);
+    delete static_cast<MaxKeyScan*>(privdata);
+}
+
+STATIC int processMaxKeySubCmd(ValkeyModuleCtx *ctx, const MaxKeyScan::Measure measure) {
+    MaxKeyScan *scan = new MaxKeyScan(measure);
+    if (ValkeyModule_GetContextFlags(ctx) & VALKEYMODULE_CTX_FLAGS_DENY_BLOCKING) {
+        while (scan_max_key_batch(ctx, scan)) {}
+        reply_max_key(ctx, scan);
+        delete scan;
+        return VALKEYMODULE_OK;
+    }
+    // The first batch is scanned right away, small keyspaces are done without blocking
+    if (!scan_max_key_batch(ctx, scan)) {
+        reply_max_key(ctx, scan);
+        delete scan;
+        return VALKEYMODULE_OK;
+    }
+    scan->db = ValkeyModule_GetSelectedDb(ctx);
+    scan->bc = ValkeyModule_BlockClient(ctx, scan_max_key_reply, nullptr, scan_max_key_free, 0);
+    ValkeyModule_CreateTimer(ctx, 0, scan_max_key_timer, scan);
+    return VALKEYMODULE_OK;
+}
+
+/**
+ * Compression of cold documents. With json.compress-min-size set, a background scan walks the keyspace of every
+ * database, KEY_SCAN_BATCH keys every COMPRESS_SCAN_INTERVAL_MS, and compresses the documents of at least that size
+ * that haven't been touched for json.compress-idle-seconds, see dom_compress_doc. The first command to get to a
+ * compressed document inflates it again, see get_document. The idle time is the LRU idle time of the key, which
+ * isn't kept with an LFU maxmemory-policy, nothing is compressed then.
+ */
+#define COMPRESS_SCAN_INTERVAL_MS 100
+
+static struct {
+    ValkeyModuleScanCursor *cursor = nullptr;
+    int db = 0;
+    size_t batch = 0;                   // keys looked at in the current batch
+} compress_scan;
 
-STATIC void scan_max_size_key_callback(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, ValkeyModuleKey *key,
-                                       void *privdata) {
+STATIC void compress_scan_callback(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, ValkeyModuleKey *key,
+                                   void *privdata) {
     VALKEYMODULE_NOT_USED(ctx);
-    if (ValkeyModule_ModuleTypeGetType(key) == DocumentType) {
-        JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
-        size_t size = dom_get_doc_size(doc);
-        MaxSizeKey *msk = static_cast<MaxSizeKey*>(privdata);
-        if (size > msk->max_size) {
-            msk->max_size = size;
-            const char *s = ValkeyModule_StringPtrLen(keyname, nullptr);
-            msk->keyname = jsn::string(s);
+    VALKEYMODULE_NOT_USED(keyname);
+    VALKEYMODULE_NOT_USED(privdata);
+    compress_scan.batch++;
+    if (key == nullptr || ValkeyModule_ModuleTypeGetType(key) != DocumentType) return;
+    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    if (dom_is_compressed(doc) || dom_get_doc_size(doc) < json_get_compress_min_size()) return;
+    mstime_t idle;
+    if (ValkeyModule_GetLRU(key, &idle) != VALKEYMODULE_OK) return;
+    if (idle < static_cast<mstime_t>(json_get_compress_idle_seconds()) * 1000) return;
+    dom_compress_doc(doc);
+}
+
+STATIC void compress_scan_timer(ValkeyModuleCtx *ctx, void *data) {
+    VALKEYMODULE_NOT_USED(data);
+    if (json_get_compress_min_size() > 0) {
+        if (compress_scan.cursor == nullptr) compress_scan.cursor = ValkeyModule_ScanCursorCreate();
+        if (ValkeyModule_SelectDb(ctx, compress_scan.db) != VALKEYMODULE_OK) {
+            compress_scan.db = 0;
+            ValkeyModule_SelectDb(ctx, 0);
+        }
+        compress_scan.batch = 0;
+        while (compress_scan.batch < KEY_SCAN_BATCH) {
+            if (!ValkeyModule_Scan(ctx, compress_scan.cursor, compress_scan_callback, nullptr)) {
+                // On to the next database with the next batch, back to the first one after the last
+                ValkeyModule_ScanCursorRestart(compress_scan.cursor);
+                compress_scan.db++;
+                break;
+            }
         }
     }
+    ValkeyModule_CreateTimer(ctx, COMPRESS_SCAN_INTERVAL_MS, compress_scan_timer, nullptr);
 }
 
-STATIC void processMaxSizeKeySubCmd(ValkeyModuleCtx *ctx, MaxSizeKey *msk) {
-    // scan keys
-    ValkeyModuleScanCursor *cursor = ValkeyModule_ScanCursorCreate();
-    while (ValkeyModule_Scan(ctx, cursor, scan_max_size_key_callback, msk)) {}
-    ValkeyModule_ScanCursorDestroy(cursor);
+STATIC int processCompressSubCmd(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, const int argc) {
+    if (argc != 3) return ValkeyModule_WrongArity(ctx);
+    ValkeyModuleKey *key;
+    JsonUtilCode rc = verify_doc_key(ctx, argv[2], &key, true);
+    if (rc != JSONUTIL_SUCCESS) {
+        if (rc == JSONUTIL_DOCUMENT_KEY_NOT_FOUND) return ValkeyModule_ReplyWithNull(ctx);
+        return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+    }
+    JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    return ValkeyModule_ReplyWithLongLong(ctx, dom_compress_doc(doc) ? 1 : 0);
 }
 
 struct KeyTableValidate {
     std::unordered_map<const KeyTable_Layout *, size_t> counts;
+    std::unordered_set<const JDocument *> sharers;  // documents of the rings walked already, see dom_copy
     size_t handles = 0;
+    size_t inlineHandles = 0;
     void walk_json(JValue &v) {
         if (v.IsObject()) {
             ValkeyModule_Log(nullptr, "debug", "Found Object");
             for (JValue::MemberIterator m = v.MemberBegin(); m != v.MemberEnd(); ++m) {
-                ValkeyModule_Log(nullptr, "debug", "Found Member : %s", m->name->getText());
-                counts[&*(m->name)]++;
-                handles++;
+                ValkeyModule_Log(nullptr, "debug", "Found Member : %.*s", static_cast<int>(m->name.GetStringLength()),
+                                 m->name.GetString());
+                if (m->name.IsInline()) {
+                    inlineHandles++;  // Not in the table, nothing to count
+                } else {
+                    counts[&*(m->name)]++;
+                    handles++;
+                }
                 walk_json(m->value);
             }
         } else if (v.IsArray()) {
@@ -1809,6 +2542,15 @@ STATIC void keytable_validate(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname,
     auto ktv = reinterpret_cast<KeyTableValidate *>(privdata);
     if (ValkeyModule_ModuleTypeGetType(key) == DocumentType) {
         JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+        if (dom_is_shared(doc)) {
+            // The handles of a shared tree are referenced once, whatever the number of documents sharing it
+            if (ktv->sharers.count(doc)) return;
+            const JDocument *d = doc;
+            do {
+                ktv->sharers.insert(d);
+                d = d->GetNextSharer();
+            } while (d != doc);
+        }
         ktv->walk_json(doc->GetJValue());
     }
 }
@@ -1839,12 +2581,84 @@ STATIC std::string processKeytableCheckCmd(ValkeyModuleCtx *ctx, size_t *handles
             << " Expected: " << stats.handles << " & " << stats.size;
         return os.str();
     }
+    if (stats.inlineHandles != validate.inlineHandles) {
+        std::ostringstream os;
+        os << "Mismatch on inline handles: Found: " << validate.inlineHandles << " Expected: " << stats.inlineHandles;
+        return os.str();
+    }
     //
     // Step 2, for each key, check the reference count against the KeyTable
     //
     return keyTable->validate_counts(validate.counts);
 }
 
+/**
+ * JSON.DEBUG MEMORY-PROFILE [ON | OFF | RESET]
+ *
+ * Without an argument, reports the allocation profile, see memory.h: whether it's on, then for each category of
+ * memory its allocations, bytes, overhead bytes, frees and freed bytes, then for each command that allocated while
+ * the profile was on its allocations and bytes. Allocations outside of a command are reported as "none".
+ */
+STATIC int processMemoryProfileCmd(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, const int argc) {
+    if (argc > 3) return ValkeyModule_WrongArity(ctx);
+    if (argc == 3) {
+        const char *action = ValkeyModule_StringPtrLen(argv[2], nullptr);
+        if (!strcasecmp(action, "ON")) {
+            memory_profile_control(true);
+        } else if (!strcasecmp(action, "OFF")) {
+            memory_profile_control(false);
+        } else if (!strcasecmp(action, "RESET")) {
+            memory_profile_reset();
+        } else {
+            return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(JSONUTIL_UNKNOWN_SUBCOMMAND));
+        }
+        return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
+    }
+
+    ValkeyModule_ReplyWithArray(ctx, 6);
+    ValkeyModule_ReplyWithSimpleString(ctx, "enabled");
+    ValkeyModule_ReplyWithLongLong(ctx, memory_profile_enabled() ? 1 : 0);
+
+    ValkeyModule_ReplyWithSimpleString(ctx, "categories");
+    ValkeyModule_ReplyWithArray(ctx, 2 * MEMORY_NUM_CATEGORIES);
+    for (int i = 0; i < MEMORY_NUM_CATEGORIES; i++) {
+        memoryCategory_t category = static_cast<memoryCategory_t>(i);
+        memoryProfile_t profile;
+        memory_profile_get_category(category, &profile);
+        ValkeyModule_ReplyWithSimpleString(ctx, memory_category_name(category));
+        ValkeyModule_ReplyWithArray(ctx, 10);
+        ValkeyModule_ReplyWithSimpleString(ctx, "allocations");
+        ValkeyModule_ReplyWithLongLong(ctx, profile.allocations);
+        ValkeyModule_ReplyWithSimpleString(ctx, "bytes");
+        ValkeyModule_ReplyWithLongLong(ctx, profile.bytes);
+        ValkeyModule_ReplyWithSimpleString(ctx, "overhead_bytes");
+        ValkeyModule_ReplyWithLongLong(ctx, profile.overhead_bytes);
+        ValkeyModule_ReplyWithSimpleString(ctx, "frees");
+        ValkeyModule_ReplyWithLongLong(ctx, profile.frees);
+        ValkeyModule_ReplyWithSimpleString(ctx, "freed_bytes");
+        ValkeyModule_ReplyWithLongLong(ctx, profile.freed_bytes);
+    }
+
+    ValkeyModule_ReplyWithSimpleString(ctx, "commands");
+    long num_replies = 0;
+    ValkeyModule_ReplyWithArray(ctx, VALKEYMODULE_POSTPONED_LEN);
+    for (int i = 0; i <= JSONSTATS_NUM_COMMANDS; i++) {
+        JsonStatsCommand cmd = static_cast<JsonStatsCommand>(i);
+        size_t allocations, bytes;
+        memory_profile_get_command(cmd, &allocations, &bytes);
+        if (allocations == 0) continue;
+        ValkeyModule_ReplyWithSimpleString(ctx, cmd == JSONSTATS_NUM_COMMANDS ? "none" : jsonstats_command_name(cmd));
+        ValkeyModule_ReplyWithArray(ctx, 4);
+        ValkeyModule_ReplyWithSimpleString(ctx, "allocations");
+        ValkeyModule_ReplyWithLongLong(ctx, allocations);
+        ValkeyModule_ReplyWithSimpleString(ctx, "bytes");
+        ValkeyModule_ReplyWithLongLong(ctx, bytes);
+        num_replies += 2;
+    }
+    ValkeyModule_ReplySetArrayLength(ctx, num_replies);
+    return VALKEYMODULE_OK;
+}
+
 /**
  * A helper method to send a reply to the client for JSON.DEBUG MEMORY | FIELDS.
  */
@@ -1937,37 +2751,23 @@ int Command_JsonDebug(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
             return VALKEYMODULE_ERR;;
         }
 
-        // ATTENTION:
-        // THIS IS AN UNDOCUMENTED SUBCOMMAND, TO BE USED FOR DEV TEST ONLY. DON'T RUN IT ON A PRODUCTION SYSTEM.
-        // KEY SCAN MAY RUN FOR A LONG TIME LOCKING OUT ALL OTHER CLIENTS.
+        // The key scan yields between batches, see MaxKeyScan
 
         // there should be exactly 2 arguments
         if (argc != 2) return ValkeyModule_WrongArity(ctx);
 
-        MaxDepthKey mdk;
-        processMaxDepthKeySubCmd(ctx, &mdk);
-        ValkeyModule_ReplyWithArray(ctx, 2);
-        ValkeyModule_ReplyWithLongLong(ctx, mdk.max_depth);
-        ValkeyModule_ReplyWithSimpleString(ctx, mdk.keyname.c_str());
-        return VALKEYMODULE_OK;
+        return processMaxKeySubCmd(ctx, MaxKeyScan::DEPTH);
     } else if (!strcasecmp(subcmd, "MAX-SIZE-KEY")) {
         if (ValkeyModule_IsKeysPositionRequest(ctx)) {
             return VALKEYMODULE_ERR;
         }
 
-        // ATTENTION:
-        // THIS IS AN UNDOCUMENTED SUBCOMMAND, TO BE USED FOR DEV TEST ONLY. DON'T RUN IT ON A PRODUCTION SYSTEM.
-        // KEY SCAN MAY RUN FOR A LONG TIME LOCKING OUT ALL OTHER CLIENTS.
+        // The key scan yields between batches, see MaxKeyScan
 
         // there should be exactly 2 arguments
         if (argc != 2) return ValkeyModule_WrongArity(ctx);
 
-        MaxSizeKey msk;
-        processMaxSizeKeySubCmd(ctx, &msk);
-        ValkeyModule_ReplyWithArray(ctx, 2);
-        ValkeyModule_ReplyWithLongLong(ctx, msk.max_size);
-        ValkeyModule_ReplyWithSimpleString(ctx, msk.keyname.c_str());
-        return VALKEYMODULE_OK;
+        return processMaxKeySubCmd(ctx, MaxKeyScan::SIZE);
     } else if (!strcasecmp(subcmd, "KEYTABLE-CHECK")) {
         // Validate that all use-counts of KeyTable are correct
         if (ValkeyModule_IsKeysPositionRequest(ctx)) {
@@ -2011,7 +2811,7 @@ int Command_JsonDebug(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
         const char *str = ValkeyModule_StringPtrLen(argv[2], &len);
 
         KeyTable_Handle h = keyTable->makeHandle(str, len);
-        ValkeyModule_Log(ctx, "warning", "*** Handle %s count is now %zd", str, h->getRefCount());
+        ValkeyModule_Log(ctx, "warning", "*** Handle %s count is now %zd", str, h.IsInline() ? 0 : h->getRefCount());
         return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
     } else if (!strcasecmp(subcmd, "KEYTABLE-DISTRIBUTION")) {
         // compute longest runs of non-empty hashtable entries, a direct measure of key distribution and
@@ -2038,6 +2838,68 @@ int Command_JsonDebug(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
             ValkeyModule_ReplyWithLongLong(ctx, it->second);
         }
         return VALKEYMODULE_OK;
+    } else if (!strcasecmp(subcmd, "KEYTABLE")) {
+        // Report the KeyTable stats, including the progress of incremental rehashing
+        if (ValkeyModule_IsKeysPositionRequest(ctx)) {
+            return VALKEYMODULE_ERR;
+        }
+
+        // there should be exactly 2 arguments
+        if (argc != 2) return ValkeyModule_WrongArity(ctx);
+
+        KeyTable::Stats s = keyTable->getStats();
+        std::vector<std::pair<const char *, size_t>> fields = {
+            {"size", s.size},
+            {"bytes", s.bytes},
+            {"handles", s.handles},
+            {"inline_handles", s.inlineHandles},
+            {"num_shards", keyTable->getNumShards()},
+            {"max_table_size", s.maxTableSize},
+            {"min_table_size", s.minTableSize},
+            {"total_table", s.totalTable},
+            {"stuck_keys", s.stuckKeys},
+            {"retired", s.retired},
+            {"lock_waits", s.lockWaits},
+            {"lock_wait_nanos", s.lockWaitNanos},
+            {"max_search", s.maxSearch},
+            {"rehashes", s.rehashes},
+            {"rehash_in_progress", s.rehashInProgress},
+            {"max_rehash_pause_nanos", s.maxRehashNanos},
+        };
+        ValkeyModule_ReplyWithArray(ctx, 2 * fields.size());
+        for (auto& f : fields) {
+            ValkeyModule_ReplyWithSimpleString(ctx, f.first);
+            ValkeyModule_ReplyWithLongLong(ctx, f.second);
+        }
+        return VALKEYMODULE_OK;
+    } else if (!strcasecmp(subcmd, "COMPRESS")) {
+        if (ValkeyModule_IsKeysPositionRequest(ctx)) {
+            if (argc < 3) {
+                return VALKEYMODULE_ERR;
+            } else {
+                ValkeyModule_KeyAtPos(ctx, 2);
+                return VALKEYMODULE_OK;
+            }
+        }
+        return processCompressSubCmd(ctx, argv, argc);
+    } else if (!strcasecmp(subcmd, "MEMORY-PROFILE")) {
+        // Switch, reset or report the allocation profile
+        if (ValkeyModule_IsKeysPositionRequest(ctx)) {
+            return VALKEYMODULE_ERR;
+        }
+        return processMemoryProfileCmd(ctx, argv, argc);
+    } else if (!strcasecmp(subcmd, "RESET-STATS")) {
+        // Reset the latency histograms, and the path and cache counters reported in INFO
+        if (ValkeyModule_IsKeysPositionRequest(ctx)) {
+            return VALKEYMODULE_ERR;
+        }
+
+        // there should be exactly 2 arguments
+        if (argc != 2) return ValkeyModule_WrongArity(ctx);
+
+        jsonstats_reset_command_stats();
+        pathCache->resetStats();
+        return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
     } else if (!strcasecmp(subcmd, "HELP")) {
         if (ValkeyModule_IsKeysPositionRequest(ctx)) {
             return VALKEYMODULE_ERR;
@@ -2053,6 +2915,12 @@ int Command_JsonDebug(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
         cmds.push_back("JSON.DEBUG DEPTH <key> - report the maximum path depth of the JSON document.");
         cmds.push_back("JSON.DEBUG FIELDS <key> [path] - report number of fields in the "
                        "JSON element. Path defaults to root if not provided.");
+        cmds.push_back("JSON.DEBUG KEYTABLE - report KeyTable stats, including rehash progress.");
+        cmds.push_back("JSON.DEBUG COMPRESS <key> - compress the document now, as if it was cold. Reports 1 if it "
+                       "was compressed.");
+        cmds.push_back("JSON.DEBUG RESET-STATS - reset latency histograms, path, cache and inflate counters.");
+        cmds.push_back("JSON.DEBUG MEMORY-PROFILE [ON|OFF|RESET] - switch or reset the allocation profile, without "
+                       "an argument report allocations by category of memory and by command.");
         cmds.push_back("JSON.DEBUG HELP - print help message.");
         cmds.push_back("------- DANGER, LONG RUNNING COMMANDS, DON'T USE ON PRODUCTION SYSTEM --------");
         cmds.push_back("JSON.DEBUG MAX-DEPTH-KEY - Find JSON key with maximum depth");
@@ -2069,6 +2937,74 @@ int Command_JsonDebug(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc)
     return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(JSONUTIL_UNKNOWN_SUBCOMMAND));
 }
 
+/**
+ * JSON.INDEX CREATE <key> <path> <member>
+ * JSON.INDEX DROP <key> <path> <member>
+ *
+ * Create or drop a secondary index on a member of the objects in the array at path, see doc_index.h. The index
+ * memory is charged to the document by the index itself, so these commands don't track memory.
+ */
+STATIC int processIndexCreateOrDrop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc, bool create) {
+    ValkeyModule_AutoMemory(ctx);
+    if (argc != 5) return ValkeyModule_WrongArity(ctx);
+
+    ValkeyModuleKey *key;
+    JsonUtilCode rc = verify_doc_key(ctx, argv[2], &key);
+    if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+
+    JDocument *doc = get_document(key);
+    const char *path = ValkeyModule_StringPtrLen(argv[3], nullptr);
+    const char *member = ValkeyModule_StringPtrLen(argv[4], nullptr);
+    if (create) {
+        rc = dom_index_create(doc, path, member);
+        if (rc != JSONUTIL_SUCCESS) return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+        ValkeyModule_ReplicateVerbatim(ctx);
+        return ValkeyModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    bool dropped = dom_index_drop(doc, path, member);
+    if (dropped) ValkeyModule_ReplicateVerbatim(ctx);
+    return ValkeyModule_ReplyWithLongLong(ctx, dropped ? 1 : 0);
+}
+
+int Command_JsonIndexCreate(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    return processIndexCreateOrDrop(ctx, argv, argc, true);
+}
+
+int Command_JsonIndexDrop(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    return processIndexCreateOrDrop(ctx, argv, argc, false);
+}
+
+/**
+ * JSON.INDEX LIST <key>
+ *
+ * Reply with an array of [path, member, stale, distinct values] entries, one per index of the document. Stale
+ * indexes are rebuilt by the next filter query that uses them, their number of distinct values is 0 until then.
+ */
+int Command_JsonIndexList(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc) {
+    ValkeyModule_AutoMemory(ctx);
+    if (argc != 3) return ValkeyModule_WrongArity(ctx);
+
+    ValkeyModuleKey *key;
+    JsonUtilCode rc = verify_doc_key(ctx, argv[2], &key, true);
+    if (rc != JSONUTIL_SUCCESS) {
+        if (rc == JSONUTIL_DOCUMENT_KEY_NOT_FOUND) return ValkeyModule_ReplyWithNull(ctx);
+        return ValkeyModule_ReplyWithError(ctx, jsonutil_code_to_message(rc));
+    }
+
+    JDocument *doc = get_document(key);
+    jsn::vector<IndexInfo> infos;
+    dom_index_list(doc, infos);
+    ValkeyModule_ReplyWithArray(ctx, infos.size());
+    for (auto &info : infos) {
+        ValkeyModule_ReplyWithArray(ctx, 4);
+        ValkeyModule_ReplyWithStringBuffer(ctx, info.path.c_str(), info.path.length());
+        ValkeyModule_ReplyWithStringBuffer(ctx, info.member.c_str(), info.member.length());
+        ValkeyModule_ReplyWithLongLong(ctx, info.stale ? 1 : 0);
+        ValkeyModule_ReplyWithLongLong(ctx, static_cast<long long>(info.distinct_values));
+    }
+    return VALKEYMODULE_OK;
+}
+
 /* =========================== Callback Methods =========================== */
 
 /*
@@ -2119,6 +3055,7 @@ void *DocumentType_Copy(ValkeyModuleString *from_key_name, ValkeyModuleString *t
     VALKEYMODULE_NOT_USED(from_key_name);  // We don't care about the from/to key names.
     VALKEYMODULE_NOT_USED(to_key_name);
     const JDocument *source = static_cast<const JDocument*>(value);
+    // The copy shares the tree of the source until either one is written, see dom_copy
     JDocument *doc = dom_copy(source);
     // Treat this the same as JSON.SET <key> .
     size_t doc_size = dom_get_doc_size(doc);
@@ -2128,39 +3065,242 @@ void *DocumentType_Copy(ValkeyModuleString *from_key_name, ValkeyModuleString *t
 
 /*
  * Defrag callback.
- * If the JSON object size is less than or equal to the defrag threshold, the JSON object is
- * re-allocated. The re-allocation is done by copying the original object into a new one,
- * swapping them, and deleting the original one. Note that the current implementation does not
- * support defrag stop and resume, which is needed for very large JSON objects.
+ * Documents are defragged in place by dom_defrag, which moves their allocations one by one and stops when Valkey
+ * says the time slice is up. Returning 1 tells Valkey to call again later, dom_defrag then resumes where it stopped,
+ * so documents of any size can be defragged with bounded pauses.
+ * With memory traps enabled, or for documents with an arena that are smaller than the defrag threshold, the
+ * document is instead re-allocated by copying it into a new one, swapping them, and deleting the original one. The
+ * copy also compacts the arena.
+ * Documents sharing their tree with copies, see dom_copy, are left alone. They're defragged once they are private.
  */
 int DocumentType_Defrag(ValkeyModuleDefragCtx *ctx, ValkeyModuleString *key, void **value) {
-    VALKEYMODULE_NOT_USED(ctx);
     VALKEYMODULE_NOT_USED(key);
     ValkeyModule_Assert(*value != nullptr);
     JDocument *orig = static_cast<JDocument*>(*value);
+    if (dom_is_shared(orig)) return 0;
     size_t doc_size = dom_get_doc_size(orig);
-    // We do not want to defrag a key larger than the default max document size.
-    // If there is a need to do that, increase the defrag-threshold config value.
-    if (doc_size <= json_get_defrag_threshold()) {
-        JDocument *new_doc = dom_copy(orig);
-        dom_set_bucket_id(new_doc, dom_get_bucket_id(orig));
-        *value = new_doc;
-        dom_free_doc(orig);  // free the original value
-        jsonstats_increment_defrag_count();
-        jsonstats_increment_defrag_bytes(doc_size);
+    if (memory_traps_enabled() || (orig->GetArena() != nullptr && doc_size <= json_get_defrag_threshold())) {
+        // We do not want to copy a key larger than the default max document size.
+        // If there is a need to do that, increase the defrag-threshold config value.
+        if (doc_size <= json_get_defrag_threshold()) {
+            JDocument *new_doc = dom_copy(orig, false);
+            dom_set_bucket_id(new_doc, dom_get_bucket_id(orig));
+            *value = new_doc;
+            dom_free_doc(orig);  // free the original value
+            jsonstats_increment_defrag_count();
+            jsonstats_increment_defrag_bytes(doc_size);
+        }
+        return 0;
+    }
+
+    JDocument *doc = orig;
+    size_t bytes_moved;
+    bool done = dom_defrag(ctx, &doc, bytes_moved);
+    *value = doc;
+    jsonstats_increment_defrag_bytes(bytes_moved);
+    if (!done) {
+        jsonstats_increment_defrag_stopped();
+        return 1;
     }
+    jsonstats_increment_defrag_count();
     return 0;
 }
 
+/*
+ * AOF rewrite of documents bigger than json.aof-rewrite-chunk-size: a skeleton JSON.SET of the members or elements of
+ * the root that fit into the chunk size, followed by JSON.MERGE, JSON.ARRAPPEND and JSON.SET records for the rest, each
+ * of about the chunk size at most, except for scalars that are bigger on their own. Containers too big for a record
+ * go into the skeleton as empty placeholders, which are filled the same way, so that members and elements keep their
+ * order. Only one record is serialized at a time, and the documents are never loaded from a single huge record.
+ */
+STATIC void aof_rewrite_value(ValkeyModuleIO *aof, ValkeyModuleString *key, const JValue &val,
+                              const jsn::string &path, size_t size, size_t chunk_size);
+
+STATIC bool is_placeholder(const JValue &val, size_t size, size_t chunk_size) {
+    return size > chunk_size && (val.IsObject() || val.IsArray());
+}
+
+STATIC void put_placeholder(const JValue &val, rapidjson::StringBuffer &oss) {
+    oss.Put(val.IsObject() ? '{' : '[');
+    oss.Put(val.IsObject() ? '}' : ']');
+}
+
+STATIC void put_member_name(const JValue::Member &m, rapidjson::StringBuffer &oss) {
+    JValue name;
+    name.SetString(m.name.GetString(), m.name.GetStringLength());
+    dom_serialize_value(name, nullptr, oss);
+    oss.Put(':');
+}
+
+// Serialized size of a member, without its value
+STATIC size_t member_name_size(const JValue::Member &m) {
+    return m.name.GetStringLength() + 4;  // quotes, colon and comma
+}
+
+// Merging the value into nothing gives the value back, i.e., it has no nulls other than within arrays
+STATIC bool merges_unchanged(const JValue &val) {
+    if (val.IsNull()) return false;
+    if (!val.IsObject()) return true;
+    for (auto &m : val.GetObject()) {
+        if (!merges_unchanged(m.value)) return false;
+    }
+    return true;
+}
+
+STATIC void aof_rewrite_object(ValkeyModuleIO *aof, ValkeyModuleString *key, const JValue &obj,
+                               const jsn::string &path, size_t chunk_size) {
+    jsn::vector<std::pair<JValue::ConstMemberIterator, size_t>> placeholders;
+    rapidjson::StringBuffer oss;
+    size_t budget = chunk_size;
+    oss.Put('{');
+    auto m = obj.MemberBegin();
+    for (; m != obj.MemberEnd(); ++m) {
+        size_t size = dom_estimate_serialized_size(m->value, nullptr);
+        bool placeholder = is_placeholder(m->value, size, chunk_size);
+        size_t used = member_name_size(*m) + (placeholder ? 2 : size);
+        if (used > budget) break;
+        budget -= used;
+        if (m != obj.MemberBegin()) oss.Put(',');
+        put_member_name(*m, oss);
+        if (placeholder) {
+            put_placeholder(m->value, oss);
+            placeholders.emplace_back(m, size);
+        } else {
+            dom_serialize_value(m->value, nullptr, oss);
+        }
+    }
+    oss.Put('}');
+    ValkeyModule_EmitAOF(aof, "JSON.SET", "scb", key, path.c_str(), oss.GetString(), oss.GetLength());
+
+    for (auto &p : placeholders) {
+        jsn::string member_path = path;
+        Selector::appendMemberStep(member_path, p.first->name.GetStringView());
+        aof_rewrite_value(aof, key, p.first->value, member_path, p.second, chunk_size);
+    }
+
+    // The rest of the members are added in order, merged in batches where the merge doesn't change them
+    oss.Clear();
+    budget = chunk_size;
+    auto flush = [&]() {
+        if (oss.GetLength() == 0) return;
+        oss.Put('}');
+        ValkeyModule_EmitAOF(aof, "JSON.MERGE", "scb", key, path.c_str(), oss.GetString(), oss.GetLength());
+        oss.Clear();
+        budget = chunk_size;
+    };
+    for (; m != obj.MemberEnd(); ++m) {
+        size_t size = dom_estimate_serialized_size(m->value, nullptr);
+        size_t used = member_name_size(*m) + size;
+        if (used > chunk_size || !merges_unchanged(m->value)) {
+            flush();
+            jsn::string member_path = path;
+            Selector::appendMemberStep(member_path, m->name.GetStringView());
+            aof_rewrite_value(aof, key, m->value, member_path, size, chunk_size);
+            continue;
+        }
+        if (used > budget) flush();
+        budget -= used;
+        oss.Put(oss.GetLength() == 0 ? '{' : ',');
+        put_member_name(*m, oss);
+        dom_serialize_value(m->value, nullptr, oss);
+    }
+    flush();
+}
+
+STATIC void aof_rewrite_array(ValkeyModuleIO *aof, ValkeyModuleString *key, const JValue &arr,
+                              const jsn::string &path, size_t chunk_size) {
+    jsn::vector<std::pair<size_t, size_t>> placeholders;
+    rapidjson::StringBuffer oss;
+    size_t budget = chunk_size;
+    oss.Put('[');
+    size_t i = 0;
+    for (; i < arr.Size(); i++) {
+        size_t size = dom_estimate_serialized_size(arr[i], nullptr);
+        bool placeholder = is_placeholder(arr[i], size, chunk_size);
+        size_t used = 1 + (placeholder ? 2 : size);
+        if (used > budget) break;
+        budget -= used;
+        if (i > 0) oss.Put(',');
+        if (placeholder) {
+            put_placeholder(arr[i], oss);
+            placeholders.emplace_back(i, size);
+        } else {
+            dom_serialize_value(arr[i], nullptr, oss);
+        }
+    }
+    oss.Put(']');
+    ValkeyModule_EmitAOF(aof, "JSON.SET", "scb", key, path.c_str(), oss.GetString(), oss.GetLength());
+
+    auto fill_placeholders = [&]() {
+        for (auto &p : placeholders) {
+            jsn::string element_path = path;
+            Selector::appendIndexStep(element_path, p.first);
+            aof_rewrite_value(aof, key, arr[p.first], element_path, p.second, chunk_size);
+        }
+        placeholders.clear();
+    };
+    fill_placeholders();
+
+    // The rest of the elements are appended in batches
+    std::vector<ValkeyModuleString *> batch;
+    budget = chunk_size;
+    auto flush = [&]() {
+        if (batch.empty()) return;
+        ValkeyModule_EmitAOF(aof, "JSON.ARRAPPEND", "scv", key, path.c_str(), batch.data(), batch.size());
+        for (ValkeyModuleString *s : batch) ValkeyModule_FreeString(nullptr, s);
+        batch.clear();
+        budget = chunk_size;
+        fill_placeholders();
+    };
+    for (; i < arr.Size(); i++) {
+        size_t size = dom_estimate_serialized_size(arr[i], nullptr);
+        bool placeholder = is_placeholder(arr[i], size, chunk_size);
+        size_t used = 1 + (placeholder ? 2 : size);
+        if (used > budget) flush();
+        budget = used > budget ? 0 : budget - used;
+        oss.Clear();
+        if (placeholder) {
+            put_placeholder(arr[i], oss);
+            placeholders.emplace_back(i, size);
+        } else {
+            dom_serialize_value(arr[i], nullptr, oss);
+        }
+        batch.push_back(ValkeyModule_CreateString(nullptr, oss.GetString(), oss.GetLength()));
+    }
+    flush();
+}
+
+STATIC void aof_rewrite_value(ValkeyModuleIO *aof, ValkeyModuleString *key, const JValue &val,
+                              const jsn::string &path, size_t size, size_t chunk_size) {
+    if (size <= chunk_size || !(val.IsObject() || val.IsArray())) {
+        rapidjson::StringBuffer oss;
+        dom_serialize_value(val, nullptr, oss);
+        ValkeyModule_EmitAOF(aof, "JSON.SET", "scb", key, path.c_str(), oss.GetString(), oss.GetLength());
+    } else if (val.IsObject()) {
+        aof_rewrite_object(aof, key, val, path, chunk_size);
+    } else {
+        aof_rewrite_array(aof, key, val, path, chunk_size);
+    }
+}
+
 void DocumentType_AofRewrite(ValkeyModuleIO *aof, ValkeyModuleString *key, void *value) {
     JDocument *doc = static_cast<JDocument*>(value);
+    // The rewrite runs in a child process, inflating there doesn't cost the server anything
+    dom_inflate_doc(doc);
+    size_t chunk_size = json_get_aof_rewrite_chunk_size();
+    if (chunk_size > 0) {
+        size_t size = dom_estimate_serialized_size(*doc, nullptr);
+        if (size > chunk_size) {
+            aof_rewrite_value(aof, key, *doc, "$", size, chunk_size);
+            return;
+        }
+    }
     rapidjson::StringBuffer oss;
     dom_serialize(doc, nullptr, oss);
     ValkeyModule_EmitAOF(aof, "JSON.SET", "scc", key, ".", oss.GetString());
 }
 
-void DocumentType_Free(void *value) {
-    JDocument *doc = static_cast<JDocument*>(value);
+STATIC void free_doc(JDocument *doc) {
     size_t orig_doc_size = dom_get_doc_size(doc);
 
     // update stats
@@ -2169,6 +3309,36 @@ void DocumentType_Free(void *value) {
     dom_free_doc(doc);
 }
 
+/*
+ * FLUSHDB ASYNC and FLUSHALL ASYNC free documents on the lazyfree thread. Freeing a document of a ring of sharers,
+ * see dom_copy, changes the other documents of the ring, which may be in another database and in use by the main
+ * thread. So documents that have shared their tree are handed over to the main thread to be freed.
+ */
+static std::thread::id main_thread_id;
+static std::mutex deferred_free_mutex;
+static std::vector<JDocument *> deferred_frees;
+
+STATIC void free_deferred_docs(void *user_data) {
+    VALKEYMODULE_NOT_USED(user_data);
+    std::vector<JDocument *> docs;
+    {
+        std::lock_guard<std::mutex> lock(deferred_free_mutex);
+        docs.swap(deferred_frees);
+    }
+    for (JDocument *doc : docs) free_doc(doc);
+}
+
+void DocumentType_Free(void *value) {
+    JDocument *doc = static_cast<JDocument*>(value);
+    if (dom_was_shared(doc) && std::this_thread::get_id() != main_thread_id) {
+        std::lock_guard<std::mutex> lock(deferred_free_mutex);
+        deferred_frees.push_back(doc);
+        if (deferred_frees.size() == 1) ValkeyModule_EventLoopAddOneShot(free_deferred_docs, nullptr);
+        return;
+    }
+    free_doc(doc);
+}
+
 size_t DocumentType_MemUsage(const void *value) {
     const JDocument *doc = static_cast<const JDocument*>(value);
     return dom_get_doc_size(doc);
@@ -2195,13 +3365,77 @@ void Module_Info(ValkeyModuleInfoCtx *ctx, int for_crash_report) {
     } \
 }
 
+#define addString(name, value) { \
+    if (ValkeyModule_InfoAddFieldCString(ctx, const_cast<char *>(name), const_cast<char *>(value)) \
+        == VALKEYMODULE_ERR) { \
+        ValkeyModule_Log(nullptr, "warning", "Can't add info variable %s", name); \
+    } \
+}
+
 
     //
     // User visible metrics
     //
     beginSection("core_metrics")
-        addULongLong("total_memory_bytes", jsonstats_get_used_mem() + keyTable->getStats().bytes);
+        KeyTable::Stats key_table_stats = keyTable->getStats();
+        addULongLong("total_memory_bytes", jsonstats_get_used_mem() + key_table_stats.bytes);
         addULongLong("num_documents", jsonstats_get_num_doc_keys());
+        PathCache::Stats path_cache_stats = pathCache->getStats();
+        addULongLong("path_cache_hits", path_cache_stats.hits);
+        addULongLong("path_cache_misses", path_cache_stats.misses);
+        addULongLong("defrag_count", jsonstats_get_defrag_count());
+        addULongLong("defrag_bytes", jsonstats_get_defrag_bytes());
+        addULongLong("defrag_stopped", jsonstats_get_defrag_stopped());
+        addULongLong("key_table_rehash_in_progress", key_table_stats.rehashInProgress);
+        addULongLong("key_table_max_rehash_pause_nanos", key_table_stats.maxRehashNanos);
+        addULongLong("key_table_inline_handles", key_table_stats.inlineHandles);
+        addULongLong("path_v1_count", jsonstats_get_v1_paths());
+        addULongLong("path_v2_count", jsonstats_get_v2_paths());
+        addULongLong("path_recursive_count", jsonstats_get_recursive_paths());
+        addULongLong("path_filter_count", jsonstats_get_filter_paths());
+        addULongLong("root_cache_hits", jsonstats_get_root_cache_hits());
+        addULongLong("root_cache_misses", jsonstats_get_root_cache_misses());
+        addULongLong("packed_arrays_parsed", logical_stats.packed_arrays_parsed);
+        addULongLong("compressed_documents", jsonstats_get_compressed_docs());
+        unsigned long long compressed_bytes = jsonstats_get_compressed_bytes();
+        addULongLong("compressed_bytes", compressed_bytes);
+        addDouble("compression_ratio", compressed_bytes == 0 ? 0.0 :
+                  static_cast<double>(jsonstats_get_compressed_tree_bytes()) / compressed_bytes);
+        unsigned long long inflate_count = jsonstats_get_inflate_count();
+        addULongLong("inflate_count", inflate_count);
+        addDouble("inflate_avg_usec", inflate_count == 0 ? 0.0 :
+                  static_cast<double>(jsonstats_get_inflate_usec()) / inflate_count);
+        addULongLong("inflate_max_usec", jsonstats_get_inflate_max_usec());
+    endSection();
+
+    //
+    // Latency histograms of the commands that have been called, in total and per phase
+    //
+    beginSection("latency")
+        char buf[512];
+        char name[128];
+        jsonstats_sprint_latency_buckets(buf, sizeof(buf));
+        addString("buckets_usec", buf);
+        for (int c = 0; c < JSONSTATS_NUM_COMMANDS; c++) {
+            JsonStatsCommand cmd = static_cast<JsonStatsCommand>(c);
+            unsigned long long calls = jsonstats_get_command_calls(cmd);
+            if (calls == 0) continue;
+            const char *cmd_name = jsonstats_command_name(cmd);
+            snprintf(name, sizeof(name), "%s_calls", cmd_name);
+            addULongLong(name, calls);
+            jsonstats_sprint_latency_hist(cmd, JSONSTATS_NUM_PHASES, buf, sizeof(buf));
+            snprintf(name, sizeof(name), "%s_usec_hist", cmd_name);
+            addString(name, buf);
+            for (int p = 0; p < JSONSTATS_NUM_PHASES; p++) {
+                JsonStatsPhase phase = static_cast<JsonStatsPhase>(p);
+                const char *phase_name = jsonstats_phase_name(phase);
+                snprintf(name, sizeof(name), "%s_%s_usec", cmd_name, phase_name);
+                addULongLong(name, jsonstats_get_phase_usec(cmd, phase));
+                jsonstats_sprint_latency_hist(cmd, phase, buf, sizeof(buf));
+                snprintf(name, sizeof(name), "%s_%s_usec_hist", cmd_name, phase_name);
+                addString(name, buf);
+            }
+        }
     endSection();
 }
 
@@ -2263,14 +3497,28 @@ KeyTable::Factors destroyKeyTable() {
     return factors;
 }
 
+//
+// KeyTable memory, attributed to its own category by the allocation profile
+//
+STATIC void *keytable_alloc(size_t size) {
+    MemoryCategoryScope scope(MEMORY_CATEGORY_KEYTABLE);
+    return memory_alloc(size);
+}
+
+STATIC void keytable_free(void *ptr) {
+    MemoryCategoryScope scope(MEMORY_CATEGORY_KEYTABLE);
+    memory_free(ptr);
+}
+
 void initKeyTable(unsigned numShards, KeyTable::Factors factors) {
     ValkeyModule_Assert(keyTable == nullptr);
     ValkeyModule_Log(nullptr, "debug", "Setting shards to %d", numShards);
     KeyTable::Config config;
-    config.malloc = memory_alloc;
-    config.free = memory_free;
+    config.malloc = keytable_alloc;
+    config.free = keytable_free;
     config.hash = hash_function;
     config.numShards = numShards;
+    config.inlineShortKeys = true;
     keyTable = new(memory_alloc(sizeof(KeyTable))) KeyTable(config);
     keyTable->setFactors(factors);
 }
@@ -2281,7 +3529,7 @@ void initKeyTable(unsigned numShards, KeyTable::Factors factors) {
 int handleSetNumShards(const void *v) {
     int value = *reinterpret_cast<const int *>(v);
     auto s = keyTable->getStats();
-    if (s.handles != 0) {
+    if (s.handles != 0 || s.inlineHandles != 0) {
         ValkeyModule_Log(nullptr, "warning", "Can't change numShards after initialization");
         return VALKEYMODULE_ERR;
     }
@@ -2315,6 +3563,9 @@ int configHashtable() {
     if (handleHashTableFactor(&rapidjson::HashTableFactors::minLoad, &val, 100.f) == VALKEYMODULE_ERR) return VALKEYMODULE_ERR;
     val = 85;
     if (handleHashTableFactor(&rapidjson::HashTableFactors::maxLoad, &val, 100.f) == VALKEYMODULE_ERR) return VALKEYMODULE_ERR;
+    val = DEFAULT_HASH_TABLE_MIN_GROUPED_SIZE;
+    if (handleHashTableFactor(&rapidjson::HashTableFactors::minGroupedHTSize, &val, size_t(1)) == VALKEYMODULE_ERR)
+        return VALKEYMODULE_ERR;
     val = DEFAULT_HASH_TABLE_MIN_SIZE;
     return handleHashTableFactor(&rapidjson::HashTableFactors::minHTSize, &val, size_t(1));
 }
@@ -2331,6 +3582,24 @@ int Config_SetSizeConfig(const char *name, long long val, void *privdata, Valkey
     return VALKEYMODULE_OK;
 }
 
+int Config_GetBoolConfig(const char *name, void *privdata) {
+    VALKEYMODULE_NOT_USED(name);
+    return *static_cast<int*>(privdata);
+}
+
+int Config_SetBoolConfig(const char *name, int val, void *privdata, ValkeyModuleString **err) {
+    VALKEYMODULE_NOT_USED(name);
+    VALKEYMODULE_NOT_USED(err);
+    *static_cast<int*>(privdata) = val;
+    return VALKEYMODULE_OK;
+}
+
+int Config_SetPathCacheSize(const char *name, long long val, void *privdata, ValkeyModuleString **err) {
+    Config_SetSizeConfig(name, val, privdata, err);
+    pathCache->setCapacity(val);
+    return VALKEYMODULE_OK;
+}
+
 int registerModuleConfigs(ValkeyModuleCtx *ctx) {
     REGISTER_NUMERIC_CONFIG(ctx, "max-document-size", DEFAULT_MAX_DOCUMENT_SIZE, VALKEYMODULE_CONFIG_MEMORY,
                             0, LLONG_MAX, &config_max_document_size, Config_GetSizeConfig, Config_SetSizeConfig)
@@ -2338,6 +3607,37 @@ int registerModuleConfigs(ValkeyModuleCtx *ctx) {
     REGISTER_NUMERIC_CONFIG(ctx, "max-path-limit", DEFAULT_MAX_PATH_LIMIT, VALKEYMODULE_CONFIG_DEFAULT,
                             0, INT_MAX, &config_max_path_limit, Config_GetSizeConfig, Config_SetSizeConfig)
 
+    REGISTER_BOOL_CONFIG(ctx, "rdb-key-dictionary", DEFAULT_RDB_KEY_DICTIONARY, &config_rdb_key_dictionary,
+                         Config_GetBoolConfig, Config_SetBoolConfig)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "path-cache-size", DEFAULT_PATH_CACHE_SIZE, VALKEYMODULE_CONFIG_DEFAULT,
+                            0, INT_MAX, &config_path_cache_size, Config_GetSizeConfig, Config_SetPathCacheSize)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "root-cache-min-size", DEFAULT_ROOT_CACHE_MIN_SIZE, VALKEYMODULE_CONFIG_MEMORY,
+                            0, LLONG_MAX, &config_root_cache_min_size, Config_GetSizeConfig, Config_SetSizeConfig)
+
+    REGISTER_BOOL_CONFIG(ctx, "doc-arena", DEFAULT_DOC_ARENA, &config_doc_arena,
+                         Config_GetBoolConfig, Config_SetBoolConfig)
+
+    REGISTER_BOOL_CONFIG(ctx, "replicate-effects", DEFAULT_REPLICATE_EFFECTS, &config_replicate_effects,
+                         Config_GetBoolConfig, Config_SetBoolConfig)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "aof-rewrite-chunk-size", DEFAULT_AOF_REWRITE_CHUNK_SIZE,
+                            VALKEYMODULE_CONFIG_MEMORY, 0, LLONG_MAX, &config_aof_rewrite_chunk_size,
+                            Config_GetSizeConfig, Config_SetSizeConfig)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "async-parse-min-size", DEFAULT_ASYNC_PARSE_MIN_SIZE, VALKEYMODULE_CONFIG_MEMORY,
+                            0, LLONG_MAX, &config_async_parse_min_size, Config_GetSizeConfig, Config_SetSizeConfig)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "compress-min-size", DEFAULT_COMPRESS_MIN_SIZE, VALKEYMODULE_CONFIG_MEMORY,
+                            0, LLONG_MAX, &config_compress_min_size, Config_GetSizeConfig, Config_SetSizeConfig)
+
+    REGISTER_NUMERIC_CONFIG(ctx, "compress-idle-seconds", DEFAULT_COMPRESS_IDLE_SECONDS, VALKEYMODULE_CONFIG_DEFAULT,
+                            0, INT_MAX, &config_compress_idle_seconds, Config_GetSizeConfig, Config_SetSizeConfig)
+
+    REGISTER_BOOL_CONFIG(ctx, "shortest-doubles", DEFAULT_SHORTEST_DOUBLES, &config_shortest_doubles,
+                         Config_GetBoolConfig, Config_SetBoolConfig)
+
     ValkeyModule_LoadConfigs(ctx);
     return VALKEYMODULE_OK;
 }
@@ -2425,6 +3725,8 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
         return VALKEYMODULE_ERR;
     }
 
+    main_thread_id = std::this_thread::get_id();
+
     // Register module type callbacks
     ValkeyModuleTypeMethods type_methods;
     memset(&type_methods, 0, sizeof(ValkeyModuleTypeMethods));
@@ -2509,6 +3811,26 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
         return VALKEYMODULE_ERR;
     }
 
+    if (ValkeyModule_CreateCommand(ctx, "JSON.MSET", Command_JsonMSet, cmdflg_slow_write_deny, 1, -1, 3)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create command JSON.MSET.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_SetCommandACLCategories(ValkeyModule_GetCommand(ctx,"JSON.MSET"), cat_slow_write_deny) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to set command category for JSON.MSET.");
+        return VALKEYMODULE_ERR;
+    }
+
+    if (ValkeyModule_CreateCommand(ctx, "JSON.MERGE", Command_JsonMerge, cmdflg_slow_write_deny, 1, 1, 1)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create command JSON.MERGE.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_SetCommandACLCategories(ValkeyModule_GetCommand(ctx,"JSON.MERGE"), cat_slow_write_deny) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to set command category for JSON.MERGE.");
+        return VALKEYMODULE_ERR;
+    }
+
     if (ValkeyModule_CreateCommand(ctx, "JSON.DEL", Command_JsonDel, cmdflg_fast_write, 1, 1, 1) == VALKEYMODULE_ERR) {
         ValkeyModule_Log(ctx, "warning", "Failed to create command JSON.DEL.");
         return VALKEYMODULE_ERR;
@@ -2718,6 +4040,22 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
         ValkeyModule_Log(ctx, "warning", "Failed to create subcommand MAX-SIZE-KEY for command JSON.DEBUG.");
         return VALKEYMODULE_ERR;
     }
+    if (ValkeyModule_CreateSubcommand(parent, "KEYTABLE", Command_JsonDebug, "", 0, 0, 0) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand KEYTABLE for command JSON.DEBUG.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_CreateSubcommand(parent, "COMPRESS", Command_JsonDebug, "", 2, 2, 1) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand COMPRESS for command JSON.DEBUG.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_CreateSubcommand(parent, "RESET-STATS", Command_JsonDebug, "", 0, 0, 0) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand RESET-STATS for command JSON.DEBUG.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_CreateSubcommand(parent, "MEMORY-PROFILE", Command_JsonDebug, "", 0, 0, 0) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand MEMORY-PROFILE for command JSON.DEBUG.");
+        return VALKEYMODULE_ERR;
+    }
     if (ValkeyModule_CreateSubcommand(parent, "KEYTABLE-CHECK", Command_JsonDebug, "", 0, 0, 0) == VALKEYMODULE_ERR) {
         ValkeyModule_Log(ctx, "warning", "Failed to create subcommand KEYTABLE-CHECK for command JSON.DEBUG.");
         return VALKEYMODULE_ERR;
@@ -2732,6 +4070,44 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
         return VALKEYMODULE_ERR;
     }
 
+    if (ValkeyModule_CreateCommand(ctx, "JSON.INDEX", NULL, "", 0, 0, 0) == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create command JSON.INDEX.");
+        return VALKEYMODULE_ERR;
+    }
+
+    // Register JSON.INDEX subcommands
+    parent = ValkeyModule_GetCommand(ctx, "JSON.INDEX");
+    if (ValkeyModule_CreateSubcommand(parent, "CREATE", Command_JsonIndexCreate, cmdflg_slow_write_deny, 2, 2, 1)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand CREATE for command JSON.INDEX.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_SetCommandACLCategories(ValkeyModule_GetCommand(ctx, "JSON.INDEX|CREATE"), cat_slow_write_deny)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to set command category for JSON.INDEX|CREATE.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_CreateSubcommand(parent, "DROP", Command_JsonIndexDrop, cmdflg_fast_write, 2, 2, 1)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand DROP for command JSON.INDEX.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_SetCommandACLCategories(ValkeyModule_GetCommand(ctx, "JSON.INDEX|DROP"), cat_fast_write)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to set command category for JSON.INDEX|DROP.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_CreateSubcommand(parent, "LIST", Command_JsonIndexList, cmdflg_readonly, 2, 2, 1)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to create subcommand LIST for command JSON.INDEX.");
+        return VALKEYMODULE_ERR;
+    }
+    if (ValkeyModule_SetCommandACLCategories(ValkeyModule_GetCommand(ctx, "JSON.INDEX|LIST"), cat_readonly)
+        == VALKEYMODULE_ERR) {
+        ValkeyModule_Log(ctx, "warning", "Failed to set command category for JSON.INDEX|LIST.");
+        return VALKEYMODULE_ERR;
+    }
+
     // key-spec flags categories
     const uint64_t ks_read_write_update = VALKEYMODULE_CMD_KEY_RW | VALKEYMODULE_CMD_KEY_UPDATE;
     const uint64_t ks_read_write_insert = VALKEYMODULE_CMD_KEY_RW | VALKEYMODULE_CMD_KEY_INSERT;
@@ -2747,6 +4123,12 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
     if (!set_command_info(ctx, "JSON.SET", -4, ks_read_write_update, 1, std::make_tuple(0, 1, 0))) {
         return VALKEYMODULE_ERR;
     }
+    if (!set_command_info(ctx, "JSON.MSET", -4, ks_read_write_update, 1, std::make_tuple(-1, 3, 0))) {
+        return VALKEYMODULE_ERR;
+    }
+    if (!set_command_info(ctx, "JSON.MERGE", 4, ks_read_write_update, 1, std::make_tuple(0, 1, 0))) {
+        return VALKEYMODULE_ERR;
+    }
     // Commands under RW + Insert
     if (!set_command_info(ctx, "JSON.ARRAPPEND", -4, ks_read_write_insert, 1, std::make_tuple(0, 1, 0))) {
         return VALKEYMODULE_ERR;
@@ -2827,14 +4209,32 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
     if (!set_command_info(ctx, "JSON.DEBUG|DEPTH", 3, ks_read_only_access, 2, std::make_tuple(0, 1, 0))) {
         return VALKEYMODULE_ERR;
     }
+    if (!set_command_info(ctx, "JSON.DEBUG|COMPRESS", 3, ks_read_only_access, 2, std::make_tuple(0, 1, 0))) {
+        return VALKEYMODULE_ERR;
+    }
     if (!set_command_info(ctx, "JSON.DEBUG|HELP", 2)) return VALKEYMODULE_ERR;
     // admin commands
     if (!set_command_info(ctx, "JSON.DEBUG|MAX-DEPTH-KEY", 2)) return VALKEYMODULE_ERR;
     if (!set_command_info(ctx, "JSON.DEBUG|MAX-SIZE-KEY", 2)) return VALKEYMODULE_ERR;
+    if (!set_command_info(ctx, "JSON.DEBUG|KEYTABLE", 2)) return VALKEYMODULE_ERR;
+    if (!set_command_info(ctx, "JSON.DEBUG|RESET-STATS", 2)) return VALKEYMODULE_ERR;
+    if (!set_command_info(ctx, "JSON.DEBUG|MEMORY-PROFILE", -2)) return VALKEYMODULE_ERR;
     if (!set_command_info(ctx, "JSON.DEBUG|KEYTABLE-CHECK", 2)) return VALKEYMODULE_ERR;
     if (!set_command_info(ctx, "JSON.DEBUG|KEYTABLE-CORRUPT", 3)) return VALKEYMODULE_ERR;
     if (!set_command_info(ctx, "JSON.DEBUG|KEYTABLE-DISTRIBUTION", 3)) return VALKEYMODULE_ERR;
 
+    // JSON.INDEX and its sub-commands
+    if (!set_command_info(ctx, "JSON.INDEX", -2)) return VALKEYMODULE_ERR;
+    if (!set_command_info(ctx, "JSON.INDEX|CREATE", 5, ks_read_write_update, 2, std::make_tuple(0, 1, 0))) {
+        return VALKEYMODULE_ERR;
+    }
+    if (!set_command_info(ctx, "JSON.INDEX|DROP", 5, ks_read_write_update, 2, std::make_tuple(0, 1, 0))) {
+        return VALKEYMODULE_ERR;
+    }
+    if (!set_command_info(ctx, "JSON.INDEX|LIST", 3, ks_read_only, 2, std::make_tuple(0, 1, 0))) {
+        return VALKEYMODULE_ERR;
+    }
+
     if (!memory_traps_control(false)) {
         ValkeyModule_Log(ctx, "warning", "Failed to setup memory trap control");
         return VALKEYMODULE_ERR;
@@ -2847,8 +4247,16 @@ extern "C" int ValkeyModule_OnLoad(ValkeyModuleCtx *ctx) {
     if (configKeyTable() == VALKEYMODULE_ERR) return VALKEYMODULE_ERR;
     if (configHashtable() == VALKEYMODULE_ERR) return VALKEYMODULE_ERR;
 
+    //
+    // Setup the compiled path cache, before the configs so that it can be resized by them
+    //
+    pathCache = new(memory_alloc(sizeof(PathCache))) PathCache(json_get_path_cache_size());
+
     // Register module configs
     if (registerModuleConfigs(ctx) == VALKEYMODULE_ERR) return VALKEYMODULE_ERR;
 
+    // The scan for cold documents runs from now on, it does nothing while json.compress-min-size is 0
+    ValkeyModule_CreateTimer(ctx, COMPRESS_SCAN_INTERVAL_MS, compress_scan_timer, nullptr);
+
     return VALKEYMODULE_OK;
 }
@@ -9,6 +9,17 @@ size_t json_get_max_path_limit();
 size_t json_get_max_parser_recursion_depth();
 size_t json_get_max_recursive_descent_tokens();
 size_t json_get_max_query_string_size();
+bool json_is_rdb_key_dictionary_enabled();
+size_t json_get_path_cache_size();
+size_t json_get_root_cache_min_size();
+bool json_is_doc_arena_enabled();
+bool json_is_replicate_effects_enabled();
+size_t json_get_aof_rewrite_chunk_size();
+size_t json_get_async_parse_min_size();
+size_t json_get_compress_min_size();
+size_t json_get_compress_idle_seconds();
+bool json_is_shortest_doubles_enabled();
+void json_set_shortest_doubles_enabled(bool enabled);  // as CONFIG SET json.shortest-doubles does
 
 bool json_is_instrument_enabled_insert();
 bool json_is_instrument_enabled_update();
@@ -3,9 +3,11 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include "json/json_api.h"
 #include "json/dom.h"
 #include "json/memory.h"
+#include "json/selector.h"
 
 extern ValkeyModuleType* DocumentType;
 
@@ -31,6 +33,7 @@ static JDocument* get_json_document(ValkeyModuleCtx *ctx, const char *keyname, c
         return nullptr;
     }
     JDocument *doc = static_cast<JDocument*>(ValkeyModule_ModuleTypeGetValue(key));
+    dom_inflate_doc(doc);  // A read of a cold document warms it up, as a command would
     ValkeyModule_CloseKey(key);
     ValkeyModule_FreeString(ctx, keystr);
     return doc;
@@ -118,3 +121,104 @@ int get_json_values_and_types(ValkeyModuleCtx *ctx, const char *keyname, const s
     }
     return 0;
 }
+
+/**
+ * A path set is a PathTrie over its paths, plus the paths that aren't in the trie, each evaluated by a Selector
+ * of its own.
+ */
+struct JsonPathSet {
+    JsonPathSet(const char **paths, const int num_paths) : trie(paths, num_paths), others() {
+        for (int i : trie.getOthers()) others.emplace_back(i, jsn::string(paths[i]));
+    }
+
+    PathTrie trie;
+    jsn::vector<std::pair<int, jsn::string>> others;
+
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+};
+
+JsonPathSet *json_path_set_create(const char **paths, const int num_paths) {
+    return new JsonPathSet(paths, num_paths);
+}
+
+void json_path_set_free(JsonPathSet *set) {
+    delete set;
+}
+
+static void make_view(const JValue &v, JsonValueView &view) {
+    view.boolean = 0;
+    view.number = 0;
+    view.str = nullptr;
+    view.len = 0;
+    view.value = &v;
+    if (v.IsNull()) {
+        view.type = JSON_VALUE_NULL;
+    } else if (v.IsBool()) {
+        view.type = JSON_VALUE_BOOLEAN;
+        view.boolean = v.IsTrue() ? 1 : 0;
+    } else if (v.IsNumber()) {
+        view.type = JSON_VALUE_NUMBER;
+        view.number = v.GetDouble();
+    } else if (v.IsString()) {
+        view.type = JSON_VALUE_STRING;
+        view.str = v.GetString();
+        view.len = v.GetStringLength();
+    } else if (v.IsArray()) {
+        view.type = JSON_VALUE_ARRAY;
+        view.len = v.Size();
+    } else {
+        view.type = JSON_VALUE_OBJECT;
+        view.len = v.MemberCount();
+    }
+}
+
+struct PathSetWalk {
+    JsonValueCallback callback;
+    void *arg;
+};
+
+static void path_set_select(void *arg, int path, JValue &v) {
+    const PathSetWalk *walk = static_cast<const PathSetWalk *>(arg);
+    JsonValueView view;
+    make_view(v, view);
+    walk->callback(walk->arg, path, &view);
+}
+
+/**
+ * Evaluate a path set against a document, see get_json_values_batch.
+ */
+void json_path_set_evaluate(const JsonPathSet *set, JDocument *doc, JsonValueCallback callback, void *arg) {
+    PathSetWalk walk{callback, arg};
+    set->trie.select(doc->GetJValue(), path_set_select, &walk);
+
+    for (const auto &other : set->others) {
+        Selector selector;
+        jsn::vector<JValue*> values;
+        if (dom_select_values(doc, other.second.c_str(), selector, values) != JSONUTIL_SUCCESS) continue;
+        for (JValue *v : values) path_set_select(&walk, other.first, *v);
+    }
+}
+
+int get_json_values_batch(ValkeyModuleCtx *ctx, const char *keyname, const size_t key_len, const JsonPathSet *set,
+                          JsonValueCallback callback, void *arg) {
+    ValkeyModule_Assert(set != nullptr);
+    ValkeyModule_Assert(callback != nullptr);
+    JDocument *doc = get_json_document(ctx, keyname, key_len);
+    if (doc == nullptr) return -1;
+    json_path_set_evaluate(set, doc, callback, arg);
+    return 0;
+}
+
+void json_array_iterator_init(JsonArrayIterator *it, const JsonValueView *array) {
+    ValkeyModule_Assert(array->type == JSON_VALUE_ARRAY);
+    it->array = array->value;
+    it->next = 0;
+}
+
+int json_array_iterator_next(JsonArrayIterator *it, JsonValueView *element) {
+    const JValue &array = *static_cast<const JValue *>(it->array);
+    if (it->next >= array.Size()) return 0;
+    make_view(array[it->next++], *element);
+    return 1;
+}
@@ -63,6 +63,82 @@ int get_json_value(ValkeyModuleCtx *ctx, const char *keyname, const size_t key_l
 int get_json_values_and_types(ValkeyModuleCtx *ctx, const char *keyname, const size_t key_len, const char **paths,
                     const int num_paths, char ***values, size_t **lengths, char ***types, size_t **type_lengths);
 
+/**
+ * A set of paths compiled once with json_path_set_create, then evaluated against any number of keys with
+ * get_json_values_batch. The paths are walked together in a single traversal of the document, and the selected
+ * values are handed to a callback as views into the document, so that nothing is serialized or copied.
+ */
+typedef struct JsonPathSet JsonPathSet;
+
+typedef enum JsonValueType {
+    JSON_VALUE_NULL,
+    JSON_VALUE_BOOLEAN,
+    JSON_VALUE_NUMBER,
+    JSON_VALUE_STRING,
+    JSON_VALUE_ARRAY,
+    JSON_VALUE_OBJECT
+} JsonValueType;
+
+/**
+ * A view of a JSON value. It points into the document, and is only valid until the callback it is passed to returns.
+ */
+typedef struct JsonValueView {
+    JsonValueType type;
+    int boolean;            // JSON_VALUE_BOOLEAN: 0 or 1
+    double number;          // JSON_VALUE_NUMBER
+    const char *str;        // JSON_VALUE_STRING: the string in the document, not NUL terminated
+    size_t len;             // JSON_VALUE_STRING: length of the string. JSON_VALUE_ARRAY, JSON_VALUE_OBJECT: size
+    const void *value;      // the value itself, see json_array_iterator_init
+} JsonValueView;
+
+/**
+ * Iterator over the elements of an array view.
+ */
+typedef struct JsonArrayIterator {
+    const void *array;
+    size_t next;
+} JsonArrayIterator;
+
+/**
+ * Called for each value selected by a path of the set.
+ *
+ * @arg         The argument given to get_json_values_batch.
+ * @path_index  Index of the path in the array given to json_path_set_create.
+ * @value       The selected value.
+ */
+typedef void (*JsonValueCallback)(void *arg, int path_index, const JsonValueView *value);
+
+/**
+ * Compile a set of paths. The paths are copied, so the caller keeps ownership of them.
+ *
+ * @return the path set, to be freed with json_path_set_free.
+ */
+JsonPathSet *json_path_set_create(const char **paths, const int num_paths);
+
+void json_path_set_free(JsonPathSet *set);
+
+/**
+ * Get the values at all the paths of a path set. Like get_json_value, a legacy path selects at most one value, the
+ * first match. A v2 path selects all the matching values, and the callback is invoked once per value, in document
+ * order. Paths that are invalid or don't match anything don't invoke the callback.
+ *
+ * @return 0 - success, -1 - not a JSON key
+ */
+int get_json_values_batch(ValkeyModuleCtx *ctx, const char *keyname, const size_t key_len, const JsonPathSet *set,
+                          JsonValueCallback callback, void *arg);
+
+/**
+ * Start iterating over the elements of a JSON_VALUE_ARRAY view. The iterator is valid as long as the view is.
+ */
+void json_array_iterator_init(JsonArrayIterator *it, const JsonValueView *array);
+
+/**
+ * Get the next element of the array.
+ *
+ * @return 1 - the element was stored in *element, 0 - no more elements
+ */
+int json_array_iterator_next(JsonArrayIterator *it, JsonValueView *element);
+
 #ifdef __cplusplus
 }
 #endif
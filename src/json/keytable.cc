@@ -3,6 +3,7 @@
 #include <memory>
 #include <sstream>
 #include <mutex>
+#include <chrono>
 #include <unordered_map>
 #include <cstring>
 #include <iostream>
@@ -26,7 +27,7 @@ extern "C" {
  * hash computations are done.
  *
  * The rehash algorithm needs the hash value for each key in order to insert it into the hash table.
- *  For simplicity, rehashing is done synchronously.
+ * Rehashing is incremental, see below, so that no single operation pays for moving a whole shard.
  *
  * If the new table size is less than 2^19, we store the low order 19 bits of the original hash value in
  * the hash-table entry itself (since it's a pointer) and just use that. Thus the only memory associated
@@ -47,18 +48,187 @@ extern "C" {
 // non-constant so unit tests can control it
 size_t MAX_FAST_TABLE_SIZE = PtrWithMetaData<KeyTable_Layout>::METADATA_MASK + 1;
 
+// non-constant so unit tests can compare with the locked path
+bool KEY_TABLE_LOCK_FREE = true;
+
+// Slots of the old table moved per locked operation during a rehash, non-constant so unit tests can control it
+size_t KEY_TABLE_REHASH_STEP = 1024;
+
+/***************************************************************************************************
+ *
+ * Incremental rehashing
+ *
+ * A rehash allocates the new table and publishes it right away, the old table hangs off the new one
+ * ("migrating") until it's drained. Every locked insert or removal then moves the next
+ * KEY_TABLE_REHASH_STEP slots of the old table into the new one, so the cost of a rehash is spread
+ * over the operations that follow it. Tables of up to KEY_TABLE_REHASH_STEP slots are moved at once.
+ *
+ * While the old table is drained:
+ *   - New strings always go into the new table.
+ *   - Searches look in the new table first, then in the old one. A string found in the old table
+ *     stays there until the migration reaches it.
+ *   - Slots of the old table that were moved or removed become tombstones rather than empty, so that
+ *     the probe sequences through them stay intact. Tombstones are never followed, only compared.
+ *   - Size and bytes count the strings of both tables, the load factor is that of the new table.
+ *
+ * Only one rehash is in progress per shard. If the new table fills up before the old one is drained,
+ * the rest of the old one is moved at once and the next rehash starts. Shrinking waits for the end of
+ * the migration.
+ *
+ */
+
+/***************************************************************************************************
+ *
+ * Lock-free lookups and epoch-based reclamation
+ *
+ * makeHandle first probes the shard's published table without the lock. On a hit it bumps the refcount
+ * with a CAS that refuses to resurrect a count of zero, because a string whose count dropped to zero is
+ * about to be removed. Anything but a successful hit falls back to the locked insert, which searches
+ * again, so a lookup racing with an insert, a removal or a rehash costs a trip through the slow path
+ * but is never wrong. Entries are read and written with atomic loads and stores, strings are immutable
+ * once published.
+ *
+ * A lock-free lookup may still be reading a string that was just removed, or a table that was just
+ * replaced by a rehash. Such memory is retired rather than freed. Each thread that does lookups owns
+ * a slot in which it announces the global epoch while it's looking. Retiring advances the global epoch
+ * and the memory can be freed once no slot announces an epoch from before the retirement. Without
+ * concurrent lookups that's immediately, otherwise the shard frees it during a later locked operation.
+ *
+ */
+namespace {
+
+struct alignas(64) EpochSlot {                  // One cache line per thread
+    std::atomic<uint64_t> epoch{0};             // Epoch of the lookup in progress, 0 => none
+    std::atomic<bool> used{false};
+};
+
+constexpr size_t MAX_EPOCH_SLOTS = 256;         // Threads beyond that always take the lock
+EpochSlot epochSlots[MAX_EPOCH_SLOTS];
+std::atomic<size_t> epochSlotsInUse{0};         // High water mark of the claimed slots
+std::atomic<uint64_t> globalEpoch{1};
+
+struct EpochThread {
+    EpochSlot *slot = nullptr;
+    bool claimed = false;
+    EpochSlot *get() {
+        if (!claimed) {
+            claimed = true;
+            for (size_t i = 0; i < MAX_EPOCH_SLOTS; ++i) {
+                if (!epochSlots[i].used.exchange(true)) {
+                    slot = &epochSlots[i];
+                    size_t inUse = epochSlotsInUse.load();
+                    while (inUse < i + 1 && !epochSlotsInUse.compare_exchange_weak(inUse, i + 1)) {}
+                    break;
+                }
+            }
+        }
+        return slot;
+    }
+    ~EpochThread() {
+        if (slot) slot->used.store(false, std::memory_order_release);
+    }
+};
+
+thread_local EpochThread epochThread;
+
+//
+// Announce the current epoch for the duration of a lock-free lookup. False => no slot, take the lock.
+//
+class EpochGuard {
+ public:
+    EpochGuard() : slot(epochThread.get()) {
+        if (slot) {
+            slot->epoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);  // Announce before reading the table
+        }
+    }
+    ~EpochGuard() {
+        if (slot) slot->epoch.store(0, std::memory_order_release);
+    }
+    explicit operator bool() const { return slot != nullptr; }
+
+ private:
+    EpochSlot *slot;
+};
+
+//
+// Oldest epoch announced by a lookup in progress, UINT64_MAX if none
+//
+uint64_t oldestAnnouncedEpoch() {
+    uint64_t oldest = UINT64_MAX;
+    size_t inUse = epochSlotsInUse.load(std::memory_order_acquire);
+    for (size_t i = 0; i < inUse; ++i) {
+        uint64_t e = epochSlots[i].epoch.load(std::memory_order_acquire);
+        if (e != 0 && e < oldest) oldest = e;
+    }
+    return oldest;
+}
+
+//
+// Inline handles don't touch the table, so they aren't counted in a shard. A single counter would have
+// every thread that makes, clones or destroys an inline handle write the same cache line. Instead each
+// thread counts in its own stripe, which can go negative as handles are often destroyed by another thread
+// than the one which made them, and getStats sums up the stripes.
+//
+constexpr size_t INLINE_COUNT_STRIPES = 64;     // Threads beyond that share a stripe
+
+size_t inlineCountStripe() {
+    static std::atomic<size_t> nextStripe{0};
+    thread_local size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % INLINE_COUNT_STRIPES;
+    return stripe;
+}
+
+}  // namespace
+
+struct alignas(64) KeyTable_InlineCount {       // One cache line per stripe
+    std::atomic<int64_t> count{0};
+};
+
 struct KeyTable_Shard {
     typedef PtrWithMetaData<KeyTable_Layout> EntryType;
+    //
+    // The entries are allocated after this header, so that lock-free lookups get the capacity that goes
+    // with them from a single pointer.
+    //
+    struct Table {
+        size_t capacity;
+        std::atomic<Table *> migrating;     // Old table being drained into this one, see above
+        explicit Table(size_t cap) : capacity(cap), migrating(nullptr) {}
+        EntryType *slots() { return reinterpret_cast<EntryType *>(this + 1); }
+        static Table *of(EntryType *entries) { return reinterpret_cast<Table *>(entries) - 1; }
+    };
+    //
+    // Memory waiting for the lock-free lookups of an older epoch to finish
+    //
+    struct Retired {
+        void *ptr;
+        uint64_t epoch;
+        Retired *next;
+    };
     size_t capacity;                        // Number of entries in table
-    size_t size;                            // Number of current entries
+    size_t size;                            // Number of current entries, in both tables during a rehash
     size_t bytes;                           // number of bytes of all current entries
-    size_t handles;                         // number of handles outstanding
+    std::atomic<size_t> handles;            // number of handles outstanding
     size_t maxSearch;                       // Max length of a search, since last read
     EntryType *entries;                     // Array of String Entries
+    std::atomic<Table *> table;             // Table of the entries, as seen by lock-free lookups
+    Table *oldTable;                        // Table being drained, nullptr => no rehash in progress
+    size_t migrateCursor;                   // Next slot of oldTable to move
+    uint64_t rehashStartTime;               // ValkeyModule_Milliseconds() at the start of the rehash
+    size_t maxRehashNanos;                  // Longest time spent rehashing in a single operation
+    Retired *retired;                       // Retired memory, oldest last
+    size_t numRetired;
     std::mutex mutex;                       // lock for this shard, mutable for "validate"
     uint32_t rehashes;                      // number of rehashes, since last read
+    size_t lockWaits;                       // number of times the lock was contended
+    size_t lockWaitNanos;                   // total time spent waiting for the lock
     static constexpr size_t MIN_TABLE_SIZE = 4;
 
+    //
+    // Marks a slot of an old table whose entry was moved or removed. Malloc never returns this address.
+    //
+    static EntryType tombstone() { return EntryType(reinterpret_cast<KeyTable_Layout *>(8), 0); }
+
     //
     // This logic implements the optimization that for Fast tables, we just get the low 19-bits of
     // the original hash value. Thereby avoiding an extra cache hit to fetch it from the Key itself
@@ -74,11 +244,16 @@ struct KeyTable_Shard {
         return hashValue;
     }
 
-    void makeTable(const KeyTable& t, size_t newCapacity) {
+    //
+    // Allocate a new empty table. It's published to lock-free lookups by the caller when it's filled in.
+    //
+    Table *makeTable(const KeyTable& t, size_t newCapacity) {
         newCapacity = std::max(newCapacity, MIN_TABLE_SIZE);
         KEYTABLE_ASSERT(newCapacity != capacity);  // oops full or empty.
         capacity = newCapacity;
-        entries = new (t.malloc(capacity * sizeof(EntryType))) EntryType[capacity];
+        Table *tbl = new (t.malloc(sizeof(Table) + capacity * sizeof(EntryType))) Table(capacity);
+        entries = new (tbl->slots()) EntryType[capacity];
+        return tbl;
     }
 
     KeyTable_Shard() : mutex() {
@@ -87,8 +262,64 @@ struct KeyTable_Shard {
         bytes = 0;
         handles = 0;
         entries = nullptr;
+        table = nullptr;
+        oldTable = nullptr;
+        migrateCursor = 0;
+        rehashStartTime = 0;
+        maxRehashNanos = 0;
+        retired = nullptr;
+        numRetired = 0;
         rehashes = 0;
         maxSearch = 0;
+        lockWaits = 0;
+        lockWaitNanos = 0;
+    }
+
+    //
+    // Free memory that lock-free lookups can no longer see, or keep it until they're done.
+    // Called with the lock held, after the memory was unlinked.
+    //
+    void retire(const KeyTable& t, void *ptr) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);   // Unlink before looking at the slots
+        uint64_t epoch = globalEpoch.fetch_add(1, std::memory_order_acq_rel);
+        if (oldestAnnouncedEpoch() > epoch) {
+            t.free(ptr);
+        } else {
+            retired = new (t.malloc(sizeof(Retired))) Retired{ptr, epoch, retired};
+            numRetired++;
+        }
+    }
+
+    void reclaim(const KeyTable& t) {
+        if (retired == nullptr) return;
+        uint64_t oldest = oldestAnnouncedEpoch();
+        for (Retired **r = &retired; *r != nullptr;) {
+            if ((*r)->epoch < oldest) {
+                Retired *dead = *r;
+                *r = dead->next;
+                t.free(dead->ptr);
+                t.free(dead);
+                numRetired--;
+            } else {
+                r = &(*r)->next;
+            }
+        }
+    }
+
+    //
+    // Lock the shard for an operation. The uncontended case is a single try_lock, the clock is
+    // only read when we actually have to wait. This feeds the contention stats.
+    //
+    std::unique_lock<std::mutex> lock() {
+        std::unique_lock<std::mutex> lck(mutex, std::try_to_lock);
+        if (!lck.owns_lock()) {
+            auto start = std::chrono::steady_clock::now();
+            lck.lock();
+            lockWaits++;
+            lockWaitNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        return lck;
     }
 
     //
@@ -96,6 +327,7 @@ struct KeyTable_Shard {
     // We scan the table to make sure all keys are gone.
     //
     void destroy(KeyTable& t) {
+        if (oldTable) rehashStep(t, SIZE_MAX);
         MEMORY_VALIDATE(entries);
         for (size_t i = 0; i < capacity; ++i) {
             if (entries[i]) {
@@ -104,8 +336,16 @@ struct KeyTable_Shard {
             }
             entries[i].clear();
         }
-        t.free(entries);
+        t.free(Table::of(entries));
         entries = nullptr;
+        table = nullptr;
+        while (retired != nullptr) {    // Nobody can be looking anymore
+            Retired *dead = retired;
+            retired = dead->next;
+            t.free(dead->ptr);
+            t.free(dead);
+        }
+        numRetired = 0;
     }
 
     ~KeyTable_Shard() {
@@ -114,10 +354,70 @@ struct KeyTable_Shard {
 
     float loadFactor() { return float(size) / float(capacity); }
 
-    size_t hashIndex(size_t hash) const { return hash % capacity; }
+    //
+    // Fast tables only keep the low bits of the hash in their entries (see getHashValueFromEntry), so
+    // they're indexed with those bits alone. Otherwise a rehash would put an entry where searches with
+    // the full hash don't look for it, unless the capacity is a power of 2.
+    //
+    static size_t hashIndex(size_t hash, size_t cap) {
+        if (cap < MAX_FAST_TABLE_SIZE) hash &= EntryType::METADATA_MASK;
+        return hash % cap;
+    }
+    size_t hashIndex(size_t hash) const { return hashIndex(hash, capacity); }
 
-    KeyTable_Layout *insert(KeyTable& t, size_t hsh, const char *ptr, size_t len, bool noescape) {
-        std::scoped_lock lck(mutex);
+    //
+    // Search one table for a string, returns its entry or an empty one. Tombstones are skipped, the
+    // first empty slot ends the search. Works without the lock, the entries are loaded atomically.
+    //
+    static EntryType search(Table *tbl, size_t hsh, const char *ptr, size_t len, size_t& searches) {
+        size_t cap = tbl->capacity;
+        EntryType *e = tbl->slots();
+        size_t ix = hashIndex(hsh, cap);
+        size_t metadata = hsh & EntryType::METADATA_MASK;
+        for (searches = 0; searches < cap; ++searches) {
+            EntryType entry = e[ix].atomicLoad();
+            if (!entry) break;
+            if (entry != tombstone() &&
+                entry.getMetaData() == metadata &&    // Early out, don't hit the cache line....
+                len == entry->getLength() &&
+                0 == std::memcmp(ptr, entry->getText(), len)) {
+                return entry;
+            }
+            if (++ix >= cap) ix = 0;
+        }
+        return EntryType();
+    }
+
+    //
+    // Lock-free search for a string that's already present, see above. Returns nullptr unless the
+    // string was found and its refcount bumped.
+    //
+    KeyTable_Layout *lookup(KeyTable& t, size_t hsh, const char *ptr, size_t len, size_t count) {
+        EpochGuard guard;
+        if (!guard) return nullptr;
+        for (Table *tbl = table.load(std::memory_order_acquire); tbl != nullptr;
+             tbl = tbl->migrating.load(std::memory_order_acquire)) {
+            size_t searches;
+            EntryType entry = search(tbl, hsh, ptr, len, searches);
+            if (!entry) continue;
+            bool saturated;
+            if (!entry->tryAddRefCount(count, saturated)) return nullptr;
+            handles.fetch_add(count, std::memory_order_relaxed);
+            if (saturated) t.stuckKeys++;
+            return &*entry;
+        }
+        return nullptr;
+    }
+
+    KeyTable_Layout *insert(KeyTable& t, size_t hsh, const char *ptr, size_t len, bool noescape,
+                            size_t count = 1) {
+        KEYTABLE_ASSERT(count > 0);
+        if (KEY_TABLE_LOCK_FREE) {
+            if (KeyTable_Layout *p = lookup(t, hsh, ptr, len, count)) return p;
+        }
+        auto lck = lock();
+        reclaim(t);
+        if (oldTable) rehashStep(t, KEY_TABLE_REHASH_STEP);
         while (loadFactor() > t.getFactors().maxLoad) {
             //
             // Oops, table too full, resize it larger.
@@ -136,16 +436,34 @@ struct KeyTable_Shard {
         for (size_t searches = 0; searches < capacity; ++searches) {
             EntryType &entry = entries[ix];
             if (!entry) {
+                //
+                // Not in this table, but it may not have been moved out of the old one yet.
+                //
+                if (oldTable) {
+                    size_t oldSearches;
+                    EntryType old = search(oldTable, hsh, ptr, len, oldSearches);
+                    if (old) {
+                        maxSearch = std::max(searches + oldSearches, maxSearch);
+                        handles += count;
+                        if (old->addRefCount(count)) {
+                            t.stuckKeys++;
+                        }
+                        return &*old;
+                    }
+                }
                 //
                 // Empty, insert it here.
                 //
-                handles++;
+                handles += count;
                 size++;
                 bytes += len;
                 maxSearch = std::max(searches, maxSearch);
 
                 KeyTable_Layout *p = KeyTable_Layout::makeLayout(t.malloc, ptr, len, hsh, noescape);
-                entry = EntryType(p, metadata);
+                entry.atomicStore(EntryType(p, metadata));
+                if (count > 1 && p->addRefCount(count - 1)) {
+                    t.stuckKeys++;
+                }
                 return p;
             } else if (entry.getMetaData() == metadata &&    // Early out, don't hit the cache line....
                         len == entry->getLength() &&
@@ -157,8 +475,8 @@ struct KeyTable_Shard {
                 // from that string. But who cares?
                 //
                 maxSearch = std::max(searches, maxSearch);
-                handles++;
-                if (entry->incrRefCount()) {
+                handles += count;
+                if (entry->addRefCount(count)) {
                     t.stuckKeys++;
                 }
                 return &*entry;
@@ -186,17 +504,41 @@ struct KeyTable_Shard {
         return result;
     }
 
+    //
+    // The handle holds a reference, so the string can't go away and the lock isn't needed.
+    //
     KeyTable_Layout *clone(KeyTable& t, const KeyTable_Handle& h) {
-        std::scoped_lock lck(mutex);
-        handles++;
+        std::unique_lock<std::mutex> lck;
+        if (!KEY_TABLE_LOCK_FREE) lck = lock();
+        handles.fetch_add(1, std::memory_order_relaxed);
         if (h->incrRefCount()) {
             t.stuckKeys++;
         }
         return const_cast<KeyTable_Layout *>(&*h);
     }
 
+    //
+    // Account for the removal of the last reference of a string whose entry was just unlinked.
+    //
+    void removed(const KeyTable& t, KeyTable_Handle& h) {
+        KEYTABLE_ASSERT(size > 0);
+        KEYTABLE_ASSERT(bytes >= h->getLength());
+        bytes -= h->getLength();
+        size--;
+        h.theHandle->poisonOriginalHash();
+        retire(t, &*h.theHandle);
+        h.clear();        // Kill the handle
+    }
+
     void destroyHandle(const KeyTable& t, KeyTable_Handle& h, size_t hsh) {
-        std::scoped_lock lck(mutex);
+        if (KEY_TABLE_LOCK_FREE && h->tryDecrRefCount()) {
+            handles.fetch_sub(1, std::memory_order_relaxed);
+            h.clear();
+            return;  // Not the last reference, no lock needed
+        }
+        auto lck = lock();
+        reclaim(t);
+        if (oldTable) rehashStep(t, KEY_TABLE_REHASH_STEP);
         handles--;
         if (h->decrRefCount() > 0) {
             h.clear();  // Kill the handle
@@ -207,7 +549,7 @@ struct KeyTable_Shard {
         //
         size_t ix = hashIndex(hsh);
         MEMORY_VALIDATE(entries);
-        for (size_t searches = 0; searches < capacity; ++searches) {
+        for (size_t searches = 0; searches < capacity && entries[ix]; ++searches) {
             if (&*entries[ix] == &*h) {
                 //
                 // Found it!!!
@@ -215,14 +557,8 @@ struct KeyTable_Shard {
                 //
                 KEYTABLE_ASSERT(entries[ix].getMetaData() == (hsh & EntryType::METADATA_MASK));
                 KEYTABLE_ASSERT(entries[ix]->getRefCount() == 0);
-                KEYTABLE_ASSERT(size > 0);
-                KEYTABLE_ASSERT(bytes >= h->getLength());
-                bytes -= h->getLength();
-                size--;
-                h.theHandle->poisonOriginalHash();
-                t.free(&*h.theHandle);
-                h.clear();        // Kill the handle
-                entries[ix].clear();
+                entries[ix].atomicStore(EntryType());
+                removed(t, h);
                 //
                 // Now reestablish the invariant of the algorithm by scanning forward until
                 // we hit another empty cell. While we're scanning we may have to move keys down
@@ -241,18 +577,18 @@ struct KeyTable_Shard {
                     //
                     size_t nativeSlot = hashIndex(getHashValueFromEntry(entries[ix]));
                     if (forward_distance(nativeSlot, ix) > forward_distance(nativeSlot, empty_ix)) {
-                        // Yes, this key can be moved.
-                        entries[empty_ix] = entries[ix];
-                        entries[ix].clear();
+                        // Yes, this key can be moved. A lookup that misses it meanwhile takes the lock.
+                        entries[empty_ix].atomicStore(entries[ix]);
+                        entries[ix].atomicStore(EntryType());
                         empty_ix = ix;
                     }
                     if (++ix >= capacity) ix = 0;
                 }
                 maxSearch = std::max(searches, maxSearch);
                 //
-                // Having removed an entry, check for rehashing
+                // Having removed an entry, check for rehashing. Not while the old table is drained.
                 //
-                if (loadFactor() < t.getFactors().minLoad && capacity > MIN_TABLE_SIZE) {
+                if (!oldTable && loadFactor() < t.getFactors().minLoad && capacity > MIN_TABLE_SIZE) {
                     size_t reduction = std::max(size_t(capacity * t.getFactors().shrink), size_t(1));
                     resizeTable(t, capacity - reduction);
                 }
@@ -262,48 +598,91 @@ struct KeyTable_Shard {
                 ix = 0;
             }
         }
+        //
+        // Not moved yet, take it out of the old table. The tombstone keeps its probe sequences intact.
+        //
+        KEYTABLE_ASSERT(oldTable);  // Not found ????
+        size_t oldCapacity = oldTable->capacity;
+        EntryType *oldEntries = oldTable->slots();
+        ix = hashIndex(hsh, oldCapacity);
+        for (size_t searches = 0; searches < oldCapacity && oldEntries[ix]; ++searches) {
+            if (oldEntries[ix] != tombstone() && &*oldEntries[ix] == &*h) {
+                KEYTABLE_ASSERT(oldEntries[ix]->getRefCount() == 0);
+                oldEntries[ix].atomicStore(tombstone());
+                removed(t, h);
+                maxSearch = std::max(searches, maxSearch);
+                return;
+            }
+            if (++ix >= oldCapacity) ix = 0;
+        }
         KEYTABLE_ASSERT(false);  // Not found ????
     }
 
+    //
+    // Start a rehash into a new table of newSize entries. The old table is drained by rehashStep.
+    //
     void resizeTable(const KeyTable& t, size_t newSize) {
-        uint64_t startTime = ValkeyModule_Milliseconds();
         if (capacity == newSize) return;      // Nothing to do.
         KEYTABLE_ASSERT(newSize >= size);     // Otherwise it won't fit.
+        if (oldTable) rehashStep(t, SIZE_MAX);  // One rehash at a time
         rehashes++;
         MEMORY_VALIDATE(entries);
-        EntryType *oldEntries = entries;
-        size_t oldCapacity = capacity;
-        makeTable(t, newSize);
-        for (size_t i = 0; i < oldCapacity; ++i) {
-            if (oldEntries[i]) {
-                //
-                // Found valid entry, Compute hash to see where it goes.
-                //
-                EntryType& oldEntry = oldEntries[i];
-                KEYTABLE_ASSERT(oldEntry->getRefCount() > 0);
-                size_t ix = hashIndex(getHashValueFromEntry(oldEntry));
-                for (size_t searches = 0; searches < capacity; ++searches) {
-                    if (!entries[ix]) {
-                        //
-                        // Empty, insert it.
-                        //
-                        entries[ix] = oldEntry;
-                        maxSearch = std::max(searches, maxSearch);
-                        goto nextOldEntry;
-                    }
-                    if (++ix >= capacity) ix = 0;
+        oldTable = Table::of(entries);
+        migrateCursor = 0;
+        rehashStartTime = ValkeyModule_Milliseconds();
+        Table *newTable = makeTable(t, newSize);
+        newTable->migrating.store(oldTable, std::memory_order_relaxed);
+        table.store(newTable, std::memory_order_release);
+        rehashStep(t, KEY_TABLE_REHASH_STEP);
+    }
+
+    //
+    // Move up to "limit" slots of the old table into the new one. Entries go to the first empty slot
+    // of their probe sequence, there are no duplicates since inserts also search the old table.
+    // The old table is retired once it's drained, lock-free lookups may still be probing it.
+    //
+    void rehashStep(const KeyTable& t, size_t limit) {
+        auto start = std::chrono::steady_clock::now();
+        EntryType *oldEntries = oldTable->slots();
+        size_t oldCapacity = oldTable->capacity;
+        size_t end = oldCapacity;
+        if (oldCapacity > KEY_TABLE_REHASH_STEP && oldCapacity - migrateCursor > limit) end = migrateCursor + limit;
+        for (; migrateCursor < end; ++migrateCursor) {
+            EntryType oldEntry = oldEntries[migrateCursor];
+            if (!oldEntry || oldEntry == tombstone()) continue;
+            //
+            // Found valid entry, Compute hash to see where it goes.
+            //
+            KEYTABLE_ASSERT(oldEntry->getRefCount() > 0);
+            size_t ix = hashIndex(getHashValueFromEntry(oldEntry));
+            for (size_t searches = 0; searches < capacity; ++searches) {
+                if (!entries[ix]) {
+                    //
+                    // Empty, insert it. Then it's gone from the old table.
+                    //
+                    entries[ix].atomicStore(oldEntry);
+                    oldEntries[migrateCursor].atomicStore(tombstone());
+                    maxSearch = std::max(searches, maxSearch);
+                    goto nextOldEntry;
                 }
-                KEYTABLE_ASSERT(false);  // can't fail if
+                if (++ix >= capacity) ix = 0;
             }
+            KEYTABLE_ASSERT(false);  // can't fail if
         nextOldEntry:{}
         }
-        t.free(oldEntries);
-        uint64_t duration = ValkeyModule_Milliseconds() - startTime;
-        if (duration == 0) duration = 1;
-        uint64_t keys_per_second = (size / duration) * 1000;
-        ValkeyModule_Log(nullptr, "notice",
-                        "Keytable Resize to %zu completed in %lu ms (%lu / sec)",
-                        capacity, duration, keys_per_second);
+        if (migrateCursor == oldCapacity) {
+            Table::of(entries)->migrating.store(nullptr, std::memory_order_release);
+            retire(t, oldTable);   // Lookups may still be probing it
+            oldTable = nullptr;
+            uint64_t duration = ValkeyModule_Milliseconds() - rehashStartTime;
+            if (duration == 0) duration = 1;
+            uint64_t keys_per_second = (size / duration) * 1000;
+            ValkeyModule_Log(nullptr, "notice",
+                            "Keytable Resize to %zu completed in %lu ms (%lu / sec)",
+                            capacity, duration, keys_per_second);
+        }
+        maxRehashNanos = std::max(maxRehashNanos, size_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
     }
 
     //
@@ -314,15 +693,43 @@ struct KeyTable_Shard {
         size_t this_refs  = 0;
         size_t this_size  = 0;
         size_t this_bytes = 0;
+        std::string result = validateTable(t, entries, capacity, false, this_size, this_refs, this_bytes);
+        if (!result.empty()) return result;
+        if (oldTable) {
+            result = validateTable(t, oldTable->slots(), oldTable->capacity, true, this_size, this_refs, this_bytes);
+            if (!result.empty()) return "Old table: " + result;
+            if (Table::of(entries)->migrating.load() != oldTable) return "Old table isn't linked to the new one";
+        }
+        // compare the counts. The summed refcounts only match handle counts if no stuck strings
+        if (this_size != size ||
+            (t.stuckKeys == 0 ? this_refs != handles : false) ||
+            this_bytes != bytes) {
+            std::ostringstream os;
+            os << "Count mismatch for shard: " << shardNumber << " Capacity:" << capacity
+                << " Handles:" << handles << " sum(refcounts):" << this_refs
+                << " Size:" << size << " this_size:" << this_size
+                << " Bytes:" << bytes << " this_bytes:" << this_bytes;
+            return os.str();
+        }
+        return std::string();  // Empty means no failure.
+    }
+    static std::string validateTable(const KeyTable& t, const EntryType *entries, size_t capacity, bool old,
+                                     size_t& this_size, size_t& this_refs, size_t& this_bytes) {
         for (size_t i = 0; i < capacity; ++i) {
             EntryType e = entries[i];
-            if (e) {
+            if (e == tombstone()) {
+                if (!old) {
+                    std::ostringstream os;
+                    os << "Found tombstone in slot " << i << " TableSize:" << capacity;
+                    return os.str();
+                }
+            } else if (e) {
                 this_size++;
                 this_refs += e->getRefCount();
                 this_bytes += e->getLength();
                 size_t orig_hash = t.hash(e->getText(), e->getLength());
                 size_t correct_metadata = orig_hash & EntryType::METADATA_MASK;
-                size_t nativeIx = hashIndex(orig_hash);
+                size_t nativeIx = hashIndex(orig_hash, capacity);
                 // Validate the metadata field
                 if (e.getMetaData() != correct_metadata) {
                     std::ostringstream os;
@@ -348,25 +755,20 @@ struct KeyTable_Shard {
                 }
             }
         }
-        // compare the counts. The summed refcounts only match handle counts if no stuck strings
-        if (this_size != size ||
-            (t.stuckKeys == 0 ? this_refs != handles : false) ||
-            this_bytes != bytes) {
-            std::ostringstream os;
-            os << "Count mismatch for shard: " << shardNumber << " Capacity:" << capacity
-                << " Handles:" << handles << " sum(refcounts):" << this_refs
-                << " Size:" << size << " this_size:" << this_size
-                << " Bytes:" << bytes << " this_bytes:" << this_bytes;
-            return os.str();
-        }
-        return std::string();  // Empty means no failure.
+        return std::string();
     }
     std::string validate_counts(std::unordered_map<const KeyTable_Layout *, size_t>& counts) const {
         std::string result;
         std::scoped_lock lck(const_cast<std::mutex&>(this->mutex));  // Cheat on the mutex
+        validate_counts(entries, capacity, counts, result);
+        if (oldTable) validate_counts(oldTable->slots(), oldTable->capacity, counts, result);
+        return result;  // Empty means no failures found.
+    }
+    static void validate_counts(const EntryType *entries, size_t capacity,
+                                std::unordered_map<const KeyTable_Layout *, size_t>& counts, std::string& result) {
         for (size_t i = 0; i < capacity; ++i) {
             EntryType e = entries[i];
-            if (e) {
+            if (e && e != tombstone()) {
                 if (counts[&*e] != e->getRefCount()) {
                     std::ostringstream os;
                     os
@@ -380,7 +782,6 @@ struct KeyTable_Shard {
                 }
             }
         }
-        return result;  // Empty means no failures found.
     }
     // Add our stats to the total so far.
     void updateStats(KeyTable::Stats& s) {
@@ -390,9 +791,15 @@ struct KeyTable_Shard {
         s.handles += handles;
         s.maxTableSize = std::max(s.maxTableSize, capacity);
         s.minTableSize = std::min(s.minTableSize, capacity);
-        s.totalTable += capacity;
+        s.totalTable += capacity + (oldTable ? oldTable->capacity : 0);
         s.rehashes += rehashes;
+        s.rehashInProgress += oldTable != nullptr;
+        s.maxRehashNanos = std::max(s.maxRehashNanos, maxRehashNanos);
         s.maxSearch = std::max(s.maxSearch, maxSearch);
+        s.retired += numRetired;
+        s.lockWaits += lockWaits;
+        s.lockWaitNanos += lockWaitNanos;
+        s.maxShardLockWaitNanos = std::max(s.maxShardLockWaitNanos, lockWaitNanos);
         //
         // Reset the counters
         //
@@ -425,12 +832,15 @@ KeyTable::KeyTable(const Config& cfg) :
     free(cfg.free),
     hash(cfg.hash),
     numShards(cfg.numShards),
+    inlineShortKeys(cfg.inlineShortKeys),
     stuckKeys(0)
 {
     KEYTABLE_ASSERT(numShards > 0);
     KEYTABLE_ASSERT(malloc && free && hash);
     shards = new(malloc(numShards * sizeof(KeyTable_Shard))) KeyTable_Shard[numShards];
-    for (size_t i = 0; i < numShards; ++i) shards[i].makeTable(*this, 1);
+    inlineHandles = new(malloc(INLINE_COUNT_STRIPES * sizeof(KeyTable_InlineCount)))
+        KeyTable_InlineCount[INLINE_COUNT_STRIPES];
+    for (size_t i = 0; i < numShards; ++i) shards[i].table = shards[i].makeTable(*this, 1);
     KEYTABLE_ASSERT(!isValidFactors(factors));
 }
 
@@ -442,6 +852,8 @@ KeyTable::~KeyTable() {
     }
     free(shards);
     shards = nullptr;
+    free(inlineHandles);
+    inlineHandles = nullptr;
 }
 
 std::string KeyTable::validate() const {
@@ -486,6 +898,11 @@ KeyTable::Stats KeyTable::getStats() const {
     // Global stats
     //
     s.stuckKeys = stuckKeys;
+    int64_t inlineCount = 0;
+    for (size_t i = 0; i < INLINE_COUNT_STRIPES; ++i) {
+        inlineCount += inlineHandles[i].count.load(std::memory_order_relaxed);
+    }
+    s.inlineHandles = static_cast<size_t>(inlineCount);
     s.factors = getFactors();
     //
     // Now sum up the per-shard stats
@@ -518,12 +935,20 @@ size_t KeyTable::hashcodeFromHash(size_t hash) {
     return hash & KeyTable_Handle::MAX_HASHCODE;
 }
 
+void KeyTable::countInlineHandles(int64_t delta) {
+    inlineHandles[inlineCountStripe()].count.fetch_add(delta, std::memory_order_relaxed);
+}
+
 /*
  * Upsert a string, returns a handle for this insertion.
  *
  * This function hashes the string and dispatches the operation to the appropriate shard.
  */
 KeyTable_Handle KeyTable::makeHandle(const char *ptr, size_t len, bool noescape) {
+    if (inlineShortKeys && len <= KeyTable_Handle::MAX_INLINE_LENGTH) {
+        countInlineHandles(1);
+        return KeyTable_Handle::makeInline(ptr, len);
+    }
     size_t hsh = hash(ptr, len);
     size_t shardNum = shardNumberFromHash(hsh);
     KeyTable_Layout *s = shards[shardNum].insert(*this, hsh, ptr, len, noescape);
@@ -531,9 +956,28 @@ KeyTable_Handle KeyTable::makeHandle(const char *ptr, size_t len, bool noescape)
 }
 
 /*
- * Clone an existing handle
+ * Upsert a string with multiple references, i.e., the same as "count" calls to makeHandle. But only
+ * one hash computation and shard lock.
+ */
+KeyTable_Handle KeyTable::makeHandle(const char *ptr, size_t len, bool noescape, size_t count) {
+    if (inlineShortKeys && len <= KeyTable_Handle::MAX_INLINE_LENGTH) {
+        countInlineHandles(static_cast<int64_t>(count));
+        return KeyTable_Handle::makeInline(ptr, len);
+    }
+    size_t hsh = hash(ptr, len);
+    size_t shardNum = shardNumberFromHash(hsh);
+    KeyTable_Layout *s = shards[shardNum].insert(*this, hsh, ptr, len, noescape, count);
+    return KeyTable_Handle(s, hashcodeFromHash(hsh));
+}
+
+/*
+ * Clone an existing handle. Inline handles are simply copied.
  */
 KeyTable_Handle KeyTable::clone(const KeyTable_Handle& h) {
+    if (h.IsInline()) {
+        countInlineHandles(1);
+        return KeyTable_Handle(h.theHandle);
+    }
     size_t hsh = hash(h.GetString(), h.GetStringLength());
     size_t shardNum = shardNumberFromHash(hsh);
     KeyTable_Layout *s = shards[shardNum].clone(*this, h);
@@ -548,6 +992,11 @@ KeyTable_Handle KeyTable::clone(const KeyTable_Handle& h) {
  */
 void KeyTable::destroyHandle(KeyTable_Handle& h) {
     if (!h) return;  // Empty
+    if (h.IsInline()) {
+        countInlineHandles(-1);
+        h.clear();
+        return;
+    }
     size_t hsh = hash(h.GetString(), h.GetStringLength());
     KEYTABLE_ASSERT(!h->isPoisoned());
     KEYTABLE_ASSERT(hsh == h->getOriginalHash());
@@ -597,26 +1046,72 @@ const char *KeyTable::isValidFactors(const Factors& f) {
 static uint32_t MAX_REF_COUNT = 0x1FFFFFFF;
 
 bool KeyTable_Layout::IsStuck() const {
-    return refCount >= MAX_REF_COUNT;
+    return getRefCount() >= MAX_REF_COUNT;
 }
 
+//
+// The refcount is updated with a CAS loop on the whole meta word, the other fields never change.
+// Once the count is saturated it stays put.
+//
 bool KeyTable_Layout::incrRefCount() const {
-    if (IsStuck()) {
-        return true;  // Saturated
-    } else {
-        refCount++;
-        return false;
-    }
+    return addRefCount(1);
+}
+
+bool KeyTable_Layout::addRefCount(size_t count) const {
+    uint32_t m = loadMeta();
+    bool saturated;
+    do {
+        uint32_t refCount = m & REF_COUNT_MASK;
+        if (refCount >= MAX_REF_COUNT) return true;  // Already saturated
+        saturated = count > MAX_REF_COUNT - refCount;
+        refCount = saturated ? MAX_REF_COUNT : refCount + count;
+        if (__atomic_compare_exchange_n(metaWord(), &m, (m & ~uint32_t(REF_COUNT_MASK)) | refCount, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } while (true);
+    return saturated;
+}
+
+bool KeyTable_Layout::tryAddRefCount(size_t count, bool& saturated) const {
+    uint32_t m = loadMeta();
+    do {
+        uint32_t refCount = m & REF_COUNT_MASK;
+        if (refCount == 0) return false;   // Being removed from the table
+        if (refCount >= MAX_REF_COUNT) {
+            saturated = true;
+            return true;
+        }
+        saturated = count > MAX_REF_COUNT - refCount;
+        refCount = saturated ? MAX_REF_COUNT : refCount + count;
+        if (__atomic_compare_exchange_n(metaWord(), &m, (m & ~uint32_t(REF_COUNT_MASK)) | refCount, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return true;
+    } while (true);
+}
+
+bool KeyTable_Layout::tryDecrRefCount() const {
+    uint32_t m = loadMeta();
+    do {
+        uint32_t refCount = m & REF_COUNT_MASK;
+        if (refCount >= MAX_REF_COUNT) return true;  // Stuck, nothing to do
+        if (refCount <= 1) return false;
+        if (__atomic_compare_exchange_n(metaWord(), &m, m - 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) return true;
+    } while (true);
 }
 
 size_t KeyTable_Layout::decrRefCount() const {
-    KEYTABLE_ASSERT(refCount > 0);
-    if (!IsStuck()) refCount--;
-    return refCount;
+    uint32_t m = loadMeta();
+    do {
+        uint32_t refCount = m & REF_COUNT_MASK;
+        KEYTABLE_ASSERT(refCount > 0);
+        if (refCount >= MAX_REF_COUNT) return refCount;
+        if (__atomic_compare_exchange_n(metaWord(), &m, m - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return refCount - 1;
+        }
+    } while (true);
 }
 
 size_t KeyTable_Layout::getLength() const {
     // Length is stored in little-endian format
+    size_t lengthBytes = loadMeta() >> LENGTH_BYTES_SHIFT;
     size_t len = 0;
     for (size_t i = 0; i <= lengthBytes; ++i) {
         len |= *reinterpret_cast<const uint8_t *>(bytes+i) << (i * 8);
@@ -625,7 +1120,7 @@ size_t KeyTable_Layout::getLength() const {
 }
 
 const char *KeyTable_Layout::getText() const {
-    return bytes + lengthBytes + 1;
+    return bytes + (loadMeta() >> LENGTH_BYTES_SHIFT) + 1;
 }
 
 KeyTable_Layout *KeyTable_Layout::makeLayout(void *(*malloc)(size_t), const char *ptr, size_t len,
@@ -638,9 +1133,7 @@ KeyTable_Layout *KeyTable_Layout::makeLayout(void *(*malloc)(size_t), const char
     KeyTable_Layout *p = reinterpret_cast<KeyTable_Layout*>(malloc(
             sizeof(KeyTable_Layout) + lengthBytes + len));
     p->original_hash = hash;
-    p->noescapeFlag = noescape;
-    p->refCount = 1;
-    p->lengthBytes = lengthBytes - 1;
+    p->meta = 1 | (noescape ? uint32_t(NOESCAPE_BIT) : 0) | uint32_t(lengthBytes - 1) << LENGTH_BYTES_SHIFT;
     // store the length in little-endian format
     for (size_t i = 0; i < lengthBytes; ++i) {
         p->bytes[i] = len >> (8 * i);
@@ -653,6 +1146,7 @@ KeyTable_Layout *KeyTable_Layout::makeLayout(void *(*malloc)(size_t), const char
 // Unit test only.
 void KeyTable_Layout::setMaxRefCount(uint32_t maxRefCount) {
     KEYTABLE_ASSERT(sizeof(KeyTable_Layout) == 5 + 8);
+    KEYTABLE_ASSERT(offsetof(KeyTable_Layout, meta) == sizeof(size_t));
     KEYTABLE_ASSERT(maxRefCount <= MAX_REF_COUNT);           // can only shrink it.
     MAX_REF_COUNT = maxRefCount;
 }
@@ -44,20 +44,34 @@
  * the mapping is updated and a handle is constructed and returned.
  *
  * The mapping is implemented as a hashtable using linear hashing. Each hash table entry is simply
- * the malloc'ed pointer and 19-bits of hash code. Various conditions can cause a rehashing event,
- * rehashing is always done as a single operation on the entire hashtable while the mutex is held,
- * i.e., there is no incremental re-hashing. This makes it very easy to ensure multi-thread correctness.
- * Worst-case CPU loads due to rehashing are limited because the size of a shard hashtable is itself
- * limited to 2^19 entries. You vary the number of shards to handle the worst-case number of strings
- * in the table.
+ * the malloc'ed pointer and 19-bits of hash code. Various conditions can cause a rehashing event.
+ * Rehashing is incremental: the shard keeps the old and the new hashtable and each subsequent insert
+ * or removal moves a bounded number of slots from the old one to the new one, so that the worst-case
+ * latency of an operation doesn't grow with the size of the shard. Shard hashtables of more than 2^19
+ * entries are still slower, because their rehashes have to fetch the full hash from each string.
+ * You vary the number of shards to handle the worst-case number of strings in the table.
  *
  * The refcount for a string is currently fixed at 30-bits. Increment and decrement of the refcount
  * is done with saturating arithmetic, meaning that if a string ever hits the maximum refcount it
  * will never be deleted from the table. This isn't considered to be a problem.
  *
+ * Looking up a string that's already in the table -- by far the most common case -- doesn't take the
+ * shard mutex. It probes the shard's hashtable without the lock and bumps the refcount atomically,
+ * the mutex is only needed to insert a string, to remove it when its refcount drops to zero and to
+ * rehash. Likewise destroying a handle that isn't the last one is just an atomic decrement. Memory
+ * that lock-free lookups may still be reading is reclaimed with epochs, see keytable.cc.
+ *
+ * Optionally, see Config::inlineShortKeys, strings of up to 7 bytes aren't put into the table at all.
+ * Their text, length and noescape flag are kept in the handle itself, tagged by a bit that's never set
+ * in the handle of a table string. Making, cloning and destroying such a handle is a copy of 8 bytes,
+ * and its hash is computed from those. A string is inline if, and only if, it's short enough, so the
+ * handles of a string are still all equal, and are only equal to those of that string.
+ *
  */
 
 #include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <ostream>
 #include <string_view>
@@ -120,6 +134,23 @@ class PtrWithMetaData {
 
     void swap(PtrWithMetaData& rhs) { std::swap<size_t>(bits, rhs.bits); }
 
+    //
+    // The raw bits, for users that keep something other than a pointer in them, see KeyTable_Handle
+    //
+    size_t getBits() const { return bits; }
+    const char *getBytes() const { return reinterpret_cast<const char *>(&bits); }
+    char *getBytes() { return reinterpret_cast<char *>(&bits); }
+
+    //
+    // Access to pointers that are read by other threads without a lock
+    //
+    PtrWithMetaData atomicLoad() const {
+        PtrWithMetaData p;
+        p.bits = __atomic_load_n(&bits, __ATOMIC_ACQUIRE);
+        return p;
+    }
+    void atomicStore(const PtrWithMetaData& v) { __atomic_store_n(&bits, v.bits, __ATOMIC_RELEASE); }
+
  private:
     size_t bits;
     T* getPointer() const { return MEMORY_VALIDATE<T>(reinterpret_cast<T *>(bits & PTR_MASK)); }
@@ -147,11 +178,11 @@ struct KeyTable_Layout {
     //
     // Interrogate existing layout
     //
-    size_t getRefCount() const { return refCount; }
+    size_t getRefCount() const { return loadMeta() & REF_COUNT_MASK; }
     size_t getLength() const;
     const char *getText() const;
     bool IsStuck() const;
-    bool getNoescape() const { return noescapeFlag != 0; }
+    bool getNoescape() const { return (loadMeta() & NOESCAPE_BIT) != 0; }
     enum { POISON_VALUE = 0xdeadbeeffeedfeadull };
     size_t getOriginalHash() const { return original_hash; }
     void poisonOriginalHash() { original_hash = POISON_VALUE; }
@@ -163,11 +194,21 @@ struct KeyTable_Layout {
     KeyTable_Layout();               // Nobody gets to create one.
     friend class KeyTable_Shard;     // Only class allowed to manipulate reference count
     bool incrRefCount() const;       // true => saturated
+    bool addRefCount(size_t count) const;  // true => saturated
+    bool tryAddRefCount(size_t count, bool& saturated) const;  // false => count is zero, string is going away
+    bool tryDecrRefCount() const;    // false => this may be the last reference, nothing was done
     size_t decrRefCount() const;     // returns current count
+    //
+    // The refcount changes concurrently with lock-free lookups, so the meta word is only accessed with
+    // atomic operations. It's at offset 8 of a malloc'ed block, i.e., aligned, even though the struct is packed.
+    //
+    enum { REF_COUNT_MASK = (1u << 29) - 1, NOESCAPE_BIT = 1u << 29, LENGTH_BYTES_SHIFT = 30 };
+    uint32_t *metaWord() const {
+        return reinterpret_cast<uint32_t *>(reinterpret_cast<uintptr_t>(this) + sizeof(original_hash));
+    }
+    uint32_t loadMeta() const { return __atomic_load_n(metaWord(), __ATOMIC_RELAXED); }
     size_t original_hash;            // Remember original hash
-    mutable uint32_t refCount:29;    // Ref count.
-    uint32_t noescapeFlag:1;         // String doesn't need to be escaped
-    uint32_t lengthBytes:2;          // 0, 1, 2 or 3 => 1, 2, 3 or 4 bytes of length
+    mutable uint32_t meta;           // Ref count:29, noescape flag:1, length bytes:2 (0..3 => 1..4 bytes of length)
     char bytes[1];                   // length bytes + text bytes
 } __attribute__((packed));           // Don't let compiler round size of up 8 bytes.
 
@@ -175,18 +216,36 @@ struct KeyTable_Handle {
     /***************************** Public Handle Interface *******************************/
     //
     // get a pointer to the text of the string. This pointer has the same lifetime as the
-    // string_table_handle object itself.
+    // string_table_handle object itself. The text isn't zero terminated.
+    //
+    const KeyTable_Layout& operator*() const { KEYTABLE_ASSERT(!IsInline()); return *theHandle; }
+    const KeyTable_Layout* operator->() const { KEYTABLE_ASSERT(!IsInline()); return &*theHandle; }
+    const char *GetString() const { return IsInline() ? theHandle.getBytes() + 1 : theHandle->getText(); }
+    size_t GetStringLength() const { return IsInline() ? InlineLength() : theHandle->getLength(); }
+    const std::string_view GetStringView() const { return std::string_view(GetString(), GetStringLength()); }
+    size_t GetHashcode() const { return IsInline() ? InlineHash() >> (64 - HASHCODE_BITS) : theHandle.getMetaData(); }
+    size_t GetOriginalHash() const { return IsInline() ? InlineHash() : theHandle->getOriginalHash(); }
+    bool IsNoescape() const {
+        return IsInline() ? (theHandle.getBits() & INLINE_NOESCAPE_BIT) != 0 : theHandle->getNoescape();
+    }
+    //
+    // Is the string kept in the handle rather than in the table, see Config::inlineShortKeys
     //
-    const KeyTable_Layout& operator*() const { return *theHandle; }
-    const KeyTable_Layout* operator->() const { return &*theHandle; }
-    const char *GetString() const { return theHandle->getText(); }
-    size_t GetStringLength() const { return theHandle->getLength(); }
-    const std::string_view GetStringView() const
-        { return std::string_view(theHandle->getText(), theHandle->getLength()); }
-    size_t GetHashcode() const { return theHandle.getMetaData(); }
-    bool IsNoescape() const { return theHandle->getNoescape(); }
+    bool IsInline() const { return (theHandle.getBits() & INLINE_TAG_BIT) != 0; }
+    //
+    // Is this the only handle of its string, i.e., no other handle can be equal to it
+    //
+    bool IsUnique() const { return !IsInline() && theHandle->getRefCount() == 1; }
+    //
+    // Equal for two handles if, and only if, they're handles of the same string
+    //
+    size_t GetIdentity() const { return theHandle.getBits(); }
 
-    enum { MAX_HASHCODE = PtrWithMetaData<KeyTable_Layout>::METADATA_MASK };
+    //
+    // The top bit of the metadata is the inline tag, which leaves 18 of them for the hashcode
+    //
+    enum { HASHCODE_BITS = 18, MAX_HASHCODE = (1 << HASHCODE_BITS) - 1 };
+    enum { MAX_INLINE_LENGTH = 7 };
     //
     // Assignment is only allowed into a empty handle.
     //
@@ -219,8 +278,9 @@ struct KeyTable_Handle {
     operator bool() const { return bool(theHandle); }
 
     friend std::ostream& operator<<(std::ostream& os, const KeyTable_Handle& h) {
+        if (h.IsInline()) return os << "Handle:inline : " << h.GetStringView();
         return os << "Handle:" << reinterpret_cast<const void *>(&*(h.theHandle))
-            << " Shard:" << h.theHandle.getMetaData()
+            << " Hashcode:" << h.theHandle.getMetaData()
             << " RefCount: " << h->getRefCount()
             << " : " << h.GetStringView();
     }
@@ -237,8 +297,37 @@ struct KeyTable_Handle {
     friend struct KeyTable_Shard;
 
     KeyTable_Handle(KeyTable_Layout *ptr, size_t hashCode) : theHandle(ptr, hashCode) {}
+    explicit KeyTable_Handle(const PtrWithMetaData<KeyTable_Layout>& h) : theHandle(h) {}
     void clear() { theHandle.clear(); }
 
+    //
+    // An inline handle: the first byte holds the tag, the length and the noescape flag, the other 7 the text,
+    // zero padded. The tag is the top bit of the metadata, which PtrWithMetaData keeps in bit 2.
+    //
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Inline handles keep their text after the tag byte");
+    static const size_t INLINE_TAG_BIT = 1 << 2;
+    static const size_t INLINE_LENGTH_SHIFT = 3;
+    static const size_t INLINE_LENGTH_MASK = 7 << INLINE_LENGTH_SHIFT;
+    static const size_t INLINE_NOESCAPE_BIT = 1 << 6;
+    static KeyTable_Handle makeInline(const char *ptr, size_t len) {
+        KEYTABLE_ASSERT(len <= MAX_INLINE_LENGTH);
+        KeyTable_Handle h;
+        bool noescape = true;
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char c = ptr[i];
+            noescape &= c >= 0x20 && c != '"' && c != '\\';
+        }
+        char *bytes = h.theHandle.getBytes();
+        bytes[0] = INLINE_TAG_BIT | (len << INLINE_LENGTH_SHIFT) | (noescape ? INLINE_NOESCAPE_BIT : 0);
+        std::memcpy(bytes + 1, ptr, len);
+        return h;
+    }
+    size_t InlineLength() const { return (theHandle.getBits() & INLINE_LENGTH_MASK) >> INLINE_LENGTH_SHIFT; }
+    size_t InlineHash() const {
+        size_t h = theHandle.getBits() * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+
     PtrWithMetaData<KeyTable_Layout> theHandle;                   // The only actual data here.
 };
 
@@ -246,11 +335,12 @@ struct KeyTable_Handle {
  * This is the core hashtable, it's invisible externally
  */
 struct KeyTable_Shard;
+struct KeyTable_InlineCount;
 
 struct KeyTable {
     /*************************** External Table Interface *********************************/
 
-    enum { MAX_SHARDS = KeyTable_Handle::MAX_HASHCODE, MIN_SHARDS = 1 };
+    enum { MAX_SHARDS = PtrWithMetaData<KeyTable_Layout>::METADATA_MASK, MIN_SHARDS = 1 };
 
 
     //
@@ -262,6 +352,7 @@ struct KeyTable {
         void (*free)(void*);                                // Use this to free memory
         size_t (*hash)(const char *, size_t);               // Hash function for strings
         size_t numShards;                                   // Number of shards to create
+        bool inlineShortKeys = false;                       // Keep strings of up to 7 bytes in their handles
     };
     //
     // Construct a table.
@@ -278,6 +369,16 @@ struct KeyTable {
     KeyTable_Handle makeHandle(const std::string_view& s, bool noescape = false) {
         return makeHandle(s.data(), s.length(), noescape);
     }
+    //
+    // Make a handle that carries "count" references to this string, for the cost of a single
+    // hash and shard lock. Use splitHandle to peel references off into individual handles. The
+    // caller is responsible for ending up with exactly "count" handles, each of which must be
+    // destroyed normally.
+    //
+    KeyTable_Handle makeHandle(const char *ptr, size_t len, bool noescape, size_t count);
+    KeyTable_Handle splitHandle(const KeyTable_Handle& h) {
+        return KeyTable_Handle(h.theHandle);  // Same bits, inline or not
+    }
 
     KeyTable_Handle clone(const KeyTable_Handle& rhs);
     //
@@ -330,10 +431,17 @@ struct KeyTable {
         size_t size;                // Total number of unique strings in table
         size_t bytes;               // Total bytes of strings
         size_t handles;             // Number of outstanding handles
+        size_t inlineHandles;       // Number of outstanding handles of strings kept in the handle, not in the table
         size_t maxTableSize;        // Largest Shard table
         size_t minTableSize;        // Smallest Shard table
         size_t totalTable;          // sum of table sizes
         size_t stuckKeys;        // Number of strings that have hit the refcount max.
+        size_t retired;             // Strings and tables waiting for lock-free lookups to finish
+        size_t lockWaits;           // Number of contended shard lock acquisitions
+        size_t lockWaitNanos;       // Total time spent waiting for shard locks
+        size_t maxShardLockWaitNanos;   // Wait time of the most contended shard
+        size_t rehashInProgress;    // Number of shards draining an old table
+        size_t maxRehashNanos;      // Longest time a single operation spent rehashing
         //
         // These counters are reset after being read.
         //
@@ -377,7 +485,10 @@ struct KeyTable {
     void (*free)(void *);                   // Use this to free memory
     size_t (*hash)(const char *, size_t);   // Hash function for strings
     size_t numShards;
+    bool inlineShortKeys;
     std::atomic<size_t> stuckKeys;       // Stuck String count.
+    KeyTable_InlineCount *inlineHandles;   // Outstanding inline handles, one counter per thread, see getStats
+    void countInlineHandles(int64_t delta);
     Factors factors;
 };
 
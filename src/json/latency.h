@@ -0,0 +1,114 @@
+/**
+ * Latency statistics. Every JSON command is timed by a JsonCommandTimer, and its time is split into phases by
+ * JsonPhaseTimers placed on the hot paths: finding or compiling the path, traversing the document, parsing JSON
+ * input, serializing values and handing the reply to Valkey. Time not spent in any of those, e.g., argument checks,
+ * key lookups and applying writes, is counted in the OTHER phase.
+ *
+ * Phases nest: a phase that begins while another one is running pauses the outer phase, so every nanosecond of a
+ * command is counted in exactly one phase. Paths that can't be compiled are parsed by the interpreter as it
+ * traverses the document, that parsing is counted as traversal.
+ *
+ * The phase times of a command are accumulated in thread local storage and added to the histograms of the command
+ * when it ends, with relaxed atomic increments. Phase timers outside of a command, e.g., during RDB load, cost a
+ * thread local check and nothing else.
+ *
+ * Histograms have power of 2 buckets in microseconds: <1, <2, <4, ... <16384 and the rest. They are reported in
+ * INFO, see Module_Info, and reset by JSON.DEBUG RESET-STATS.
+ */
+#ifndef VALKEYJSONMODULE_JSON_LATENCY_H_
+#define VALKEYJSONMODULE_JSON_LATENCY_H_
+
+#include <cstddef>
+#include <cstdint>
+
+typedef enum {
+    JSONSTATS_PHASE_PATH_PARSE = 0,
+    JSONSTATS_PHASE_TRAVERSAL,
+    JSONSTATS_PHASE_INPUT_PARSE,
+    JSONSTATS_PHASE_SERIALIZATION,
+    JSONSTATS_PHASE_REPLY,
+    JSONSTATS_PHASE_OTHER,
+    JSONSTATS_NUM_PHASES
+} JsonStatsPhase;
+
+typedef enum {
+    JSONSTATS_CMD_SET = 0,
+    JSONSTATS_CMD_GET,
+    JSONSTATS_CMD_MGET,
+    JSONSTATS_CMD_MSET,
+    JSONSTATS_CMD_MERGE,
+    JSONSTATS_CMD_DEL,          // JSON.DEL and JSON.FORGET
+    JSONSTATS_CMD_NUMINCRBY,
+    JSONSTATS_CMD_NUMMULTBY,
+    JSONSTATS_CMD_STRLEN,
+    JSONSTATS_CMD_STRAPPEND,
+    JSONSTATS_CMD_TOGGLE,
+    JSONSTATS_CMD_OBJLEN,
+    JSONSTATS_CMD_OBJKEYS,
+    JSONSTATS_CMD_ARRLEN,
+    JSONSTATS_CMD_ARRAPPEND,
+    JSONSTATS_CMD_ARRPOP,
+    JSONSTATS_CMD_ARRINSERT,
+    JSONSTATS_CMD_ARRTRIM,
+    JSONSTATS_CMD_CLEAR,
+    JSONSTATS_CMD_ARRINDEX,
+    JSONSTATS_CMD_TYPE,
+    JSONSTATS_CMD_RESP,
+    JSONSTATS_NUM_COMMANDS
+} JsonStatsCommand;
+
+#define JSONSTATS_NUM_LATENCY_BUCKETS (16)
+
+/**
+ * Times a command from construction to destruction. A command timer within a command that is already being timed
+ * does nothing.
+ */
+class JsonCommandTimer {
+ public:
+    explicit JsonCommandTimer(JsonStatsCommand cmd);
+    ~JsonCommandTimer();
+
+ private:
+    JsonCommandTimer(const JsonCommandTimer &);  // disable copy constructor
+    JsonCommandTimer& operator=(const JsonCommandTimer &);  // disable assignment operator
+    JsonStatsCommand cmd;
+    bool active;
+};
+
+/**
+ * Counts the time from construction to destruction in a phase of the command being timed, if any.
+ */
+class JsonPhaseTimer {
+ public:
+    explicit JsonPhaseTimer(JsonStatsPhase phase);
+    ~JsonPhaseTimer();
+
+ private:
+    JsonPhaseTimer(const JsonPhaseTimer &);  // disable copy constructor
+    JsonPhaseTimer& operator=(const JsonPhaseTimer &);  // disable assignment operator
+    JsonStatsPhase outer;
+    bool active;
+};
+
+// the command being timed on this thread, JSONSTATS_NUM_COMMANDS if none
+JsonStatsCommand jsonstats_current_command();
+
+const char *jsonstats_command_name(const JsonStatsCommand cmd);
+const char *jsonstats_phase_name(const JsonStatsPhase phase);
+
+unsigned long long jsonstats_get_command_calls(const JsonStatsCommand cmd);
+// total microseconds spent in a phase of a command
+unsigned long long jsonstats_get_phase_usec(const JsonStatsCommand cmd, const JsonStatsPhase phase);
+
+// helper methods for printing latency histograms into C string, phase JSONSTATS_NUM_PHASES is the whole command
+void jsonstats_sprint_latency_buckets(char *buf, const size_t buf_size);
+void jsonstats_sprint_latency_hist(const JsonStatsCommand cmd, const JsonStatsPhase phase, char *buf,
+                                   const size_t buf_size);
+
+/* Given a duration (nanoseconds), find the latency histogram bucket index. */
+uint32_t jsonstats_find_latency_bucket(uint64_t nanos);
+
+/* Reset the latency histograms, and the path, cache and inflate counters of stats.h. */
+void jsonstats_reset_command_stats();
+
+#endif  // VALKEYJSONMODULE_JSON_LATENCY_H_
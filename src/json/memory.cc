@@ -14,15 +14,22 @@ extern "C" {
 
 #define STATIC /* decorator for static functions, remove so that backtrace symbols include these */
 
-void *(*memory_alloc)(size_t size);
-void (*memory_free)(void *ptr);
-void *(*memory_realloc)(void *orig_ptr, size_t new_size);
+std::atomic<void *(*)(size_t size)> memoryAlloc{nullptr};
+std::atomic<void (*)(void *ptr)> memoryFree{nullptr};
+std::atomic<void *(*)(void *orig_ptr, size_t new_size)> memoryRealloc{nullptr};
 size_t (*memory_allocsize)(void *ptr);
 
 bool memoryTrapsEnabled = false;
 
 static std::atomic<size_t> totalMemoryUsage;
 
+//
+// The functions of the allocator below the profile, i.e., with or without traps
+//
+static void *(*base_alloc)(size_t size);
+static void (*base_free)(void *ptr);
+static void *(*base_realloc)(void *orig_ptr, size_t new_size);
+
 size_t memory_usage() {
     return totalMemoryUsage;
 }
@@ -169,6 +176,122 @@ STATIC void *memory_realloc_with_traps(void *orig_ptr, size_t new_size) {
     return new_ptr;
 }
 
+/*
+ * The allocation profile, see memory.h
+ */
+std::atomic<bool> memoryProfileEnabled{false};
+thread_local memoryCategory_t memoryCurrentCategory = MEMORY_CATEGORY_OTHER;
+
+typedef struct {
+    std::atomic_size_t allocations;
+    std::atomic_size_t bytes;
+    std::atomic_size_t requested_bytes;
+    std::atomic_size_t frees;
+    std::atomic_size_t freed_bytes;
+} CategoryProfile;
+static CategoryProfile category_profile[MEMORY_NUM_CATEGORIES];
+
+typedef struct {
+    std::atomic_size_t allocations;
+    std::atomic_size_t bytes;
+} CommandProfile;
+static CommandProfile command_profile[JSONSTATS_NUM_COMMANDS + 1];
+
+static const char *category_names[] = {
+    "other", "nodes", "strings", "hashtables", "keytable"
+};
+static_assert(sizeof(category_names) / sizeof(category_names[0]) == MEMORY_NUM_CATEGORIES, "name every category");
+
+STATIC void profile_allocation(void *ptr, size_t requested) {
+    if (!ptr) return;
+    size_t sz = memory_allocsize(ptr);
+    CategoryProfile &c = category_profile[memoryCurrentCategory];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(sz, std::memory_order_relaxed);
+    c.requested_bytes.fetch_add(requested < sz ? requested : sz, std::memory_order_relaxed);
+    CommandProfile &cmd = command_profile[jsonstats_current_command()];
+    cmd.allocations.fetch_add(1, std::memory_order_relaxed);
+    cmd.bytes.fetch_add(sz, std::memory_order_relaxed);
+}
+
+STATIC void profile_free(void *ptr) {
+    if (!ptr) return;
+    CategoryProfile &c = category_profile[memoryCurrentCategory];
+    c.frees.fetch_add(1, std::memory_order_relaxed);
+    c.freed_bytes.fetch_add(memory_allocsize(ptr), std::memory_order_relaxed);
+}
+
+STATIC void *memory_alloc_with_profile(size_t size) {
+    void *ptr = base_alloc(size);
+    profile_allocation(ptr, size);
+    return ptr;
+}
+
+STATIC void memory_free_with_profile(void *ptr) {
+    profile_free(ptr);
+    base_free(ptr);
+}
+
+STATIC void *memory_realloc_with_profile(void *orig_ptr, size_t new_size) {
+    profile_free(orig_ptr);
+    void *ptr = base_realloc(orig_ptr, new_size);
+    profile_allocation(ptr, new_size);
+    return ptr;
+}
+
+//
+// Install the profile, or the base allocator, as the functions everyone calls. Allocations of one can be freed by
+// the other, so threads that are allocating meanwhile are fine.
+//
+STATIC void install_allocator() {
+    if (memoryProfileEnabled.load(std::memory_order_relaxed)) {
+        memoryAlloc.store(memory_alloc_with_profile, std::memory_order_relaxed);
+        memoryFree.store(memory_free_with_profile, std::memory_order_relaxed);
+        memoryRealloc.store(memory_realloc_with_profile, std::memory_order_relaxed);
+    } else {
+        memoryAlloc.store(base_alloc, std::memory_order_relaxed);
+        memoryFree.store(base_free, std::memory_order_relaxed);
+        memoryRealloc.store(base_realloc, std::memory_order_relaxed);
+    }
+}
+
+void memory_profile_control(bool enable) {
+    memoryProfileEnabled.store(enable, std::memory_order_relaxed);
+    install_allocator();
+}
+
+void memory_profile_reset() {
+    for (auto &c : category_profile) {
+        c.allocations = 0;
+        c.bytes = 0;
+        c.requested_bytes = 0;
+        c.frees = 0;
+        c.freed_bytes = 0;
+    }
+    for (auto &cmd : command_profile) {
+        cmd.allocations = 0;
+        cmd.bytes = 0;
+    }
+}
+
+const char *memory_category_name(memoryCategory_t category) {
+    return category_names[category];
+}
+
+void memory_profile_get_category(memoryCategory_t category, memoryProfile_t *profile) {
+    const CategoryProfile &c = category_profile[category];
+    profile->allocations = c.allocations;
+    profile->bytes = c.bytes;
+    profile->overhead_bytes = c.bytes - c.requested_bytes;
+    profile->frees = c.frees;
+    profile->freed_bytes = c.freed_bytes;
+}
+
+void memory_profile_get_command(JsonStatsCommand cmd, size_t *allocations, size_t *bytes) {
+    *allocations = command_profile[cmd].allocations;
+    *bytes = command_profile[cmd].bytes;
+}
+
 //
 // Enable/Disable traps
 //
@@ -179,17 +302,18 @@ bool memory_traps_control(bool enable) {
         return false;
     }
     if (enable) {
-        memory_alloc = memory_alloc_with_traps;
-        memory_free = memory_free_with_traps;
-        memory_realloc = memory_realloc_with_traps;
+        base_alloc = memory_alloc_with_traps;
+        base_free = memory_free_with_traps;
+        base_realloc = memory_realloc_with_traps;
         memory_allocsize = memory_allocsize_with_traps;
     } else {
-        memory_alloc = memory_alloc_without_traps;
-        memory_free = memory_free_without_traps;
-        memory_realloc = memory_realloc_without_traps;
+        base_alloc = memory_alloc_without_traps;
+        base_free = memory_free_without_traps;
+        base_realloc = memory_realloc_without_traps;
         memory_allocsize = memory_allocsize_without_traps;
     }
     memoryTrapsEnabled = enable;
+    install_allocator();
     return true;
 }
 
@@ -268,7 +392,9 @@ void DumpRedactedJValue(std::ostream& os, const JValue &v, size_t level, int ind
     for (size_t i = 0; i < (3 * level); ++i) os << ' ';  // Indent
     os << "@" << reinterpret_cast<const void *>(&v) << " ";
     if (index != -1) os << '[' << index << ']' << ' ';
-    if (v.IsDouble()) {
+    if (v.IsBinaryDouble()) {
+        os << "binary double\n";
+    } else if (v.IsDouble()) {
         os << "double string of length " << v.GetDoubleStringLength();
         if (!IS_VALID_MEMORY(v.trap_GetMallocPointer(false))) {
             os << " <*INVALID*>\n";
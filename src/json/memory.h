@@ -5,13 +5,17 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <vector>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <iostream>
 #include <string>
 #include <sstream>
 
+#include "json/latency.h"
+
 //
 // Trap implementation
 //
@@ -36,9 +40,18 @@
 // All functions in the module (outsize of memory.cc) should use these to allocate memory
 // instead of the ValkeyModule_xxxx functions.
 //
-extern void *(*memory_alloc)(size_t size);
-extern void (*memory_free)(void *ptr);
-extern void *(*memory_realloc)(void *orig_ptr, size_t new_size);
+// The allocator behind them is swapped while other threads are allocating when the profile is switched on or off,
+// hence the atomics. Relaxed is enough, an allocation of either allocator can be freed by the other.
+//
+extern std::atomic<void *(*)(size_t size)> memoryAlloc;
+extern std::atomic<void (*)(void *ptr)> memoryFree;
+extern std::atomic<void *(*)(void *orig_ptr, size_t new_size)> memoryRealloc;
+
+inline void *memory_alloc(size_t size) { return memoryAlloc.load(std::memory_order_relaxed)(size); }
+inline void memory_free(void *ptr) { memoryFree.load(std::memory_order_relaxed)(ptr); }
+inline void *memory_realloc(void *orig_ptr, size_t new_size) {
+    return memoryRealloc.load(std::memory_order_relaxed)(orig_ptr, new_size);
+}
 extern size_t (*memory_allocsize)(void *ptr);
 
 //
@@ -87,6 +100,80 @@ static inline bool IS_VALID_MEMORY(t *ptr) {
     return memory_validate_ptr(ptr, false);
 }
 
+//
+// Allocation profile
+//
+// The allocation profile is a diagnostic that tells which kind of memory the module is allocating. Allocations are
+// attributed to the category of the innermost MemoryCategoryScope of the allocating thread: document memory is
+// NODES unless a scope says otherwise, e.g., string payloads and object hashtables, KeyTable memory is KEYTABLE and
+// everything else, e.g., STL containers and reply buffers, is OTHER. Frees are attributed the same way. The bytes of
+// an allocation are what the allocator handed out, the overhead is the part of that which wasn't requested.
+// Allocations are also counted against the JSON command being run on the thread, see latency.h.
+//
+// Unlike traps, the profile doesn't change the layout of allocations, so it can be switched on and off at any time.
+// Its counters cover what was allocated and freed while it was on, see JSON.DEBUG MEMORY-PROFILE.
+//
+typedef enum MEMORY_CATEGORY {
+    MEMORY_CATEGORY_OTHER = 0,
+    MEMORY_CATEGORY_NODES,          // Document memory not in another category: arrays of values, member vectors,
+                                    // the blocks of arenas
+    MEMORY_CATEGORY_STRINGS,        // String payloads and the text of numbers
+    MEMORY_CATEGORY_HASHTABLES,     // Object hashtables
+    MEMORY_CATEGORY_KEYTABLE,       // KeyTable strings and tables
+    MEMORY_NUM_CATEGORIES
+} memoryCategory_t;
+
+typedef struct {
+    size_t allocations;
+    size_t bytes;
+    size_t overhead_bytes;
+    size_t frees;
+    size_t freed_bytes;
+} memoryProfile_t;
+
+inline bool memory_profile_enabled() {
+    extern std::atomic<bool> memoryProfileEnabled;
+    return memoryProfileEnabled.load(std::memory_order_relaxed);
+}
+
+//
+// Switches the profile on or off. Switching it on doesn't reset the counters.
+//
+void memory_profile_control(bool enable);
+void memory_profile_reset();
+const char *memory_category_name(memoryCategory_t category);
+void memory_profile_get_category(memoryCategory_t category, memoryProfile_t *profile);
+//
+// Allocations made while running a command, JSONSTATS_NUM_COMMANDS is all of those made outside of a command
+//
+void memory_profile_get_command(JsonStatsCommand cmd, size_t *allocations, size_t *bytes);
+
+extern thread_local memoryCategory_t memoryCurrentCategory;
+
+//
+// Attributes the allocations and frees of this thread to a category from construction to destruction. A default
+// scope only applies if no other category was set. Costs a global check while the profile is off.
+//
+class MemoryCategoryScope {
+ public:
+    explicit MemoryCategoryScope(memoryCategory_t category, bool is_default = false)
+        : active(memory_profile_enabled() && (!is_default || memoryCurrentCategory == MEMORY_CATEGORY_OTHER)) {
+        if (active) {
+            outer = memoryCurrentCategory;
+            memoryCurrentCategory = category;
+        }
+    }
+    ~MemoryCategoryScope() {
+        if (active) memoryCurrentCategory = outer;
+    }
+
+ private:
+    MemoryCategoryScope(const MemoryCategoryScope &);  // disable copy constructor
+    MemoryCategoryScope& operator=(const MemoryCategoryScope &);  // disable assignment operator
+    bool active;
+    memoryCategory_t outer;
+};
+
 //
 // Classes for STL Containers that utilize memory usage and trap logic.
 //
@@ -114,6 +201,9 @@ template<class Key, class Compare = std::less<Key>> using set = std::set<Key, Co
 template<class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
         using unordered_set = std::unordered_set<Key, Hash, KeyEqual, stl_allocator<Key>>;
 
+template<class Key, class T, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+        using unordered_map = std::unordered_map<Key, T, Hash, KeyEqual, stl_allocator<std::pair<const Key, T>>>;
+
 typedef std::basic_string<char, std::char_traits<char>, stl_allocator<char>> string;
 typedef std::basic_stringstream<char, std::char_traits<char>, stl_allocator<char>> stringstream;
 
@@ -1,9 +1,11 @@
 #include "json/selector.h"
 #include "json/util.h"
 #include "json/json.h"
+#include "json/stats.h"
 #include "json/rapidjson_includes.h"
 #include <rapidjson/pointer.h>
 #include <iostream>
+#include <cstdio>
 #include <cstring>
 #include <algorithm>
 #include <iterator>
@@ -20,6 +22,11 @@ std::cout << level << " " << msg << std::endl;
 static const char DOUBLE_QUOTE = '"';
 static const char SINGLE_QUOTE = '\'';
 
+// Characters that can't appear in, and therefore terminate, an unquoted member name
+static const char *unquotedMemberNameTerminators = ".[]()<>=!'\" |&";
+
+PathCache *pathCache = nullptr;
+
 typedef rapidjson::GenericPointer<RJValue, RapidJsonAllocator> RJPointer;
 
 struct JPointer : RJPointer {
@@ -295,7 +302,6 @@ int64_t Lexer::scanUnsignedInteger() {
  */
 JsonUtilCode Lexer::scanUnquotedMemberName(StringViewHelper &member_name) {
     // Check if the first character is a member name terminator char
-    static const char *unquotedMemberNameTerminators = ".[]()<>=!'\" |&";
     const char *p_start = next.strVal.data();
     if (strchr(unquotedMemberNameTerminators, *p_start) != nullptr) {
         TRACE("ERROR", "scanUnquotedMemberName invalid first char of an expected member name: " << p_start)
@@ -603,9 +609,19 @@ void Lexer::unescape(const std::string_view &input, jsn::stringstream &ss) {
 }
 
 JsonUtilCode Selector::getValues(JValue &root, const char *path) {
-    JsonUtilCode rc = init(root, path, READ);
+    return getValues(root, nullptr, path);
+}
+
+JsonUtilCode Selector::getValues(JDocument &doc, const char *path) {
+    JsonUtilCode rc = getValues(doc, &doc, path);
+    if (rc == JSONUTIL_SUCCESS) recordUpdates();
+    return rc;
+}
+
+JsonUtilCode Selector::getValues(JValue &root, JDocument *doc, const char *path) {
+    JsonUtilCode rc = init(root, doc, path, READ);
     if (rc != JSONUTIL_SUCCESS) return rc;
-    return eval();
+    return evalPath();
 }
 
 struct pathCompare {
@@ -645,10 +661,18 @@ struct pathCompare {
 };
 
 JsonUtilCode Selector::deleteValues(JValue &root, const char *path, size_t &numValsDeleted) {
+    return deleteValues(root, nullptr, path, numValsDeleted);
+}
+
+JsonUtilCode Selector::deleteValues(JDocument &doc, const char *path, size_t &numValsDeleted) {
+    return deleteValues(doc, &doc, path, numValsDeleted);
+}
+
+JsonUtilCode Selector::deleteValues(JValue &root, JDocument *doc, const char *path, size_t &numValsDeleted) {
     numValsDeleted = 0;
-    JsonUtilCode rc = init(root, path, DELETE);
+    JsonUtilCode rc = init(root, doc, path, DELETE);
     if (rc != JSONUTIL_SUCCESS) return rc;
-    rc = eval();
+    rc = evalPath();
     if (rc != JSONUTIL_SUCCESS) return rc;
     if (!isV2Path && !hasValues()) return JSONUTIL_JSON_PATH_NOT_EXIST;
     if (resultSet.empty()) return getError();
@@ -675,19 +699,24 @@ JsonUtilCode Selector::deleteValues(JValue &root, const char *path, size_t &numV
                 DumpRedactedJValue(*resultSet[0].first, nullptr, "warning");
             }
         }
-        if (deleteValue(resultSet[0].second)) numValsDeleted++;
+        jsn::string value_path = getPath(resultSet[0]);
+        invalidateIndexes(value_path);
+        if (deleteValue(value_path)) numValsDeleted++;
     } else {
+        // Paths refer to member names in the document, so all of them are materialized before deleting anything
         jsn::set<jsn::string, pathCompare> path_set;
         for (auto &vInfo : resultSet) {
             if (json_is_instrument_enabled_delete()) {
                 ValkeyModule_Log(nullptr, "warning", "preparing to delete value %p of doc %p at path %s",
-                                static_cast<void *>(vInfo.first), static_cast<void *>(&root), vInfo.second.c_str());
+                                static_cast<void *>(vInfo.first), static_cast<void *>(&root),
+                                getPath(vInfo).c_str());
                 if (json_is_instrument_enabled_dump_value_before_delete()) {
                     DumpRedactedJValue(*vInfo.first, nullptr, "warning");
                 }
             }
-            path_set.insert(std::move(vInfo.second));
+            path_set.insert(getPath(vInfo));
         }
+        for (auto &value_path : path_set) invalidateIndexes(value_path);
         for (auto it = path_set.begin(); it != path_set.end(); it++) {
             if (json_is_instrument_enabled_delete()) {
                 ValkeyModule_Log(nullptr, "warning", "deleting value of doc %p at path %s",
@@ -719,9 +748,89 @@ bool Selector::deleteValue(const jsn::string &path) {
     TRACE("DEBUG", "deleteValue deleting value at " << path)
     JPointer ptr = JPointer(path);
     if (ptr.HasError() || !ptr.PathExists(*root)) return false;
+    JsonEffectRecorder *recorder = JsonEffectRecorder::current();
+    if (recorder != nullptr) {
+        jsn::string json_path;
+        resolvePointer(*root, path, json_path);
+        recorder->deleted.emplace_back(json_path.c_str(), json_path.length());
+    }
     return ptr.Erase(*root);
 }
 
+thread_local JsonEffectRecorder *JsonEffectRecorder::active = nullptr;
+
+JsonEffectRecorder::JsonEffectRecorder() : updated(), deleted(), outermost(active == nullptr) {
+    if (outermost) active = this;
+}
+
+JsonEffectRecorder::~JsonEffectRecorder() {
+    if (outermost) active = nullptr;
+}
+
+void Selector::recordUpdates() {
+    JsonEffectRecorder *recorder = JsonEffectRecorder::current();
+    if (recorder == nullptr) return;
+    for (auto &vInfo : resultSet) {
+        jsn::string path = getPath(vInfo);
+        recorder->updated.emplace_back(path.c_str(), path.length());
+    }
+    for (auto &path : insertPaths) recorder->updated.emplace_back(path.c_str(), path.length());
+}
+
+bool Selector::isDefinitePath(const char *path) {
+    std::shared_ptr<const CompiledPath> compiled = pathCache != nullptr ? pathCache->get(path)
+                                                                         : CompiledPath::compile(path);
+    if (!compiled->compiled) return false;
+    for (auto &step : compiled->steps) {
+        if (step.type != CompiledPath::Step::MEMBER && step.type != CompiledPath::Step::INDEX) return false;
+    }
+    return true;
+}
+
+void Selector::appendMemberStep(jsn::string &json_path, const std::string_view &name) {
+    // Quotes, backslashes and control characters are \u escapes, so that the lexer never sees \"
+    json_path.append("[\"");
+    for (char ch : name) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c == DOUBLE_QUOTE || c == '\\' || c < ' ') {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            json_path.append(buf);
+        } else {
+            json_path.push_back(ch);
+        }
+    }
+    json_path.append("\"]");
+}
+
+void Selector::appendIndexStep(jsn::string &json_path, size_t index) {
+    json_path.append("[").append(std::to_string(index).c_str()).append("]");
+}
+
+JValue *Selector::resolvePointer(JValue &root, const jsn::string &pointer, jsn::string &json_path) {
+    JPointer ptr = JPointer(pointer);
+    if (ptr.HasError()) return nullptr;
+    json_path = "$";
+    JValue *v = &root;
+    const JPointer::Token *tokens = ptr.GetTokens();
+    for (size_t i = 0; i < ptr.GetTokenCount(); i++) {
+        const JPointer::Token &t = tokens[i];
+        if (v->IsArray()) {
+            if (t.index == rapidjson::kPointerInvalidIndex || t.index >= v->Size()) return nullptr;
+            appendIndexStep(json_path, t.index);
+            v = &(*v)[t.index];
+        } else if (v->IsObject()) {
+            auto m = v->FindMember(std::string_view(t.name, t.length));
+            if (m == v->MemberEnd()) return nullptr;
+            appendMemberStep(json_path, std::string_view(t.name, t.length));
+            v = &m->value;
+        } else {
+            return nullptr;
+        }
+    }
+    return v;
+}
+
 /**
  * Single stage insert/update, which commits the operation.
  *
@@ -749,9 +858,19 @@ JsonUtilCode Selector::setValues(JValue &root, const char *path, JValue &new_val
  *    operation.
  */
 JsonUtilCode Selector::prepareSetValues(JValue &root, const char *path) {
-    JsonUtilCode rc = init(root, path, INSERT_OR_UPDATE);
+    return prepareSetValues(root, nullptr, path);
+}
+
+JsonUtilCode Selector::prepareSetValues(JDocument &doc, const char *path) {
+    JsonUtilCode rc = prepareSetValues(doc, &doc, path);
+    if (rc == JSONUTIL_SUCCESS) recordUpdates();
+    return rc;
+}
+
+JsonUtilCode Selector::prepareSetValues(JValue &root, JDocument *doc, const char *path) {
+    JsonUtilCode rc = init(root, doc, path, INSERT_OR_UPDATE);
     if (rc != JSONUTIL_SUCCESS) return rc;
-    rc = eval();
+    rc = evalPath();
     if (rc != JSONUTIL_SUCCESS) return rc;
     return JSONUTIL_SUCCESS;
 }
@@ -778,19 +897,29 @@ JsonUtilCode Selector::commit(JValue &new_val) {
         }
 
         if (rs.size() == 1) {
-            JPointer ptr = JPointer(rs[0].second);
+            jsn::string path = getPath(rs[0]);
+            JPointer ptr = JPointer(path);
             if (ptr.HasError()) return ptr.error;
+            invalidateIndexes(path);
             if (json_is_instrument_enabled_update()) {
                 ValkeyModule_Log(nullptr, "warning", "updating value %p of doc %p at path %s",
-                                static_cast<void *>(rs[0].first), static_cast<void *>(root), rs[0].second.c_str());
+                                static_cast<void *>(rs[0].first), static_cast<void *>(root), path.c_str());
             }
             ptr.Swap(*root, new_val, allocator);
-            TRACE("DEBUG", "commit updated value at " << rs[0].second);
+            TRACE("DEBUG", "commit updated value at " << path);
         } else {
+            // Paths refer to member names in the document, an update may free the names of the paths after it
+            jsn::vector<jsn::string> paths;
+            paths.reserve(rs.size());
             for (auto &vInfo : rs) {
+                paths.push_back(getPath(vInfo));
+                invalidateIndexes(paths.back());
+            }
+            for (size_t i = 0; i < rs.size(); i++) {
+                const ValueInfo &vInfo = rs[i];
                 // copy the new value so that it can be set at multiple paths
                 JValue new_val_copy(new_val, allocator);
-                JPointer ptr = JPointer(vInfo.second);
+                JPointer ptr = JPointer(paths[i]);
                 if (ptr.HasError()) return ptr.error;
                 // An existing path may not exist due to updates of other values.
                 // However, JPointer will always insert the value if the path does not exist.
@@ -799,10 +928,10 @@ JsonUtilCode Selector::commit(JValue &new_val) {
                     if (json_is_instrument_enabled_update()) {
                         ValkeyModule_Log(nullptr, "warning", "updating value %p of doc %p at path %s",
                                         static_cast<void *>(vInfo.first), static_cast<void *>(&root),
-                                        vInfo.second.c_str());
+                                        paths[i].c_str());
                     }
                     ptr.Swap(*root, new_val_copy, allocator);
-                    TRACE("DEBUG", "commit updated value at " << vInfo.second);
+                    TRACE("DEBUG", "commit updated value at " << paths[i]);
                 }
             }
         }
@@ -842,6 +971,7 @@ JsonUtilCode Selector::commit(JValue &new_val) {
                 ValkeyModule_Log(nullptr, "warning", "inserting value into doc %p at path %s",
                                 static_cast<void *>(root), (*insertPaths.begin()).c_str());
             }
+            invalidateIndexes(*insertPaths.begin());
             ptr.Set(*root, new_val, allocator);
             TRACE("DEBUG", "commit inserted value at " << *insertPaths.begin());
         } else {
@@ -854,6 +984,7 @@ JsonUtilCode Selector::commit(JValue &new_val) {
                     ValkeyModule_Log(nullptr, "warning", "inserting value into doc %p at path %s",
                                     static_cast<void *>(root), path.c_str());
                 }
+                invalidateIndexes(path);
                 ptr.Set(*root, new_val_copy, allocator);
                 TRACE("DEBUG", "commit inserted value at " << *insertPaths.begin());
             }
@@ -875,32 +1006,109 @@ JsonUtilCode Selector::commit(JValue &new_val) {
     return JSONUTIL_SUCCESS;
 }
 
-JsonUtilCode Selector::init(JValue &root, const char *path, const Mode mode) {
+/**
+ * Apply a merge patch to a value in place, as RFC 7396. Existing members of the target are merged into recursively,
+ * so they keep their names and hash table slots. New members share the names of the patch in the KeyTable.
+ */
+static void mergePatch(JValue &target, const JValue &patch) {
+    if (!patch.IsObject()) {
+        target.CopyFrom(patch, allocator);
+        return;
+    }
+    if (!target.IsObject()) target.SetObject();
+    for (auto m = patch.MemberBegin(); m != patch.MemberEnd(); ++m) {
+        JValue::MemberIterator it = target.FindMember(m->name);
+        if (m->value.IsNull()) {
+            if (it != target.MemberEnd()) target.EraseMember(it);
+        } else if (it != target.MemberEnd()) {
+            mergePatch(it->value, m->value);
+        } else {
+            // merging into nothing drops the nulls of nested objects
+            JValue value;
+            mergePatch(value, m->value);
+            KeyTable_Handle h = keyTable->clone(m->name);
+            JValue name(h);
+            target.AddMember(name, value, allocator);
+        }
+    }
+}
+
+/**
+ * Commit a 2-stage merge, prepared by prepareSetValues. The patch is merged into the values to update, and
+ * inserted, without its nulls, at the insert paths.
+ */
+JsonUtilCode Selector::commitMerge(JValue &patch) {
+    if (resultSet.empty() && insertPaths.empty()) return getError();
+
+    auto &rs = getUniqueResultSet();
+    if (!rs.empty()) {
+        // Paths refer to member names in the document, a merge may free the names of the paths after it
+        jsn::vector<jsn::string> paths;
+        paths.reserve(rs.size());
+        for (auto &vInfo : rs) {
+            paths.push_back(getPath(vInfo));
+            invalidateIndexes(paths.back());
+        }
+        for (auto &path : paths) {
+            JPointer ptr = JPointer(path);
+            if (ptr.HasError()) return ptr.error;
+            // A value may be gone if an earlier merge of a value that contains it removed or replaced it
+            JValue *value = ptr.Get(*root);
+            if (value) mergePatch(*value, patch);
+            TRACE("DEBUG", "commitMerge merged value at " << path);
+        }
+    }
+
+    if (!insertPaths.empty()) {
+        JValue new_val;
+        mergePatch(new_val, patch);
+        resultSet.clear();  // merged above, commit only the inserts
+        return commit(new_val);
+    }
+    return JSONUTIL_SUCCESS;
+}
+
+JsonUtilCode Selector::init(JValue &root, JDocument *doc, const char *path, const Mode mode) {
     CHECK_QUERY_STRING_SIZE(path);
     this->mode = mode;
     this->root = &root;
+    indexedDoc = (doc != nullptr && doc->GetIndexes() != nullptr) ? doc : nullptr;
     node = &root;
-    nodePath = "";
+    nodePath = ROOT_PATH;
+    pathSteps.clear();
+    pinnedPathSteps = 0;
     lex.init(path);
     resultSet.clear();
     insertPaths.clear();
     maxPathDepth = 0;
     currPathDepth = 0;
+    hasFilter = false;
     error = JSONUTIL_SUCCESS;
 
+    JsonPhaseTimer phase(JSONSTATS_PHASE_PATH_PARSE);
+    compiledPath = pathCache ? pathCache->get(path) : CompiledPath::compile(path);
+    // The interpreter detects v2 syntax when it matches the leading '$', compiled paths know it upfront.
+    if (compiledPath->compiled && compiledPath->isV2Path) isV2Path = true;
+
     lex.nextToken();  // initial pull
     return JSONUTIL_SUCCESS;
 }
 
+JsonUtilCode Selector::evalPath() {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_TRAVERSAL);
+    JsonUtilCode rc = compiledPath->compiled ? evalSteps(0) : eval();
+    jsonstats_count_path(isV2Path, isRecursiveSearch, hasFilter);
+    return rc;
+}
+
 JsonUtilCode Selector::eval() {
     TRACE("DEBUG", "eval curr token: " << lex.currToken().type << ", remaining path: " << lex.p
-        << ", nodePath: " << nodePath)
+        << ", nodePath: " << getPath(nodePath))
     CHECK_RECURSION_DEPTH();
     JsonUtilCode rc = parseSupportedPath();
     if (rc == JSONUTIL_SUCCESS && node != nullptr) {
         // select the value
-        ValueInfo vInfo(node, nodePath);
-        resultSet.push_back(std::move(vInfo));
+        selectValue();
     }
     return rc;
 }
@@ -978,7 +1186,8 @@ JsonUtilCode Selector::parseRecursivePath() {
  */
 JsonUtilCode Selector::recursiveSearch(JValue &v, const char *p) {
     TRACE("DEBUG", "recursiveSearch curr token " << lex.currToken().type << ", curr path: "<< lex.p
-        << ", nodePath: " << nodePath << ", currPathDepth: " << currPathDepth << ", maxPathDepth: " << maxPathDepth)
+        << ", nodePath: " << getPath(nodePath) << ", currPathDepth: " << currPathDepth << ", maxPathDepth: "
+        << maxPathDepth)
     if (lex.currToken().type == Token::DOTDOT || lex.currToken().type == Token::DOT) {
         TRACE("DEBUG", "We have an ambiguous (and therefore invalid) sequence of 3+ dots")
         return JSONUTIL_INVALID_DOT_SEQUENCE;
@@ -998,30 +1207,30 @@ JsonUtilCode Selector::recursiveSearch(JValue &v, const char *p) {
     if (isSyntaxError(rc)) return rc;
 
     // Descend to each child (i.e., recursive descent)
+    size_t path = nodePath;
+    size_t numPathSteps = pathSteps.size();
     if (v.IsObject()) {
         for (auto &m : v.GetObject()) {
-            jsn::string path_copy = nodePath;
-            nodePath.append("/").append(m.name.GetStringView());
+            appendPathMember(m.name.GetStringView());
             incrPathDepth();
             TRACE("DEBUG", "-> recursiveSearch descend to object member " << m.name.GetStringView()
-                << ", nodePath: " << nodePath << ", currPathDepth: " << currPathDepth << ", maxPathDepth: "
+                << ", nodePath: " << getPath(nodePath) << ", currPathDepth: " << currPathDepth << ", maxPathDepth: "
                 << maxPathDepth)
             rc = recursiveSearch(m.value, p);
             decrPathDepth();
             if (isSyntaxError(rc)) return rc;
-            nodePath = path_copy;
+            restorePath(path, numPathSteps);
         }
     } else if (v.IsArray()) {
         for (int64_t i=0; i < v.Size(); i++) {
-            jsn::string path_copy = nodePath;
-            nodePath.append("/").append(std::to_string(i));
+            appendPathIndex(i);
             incrPathDepth();
-            TRACE("DEBUG", "-> recursiveSearch descend to array index " << i << ", nodePath: " << nodePath
+            TRACE("DEBUG", "-> recursiveSearch descend to array index " << i << ", nodePath: " << getPath(nodePath)
             << ", currPathDepth: " << currPathDepth << ", maxPathDepth: " << maxPathDepth)
             rc = recursiveSearch(v.GetArray()[i], p);
             decrPathDepth();
             if (isSyntaxError(rc)) return rc;
-            nodePath = path_copy;
+            restorePath(path, numPathSteps);
         }
     }
 
@@ -1057,7 +1266,7 @@ JsonUtilCode Selector::parseBracketPath() {
  */
 JsonUtilCode Selector::parseBracketPathElement() {
     if (!lex.matchToken(Token::LBRACKET, true)) {
-        TRACE("ERROR", "parseBracketPathElement token [ is not seen"  << ", nodePath: " << nodePath)
+        TRACE("ERROR", "parseBracketPathElement token [ is not seen"  << ", nodePath: " << getPath(nodePath))
         return JSONUTIL_INVALID_JSON_PATH;
     }
 
@@ -1073,7 +1282,7 @@ JsonUtilCode Selector::parseBracketPathElement() {
         }
     }
     if (rc != JSONUTIL_SUCCESS) {
-        TRACE("ERROR", "parseBracketPathElement rc: " << rc << ", nodePath: " << nodePath)
+        TRACE("ERROR", "parseBracketPathElement rc: " << rc << ", nodePath: " << getPath(nodePath))
         return rc;
     }
     lex.skipSpaces();
@@ -1135,7 +1344,7 @@ JsonUtilCode Selector::processUnionOfMembers(const jsn::vector<jsn::string> &mem
         StringViewHelper member_name;
         member_name.setInternalString(member_names[0]);
         TRACE("DEBUG", "processUnionOfMembers member: " << member_name.getView())
-        return traverseToObjectMember(member_name);
+        return traverseToObjectMember(member_name, lex.peekToken() == Token::END);
     }
 
     if (!node->IsObject()) {
@@ -1150,7 +1359,7 @@ JsonUtilCode Selector::processUnionOfMembers(const jsn::vector<jsn::string> &mem
         JValue::MemberIterator it = node->FindMember(s);
         if (it != node->MemberEnd()) {
             StringViewHelper member_name;
-            member_name.setInternalString(s);
+            member_name.setExternalView(it->name.GetStringView());
             JsonUtilCode rc = evalObjectMember(member_name, it->value);
             if (isSyntaxError(rc)) return rc;
         }
@@ -1183,7 +1392,7 @@ JsonUtilCode Selector::parseQuotedMemberName(jsn::stringstream &ss) {
  *   QualifiedPath       ::= QualifiedPathElement RelativePath
  */
 JsonUtilCode Selector::parseQualifiedPath() {
-    TRACE("DEBUG", "parseQualifiedPath curr token: " << lex.currToken().type << ", nodePath: " << nodePath)
+    TRACE("DEBUG", "parseQualifiedPath curr token: " << lex.currToken().type << ", nodePath: " << getPath(nodePath))
     JsonUtilCode rc = parseQualifiedPathElement();
     if (rc != JSONUTIL_SUCCESS) return rc;
     return parseRelativePath();
@@ -1215,7 +1424,7 @@ JsonUtilCode Selector::parseKey() {
         StringViewHelper name;
         JsonUtilCode rc = parseUnquotedMemberName(name);
         if (rc != JSONUTIL_SUCCESS) return rc;
-        return traverseToObjectMember(name);
+        return traverseToObjectMember(name, lex.peekToken() == Token::END);
     }
 }
 
@@ -1225,7 +1434,7 @@ JsonUtilCode Selector::parseKey() {
 JsonUtilCode Selector::parseUnquotedMemberName(StringViewHelper &name) {
     JsonUtilCode rc = lex.scanUnquotedMemberName(name);
     if (rc != JSONUTIL_SUCCESS) return rc;
-    TRACE("DEBUG", "parseUnquotedMemberName name: " << name.getView() << ", nodePath: " << nodePath)
+    TRACE("DEBUG", "parseUnquotedMemberName name: " << name.getView() << ", nodePath: " << getPath(nodePath))
     return JSONUTIL_SUCCESS;
 }
 
@@ -1270,7 +1479,7 @@ JsonUtilCode Selector::processWildcardKey() {
         State state;
         snapshotState(state);
         StringViewHelper member_name;
-        member_name.setInternalView(m.name.GetStringView());
+        member_name.setExternalView(m.name.GetStringView());
         rc = evalObjectMember(member_name, m.value);
         restoreState(state);
         if (isSyntaxError(rc)) return rc;
@@ -1284,7 +1493,8 @@ JsonUtilCode Selector::processWildcardIndex() {
     JsonUtilCode rc;
     for (int64_t i=0; i < node->Size(); i++) {
         TRACE("DEBUG", "processWildcardIndex continue parsing array index " << i
-            << ", curr token: " << lex.currToken().type << ", remaining path: " << lex.p << ", nodePath: " << nodePath)
+            << ", curr token: " << lex.currToken().type << ", remaining path: " << lex.p
+            << ", nodePath: " << getPath(nodePath))
         rc = evalArrayMember(i);
         if (isSyntaxError(rc)) return rc;
     }
@@ -1313,6 +1523,9 @@ JsonUtilCode Selector::evalMember(JValue &m, const char *path_start) {
     return eval();
 }
 
+/**
+ * @param member_name must be a view of the member's key in the document, it's kept in the path of selected values.
+ */
 JsonUtilCode Selector::evalObjectMember(const StringViewHelper &member_name, JValue &val) {
     if (!node->IsObject()) {
         TRACE("DEBUG", "evalObjectMember Current node is not object. Cannot eval member "
@@ -1323,9 +1536,9 @@ JsonUtilCode Selector::evalObjectMember(const StringViewHelper &member_name, JVa
     State state;
     snapshotState(state);
 
-    nodePath.append("/").append(member_name.getView());
+    appendPathMember(member_name.getView());
     TRACE("DEBUG", "evalObjectMember object member " << member_name.getView()
-    << ", curr token: " << lex.currToken().type << ", remaining path: " << lex.p << ", nodePath: " << nodePath)
+    << ", curr token: " << lex.currToken().type << ", remaining path: " << lex.p << ", nodePath: " << getPath(nodePath))
     JsonUtilCode rc =  evalMember(val, lex.p);
 
     restoreState(state);
@@ -1342,16 +1555,19 @@ JsonUtilCode Selector::evalArrayMember(int64_t idx) {
     State state;
     snapshotState(state);
 
-    nodePath.append("/").append(std::to_string(idx));
+    appendPathIndex(idx);
     TRACE("DEBUG", "evalArrayMember array index " << idx << ", curr token: " << lex.currToken().type
-        << ", remaining path: " << lex.p << ", nodePath: " << nodePath)
+        << ", remaining path: " << lex.p << ", nodePath: " << getPath(nodePath))
     JsonUtilCode rc = evalMember(node->GetArray()[idx], lex.p);
 
     restoreState(state);
     return rc;
 }
 
-JsonUtilCode Selector::traverseToObjectMember(const StringViewHelper &member_name) {
+/**
+ * @param isLastStep true if the member is the last element of the path, which is where a new member can be inserted.
+ */
+JsonUtilCode Selector::traverseToObjectMember(const StringViewHelper &member_name, const bool isLastStep) {
     if (!node->IsObject()) {
         // We should not assert node must be an object, because this could just be a user error.
         // e.g., path: $.phoneNumbers.city, where phoneNumbers is actually an array not object. An assertion would
@@ -1359,7 +1575,7 @@ JsonUtilCode Selector::traverseToObjectMember(const StringViewHelper &member_nam
         // with no matching values found. Neither should we indicate a syntax error that will fail the entire search,
         // because this is just a termination of one search path. Other path searches should continue.
         TRACE("DEBUG", "traverseToObjectMember Current node is not object. Cannot traverse to member "
-        << member_name.getView() << ", nodePath: " << nodePath)
+        << member_name.getView() << ", nodePath: " << getPath(nodePath))
         if (mode != READ) return JSONUTIL_CANNOT_INSERT_MEMBER_INTO_NON_OBJECT_VALUE;
 
         // Null out the current node to signal termination of the current path search.
@@ -1372,24 +1588,24 @@ JsonUtilCode Selector::traverseToObjectMember(const StringViewHelper &member_nam
          TRACE("DEBUG", "traverseToObjectMember Member not found: "
          << member_name.getView() << " len: "
          << member_name.getView().length() << " mode:" << mode
-         << " cur node isObj? " << node->IsObject() << ", nodePath: " << nodePath)
+         << " cur node isObj? " << node->IsObject() << ", nodePath: " << getPath(nodePath))
 #ifdef INSTRUMENT_V2PATH
          dom_dump_value(*node);
 #endif
 
         if ((mode == INSERT || mode == INSERT_OR_UPDATE) && !isRecursiveSearch) {
             // A new key can be appended to an object if and only if it is the last child in the path
-            TRACE("DEBUG", "traverseToObjectMember insert mode, peek next token: " << lex.peekToken()
-                << ", nodePath: " << nodePath);
-            if (lex.peekToken() == Token::END) {
-                jsn::string insert_path = nodePath;
+            TRACE("DEBUG", "traverseToObjectMember insert mode, last step: " << isLastStep
+                << ", nodePath: " << getPath(nodePath));
+            if (isLastStep) {
+                jsn::string insert_path = getPath(nodePath);
                 insert_path.append("/").append(member_name.getView());
                 TRACE("DEBUG", "traverseToObjectMember add insert path: " << insert_path)
                 insertPaths.insert(std::move(insert_path));
                 incrPathDepth();
             } else {
                 TRACE("DEBUG", "traverseToObjectMember insert mode, cannot insert because current "
-                               "node is not the last child in the path, nodePath: " << nodePath)
+                               "node is not the last child in the path, nodePath: " << getPath(nodePath))
                 setError(JSONUTIL_JSON_PATH_NOT_EXIST);
                 return JSONUTIL_JSON_PATH_NOT_EXIST;
             }
@@ -1400,10 +1616,10 @@ JsonUtilCode Selector::traverseToObjectMember(const StringViewHelper &member_nam
         return JSONUTIL_SUCCESS;
     }
 
-    nodePath.append("/").append(member_name.getView());
+    appendPathMember(it->name.GetStringView());
     TRACE("DEBUG", "traverseToObjectMember traversed to object member "
     << member_name.getView() << ". remaining path: " << lex.p
-    << ", nodePath: " << nodePath)
+    << ", nodePath: " << getPath(nodePath))
     node = &it->value;
     incrPathDepth();
     return JSONUTIL_SUCCESS;
@@ -1419,7 +1635,7 @@ JsonUtilCode Selector::traverseToArrayIndex(int64_t idx) {
         // continue.
 
         TRACE("DEBUG", "traverseToArrayIndex Current node is not array. Cannot traverse to index " << idx
-            << ", nodePath: " << nodePath)
+            << ", nodePath: " << getPath(nodePath))
         // Null out the current node to signal termination of the current path search.
         node = nullptr;
         return JSONUTIL_SUCCESS;
@@ -1433,8 +1649,8 @@ JsonUtilCode Selector::traverseToArrayIndex(int64_t idx) {
         return JSONUTIL_INDEX_OUT_OF_ARRAY_BOUNDARIES;
     }
 
-    nodePath.append("/").append(std::to_string(idx));
-    TRACE("DEBUG", "traverseToArrayIndex traversed to array index " << idx << ", nodePath: " << nodePath)
+    appendPathIndex(idx);
+    TRACE("DEBUG", "traverseToArrayIndex traversed to array index " << idx << ", nodePath: " << getPath(nodePath))
     node = &node->GetArray()[idx];
     incrPathDepth();
     return JSONUTIL_SUCCESS;
@@ -1586,7 +1802,7 @@ JsonUtilCode Selector::processSlice(int64_t start, int64_t end, const int64_t st
     if (!node->IsArray()) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
     if (!lex.matchToken(Token::RBRACKET, true)) return JSONUTIL_INVALID_JSON_PATH;
     TRACE("DEBUG", "processSlice start: " << start << " end: " << end << " step: "
-            << step << ", p: " << lex.p << ", nodePath: " << nodePath)
+            << step << ", p: " << lex.p << ", nodePath: " << getPath(nodePath))
     // handle negative index
     if (start < 0) start += node->Size();
     if (end < 0) end += node->Size();
@@ -1640,6 +1856,7 @@ JsonUtilCode Selector::processSlice(int64_t start, int64_t end, const int64_t st
  *   PartialPath         ::= "$" RelativePath
  */
 JsonUtilCode Selector::parseFilter() {
+    hasFilter = true;
     lex.nextToken();  // skip QUESTION_MARK
     if (!lex.matchToken(Token::LPAREN)) return JSONUTIL_INVALID_JSON_PATH;
     jsn::vector<int64_t> result;  // subset of indexes of the current array
@@ -1656,7 +1873,7 @@ JsonUtilCode Selector::processFilterResult(jsn::vector<int64_t> &result) {
     if (node->IsArray()) {
         for (auto idx : result) {
             TRACE("DEBUG", "processFilterResult proceed to array index " << idx << ". remaining path: "
-                << lex.p << ", nodePath: " << nodePath)
+                << lex.p << ", nodePath: " << getPath(nodePath))
             rc = evalArrayMember(idx);
             if (isSyntaxError(rc)) return rc;
         }
@@ -1688,7 +1905,7 @@ JsonUtilCode Selector::parseFilterExpr(jsn::vector<int64_t> &result) {
     CHECK_RECURSION_DEPTH();
     lex.skipSpaces();
     JsonUtilCode rc = parseTerm(result);
-    TRACE("DEBUG", "parseFilterExpr parsed first term, rc: " << rc << ", nodePath: " << nodePath)
+    TRACE("DEBUG", "parseFilterExpr parsed first term, rc: " << rc << ", nodePath: " << getPath(nodePath))
     if (rc != JSONUTIL_SUCCESS) return rc;
 
     jsn::unordered_set<int64_t> set;
@@ -1697,7 +1914,7 @@ JsonUtilCode Selector::parseFilterExpr(jsn::vector<int64_t> &result) {
     while (lex.matchToken(Token::OR, true)) {
         v.clear();
         rc = parseTerm(v);
-        TRACE("DEBUG", "parseFilterExpr parsed OR term, rc: " << rc << ", nodePath: " << nodePath)
+        TRACE("DEBUG", "parseFilterExpr parsed OR term, rc: " << rc << ", nodePath: " << getPath(nodePath))
         if (rc != JSONUTIL_SUCCESS) return rc;
 
         if (!set_initialized) {
@@ -1960,7 +2177,8 @@ JsonUtilCode Selector::parseComparisonValue(JValue &v) {
         }
 
         if (parser.Parse(sv.getView()).HasParseError()) {
-            TRACE("DEBUG", "parseComparisonValue failed to parse " << sv.getView() << ", nodePath: " << nodePath)
+            TRACE("DEBUG", "parseComparisonValue failed to parse " << sv.getView()
+                << ", nodePath: " << getPath(nodePath))
             return parser.GetParseErrorCode();
         }
         TRACE("DEBUG", "parseComparisonValue ComparisonValue: ")
@@ -1986,7 +2204,7 @@ JsonUtilCode Selector::parseComparisonOp(Token::TokenType &op) {
     lex.skipSpaces();
 
     lex.nextToken(true);  // advance to the next token
-    TRACE("DEBUG", "parseComparisonOp op: " << op << ", curr path: " << lex.p << ", nodePath: " << nodePath)
+    TRACE("DEBUG", "parseComparisonOp op: " << op << ", curr path: " << lex.p << ", nodePath: " << getPath(nodePath))
     return JSONUTIL_SUCCESS;
 }
 
@@ -2078,6 +2296,21 @@ JsonUtilCode Selector::processComparisonExprAtIndex(const int64_t idx, const Str
 JsonUtilCode Selector::processComparisonExpr(const bool is_self, const StringViewHelper &member_name,
                                              const Token::TokenType op, const JValue &comparison_value,
                                              jsn::vector<int64_t> &result) {
+    if (op == Token::EQ && !is_self && indexedDoc != nullptr && node->IsArray()) {
+        const jsn::vector<int64_t> *positions =
+            dom_index_lookup(indexedDoc, *node, member_name.getView(), comparison_value);
+        if (positions != nullptr) {
+            // The candidates are in ascending order, and checked like in the scan below
+            for (int64_t i : *positions) {
+                if (static_cast<size_t>(i) >= node->Size()) break;
+                JValue &m = node->GetArray()[i];
+                if (!m.IsObject()) continue;
+                JValue::MemberIterator it = m.FindMember(member_name.getView());
+                if (it != m.MemberEnd() && evalOp(&it->value, op, comparison_value)) result.push_back(i);
+            }
+            return JSONUTIL_SUCCESS;
+        }
+    }
     if (node->IsArray()) {
         for (int64_t i = 0; i < node->Size(); i++) {
             JValue &m = node->GetArray()[i];
@@ -2384,7 +2617,7 @@ void Selector::getSelectedValues(jsn::vector<JValue*> &values) const {
     std::transform(resultSet.begin(),
                    resultSet.end(),
                    std::back_inserter(values),
-                   [](const std::pair<JValue*, jsn::string> &p) { return p.first; });
+                   [](const ValueInfo &p) { return p.first; });
 }
 
 /**
@@ -2416,3 +2649,499 @@ void Selector::dedupe() {
     resultSet.insert(resultSet.end(), rs.begin(), rs.end());
     TRACE("DEBUG", "dedupe resultSet size after dedupe: " << resultSet.size());
 }
+
+/**
+ * Build the json pointer path from the chain of steps, root first.
+ */
+jsn::string Selector::getPath(size_t path) const {
+    size_t len = 0;
+    size_t depth = 0;
+    for (size_t i = path; i != ROOT_PATH; i = pathSteps[i].parent) {
+        len += 1 + (pathSteps[i].index < 0 ? pathSteps[i].name.length() : 20);
+        depth++;
+    }
+    jsn::vector<size_t> chain(depth);
+    for (size_t i = path; i != ROOT_PATH; i = pathSteps[i].parent) chain[--depth] = i;
+
+    jsn::string result;
+    result.reserve(len);
+    for (size_t i : chain) {
+        result.append("/");
+        const PathStep &step = pathSteps[i];
+        if (step.index < 0) {
+            result.append(step.name);
+        } else {
+            result.append(std::to_string(step.index));
+        }
+    }
+    return result;
+}
+
+/**
+ * Compiled counterpart of eval(): evaluate the steps starting at index next against the current node.
+ */
+JsonUtilCode Selector::evalSteps(size_t next) {
+    CHECK_RECURSION_DEPTH();
+    JsonUtilCode rc = processSteps(next);
+    if (rc == JSONUTIL_SUCCESS && node != nullptr) {
+        // select the value
+        selectValue();
+    }
+    return rc;
+}
+
+/**
+ * Walk the steps. Member and index steps just move the current node. Steps that select multiple values fork the
+ * search, i.e., evaluate the remaining steps at each of the selected values, and then terminate the current path
+ * search as the interpreter does. Return codes and errors are the same as the interpreter's.
+ */
+JsonUtilCode Selector::processSteps(size_t next) {
+    const jsn::vector<CompiledPath::Step> &steps = compiledPath->steps;
+    for (size_t i = next; i < steps.size(); i++) {
+        if (node == nullptr) return JSONUTIL_SUCCESS;
+        const CompiledPath::Step &step = steps[i];
+        JsonUtilCode rc;
+        switch (step.type) {
+            case CompiledPath::Step::MEMBER: {
+                StringViewHelper member_name;
+                member_name.setExternalView(std::string_view(step.names[0]));
+                rc = traverseToObjectMember(member_name, i + 1 == steps.size());
+                if (rc != JSONUTIL_SUCCESS) return rc;
+                break;
+            }
+            case CompiledPath::Step::INDEX: {
+                if (!node->IsArray()) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
+                rc = traverseToArrayIndex(step.indexes[0]);
+                if (rc != JSONUTIL_SUCCESS) return rc;
+                break;
+            }
+            case CompiledPath::Step::WILDCARD: {
+                if (node->IsObject()) {
+                    for (auto &m : node->GetObject()) {
+                        rc = evalStepsAtObjectMember(m.name.GetStringView(), m.value, i + 1);
+                        if (isSyntaxError(rc)) return rc;
+                    }
+                } else if (node->IsArray()) {
+                    for (int64_t idx = 0; idx < node->Size(); idx++) {
+                        rc = evalStepsAtArrayMember(idx, i + 1);
+                        if (isSyntaxError(rc)) return rc;
+                    }
+                } else {
+                    // See processWildcard
+                    return isV2Path ? JSONUTIL_INVALID_USE_OF_WILDCARD : JSONUTIL_INVALID_JSON_PATH;
+                }
+                node = nullptr;
+                return JSONUTIL_SUCCESS;
+            }
+            case CompiledPath::Step::SLICE: {
+                if (!node->IsArray()) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
+                int64_t size = node->Size();
+                int64_t start = step.start;
+                int64_t end = step.hasEnd ? step.end : size;
+                // handle negative index, then round out of bounds indexes to the respective bound
+                if (start < 0) start += size;
+                if (end < 0) end += size;
+                start = std::min(std::max(start, int64_t(0)), size);
+                end = std::min(std::max(end, int64_t(0)), size);
+                if (step.step > 0) {
+                    for (int64_t idx = start; idx < end; idx += step.step) {
+                        rc = evalStepsAtArrayMember(idx, i + 1);
+                        if (isSyntaxError(rc)) return rc;
+                    }
+                } else {
+                    for (int64_t idx = start; idx > end; idx += step.step) {
+                        rc = evalStepsAtArrayMember(idx, i + 1);
+                        if (isSyntaxError(rc)) return rc;
+                    }
+                }
+                node = nullptr;
+                return JSONUTIL_SUCCESS;
+            }
+            case CompiledPath::Step::UNION_OF_INDEXES: {
+                if (!node->IsArray()) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
+                for (int64_t idx : step.indexes) {
+                    // Same as processUnion, including the bounds check
+                    if (idx < 0) idx += node->Size();
+                    if (idx < 0 || idx > node->Size()-1) continue;
+                    rc = evalStepsAtArrayMember(idx, i + 1);
+                    if (rc != JSONUTIL_SUCCESS) return rc;
+                }
+                node = nullptr;
+                return JSONUTIL_SUCCESS;
+            }
+            case CompiledPath::Step::UNION_OF_MEMBERS: {
+                if (!node->IsObject()) {
+                    if (mode != READ) return JSONUTIL_CANNOT_INSERT_MEMBER_INTO_NON_OBJECT_VALUE;
+                    node = nullptr;
+                    return JSONUTIL_SUCCESS;
+                }
+                for (auto &s : step.names) {
+                    JValue::MemberIterator it = node->FindMember(s);
+                    if (it != node->MemberEnd()) {
+                        rc = evalStepsAtObjectMember(it->name.GetStringView(), it->value, i + 1);
+                        if (isSyntaxError(rc)) return rc;
+                    }
+                }
+                node = nullptr;
+                return JSONUTIL_SUCCESS;
+            }
+        }
+    }
+    return JSONUTIL_SUCCESS;
+}
+
+JsonUtilCode Selector::evalStepsAtMember(JValue &m, const size_t next) {
+    CHECK_RECURSION_DEPTH();
+    incrPathDepth();
+    node = &m;
+    return evalSteps(next);
+}
+
+/**
+ * @param member_name must be a view of the member's key in the document, as for evalObjectMember.
+ */
+JsonUtilCode Selector::evalStepsAtObjectMember(const std::string_view &member_name, JValue &val, const size_t next) {
+    if (!node->IsObject()) return JSONUTIL_JSON_ELEMENT_NOT_OBJECT;
+
+    State state;
+    snapshotState(state);
+    appendPathMember(member_name);
+    JsonUtilCode rc = evalStepsAtMember(val, next);
+    restoreState(state);
+    return rc;
+}
+
+JsonUtilCode Selector::evalStepsAtArrayMember(int64_t idx, const size_t next) {
+    if (!node->IsArray()) return JSONUTIL_JSON_ELEMENT_NOT_ARRAY;
+    if (idx < 0 || idx >= static_cast<long long>(node->Size())) return JSONUTIL_INDEX_OUT_OF_ARRAY_BOUNDARIES;
+
+    State state;
+    snapshotState(state);
+    appendPathIndex(idx);
+    JsonUtilCode rc = evalStepsAtMember(node->GetArray()[idx], next);
+    restoreState(state);
+    return rc;
+}
+
+/**
+ * The path compiler. Each function returns false if the path is outside of what we compile (see CompiledPath),
+ * in which case the path is left to the interpreter. It never reports errors, that's also left to the interpreter.
+ */
+
+/**
+ * Integer ::= ["-"] digit {digit}
+ * Numbers that may overflow are left to the interpreter.
+ */
+static bool compileInteger(const char *&p, int64_t &val) {
+    bool negative = (*p == '-');
+    if (negative) p++;
+    if (!std::isdigit(static_cast<unsigned char>(*p))) return false;
+    val = 0;
+    for (size_t digits = 0; std::isdigit(static_cast<unsigned char>(*p)); digits++) {
+        if (digits == 18) return false;
+        val = val * 10 + (*p++ - '0');
+    }
+    if (negative) val = -val;
+    return true;
+}
+
+/**
+ * QuotedMemberName ::= "\"" {char} "\"" | "'" {char} "'"
+ * Only printable ASCII without backslashes, so that the name is the same with or without unescaping.
+ */
+static bool compileQuotedMemberName(const char *&p, jsn::string &name) {
+    const char quote = *p++;
+    const char *start = p;
+    while (*p != quote) {
+        if (*p < ' ' || *p > '~' || *p == '\\') return false;
+        p++;
+    }
+    name.assign(start, p - start);
+    p++;  // skip the end quote
+    return true;
+}
+
+/**
+ * Key ::= "*" | UnquotedMemberName
+ */
+static bool compileKey(const char *&p, CompiledPath::Step &step) {
+    if (*p == '*') {
+        p++;
+        step.type = CompiledPath::Step::WILDCARD;
+        return true;
+    }
+    size_t len = strcspn(p, unquotedMemberNameTerminators);
+    if (len == 0) return false;
+    step.type = CompiledPath::Step::MEMBER;
+    step.names.emplace_back(p, len);
+    p += len;
+    return true;
+}
+
+/**
+ * BracketPathElement ::= "[" ( "*" | QuotedMemberName { "," QuotedMemberName } |
+ *                              Integer { "," Integer } | [Integer] ":" [Integer] [ ":" [Integer] ] ) "]"
+ */
+static bool compileBracketPathElement(const char *&p, CompiledPath::Step &step) {
+    p++;  // skip "["
+    if (*p == '*') {
+        p++;
+        step.type = CompiledPath::Step::WILDCARD;
+    } else if (*p == DOUBLE_QUOTE || *p == SINGLE_QUOTE) {
+        while (true) {
+            jsn::string name;
+            if (!compileQuotedMemberName(p, name)) return false;
+            step.names.push_back(std::move(name));
+            if (*p != ',') break;
+            p++;
+            if (*p != DOUBLE_QUOTE && *p != SINGLE_QUOTE) return false;
+        }
+        step.type = step.names.size() == 1 ? CompiledPath::Step::MEMBER : CompiledPath::Step::UNION_OF_MEMBERS;
+    } else {
+        if (*p != ':') {
+            int64_t idx;
+            if (!compileInteger(p, idx)) return false;
+            step.indexes.push_back(idx);
+            if (*p == ']') {
+                step.type = CompiledPath::Step::INDEX;
+            } else if (*p == ',') {
+                while (*p == ',') {
+                    p++;
+                    if (!compileInteger(p, idx)) return false;
+                    step.indexes.push_back(idx);
+                }
+                step.type = CompiledPath::Step::UNION_OF_INDEXES;
+            } else if (*p == ':') {
+                step.indexes.clear();
+                step.start = idx;
+            } else {
+                return false;
+            }
+        }
+        if (*p == ':') {
+            p++;
+            if (*p != ':' && *p != ']') {
+                if (!compileInteger(p, step.end)) return false;
+                step.hasEnd = true;
+            }
+            if (*p == ':') {
+                p++;
+                if (*p != ']') {
+                    if (!compileInteger(p, step.step)) return false;
+                    // The interpreter fails the step 0 only once it gets there, leave that to it
+                    if (step.step == 0) return false;
+                }
+            }
+            step.type = CompiledPath::Step::SLICE;
+        }
+    }
+    if (*p != ']') return false;
+    p++;
+    return true;
+}
+
+/**
+ * SupportedPath ::= ["$" | "."] [Key] { "." Key | BracketPathElement }
+ */
+std::shared_ptr<const CompiledPath> CompiledPath::compile(const char *path) {
+    std::shared_ptr<CompiledPath> cp = std::allocate_shared<CompiledPath>(jsn::stl_allocator<CompiledPath>());
+    const char *p = path;
+    bool isV2Path = false;
+    if (*p == '$') {
+        isV2Path = true;
+        p++;
+    } else if (*p == '.' && *(p+1) != '.') {
+        p++;
+    }
+
+    jsn::vector<Step> steps;
+    while (*p != '\0') {
+        Step step;
+        if (*p == '[') {
+            if (!compileBracketPathElement(p, step)) return cp;
+        } else if (*p == '.') {
+            p++;
+            if (!compileKey(p, step)) return cp;
+        } else {
+            // Only the first key can go without the leading dot, e.g. "a.b" or "$a"
+            if (!steps.empty() || !compileKey(p, step)) return cp;
+        }
+        // A step must be followed by the end of the path or by the beginning of another step
+        if (*p != '\0' && *p != '.' && *p != '[') return cp;
+        steps.push_back(std::move(step));
+    }
+
+    cp->compiled = true;
+    cp->isV2Path = isV2Path;
+    cp->steps = std::move(steps);
+    return cp;
+}
+
+// Longer paths are compiled, but not cached
+static const size_t MAX_CACHED_PATH_LENGTH = 1024;
+
+std::shared_ptr<const CompiledPath> PathCache::get(const char *path) {
+    std::string_view key(path);
+    {
+        std::lock_guard<std::mutex> lck(mutex);
+        if (capacity == 0) return CompiledPath::compile(path);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            hits++;
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+        misses++;
+    }
+
+    // Compile without holding the lock
+    std::shared_ptr<const CompiledPath> cp = CompiledPath::compile(path);
+    if (key.length() > MAX_CACHED_PATH_LENGTH) return cp;
+
+    std::lock_guard<std::mutex> lck(mutex);
+    if (capacity > 0 && index.find(key) == index.end()) {  // another thread may have beaten us to it
+        lru.emplace_front(jsn::string(key), cp);
+        index.emplace(std::string_view(lru.front().first), lru.begin());
+        evict();
+    }
+    return cp;
+}
+
+void PathCache::setCapacity(size_t new_capacity) {
+    std::lock_guard<std::mutex> lck(mutex);
+    capacity = new_capacity;
+    evict();
+}
+
+void PathCache::evict() {
+    while (lru.size() > capacity) {
+        index.erase(std::string_view(lru.back().first));
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+PathCache::Stats PathCache::getStats() const {
+    std::lock_guard<std::mutex> lck(mutex);
+    Stats s;
+    s.entries = lru.size();
+    s.capacity = capacity;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    return s;
+}
+
+void PathCache::resetStats() {
+    std::lock_guard<std::mutex> lck(mutex);
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+}
+
+PathTrie::PathTrie(const char **paths, const int num_paths, const bool force_v2_path_behavior)
+        : nodes(1)
+        , others()
+        , numV1Paths(0)
+        , numV2Paths(0) {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_PATH_PARSE);
+    for (int i = 0; i < num_paths; i++) {
+        // Paths the Selector would reject upfront are left to it, so that it reports the error
+        if (strlen(paths[i]) > json_get_max_query_string_size()) {
+            others.push_back(i);
+            continue;
+        }
+        std::shared_ptr<const CompiledPath> cp = pathCache ? pathCache->get(paths[i])
+                                                           : CompiledPath::compile(paths[i]);
+        bool is_v2_path = force_v2_path_behavior || cp->isV2Path;
+        bool in_trie = cp->compiled;
+        size_t wildcards = 0;
+        for (const CompiledPath::Step &step : cp->steps) {
+            if (step.type == CompiledPath::Step::WILDCARD) {
+                wildcards++;
+                if (!is_v2_path) in_trie = false;
+            } else if (step.type != CompiledPath::Step::MEMBER && step.type != CompiledPath::Step::INDEX) {
+                in_trie = false;
+            }
+        }
+        // Every wildcard costs the Selector two levels of recursion, see processSteps
+        if (!in_trie || 1 + 2 * wildcards > json_get_max_parser_recursion_depth()) {
+            others.push_back(i);
+            continue;
+        }
+        size_t n = 0;
+        for (const CompiledPath::Step &step : cp->steps) n = child(n, step);
+        nodes[n].paths.push_back(i);
+        if (is_v2_path) {
+            numV2Paths++;
+        } else {
+            numV1Paths++;
+        }
+    }
+}
+
+/**
+ * Get the child of a node for the step, adding it if need be.
+ */
+size_t PathTrie::child(size_t parent, const CompiledPath::Step &step) {
+    for (size_t c : nodes[parent].children) {
+        const Node &node = nodes[c];
+        if (node.type != step.type) continue;
+        if (step.type == CompiledPath::Step::MEMBER && node.name != step.names[0]) continue;
+        if (step.type == CompiledPath::Step::INDEX && node.index != step.indexes[0]) continue;
+        return c;
+    }
+    Node node;
+    node.type = step.type;
+    if (step.type == CompiledPath::Step::MEMBER) node.name = step.names[0];
+    if (step.type == CompiledPath::Step::INDEX) node.index = step.indexes[0];
+    nodes.push_back(std::move(node));
+    size_t c = nodes.size() - 1;
+    nodes[parent].children.push_back(c);
+    return c;
+}
+
+void PathTrie::select(JValue &root, SelectCallback callback, void *arg) const {
+    JsonPhaseTimer phase(JSONSTATS_PHASE_TRAVERSAL);
+    walk(0, root, callback, arg);
+    for (size_t i = 0; i < numV1Paths; i++) jsonstats_count_path(false, false, false);
+    for (size_t i = 0; i < numV2Paths; i++) jsonstats_count_path(true, false, false);
+}
+
+/**
+ * Walk the subtree of the trie rooted at node n, at value v. Wildcards visit the members or elements of v in
+ * document order, so that the values of each path come in the order a Selector would select them.
+ */
+void PathTrie::walk(size_t n, JValue &v, SelectCallback callback, void *arg) const {
+    const Node &node = nodes[n];
+    for (int path : node.paths) callback(arg, path, v);
+    for (size_t c : node.children) {
+        const Node &child = nodes[c];
+        switch (child.type) {
+            case CompiledPath::Step::MEMBER:
+                if (v.IsObject()) {
+                    JValue::MemberIterator it = v.FindMember(std::string_view(child.name));
+                    if (it != v.MemberEnd()) walk(c, it->value, callback, arg);
+                }
+                break;
+            case CompiledPath::Step::INDEX:
+                if (v.IsArray()) {
+                    int64_t idx = child.index;
+                    if (idx < 0) idx += v.Size();
+                    if (idx >= 0 && idx < static_cast<int64_t>(v.Size()))
+                        walk(c, v[static_cast<size_t>(idx)], callback, arg);
+                }
+                break;
+            case CompiledPath::Step::WILDCARD:
+                if (v.IsObject()) {
+                    for (JValue::MemberIterator it = v.MemberBegin(); it != v.MemberEnd(); ++it)
+                        walk(c, it->value, callback, arg);
+                } else if (v.IsArray()) {
+                    for (size_t i = 0; i < v.Size(); i++) walk(c, v[i], callback, arg);
+                }
+                break;
+            default:
+                ValkeyModule_Assert(false);
+        }
+    }
+}
@@ -3,7 +3,12 @@
 
 #include "json/dom.h"
 #include "json/rapidjson_includes.h"
+#include <string>
 #include <string_view>
+#include <vector>
+#include <memory>
+#include <list>
+#include <mutex>
 
 struct Token {
     enum TokenType {
@@ -98,6 +103,56 @@ class Lexer {
     size_t rdTokens;  // number of recursive descent tokens
 };
 
+/**
+ * A JSONPath compiled into a vector of typed steps, so that evaluating it doesn't require re-scanning the path.
+ *
+ * Only the plain navigational subset of the grammar is compiled: member names (dotted or bracketed, without escape
+ * sequences), indexes, slices, unions of indexes or member names and wildcards, and no whitespace. Anything else,
+ * e.g., filter expressions or recursive descent, leaves compiled == false and the Selector falls back to the
+ * interpreter. The compiler is deliberately strict: a path that it accepts is guaranteed to be syntactically valid,
+ * and it is evaluated exactly like the interpreter would.
+ */
+struct CompiledPath {
+    struct Step {
+        enum Type {
+            MEMBER,             // .name, ['name'] or ["name"]
+            INDEX,              // [idx]
+            WILDCARD,           // .* or [*]
+            SLICE,              // [start:end:step]
+            UNION_OF_INDEXES,   // [idx1,idx2,...]
+            UNION_OF_MEMBERS    // ['name1','name2',...]
+        };
+
+        Step()
+                : type(MEMBER)
+                , names()
+                , indexes()
+                , start(0)
+                , end(0)
+                , step(1)
+                , hasEnd(false)
+        {}
+        Type type;
+        jsn::vector<jsn::string> names;  // MEMBER, UNION_OF_MEMBERS
+        jsn::vector<int64_t> indexes;     // INDEX, UNION_OF_INDEXES
+        int64_t start;                    // SLICE
+        int64_t end;                      // SLICE, only if hasEnd, otherwise the size of the array
+        int64_t step;                     // SLICE, never 0
+        bool hasEnd;
+    };
+
+    CompiledPath() : compiled(false), isV2Path(false), steps() {}
+
+    /**
+     * Compile a path. Never fails, paths that can't be compiled come back with compiled == false.
+     */
+    static std::shared_ptr<const CompiledPath> compile(const char *path);
+
+    bool compiled;
+    bool isV2Path;
+    jsn::vector<Step> steps;
+};
+
 /**
  * A JSONPath parser and evaluator that supports both v2 JSONPath and the legacy path syntax, and operates in either
  * READ or WRITE mode. It is named Selector because:
@@ -147,8 +202,11 @@ class Selector {
     explicit Selector(bool force_v2_path_behavior = false)
             : isV2Path(force_v2_path_behavior)
             , root(nullptr)
+            , indexedDoc(nullptr)
             , node(nullptr)
-            , nodePath()
+            , nodePath(ROOT_PATH)
+            , pathSteps()
+            , pinnedPathSteps(0)
             , lex()
             , maxPathDepth(0)
             , currPathDepth(0)
@@ -157,13 +215,16 @@ class Selector {
             , uniqueResultSet()
             , mode(READ)
             , isRecursiveSearch(false)
+            , hasFilter(false)
             , error(JSONUTIL_SUCCESS)
+            , compiledPath()
     {}
 
     // ValueInfo - (value, path) pair.
     //   first:  JValue pointer
-    //   second: path to the value, which is in json pointer format.
-    typedef std::pair<JValue*, jsn::string> ValueInfo;
+    //   second: path to the value, as a reference to the selector's path steps. Use getPath to get the path in
+    //           json pointer format. Only valid until the selector is reused or the document is modified.
+    typedef std::pair<JValue*, size_t> ValueInfo;
 
     /**
      * Entry point for READ query.
@@ -191,10 +252,24 @@ class Selector {
      * certain conditions are not satisfied.
      */
     JsonUtilCode prepareSetValues(JValue &root, const char *path);
+
+    /**
+     * The same entry points for a whole document. Equality filters then use the secondary indexes of the document,
+     * and writes keep them up to date, see doc_index.h.
+     */
+    JsonUtilCode getValues(JDocument &doc, const char *path);
+    JsonUtilCode deleteValues(JDocument &doc, const char *path, size_t &numValsDeleted);
+    JsonUtilCode prepareSetValues(JDocument &doc, const char *path);
+
     /**
      * Commit a 2-stage INSERT/UPDATE.
      */
     JsonUtilCode commit(JValue &new_val);
+    /**
+     * Commit a 2-stage MERGE, which applies an RFC 7396 merge patch in place to the values to update, and inserts
+     * the patch at the insert paths.
+     */
+    JsonUtilCode commitMerge(JValue &patch);
     bool isLegacyJsonPathSyntax() const { return !isV2Path; }
     bool isSyntaxError(JsonUtilCode code) const;
 
@@ -208,6 +283,24 @@ class Selector {
         return false;
     }
 
+    /**
+     * Check if a path has only member and index steps, so that it selects at most one value and needs no searching.
+     */
+    static bool isDefinitePath(const char *path);
+
+    /**
+     * Find the value at a JSON pointer path, and spell the path as a JSONPath of member and index steps, e.g.,
+     * $["a"][0] for /a/0. Member names are escaped so that any Selector reads them back unchanged.
+     * @return the value, or nullptr if there is no value at the path.
+     */
+    static JValue *resolvePointer(JValue &root, const jsn::string &pointer, jsn::string &json_path);
+
+    /**
+     * Append a member or index step to a JSONPath, in the form resolvePointer spells them.
+     */
+    static void appendMemberStep(jsn::string &json_path, const std::string_view &name);
+    static void appendIndexStep(jsn::string &json_path, size_t index);
+
     bool hasValues() const { return !resultSet.empty(); }
     bool hasUpdates() const { return !resultSet.empty(); }
     bool hasInserts() const { return !insertPaths.empty(); }
@@ -217,6 +310,11 @@ class Selector {
     const jsn::vector<Selector::ValueInfo>& getUniqueResultSet();
     void dedupe();
 
+    /**
+     * Materialize the path of a result in json pointer format.
+     */
+    jsn::string getPath(const ValueInfo &vInfo) const { return getPath(vInfo.second); }
+
     bool isV2Path;  // if false, it's legacy syntax
 
  private:
@@ -228,16 +326,31 @@ class Selector {
         DELETE
     };
 
+    /**
+     * The path to a node is kept as a chain of steps, each one a member name or an array index plus the step of the
+     * parent. Paths of nodes we visit and then leave without selecting anything are discarded, and only write
+     * operations ever turn them into json pointer strings, so read queries on large documents don't pay for paths
+     * they never use.
+     */
+    static const size_t ROOT_PATH = SIZE_MAX;
+    struct PathStep {
+        size_t parent;          // ROOT_PATH for children of the root
+        int64_t index;          // array index, or -1 for an object member
+        std::string_view name;  // the member's key in the document, which outlives the selector's use of it
+    };
+
     struct State {
         State()
                 : currNode(nullptr)
-                , nodePath()
+                , nodePath(ROOT_PATH)
+                , numPathSteps(0)
                 , currPathPtr(nullptr)
                 , currToken()
                 , currPathDepth(0)
         {}
         JValue *currNode;
-        jsn::string nodePath;
+        size_t nodePath;
+        size_t numPathSteps;
         const char *currPathPtr;
         Token currToken;
         size_t currPathDepth;
@@ -245,22 +358,58 @@ class Selector {
     void snapshotState(State &state) {
         state.currNode = node;
         state.nodePath = nodePath;
+        state.numPathSteps = pathSteps.size();
         state.currPathPtr = lex.p;
         state.currToken = lex.next;
         state.currPathDepth = currPathDepth;
     }
     void restoreState(const State &state) {
         node = state.currNode;
-        nodePath = state.nodePath;
+        restorePath(state.nodePath, state.numPathSteps);
         lex.p = state.currPathPtr;
         lex.next = state.currToken;
         currPathDepth = state.currPathDepth;
     }
 
+    void appendPathMember(const std::string_view &name) {
+        pathSteps.push_back(PathStep{nodePath, -1, name});
+        nodePath = pathSteps.size() - 1;
+    }
+    void appendPathIndex(int64_t idx) {
+        pathSteps.push_back(PathStep{nodePath, idx, std::string_view()});
+        nodePath = pathSteps.size() - 1;
+    }
+    /**
+     * Go back to a saved path, dropping the steps appended since, except for the ones that selected values refer to.
+     */
+    void restorePath(size_t path, size_t numPathSteps) {
+        nodePath = path;
+        pathSteps.resize(std::max(numPathSteps, pinnedPathSteps));
+    }
+    void selectValue() {
+        resultSet.emplace_back(node, nodePath);
+        pinnedPathSteps = pathSteps.size();
+    }
+    jsn::string getPath(size_t path) const;
+
+    JsonUtilCode getValues(JValue &root, JDocument *doc, const char *path);
+    JsonUtilCode deleteValues(JValue &root, JDocument *doc, const char *path, size_t &numValsDeleted);
+    JsonUtilCode prepareSetValues(JValue &root, JDocument *doc, const char *path);
+
     /***
      * Initialize the selector.
+     * @param doc - the document, if root is one, for its secondary indexes.
+     */
+    JsonUtilCode init(JValue &root, JDocument *doc, const char *path, const Mode mode);
+
+    /**
+     * Record the values to write with the current JsonEffectRecorder, if any.
      */
-    JsonUtilCode init(JValue &root, const char *path, const Mode mode);
+    void recordUpdates();
+
+    void invalidateIndexes(const jsn::string &path) {
+        if (indexedDoc != nullptr) dom_index_invalidate(indexedDoc, path);
+    }
 
     void resetPointers(JValue &currVal, const char *currPath) {
         node = &currVal;
@@ -277,14 +426,29 @@ class Selector {
         currPathDepth--;
     }
 
+    /***
+     * Evaluate the path, using the compiled steps if the path could be compiled, or the interpreter otherwise.
+     */
+    JsonUtilCode evalPath();
+
     /***
      * Evaluate the path, which includes parsing and evaluating the path.
      */
     JsonUtilCode eval();
+
+    /***
+     * Compiled counterparts of eval, evalMember, evalObjectMember and evalArrayMember. Rather than a position in the
+     * path string, they take the index of the next step to evaluate.
+     */
+    JsonUtilCode evalSteps(size_t next);
+    JsonUtilCode processSteps(size_t next);
+    JsonUtilCode evalStepsAtMember(JValue &m, const size_t next);
+    JsonUtilCode evalStepsAtObjectMember(const std::string_view &member_name, JValue &val, const size_t next);
+    JsonUtilCode evalStepsAtArrayMember(int64_t idx, const size_t next);
     JsonUtilCode evalMember(JValue &m, const char *path_start);
     JsonUtilCode evalObjectMember(const StringViewHelper &member_name, JValue &val);
     JsonUtilCode evalArrayMember(int64_t idx);
-    JsonUtilCode traverseToObjectMember(const StringViewHelper &member_name);
+    JsonUtilCode traverseToObjectMember(const StringViewHelper &member_name, const bool isLastStep);
     JsonUtilCode traverseToArrayIndex(int64_t idx);
     JsonUtilCode parseSupportedPath();
     JsonUtilCode parseRelativePath();
@@ -344,8 +508,11 @@ class Selector {
     JsonUtilCode getError() const { return error; }
 
     JValue *root;          // the root value, aka the document
+    JDocument *indexedDoc;  // the document, if it's the root and has secondary indexes, nullptr otherwise
     JValue *node;          // current node (value) in the JSON tree
-    jsn::string nodePath;  // current node's path, which is in json pointer format
+    size_t nodePath;       // current node's path, the index of its last step in pathSteps
+    jsn::vector<PathStep> pathSteps;
+    size_t pinnedPathSteps;  // steps that selected values refer to, which must be kept
     Lexer lex;
     size_t maxPathDepth;
     size_t currPathDepth;
@@ -363,7 +530,155 @@ class Selector {
 
     Mode mode;
     bool isRecursiveSearch;  // if we are doing a recursive search we do not wish to add new fields
+    bool hasFilter;  // the path has a filter expression, for jsonstats_count_path
     JsonUtilCode error;  // JSONUTIL_SUCCESS indicates no error
+    std::shared_ptr<const CompiledPath> compiledPath;  // the path being evaluated, from the path cache if enabled
+};
+
+/**
+ * A bounded LRU cache of compiled paths keyed by the path string. Clients tend to send a small set of distinct paths
+ * over and over again, so this saves compiling the path for every command and every document. Paths that can't be
+ * compiled are cached too, which saves trying again.
+ *
+ * Thread safe. Entries are reference counted, an evicted entry stays alive until the last Selector using it is done.
+ * A capacity of 0 disables caching, every lookup then compiles the path.
+ */
+class PathCache {
+ public:
+    explicit PathCache(size_t capacity)
+            : mutex()
+            , lru()
+            , index()
+            , capacity(capacity)
+            , hits(0)
+            , misses(0)
+            , evictions(0)
+    {}
+
+    /**
+     * Get the compiled path from the cache, or compile and cache it on a miss.
+     */
+    std::shared_ptr<const CompiledPath> get(const char *path);
+
+    /**
+     * Change the capacity, evicting the least recently used entries as needed.
+     */
+    void setCapacity(size_t capacity);
+
+    struct Stats {
+        size_t entries;
+        size_t capacity;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+    };
+    Stats getStats() const;
+
+    /**
+     * Zero the hits, misses and evictions.
+     */
+    void resetStats();
+
+ private:
+    PathCache(const PathCache &);  // disable copy constructor
+    PathCache& operator=(const PathCache &);  // disable assignment operator
+    void evict();
+
+    typedef std::pair<jsn::string, std::shared_ptr<const CompiledPath>> Entry;
+    typedef std::list<Entry, jsn::stl_allocator<Entry>> LruList;
+
+    mutable std::mutex mutex;
+    LruList lru;  // most recently used first
+    jsn::unordered_map<std::string_view, LruList::iterator> index;  // keys are views of the strings in lru
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+//
+// The global path cache, created when the module is loaded. Without it (e.g., in unit tests) paths are compiled
+// for every Selector.
+//
+extern PathCache *pathCache;
+
+/**
+ * A trie of the steps of several paths, so that a prefix shared by the paths, e.g., $.profile in $.profile.name and
+ * $.profile.age, is walked once per document, and each path is compiled once instead of once per document.
+ *
+ * Only compiled member, index and wildcard steps go into the trie, and wildcards only for paths with v2 behavior, so
+ * that a legacy path in the trie selects at most one value. A path in the trie selects exactly the values a Selector
+ * would, in the same order, and never fails: where the Selector returns a non-syntax error, e.g., a member of a
+ * non-object, the trie selects nothing. Other paths, e.g., filters, slices or recursive descent, are left out and
+ * must be evaluated by a Selector, see getOthers.
+ */
+class PathTrie {
+ public:
+    /**
+     * @param force_v2_path_behavior treat every path as v2 path, as Selector(true) does.
+     */
+    PathTrie(const char **paths, const int num_paths, const bool force_v2_path_behavior = false);
+
+    typedef void (*SelectCallback)(void *arg, int path, JValue &value);
+
+    /**
+     * Walk the document once, calling the callback for every value selected by every path in the trie.
+     */
+    void select(JValue &root, SelectCallback callback, void *arg) const;
+
+    /**
+     * The indexes of the paths that aren't in the trie, in ascending order.
+     */
+    const jsn::vector<int>& getOthers() const { return others; }
+
+    void *operator new(size_t size) { return dom_alloc(size); }
+    void operator delete(void *ptr) { return dom_free(ptr); }
+
+ private:
+    PathTrie(const PathTrie &);  // disable copy constructor
+    PathTrie& operator=(const PathTrie &);  // disable assignment operator
+
+    struct Node {
+        Node() : type(CompiledPath::Step::MEMBER), name(), index(0), children(), paths() {}
+        CompiledPath::Step::Type type;  // the step from the parent node: MEMBER, INDEX or WILDCARD
+        jsn::string name;               // MEMBER
+        int64_t index;                  // INDEX
+        jsn::vector<size_t> children;   // indexes into nodes
+        jsn::vector<int> paths;         // the paths that end at this node
+    };
+
+    size_t child(size_t parent, const CompiledPath::Step &step);
+    void walk(size_t n, JValue &v, SelectCallback callback, void *arg) const;
+
+    jsn::vector<Node> nodes;  // nodes[0] is the root of the document
+    jsn::vector<int> others;
+    size_t numV1Paths;  // the paths in the trie, for the path counters
+    size_t numV2Paths;
+};
+
+/**
+ * Records the changes of a write command for effect replication, see json.replicate-effects. While a recorder is
+ * alive on the thread, the Selectors of documents record the values selected for writing as JSON pointer paths, and
+ * the values they delete as JSONPaths, in the order they are deleted. A recorder within one that is already alive
+ * records nothing.
+ *
+ * The paths are std strings, not jsn ones, so that recording isn't charged to the document being written.
+ */
+class JsonEffectRecorder {
+ public:
+    JsonEffectRecorder();
+    ~JsonEffectRecorder();
+
+    static JsonEffectRecorder *current() { return active; }
+
+    std::vector<std::string> updated;  // may repeat, and contain paths within one another
+    std::vector<std::string> deleted;
+
+ private:
+    JsonEffectRecorder(const JsonEffectRecorder &);  // disable copy constructor
+    JsonEffectRecorder& operator=(const JsonEffectRecorder &);  // disable assignment operator
+    bool outermost;
+    static thread_local JsonEffectRecorder *active;
 };
 
 #endif
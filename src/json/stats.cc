@@ -2,6 +2,7 @@
 #include <pthread.h>
 #include <cstring>
 #include <atomic>
+#include <chrono>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -28,6 +29,10 @@ typedef struct {
     std::atomic_ullong max_size_ever_seen;
     std::atomic_ullong defrag_count;
     std::atomic_ullong defrag_bytes;
+    std::atomic_ullong defrag_stopped;
+    std::atomic_ullong compressed_docs;
+    std::atomic_ullong compressed_tree_bytes;
+    std::atomic_ullong compressed_bytes;
 
     void reset() {
         used_mem = 0;
@@ -36,6 +41,10 @@ typedef struct {
         max_size_ever_seen = 0;
         defrag_count = 0;
         defrag_bytes = 0;
+        defrag_stopped = 0;
+        compressed_docs = 0;
+        compressed_tree_bytes = 0;
+        compressed_bytes = 0;
     }
 } JsonStats;
 static JsonStats jsonstats;
@@ -47,16 +56,23 @@ static size_t buckets[] = {
         4*1024*1024, 16*1024*1024, 64*1024*1024, SIZE_MAX
 };
 
+// Histogram buckets are atomic for the same reason as JsonStats, rdb_load may run on multiple threads.
+typedef std::atomic_size_t Histogram[NUM_BUCKETS];
+
 // static histogram showing document size distribution
-static size_t doc_hist[NUM_BUCKETS];
+static Histogram doc_hist;
 // dynamic histogram for read operations (JSON.GET and JSON.MGET only)
-static size_t read_hist[NUM_BUCKETS];
+static Histogram read_hist;
 // dynamic histogram for insert operations (JSON.SET and JSON.ARRINSERT)
-static size_t insert_hist[NUM_BUCKETS];
+static Histogram insert_hist;
 // dynamic histogram for update operations (JSON.SET, JSON.STRAPPEND and JSON.ARRAPPEND)
-static size_t update_hist[NUM_BUCKETS];
+static Histogram update_hist;
 // dynamic histogram for delete operations (JSON.DEL, JSON.FORGET, JSON.ARRPOP and JSON.ARRTRIM)
-static size_t delete_hist[NUM_BUCKETS];
+static Histogram delete_hist;
+
+STATIC void reset_hist(Histogram &hist) {
+    for (auto &bucket : hist) bucket = 0;
+}
 
 JsonUtilCode jsonstats_init() {
     ValkeyModule_Assert(jsonstats.used_mem == 0);  // Otherwise you'll lose memory accounting
@@ -66,11 +82,12 @@ JsonUtilCode jsonstats_init() {
 
     jsonstats.reset();
     logical_stats.reset();
-    memset(doc_hist, 0, sizeof(doc_hist));
-    memset(read_hist, 0, sizeof(read_hist));
-    memset(insert_hist, 0, sizeof(insert_hist));
-    memset(update_hist, 0, sizeof(update_hist));
-    memset(delete_hist, 0, sizeof(delete_hist));
+    reset_hist(doc_hist);
+    reset_hist(read_hist);
+    reset_hist(insert_hist);
+    reset_hist(update_hist);
+    reset_hist(delete_hist);
+    jsonstats_reset_command_stats();
     return JSONUTIL_SUCCESS;
 }
 
@@ -83,6 +100,11 @@ int64_t jsonstats_end_track_mem(const int64_t begin_val) {
     return end_val - begin_val;
 }
 
+void jsonstats_untrack_mem(const int64_t delta) {
+    int64_t curr_val = reinterpret_cast<int64_t>(pthread_getspecific(thread_local_mem_counter_key));
+    pthread_setspecific(thread_local_mem_counter_key, reinterpret_cast<int64_t*>(curr_val - delta));
+}
+
 void jsonstats_increment_used_mem(size_t delta) {
     // update the atomic global counter
     jsonstats.used_mem += delta;
@@ -120,6 +142,12 @@ void jsonstats_update_max_depth_ever_seen(const size_t max_depth) {
     }
 }
 
+void jsonstats_count_packed_arrays(size_t arrays, size_t elements) {
+    if (arrays == 0) return;
+    logical_stats.packed_arrays_parsed += arrays;
+    logical_stats.sum_packed_elements_parsed += elements;
+}
+
 unsigned long long jsonstats_get_max_size_ever_seen() {
     return jsonstats.max_size_ever_seen;
 }
@@ -146,6 +174,39 @@ void jsonstats_increment_defrag_bytes(const size_t amount) {
     jsonstats.defrag_bytes += amount;
 }
 
+unsigned long long jsonstats_get_defrag_stopped() {
+    return jsonstats.defrag_stopped;
+}
+
+void jsonstats_increment_defrag_stopped() {
+    jsonstats.defrag_stopped++;
+}
+
+unsigned long long jsonstats_get_compressed_docs() {
+    return jsonstats.compressed_docs;
+}
+
+unsigned long long jsonstats_get_compressed_tree_bytes() {
+    return jsonstats.compressed_tree_bytes;
+}
+
+unsigned long long jsonstats_get_compressed_bytes() {
+    return jsonstats.compressed_bytes;
+}
+
+void jsonstats_add_compressed(const size_t tree_size, const size_t length) {
+    jsonstats.compressed_docs++;
+    jsonstats.compressed_tree_bytes += tree_size;
+    jsonstats.compressed_bytes += length;
+}
+
+void jsonstats_remove_compressed(const size_t tree_size, const size_t length) {
+    ValkeyModule_Assert(jsonstats.compressed_docs > 0);
+    jsonstats.compressed_docs--;
+    jsonstats.compressed_tree_bytes -= tree_size;
+    jsonstats.compressed_bytes -= length;
+}
+
 /* Given a size (bytes), find histogram bucket index using binary search.
  */
 uint32_t jsonstats_find_bucket(size_t size) {
@@ -222,12 +283,12 @@ void jsonstats_sprint_hist_buckets(char *buf, const size_t buf_size) {
     buf[str.length()] = '\0';
 }
 
-STATIC void sprint_hist(size_t *arr, const size_t len, char *buf, const size_t buf_size) {
+STATIC void sprint_hist(const Histogram &arr, const size_t len, char *buf, const size_t buf_size) {
     std::ostringstream oss;
     oss << "[";
     for (size_t i=0; i < len; i++) {
         if (i > 0) oss << ",";
-        oss << arr[i];
+        oss << arr[i].load();
     }
     oss << "]";
     std::string str = oss.str();
@@ -278,6 +339,11 @@ void jsonstats_update_stats_on_update(JDocument *doc, const size_t orig_size, co
     jsonstats_update_max_size_ever_seen(new_size);
 }
 
+void jsonstats_update_stats_on_resize(JDocument *doc, const size_t orig_size, const size_t new_size) {
+    update_doc_hist(doc, orig_size, new_size, JSONSTATS_UPDATE);
+    jsonstats_update_max_size_ever_seen(new_size);
+}
+
 void jsonstats_update_stats_on_delete(JDocument *doc, const bool is_delete_doc_key, const size_t orig_size,
                                       const size_t new_size, const size_t deleted_val_size) {
     update_doc_hist(doc, orig_size, new_size, JSONSTATS_DELETE);
@@ -289,3 +355,241 @@ void jsonstats_update_stats_on_delete(JDocument *doc, const bool is_delete_doc_k
     delete_hist[bucket]++;
 }
 
+
+/* Path, cache and inflate counters, see stats.h. Relaxed, as they are only ever read for reporting.
+ */
+typedef struct {
+    std::atomic_ullong v1_paths;
+    std::atomic_ullong v2_paths;
+    std::atomic_ullong recursive_paths;
+    std::atomic_ullong filter_paths;
+    std::atomic_ullong root_cache_hits;
+    std::atomic_ullong root_cache_misses;
+    std::atomic_ullong inflate_count;
+    std::atomic_ullong inflate_nanos;
+    std::atomic_ullong inflate_max_nanos;
+
+    void reset() {
+        v1_paths = 0;
+        v2_paths = 0;
+        recursive_paths = 0;
+        filter_paths = 0;
+        root_cache_hits = 0;
+        root_cache_misses = 0;
+        inflate_count = 0;
+        inflate_nanos = 0;
+        inflate_max_nanos = 0;
+    }
+} CommandStats;
+static CommandStats command_stats;
+
+unsigned long long jsonstats_get_v1_paths() {
+    return command_stats.v1_paths;
+}
+
+unsigned long long jsonstats_get_v2_paths() {
+    return command_stats.v2_paths;
+}
+
+unsigned long long jsonstats_get_recursive_paths() {
+    return command_stats.recursive_paths;
+}
+
+unsigned long long jsonstats_get_filter_paths() {
+    return command_stats.filter_paths;
+}
+
+void jsonstats_count_path(const bool is_v2_path, const bool is_recursive, const bool has_filter) {
+    (is_v2_path ? command_stats.v2_paths : command_stats.v1_paths).fetch_add(1, std::memory_order_relaxed);
+    if (is_recursive) command_stats.recursive_paths.fetch_add(1, std::memory_order_relaxed);
+    if (has_filter) command_stats.filter_paths.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long jsonstats_get_root_cache_hits() {
+    return command_stats.root_cache_hits;
+}
+
+unsigned long long jsonstats_get_root_cache_misses() {
+    return command_stats.root_cache_misses;
+}
+
+void jsonstats_count_root_cache(const bool hit) {
+    (hit ? command_stats.root_cache_hits : command_stats.root_cache_misses).fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long jsonstats_get_inflate_count() {
+    return command_stats.inflate_count;
+}
+
+unsigned long long jsonstats_get_inflate_usec() {
+    return command_stats.inflate_nanos / 1000;
+}
+
+unsigned long long jsonstats_get_inflate_max_usec() {
+    return command_stats.inflate_max_nanos / 1000;
+}
+
+void jsonstats_count_inflate(const uint64_t nanos) {
+    command_stats.inflate_count.fetch_add(1, std::memory_order_relaxed);
+    command_stats.inflate_nanos.fetch_add(nanos, std::memory_order_relaxed);
+    unsigned long long max = command_stats.inflate_max_nanos.load(std::memory_order_relaxed);
+    while (nanos > max && !command_stats.inflate_max_nanos.compare_exchange_weak(max, nanos,
+                                                                                  std::memory_order_relaxed)) {}
+}
+
+/* Latency histograms, see latency.h.
+ */
+typedef std::atomic_ullong LatencyHistogram[JSONSTATS_NUM_LATENCY_BUCKETS];
+
+typedef struct {
+    std::atomic_ullong calls;
+    LatencyHistogram total;
+    std::atomic_ullong phase_nanos[JSONSTATS_NUM_PHASES];
+    LatencyHistogram phases[JSONSTATS_NUM_PHASES];
+} CommandLatency;
+static CommandLatency command_latency[JSONSTATS_NUM_COMMANDS];
+
+static const char *command_names[] = {
+    "set", "get", "mget", "mset", "merge", "del", "numincrby", "nummultby", "strlen", "strappend", "toggle", "objlen",
+    "objkeys", "arrlen", "arrappend", "arrpop", "arrinsert", "arrtrim", "clear", "arrindex", "type", "resp"
+};
+
+static const char *phase_names[] = {
+    "path_parse", "traversal", "input_parse", "serialization", "reply", "other"
+};
+static_assert(sizeof(command_names) / sizeof(command_names[0]) == JSONSTATS_NUM_COMMANDS, "name every command");
+static_assert(sizeof(phase_names) / sizeof(phase_names[0]) == JSONSTATS_NUM_PHASES, "name every phase");
+
+// The command being timed on this thread
+typedef struct {
+    bool active;
+    JsonStatsCommand cmd;
+    JsonStatsPhase phase;  // the phase running now
+    uint64_t phase_start;  // when it began or resumed
+    uint64_t nanos[JSONSTATS_NUM_PHASES];
+    bool entered[JSONSTATS_NUM_PHASES];
+} CommandTiming;
+static thread_local CommandTiming timing;
+
+STATIC uint64_t now_nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+STATIC void switch_phase(const JsonStatsPhase phase) {
+    uint64_t now = now_nanos();
+    timing.nanos[timing.phase] += now - timing.phase_start;
+    timing.phase_start = now;
+    timing.phase = phase;
+    timing.entered[phase] = true;
+}
+
+STATIC void add_latency(LatencyHistogram &hist, const uint64_t nanos) {
+    hist[jsonstats_find_latency_bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+}
+
+JsonCommandTimer::JsonCommandTimer(JsonStatsCommand _cmd) : cmd(_cmd), active(!timing.active) {
+    if (!active) return;
+    timing.active = true;
+    timing.cmd = cmd;
+    timing.phase = JSONSTATS_PHASE_OTHER;
+    for (int i = 0; i < JSONSTATS_NUM_PHASES; i++) {
+        timing.nanos[i] = 0;
+        timing.entered[i] = false;
+    }
+    timing.entered[JSONSTATS_PHASE_OTHER] = true;
+    timing.phase_start = now_nanos();
+}
+
+JsonCommandTimer::~JsonCommandTimer() {
+    if (!active) return;
+    switch_phase(JSONSTATS_PHASE_OTHER);
+    timing.active = false;
+    CommandLatency &latency = command_latency[cmd];
+    uint64_t total = 0;
+    for (int i = 0; i < JSONSTATS_NUM_PHASES; i++) {
+        if (!timing.entered[i]) continue;
+        total += timing.nanos[i];
+        latency.phase_nanos[i].fetch_add(timing.nanos[i], std::memory_order_relaxed);
+        add_latency(latency.phases[i], timing.nanos[i]);
+    }
+    add_latency(latency.total, total);
+    latency.calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+JsonPhaseTimer::JsonPhaseTimer(JsonStatsPhase phase) : outer(timing.phase), active(timing.active) {
+    if (active) switch_phase(phase);
+}
+
+JsonPhaseTimer::~JsonPhaseTimer() {
+    if (active && timing.active) switch_phase(outer);
+}
+
+JsonStatsCommand jsonstats_current_command() {
+    return timing.active ? timing.cmd : JSONSTATS_NUM_COMMANDS;
+}
+
+const char *jsonstats_command_name(const JsonStatsCommand cmd) {
+    return command_names[cmd];
+}
+
+const char *jsonstats_phase_name(const JsonStatsPhase phase) {
+    return phase_names[phase];
+}
+
+unsigned long long jsonstats_get_command_calls(const JsonStatsCommand cmd) {
+    return command_latency[cmd].calls;
+}
+
+unsigned long long jsonstats_get_phase_usec(const JsonStatsCommand cmd, const JsonStatsPhase phase) {
+    return command_latency[cmd].phase_nanos[phase] / 1000;
+}
+
+/* Bucket i > 0 holds durations of [2^(i-1), 2^i) microseconds, the last one everything from 2^14 up.
+ */
+uint32_t jsonstats_find_latency_bucket(uint64_t nanos) {
+    uint64_t usec = nanos / 1000;
+    if (usec == 0) return 0;
+    uint32_t bucket = 64 - __builtin_clzll(usec);
+    return bucket < JSONSTATS_NUM_LATENCY_BUCKETS ? bucket : JSONSTATS_NUM_LATENCY_BUCKETS - 1;
+}
+
+void jsonstats_sprint_latency_buckets(char *buf, const size_t buf_size) {
+    std::ostringstream oss;
+    oss << "[0";
+    for (size_t i=1; i < JSONSTATS_NUM_LATENCY_BUCKETS; i++) oss << "," << (1ull << (i - 1));
+    oss << ",INF]";
+    std::string str = oss.str();
+    ValkeyModule_Assert(str.length() < buf_size);
+    memcpy(buf, str.c_str(), str.length());
+    buf[str.length()] = '\0';
+}
+
+void jsonstats_sprint_latency_hist(const JsonStatsCommand cmd, const JsonStatsPhase phase, char *buf,
+                                   const size_t buf_size) {
+    const LatencyHistogram &hist = (phase == JSONSTATS_NUM_PHASES) ? command_latency[cmd].total
+                                                                  : command_latency[cmd].phases[phase];
+    std::ostringstream oss;
+    oss << "[";
+    for (size_t i=0; i < JSONSTATS_NUM_LATENCY_BUCKETS; i++) {
+        if (i > 0) oss << ",";
+        oss << hist[i].load(std::memory_order_relaxed);
+    }
+    oss << "]";
+    std::string str = oss.str();
+    ValkeyModule_Assert(str.length() < buf_size);
+    memcpy(buf, str.c_str(), str.length());
+    buf[str.length()] = '\0';
+}
+
+void jsonstats_reset_command_stats() {
+    command_stats.reset();
+    for (auto &latency : command_latency) {
+        latency.calls = 0;
+        for (auto &bucket : latency.total) bucket = 0;
+        for (int i = 0; i < JSONSTATS_NUM_PHASES; i++) {
+            latency.phase_nanos[i] = 0;
+            for (auto &bucket : latency.phases[i]) bucket = 0;
+        }
+    }
+}
@@ -12,6 +12,7 @@
 #define VALKEYJSONMODULE_JSON_STATS_H_
 
 #include "json/dom.h"
+#include "json/latency.h"
 
 typedef enum {
     JSONSTATS_READ = 0,
@@ -34,6 +35,12 @@ int64_t jsonstats_begin_track_mem();
  */
 int64_t jsonstats_end_track_mem(const int64_t begin_val);
 
+/* Take memory out of the tracking of the current command, for memory that's charged to a document as it's
+ * allocated, rather than by the command, see doc_index.h.
+ * @param delta - memory allocated, negative for memory freed.
+ */
+void jsonstats_untrack_mem(const int64_t delta);
+
 /* Get the total memory allocated to JSON objects. */
 unsigned long long jsonstats_get_used_mem();
 
@@ -56,6 +63,36 @@ void jsonstats_increment_defrag_count();
 unsigned long long jsonstats_get_defrag_bytes();
 void jsonstats_increment_defrag_bytes(const size_t amount);
 
+// number of times an incremental defrag of a document stopped before it was done, to be resumed later
+unsigned long long jsonstats_get_defrag_stopped();
+void jsonstats_increment_defrag_stopped();
+
+// number of paths evaluated by Selectors: legacy (v1) or v2 syntax, and those using recursive descent or filters
+unsigned long long jsonstats_get_v1_paths();
+unsigned long long jsonstats_get_v2_paths();
+unsigned long long jsonstats_get_recursive_paths();
+unsigned long long jsonstats_get_filter_paths();
+void jsonstats_count_path(const bool is_v2_path, const bool is_recursive, const bool has_filter);
+
+// lookups of the serialized root cache, see dom_get_serialized_root
+unsigned long long jsonstats_get_root_cache_hits();
+unsigned long long jsonstats_get_root_cache_misses();
+void jsonstats_count_root_cache(const bool hit);
+
+// compressed documents, the memory of their trees when they were compressed, and of their encodings, see
+// dom_compress_doc
+unsigned long long jsonstats_get_compressed_docs();
+unsigned long long jsonstats_get_compressed_tree_bytes();
+unsigned long long jsonstats_get_compressed_bytes();
+void jsonstats_add_compressed(const size_t tree_size, const size_t length);
+void jsonstats_remove_compressed(const size_t tree_size, const size_t length);
+
+// inflations of compressed documents, and their latency
+unsigned long long jsonstats_get_inflate_count();
+unsigned long long jsonstats_get_inflate_usec();
+unsigned long long jsonstats_get_inflate_max_usec();
+void jsonstats_count_inflate(const uint64_t nanos);
+
 // updating stats on read/insert/update/delete operation
 void jsonstats_update_stats_on_read(const size_t fetched_val_size);
 void jsonstats_update_stats_on_insert(JDocument *doc, const bool is_delete_doc_key, const size_t orig_size,
@@ -64,6 +101,8 @@ void jsonstats_update_stats_on_update(JDocument *doc, const size_t orig_size, co
                                       const size_t input_json_size);
 void jsonstats_update_stats_on_delete(JDocument *doc, const bool is_delete_doc_key, const size_t orig_size,
                                       const size_t new_size, const size_t deleted_val_size);
+// a document changed size without a write, e.g., by caching its serialization on read
+void jsonstats_update_stats_on_resize(JDocument *doc, const size_t orig_size, const size_t new_size);
 
 // helper methods for printing histograms into C string
 void jsonstats_sprint_hist_buckets(char *buf, const size_t buf_size);
@@ -96,6 +135,8 @@ typedef struct {
     std::atomic_size_t object_count;  // 16 bytes
     std::atomic_size_t sum_object_members;  // internal metric
     std::atomic_size_t sum_object_key_chars;  // 1 byte per char
+    std::atomic_size_t packed_arrays_parsed;  // counter, not a gauge, see jsonstats_count_packed_arrays
+    std::atomic_size_t sum_packed_elements_parsed;  // internal metric
 
     void reset() {
         boolean_count = 0;
@@ -109,10 +150,18 @@ typedef struct {
         object_count = 0;
         sum_object_members = 0;
         sum_object_key_chars = 0;
+        packed_arrays_parsed = 0;
+        sum_packed_elements_parsed = 0;
     }
 } LogicalStats;
 extern LogicalStats logical_stats;
 
+/* Count the arrays a parse packed, see RAPIDJSON_VALUE_PACKED_ARRAY_MIN_SIZE.
+ * Every parse counts, including RDB and AOF loads and values rejected afterwards, and nothing is taken off when a
+ * packed array is deleted or overwritten. Hence this is the number of packed arrays parsed, not kept.
+ */
+void jsonstats_count_packed_arrays(size_t arrays, size_t elements);
+
 #define DOUBLE_CHARS_CUTOFF 24
 
 #endif  // VALKEYJSONMODULE_JSON_STATS_H_
@@ -1,6 +1,9 @@
 #include "json/util.h"
 #include "json/dom.h"
 #include "json/alloc.h"
+#include "json/json.h"
+#include <charconv>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include "json/rapidjson_includes.h"
@@ -70,10 +73,58 @@ const char *jsonutil_code_to_message(JsonUtilCode code) {
 size_t jsonutil_double_to_string(const double val, char *double_to_string_buf, size_t len) {
     // It's safe to write a double value into double_to_string_buf, because the converted string will
     // never exceed length of 1024.
+    return jsonutil_double_to_string_format(val, json_is_shortest_doubles_enabled(), double_to_string_buf, len);
+}
+
+size_t jsonutil_double_to_string_format(const double val, const bool shortest, char *double_to_string_buf,
+                                        size_t len) {
     ValkeyModule_Assert(len == BUF_SIZE_DOUBLE_JSON);
+    if (shortest) return jsonutil_double_to_string_shortest(val, double_to_string_buf, len);
     return snprintf(double_to_string_buf, len, "%.17g", val);
 }
 
+size_t jsonutil_double_to_string_shortest(const double val, char *double_to_string_buf, size_t len) {
+    ValkeyModule_Assert(len == BUF_SIZE_DOUBLE_JSON);
+#if defined(__cpp_lib_to_chars)
+    // std::to_chars is the shortest round trip formatter of the standard library (Ryu in libstdc++ and libc++).
+    // Like %.17g, the exponent form is used for exponents below -4 or above 16, e.g., 200000 rather than 2e+05.
+    char *end = double_to_string_buf + len - 1;
+    std::to_chars_result res = std::to_chars(double_to_string_buf, end, val, std::chars_format::scientific);
+    ValkeyModule_Assert(res.ec == std::errc());
+    const char *e = static_cast<const char *>(memchr(double_to_string_buf, 'e', res.ptr - double_to_string_buf));
+    if (e != nullptr) {
+        int exponent = 0;
+        std::from_chars(e + (e[1] == '+' ? 2 : 1), res.ptr, exponent);
+        if (exponent >= -4 && exponent < 17) {
+            res = std::to_chars(double_to_string_buf, end, val, std::chars_format::fixed);
+            ValkeyModule_Assert(res.ec == std::errc());
+        }
+    }
+    *res.ptr = '\0';
+    return res.ptr - double_to_string_buf;
+#else
+    // No floating point std::to_chars, take the fewest digits that read back
+    int n = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+        n = snprintf(double_to_string_buf, len, "%.*g", precision, val);
+        if (std::strtod(double_to_string_buf, nullptr) == val) break;
+    }
+    return n;
+#endif
+}
+
+double jsonutil_string_to_double(const char *str, size_t len) {
+#if defined(__cpp_lib_to_chars)
+    double d;
+    std::from_chars_result res = std::from_chars(str, str + len, d);
+    if (res.ec == std::errc() && res.ptr == str + len) return d;
+#else
+    (void)len;
+#endif
+    // Out of range or not a plain number, fall back to strtod, which rounds out of range values to HUGE_VAL or 0
+    return std::strtod(str, nullptr);
+}
+
 /**
  * Convert double to string using the same format as RapidJSON's Writer::WriteDouble does.
  */
@@ -79,9 +79,27 @@ const char *jsonutil_code_to_message(JsonUtilCode code);
 
 /* Convert a double value to string. This method is used to help serializing numbers to strings.
  * Trailing zeros will be removed. For example, 135.250000 will be converted to string 135.25.
+ * Formats with %.17g, or with jsonutil_double_to_string_shortest if json.shortest-doubles is enabled.
  */
 size_t jsonutil_double_to_string(const double val, char *double_to_string_buf, size_t len);
 
+/* Convert a double value to string with %.17g, or with jsonutil_double_to_string_shortest if shortest is true,
+ * whatever json.shortest-doubles says. Doubles kept in binary are formatted this way, in the format they were
+ * stored with, so that their text doesn't change with the config.
+ */
+size_t jsonutil_double_to_string_format(const double val, const bool shortest, char *double_to_string_buf,
+                                        size_t len);
+
+/* Convert a double value to the shortest string that reads back as the same double, e.g., 0.1 rather than
+ * 0.10000000000000001, independent of the locale.
+ */
+size_t jsonutil_double_to_string_shortest(const double val, char *double_to_string_buf, size_t len);
+
+/* Convert the text of a JSON number to a double, rounded as strtod does but independent of the locale.
+ * The text must be zero terminated.
+ */
+double jsonutil_string_to_double(const char *str, size_t len);
+
 /**
  * Convert double to string using the same format as RapidJSON's Writer::WriteDouble does.
  */
@@ -21,6 +21,7 @@
 #endif
 
 #include "rapidjson/reader.h"
+#include "rapidjson/htgroup.h"
 #include <rapidjson/internal/meta.h>
 #include <rapidjson/internal/strfunc.h>
 #include <rapidjson/memorystream.h>
@@ -121,6 +122,28 @@ class GenericDocument;
 #define RAPIDJSON_VALUE_DEFAULT_ARRAY_CAPACITY 16
 #endif
 
+/*! \def RAPIDJSON_VALUE_FRONT_GAP_MIN_SIZE
+    \ingroup RAPIDJSON_CONFIG
+    \brief Minimum size of an array that keeps a gap at the front of its elements.
+
+    Removing or inserting elements at the front of an array this large moves the start of the elements within their
+    buffer, rather than moving all of the other elements. Smaller arrays are cheaper to move.
+*/
+#ifndef RAPIDJSON_VALUE_FRONT_GAP_MIN_SIZE
+#define RAPIDJSON_VALUE_FRONT_GAP_MIN_SIZE 32
+#endif
+
+/*! \def RAPIDJSON_VALUE_PACKED_ARRAY_MIN_SIZE
+    \ingroup RAPIDJSON_CONFIG
+    \brief Minimum size of a parsed array of numbers that gets packed, see GenericValue::PackNumber.
+
+    The doubles of such an array are kept in binary rather than as their text, which cuts the memory of vectors and
+    time series by up to 2/3. Smaller arrays aren't worth the extra formatting.
+*/
+#ifndef RAPIDJSON_VALUE_PACKED_ARRAY_MIN_SIZE
+#define RAPIDJSON_VALUE_PACKED_ARRAY_MIN_SIZE 16
+#endif
+
 struct HashTableFactors {
     enum { MIN_HT_SIZE = 4 };   // Minimum size of a hash table
     float minLoad = 0.25;       // Keep table at least 1/2 full (after shrink)
@@ -128,6 +151,7 @@ struct HashTableFactors {
     float shrink = 0.5;         // reduce by 50%
     float grow = 1.0;           // grow by 100%
     size_t minHTSize = 32;      // Minimum size for hashtable
+    size_t minGroupedHTSize = 1024; // Minimum capacity for a hashtable with control bytes, 0 => never
     const char *isValid() const {
         if (minHTSize < 2)  return "minHTSize < 2";
         if (minLoad <= 0) return "minLoad <= 0.0";
@@ -798,7 +822,7 @@ public:
             SetNoescape(rhs.IsNoescape());
             break;
         case kNumberType:
-            if ((rhs.data_.f.flags & kDoubleFlag) != 0) {
+            if ((rhs.data_.f.flags & kDoubleFlag) != 0 && !rhs.IsBinaryDouble()) {
                 SetStringRaw(StringRef(rhs.GetDoubleString(), rhs.GetDoubleStringLength()), allocator, false, true);
                 RAPIDJSON_ASSERT(rhs.IsNoescape());
                 SetNoescape(true);
@@ -876,6 +900,22 @@ public:
             data_.f.flags |= kIntFlag;
     }
 
+    //! Constructor for a double kept in binary, see kNumberBinaryDoubleFlag, formatted as json.shortest-doubles says
+    explicit GenericValue(double d) RAPIDJSON_NOEXCEPT : data_() {
+        data_.bd.d = d;
+        data_.bd.shortest = json_is_shortest_doubles_enabled();
+        data_.f.flags = kNumberBinaryDoubleFlag;
+        SetNoescape(true);
+    }
+
+    //! Constructor for a double kept in binary, formatted with %.17g or as the shortest text that reads back
+    GenericValue(double d, bool shortest) RAPIDJSON_NOEXCEPT : data_() {
+        data_.bd.d = d;
+        data_.bd.shortest = shortest;
+        data_.f.flags = kNumberBinaryDoubleFlag;
+        SetNoescape(true);
+    }
+
     //! Constructor for constant string (i.e. do not make a copy of string)
     GenericValue(const Ch* s, SizeType length, bool noescape = false) RAPIDJSON_NOEXCEPT : data_() { SetStringRaw(StringRef(s, length), noescape); }
 
@@ -950,7 +990,7 @@ public:
                     for (GenericValue* v = e; v != e + data_.a.size; ++v)
                         v->~GenericValue();
                     if (Allocator::kNeedFree) { // Shortcut by Allocator's trait
-                        Allocator::Free(e);
+                        Allocator::Free(GetElementsBuffer(e));
                     }
                 }
                 break;
@@ -970,6 +1010,7 @@ public:
             case kCopyStringFlag:
             case kNumberDoubleFlag:
                 if (Allocator::kNeedFree) { // Shortcut by Allocator's trait
+                    MemoryCategoryScope scope(MEMORY_CATEGORY_STRINGS);
                     Allocator::Free(const_cast<Ch*>(GetStringPointer()));
                 }
                 break;
@@ -1204,8 +1245,42 @@ public:
     bool IsString() const { return (data_.f.flags & kStringFlag) != 0; }
     bool IsShortString() const { return (data_.f.flags & kShortStringFlag) != 0;}
     bool IsShortDouble() const { return (data_.f.flags & kNumberShortDoubleFlag) != 0;}
+    bool IsBinaryDouble() const { return data_.f.flags == kNumberBinaryDoubleFlag; }
     bool IsHandle() const { return data_.f.flags == kHandleFlag; }
 
+    //! Relocate the memory this value owns directly: the element or member buffer, or a copied string. Children are
+    //! not visited. \c move is called with each pointer and returns its new location, or nullptr if it wasn't moved.
+    //! Used by defragmentation.
+    template <typename Move>
+    void MoveBuffers(Move& move) {
+        switch (data_.f.flags) {
+            case kArrayFlag:
+                if (GenericValue* e = GetElementsPointer(false)) {
+                    // The buffer is moved as a whole, elements stay at the same offset from its start
+                    GenericValue* b = GetElementsBuffer(e);
+                    if (void* n = move(b)) SetElementsPointerRaw(static_cast<GenericValue*>(n) + (e - b));
+                }
+                break;
+            case kObjectVecFlag:
+                if (!MembersPointerIsNull()) {
+                    if (void* n = move(GetMembersPointerVec(false))) SetMembersPointerVec(static_cast<Member*>(n));
+                }
+                break;
+            case kObjectHTFlag:
+                // Members are linked by index, so the table can be moved as a whole
+                if (!MembersPointerIsNull()) {
+                    if (void* n = move(GetMembersPointerHT(false))) SetMembersPointerHT(static_cast<MemberHT*>(n));
+                }
+                break;
+            case kCopyStringFlag:
+            case kNumberDoubleFlag:
+                if (void* n = move(const_cast<Ch*>(GetStringPointer(false)))) SetStringPointer(static_cast<Ch*>(n));
+                break;
+            default:
+                break;
+        }
+    }
+
     // Checks whether a number can be losslessly converted to a double.
     bool IsLosslessDouble() const {
         if (!IsNumber()) return false;
@@ -1421,6 +1496,16 @@ public:
     MemberIterator FindMember(const std::basic_string_view<Ch>& name) { return FindMember(GenericValue(StringRef(name))); }
     ConstMemberIterator FindMember(const std::basic_string_view<Ch>& name) const { return FindMember(GenericValue(StringRef(name))); }
 
+    //! Find member by the handle of its name, e.g., the name of a member of another object.
+    /*! Faster than finding it by string, the name isn't hashed and looked up in the KeyTable again.
+        \pre IsObject() == true
+    */
+    MemberIterator FindMember(const KeyTable_Handle& name) {
+        RAPIDJSON_ASSERT(IsObject());
+        KeyTable_Handle h = keyTable->clone(name);
+        return DoFindMember(h);
+    }
+
     //! Add a member (name-value pair) to the object.
     /*! \param name A string value as name of member.
         \param value Value of any type.
@@ -1695,7 +1780,7 @@ public:
     SizeType Size() const { RAPIDJSON_ASSERT(IsArray()); return data_.a.size; }
 
     //! Get the capacity of array.
-    SizeType Capacity() const { RAPIDJSON_ASSERT(IsArray()); return data_.a.capacity; }
+    SizeType Capacity() const { RAPIDJSON_ASSERT(IsArray()); return ArrayCapacity(); }
 
     //! Check whether the array is empty.
     bool Empty() const { RAPIDJSON_ASSERT(IsArray()); return data_.a.size == 0; }
@@ -1743,9 +1828,18 @@ public:
         \note Linear time complexity.
     */
     GenericValue& Reserve(SizeType newCapacity, Allocator &allocator) {
-        if (newCapacity > data_.a.capacity) {
-            SetElementsPointer(reinterpret_cast<GenericValue*>(allocator.Realloc(GetElementsPointer(), data_.a.capacity * sizeof(GenericValue), newCapacity * sizeof(GenericValue))));
-            data_.a.capacity = newCapacity;
+        if (newCapacity > ArrayCapacity()) {
+            if (HasFrontGap()) {
+                GenericValue* e = GetElementsPointer();
+                GenericValue* b = GetElementsBuffer(e);
+                SizeType front = static_cast<SizeType>(e - b);
+                b = reinterpret_cast<GenericValue*>(allocator.Realloc(b, (front + ArrayCapacity()) * sizeof(GenericValue), (front + newCapacity) * sizeof(GenericValue)));
+                SetElementsPointerRaw(b + front);
+                data_.a.capacity = newCapacity | kFrontGapBit;
+            } else {
+                SetElementsPointer(reinterpret_cast<GenericValue*>(allocator.Realloc(GetElementsPointer(), data_.a.capacity * sizeof(GenericValue), newCapacity * sizeof(GenericValue))));
+                data_.a.capacity = newCapacity;
+            }
         }
         return *this;
     }
@@ -1761,12 +1855,53 @@ public:
         \note Amortized constant time complexity.
     */
     GenericValue& PushBack(GenericValue& value, Allocator& allocator) {
-        if (data_.a.size >= data_.a.capacity)
-            Reserve(data_.a.capacity == 0 ? kDefaultArrayCapacity : (data_.a.capacity + (data_.a.capacity + 1) / 2), allocator);
+        if (data_.a.size >= ArrayCapacity()) {
+            // A queue pops at the front and pushes at the back, reuse the front rather than growing forever
+            if (HasFrontGap() && GetFrontGap() >= data_.a.size / 2)
+                CloseFrontGap();
+            else
+                Reserve(ArrayCapacity() == 0 ? kDefaultArrayCapacity : (ArrayCapacity() + (ArrayCapacity() + 1) / 2), allocator);
+        }
         GetElementsPointer()[data_.a.size++].RawAssign(value, true);
         return *this;
     }
 
+    //! Insert a GenericValue at the front of the array.
+    /*! \param value        Value to be inserted.
+        \param allocator    Allocator for reallocating memory. It must be the same one as used before.
+        \pre IsArray() == true
+        \post value.IsNull() == true
+        \note Arrays of at least RAPIDJSON_VALUE_FRONT_GAP_MIN_SIZE elements keep a gap in front of their elements,
+              which makes this amortized constant time. Linear time for smaller arrays.
+    */
+    GenericValue& PushFront(GenericValue& value, Allocator& allocator) {
+        RAPIDJSON_ASSERT(IsArray());
+        if (data_.a.size < kFrontGapMinSize && GetFrontGap() == 0) {
+            PushBack(value, allocator);
+            GenericValue* e = GetElementsPointer();
+            char last[sizeof(GenericValue)];
+            std::memcpy(last, static_cast<void*>(e + data_.a.size - 1), sizeof(GenericValue));
+            std::memmove(static_cast<void*>(e + 1), e, (data_.a.size - 1) * sizeof(GenericValue));
+            std::memcpy(static_cast<void*>(e), last, sizeof(GenericValue));
+            return *this;
+        }
+        if (GetFrontGap() == 0) OpenFrontGap(data_.a.size / 2, allocator);
+        GenericValue* e = GetElementsPointer() - 1;
+        SizeType gap = GetFrontGap() - 1;
+        SetElementsPointerRaw(e);
+        SetFrontGap(e, gap);
+        data_.a.capacity++;
+        data_.a.size++;
+        e->RawAssign(value, true);
+        return *this;
+    }
+
+#if RAPIDJSON_HAS_CXX11_RVALUE_REFS
+    GenericValue& PushFront(GenericValue&& value, Allocator& allocator) {
+        return PushFront(value, allocator);
+    }
+#endif // RAPIDJSON_HAS_CXX11_RVALUE_REFS
+
 #if RAPIDJSON_HAS_CXX11_RVALUE_REFS
     GenericValue& PushBack(GenericValue&& value, Allocator& allocator) {
         return PushBack(value, allocator);
@@ -1847,11 +1982,27 @@ public:
         RAPIDJSON_ASSERT(first <= last);
         RAPIDJSON_ASSERT(last <= End());
         ValueIterator pos = Begin() + (first - Begin());
+        SizeType count = static_cast<SizeType>(last - first);
+        if (count == 0) return pos;  // Nothing to free, and no slot to open a front gap with
         for (ValueIterator itr = pos; itr != last; ++itr) {
             itr->~GenericValue();
         }
+        SizeType before = static_cast<SizeType>(pos - Begin());
+        if (data_.a.size >= kFrontGapMinSize && before < static_cast<SizeType>(End() - last)) {
+            // Fewer elements in front, move them instead, which leaves the freed slots in the front gap
+            GenericValue* e = GetElementsPointer();
+            std::memmove(static_cast<void*>(e + count), e, static_cast<size_t>(before) * sizeof(GenericValue));
+            // An array without a gap gives up its first slot to hold the size of the gap
+            SizeType gap = HasFrontGap() ? GetFrontGap() + count : count - 1;
+            e += count;
+            SetElementsPointerRaw(e);
+            SetFrontGap(e, gap);
+            data_.a.capacity = (ArrayCapacity() - count) | kFrontGapBit;
+            data_.a.size -= count;
+            return e + before;
+        }
         std::memmove(static_cast<void*>(pos), last, static_cast<size_t>(End() - last) * sizeof(GenericValue));
-        data_.a.size -= static_cast<SizeType>(last - first);
+        data_.a.size -= count;
         return pos;
     }
 
@@ -1873,7 +2024,8 @@ public:
     */
     double GetDouble() const {
         RAPIDJSON_ASSERT(IsNumber());
-        if ((data_.f.flags & kDoubleFlag) != 0)                { return std::stod(DataString(data_)); }   // convert from string to double.
+        if (data_.f.flags == kNumberBinaryDoubleFlag)          return data_.n.d;
+        if ((data_.f.flags & kDoubleFlag) != 0)                return jsonutil_string_to_double(DataString(data_), DataStringLength(data_));   // The text is zero-terminated
         if ((data_.f.flags & kIntFlag) != 0)                   return data_.n.i.i; // int -> double
         if ((data_.f.flags & kUintFlag) != 0)                  return data_.n.u.u; // unsigned -> double
         if ((data_.f.flags & kInt64Flag) != 0)                 return static_cast<double>(data_.n.i64); // int64_t -> double (may lose precision)
@@ -1885,6 +2037,29 @@ public:
     GenericValue& SetInt64(int64_t i64)     { this->~GenericValue(); new (this) GenericValue(i64);  return *this; }
     GenericValue& SetUint64(uint64_t u64)   { this->~GenericValue(); new (this) GenericValue(u64);  return *this; }
     GenericValue& SetDouble(const Ch* d, SizeType length, Allocator& allocator)       { this->~GenericValue(); new (this) GenericValue(d, length, allocator, true, true);    return *this; }
+    GenericValue& SetDouble(double d)       { this->~GenericValue(); new (this) GenericValue(d);    return *this; }
+
+    //! Keep a parsed double in binary if that doesn't change its text, i.e., formatting it gives back the text.
+    /*! Texts of %.17g, e.g., C printf, and of the shortest round trip, e.g., Python repr and JavaScript, qualify. The
+        format is kept with the double, see BinaryDouble, so it doesn't matter what json.shortest-doubles says later.
+        Doubles short enough to be inlined are left alone, they don't cost any memory.
+        \return false if this isn't a number, or is a double that has to keep its text on the heap.
+    */
+    bool PackNumber() {
+        if (!IsDouble()) return IsNumber();
+        if (IsBinaryDouble() || (data_.f.flags & kInlineStrFlag)) return true;
+        Ch buf[BUF_SIZE_DOUBLE_JSON];
+        double d = GetDouble();
+        for (bool shortest : {false, true}) {
+            size_t length = jsonutil_double_to_string_format(d, shortest, buf, BUF_SIZE_DOUBLE_JSON);
+            if (length == DataStringLength(data_) && std::memcmp(buf, DataString(data_), length) == 0) {
+                this->~GenericValue();
+                new (this) GenericValue(d, shortest);
+                return true;
+            }
+        }
+        return false;
+    }
 
     //@}
     void ExtractHandle(KeyTable_Handle* h) {
@@ -1897,7 +2072,21 @@ public:
     //@{
 
     const Ch* GetString(bool validate = true) const { RAPIDJSON_ASSERT(IsString()); return DataString(data_, validate); }
-    const Ch* GetDoubleString(bool validate = true) const { RAPIDJSON_ASSERT(IsDouble()); return DataString(data_, validate); }
+    const Ch* GetDoubleString(bool validate = true) const {
+        RAPIDJSON_ASSERT(IsDouble() && !IsBinaryDouble());
+        return DataString(data_, validate);
+    }
+    //! Get the text of any double. Binary doubles are formatted into buf, which has BUF_SIZE_DOUBLE_JSON chars.
+    const Ch* GetDoubleString(Ch* buf, SizeType& length) const {
+        RAPIDJSON_ASSERT(IsDouble());
+        if (IsBinaryDouble()) {
+            length = static_cast<SizeType>(jsonutil_double_to_string_format(data_.bd.d, data_.bd.shortest != 0, buf,
+                                                                            BUF_SIZE_DOUBLE_JSON));
+            return buf;
+        }
+        length = DataStringLength(data_);
+        return DataString(data_);
+    }
     const std::basic_string_view<Ch> GetStringView() const {
         RAPIDJSON_ASSERT(IsString());
         return std::basic_string_view<Ch>(DataString(data_), DataStringLength(data_));
@@ -1907,7 +2096,7 @@ public:
     /*! Since rapidjson permits "\\u0000" in the json string, strlen(v.GetString()) may not equal to v.GetStringLength().
     */
     SizeType GetStringLength() const { RAPIDJSON_ASSERT(IsString()); return DataStringLength(data_); }
-    SizeType GetDoubleStringLength() const { RAPIDJSON_ASSERT(IsDouble()); return DataStringLength(data_); }
+    SizeType GetDoubleStringLength() const { RAPIDJSON_ASSERT(IsDouble() && !IsBinaryDouble()); return DataStringLength(data_); }
 
     //! Set this value as a string without copying source string.
     /*! This version has better performance with supplied length, and also support string containing null character.
@@ -2032,7 +2221,12 @@ public:
     
         default:
             RAPIDJSON_ASSERT(GetType() == kNumberType);
-            if (IsDouble())         return handler.RawNumber(GetDoubleString(), GetDoubleStringLength(), true);
+            if (IsDouble()) {
+                Ch buf[BUF_SIZE_DOUBLE_JSON];
+                SizeType length;
+                const Ch* str = GetDoubleString(buf, length);
+                return handler.RawNumber(str, length, true);
+            }
             else if (IsInt())       return handler.Int(data_.n.i.i);
             else if (IsUint())      return handler.Uint(data_.n.u.u);
             else if (IsInt64())     return handler.Int64(data_.n.i64);
@@ -2089,6 +2283,11 @@ private:
         // They function as doubles (printed like numbers, support numerical operations) but are stored as strings (but restricted to double values)
         kNumberDoubleFlag = static_cast<int>(kNumberType) | static_cast<int>(kNumberFlag | kDoubleFlag),
         kNumberShortDoubleFlag = static_cast<int>(kNumberType) | static_cast<int>(kNumberFlag | kDoubleFlag | kInlineStrFlag),
+        // kNumberBinaryDoubleFlag keeps the double itself in n.d, for the results of arithmetic. Its text is produced
+        // when it's serialized, in the format json.shortest-doubles had when the double was stored, see BinaryDouble,
+        // which is what the string form of a computed double would have held, so the output doesn't change. Reuses the
+        // kCopyFlag bit, which has no meaning for numbers.
+        kNumberBinaryDoubleFlag = static_cast<int>(kNumberType) | static_cast<int>(kNumberFlag | kDoubleFlag | kCopyFlag),
         kNumberAnyFlag = static_cast<int>(kNumberType) | static_cast<int>(kNumberFlag | kIntFlag | kInt64Flag | kUintFlag | kUint64Flag | kDoubleFlag),
         kConstStringFlag = static_cast<int>(kStringType) | static_cast<int>(kStringFlag),
         kCopyStringFlag = static_cast<int>(kStringType) | static_cast<int>(kStringFlag | kCopyFlag),
@@ -2101,6 +2300,8 @@ private:
     };
 
     static const SizeType kDefaultArrayCapacity = RAPIDJSON_VALUE_DEFAULT_ARRAY_CAPACITY;
+    static const SizeType kFrontGapMinSize = RAPIDJSON_VALUE_FRONT_GAP_MIN_SIZE;
+    static const SizeType kFrontGapBit = 0x80000000u;   // in ArrayData::capacity, see HasFrontGap
     static const SizeType kDefaultObjectCapacity = RAPIDJSON_VALUE_DEFAULT_OBJECT_CAPACITY;
 
     struct Flag {
@@ -2165,6 +2366,16 @@ private:
         double d;
     };  // 8 bytes
 
+    // A double kept in binary, see kNumberBinaryDoubleFlag, and the format of its text: %.17g or the shortest text
+    // that reads back. The format is fixed when the double is stored, changing json.shortest-doubles later doesn't
+    // change the text of stored data.
+    struct BinaryDouble {
+        double d;
+        uint8_t shortest;
+    };  // both in the payload, clear of the flags
+    static_assert(sizeof(double) + sizeof(uint8_t) <= sizeof(static_cast<Flag*>(0)->payload),
+                  "The format of a binary double must not overlap the flags");
+
     struct ObjectData {
         SizeType size;
         SizeType capacity;
@@ -2188,6 +2399,7 @@ private:
         String s;
         ShortString ss;
         Number n;
+        BinaryDouble bd;
         ObjectData o;
         ArrayData a;
         HandleData h;
@@ -2208,8 +2420,55 @@ private:
 
     RAPIDJSON_FORCEINLINE const Ch* GetStringPointer(bool validate = true) const { return DataString(data_, validate); }
     RAPIDJSON_FORCEINLINE const Ch* SetStringPointer(const Ch* str) { return RAPIDJSON_SETPOINTER(Ch, data_.s.str, str); }
-    RAPIDJSON_FORCEINLINE GenericValue* GetElementsPointer(bool validate = true) const { return MEMORY_VALIDATE(RAPIDJSON_GETPOINTER(GenericValue, data_.a.elements), validate); }
+    RAPIDJSON_FORCEINLINE GenericValue* GetElementsPointer(bool validate = true) const {
+        GenericValue* e = RAPIDJSON_GETPOINTER(GenericValue, data_.a.elements);
+        MEMORY_VALIDATE(GetElementsBuffer(e), validate);
+        return e;
+    }
     RAPIDJSON_FORCEINLINE GenericValue* SetElementsPointer(GenericValue* elements) { MEMORY_VALIDATE(elements); return RAPIDJSON_SETPOINTER(GenericValue, data_.a.elements, elements); }
+    RAPIDJSON_FORCEINLINE GenericValue* SetElementsPointerRaw(GenericValue* elements) { return RAPIDJSON_SETPOINTER(GenericValue, data_.a.elements, elements); }
+
+    //
+    // Front gap of arrays. An array with kFrontGapBit set in its capacity doesn't start its elements at the start of
+    // their buffer: the buffer is [slot holding the gap size][gap free slots][capacity slots for the elements], and
+    // the size of the gap is kept in the slot right before the first element, which is either the first slot or a
+    // free one. Removing elements at the front then grows the gap instead of moving the rest, see Erase, and
+    // PushFront fills it. The capacity is what's left from the first element on.
+    //
+    RAPIDJSON_FORCEINLINE SizeType ArrayCapacity() const { return data_.a.capacity & ~kFrontGapBit; }
+    RAPIDJSON_FORCEINLINE bool HasFrontGap() const { return (data_.a.capacity & kFrontGapBit) != 0; }
+    RAPIDJSON_FORCEINLINE SizeType GetFrontGap() const {
+        return HasFrontGap() ? *reinterpret_cast<const SizeType*>(RAPIDJSON_GETPOINTER(GenericValue, data_.a.elements) - 1) : 0;
+    }
+    RAPIDJSON_FORCEINLINE static void SetFrontGap(GenericValue* elements, SizeType gap) {
+        *reinterpret_cast<SizeType*>(static_cast<void*>(elements - 1)) = gap;
+    }
+    // The start of the allocation holding the elements
+    RAPIDJSON_FORCEINLINE GenericValue* GetElementsBuffer(GenericValue* elements) const {
+        return HasFrontGap() ? elements - 1 - *reinterpret_cast<const SizeType*>(elements - 1) : elements;
+    }
+
+    //! Make room for \c gap elements in front of the elements, in a new buffer.
+    void OpenFrontGap(SizeType gap, Allocator& allocator) {
+        GenericValue* e = GetElementsPointer();
+        GenericValue* b = GetElementsBuffer(e);
+        SizeType capacity = ArrayCapacity();
+        GenericValue* n = static_cast<GenericValue*>(allocator.Malloc((1 + gap + capacity) * sizeof(GenericValue)));
+        if (data_.a.size) std::memcpy(static_cast<void*>(n + 1 + gap), e, data_.a.size * sizeof(GenericValue));
+        if (Allocator::kNeedFree) Allocator::Free(b);
+        SetElementsPointerRaw(n + 1 + gap);
+        SetFrontGap(n + 1 + gap, gap);
+        data_.a.capacity = capacity | kFrontGapBit;
+    }
+
+    //! Move the elements back to the start of their buffer, which gives the gap to the capacity.
+    void CloseFrontGap() {
+        GenericValue* e = GetElementsPointer();
+        GenericValue* b = GetElementsBuffer(e);
+        std::memmove(static_cast<void*>(b), e, data_.a.size * sizeof(GenericValue));
+        data_.a.capacity = ArrayCapacity() + static_cast<SizeType>(e - b);
+        SetElementsPointer(b);
+    }
 
     RAPIDJSON_FORCEINLINE bool MembersPointerIsNull() const { return RAPIDJSON_GETPOINTER(Member, data_.o.u.members) == nullptr; }
 
@@ -2254,6 +2513,10 @@ private:
     template <typename SourceAllocator>
     MemberIterator DoFindMember(const GenericValue<Encoding, SourceAllocator>& name) {
         KeyTable_Handle h = keyTable->makeHandle(name.GetString(), name.GetStringLength());
+        return DoFindMember(h);
+    }
+
+    MemberIterator DoFindMember(KeyTable_Handle& h) {
         MemberIterator i;
         if (IsObjectHT()) {
             i = DoFindMemberHT(h, false);
@@ -2397,7 +2660,7 @@ private:
         // Check for duplicates
         //
         trace("Add Size:" << o.size << " Cap:" << o.capacity << " H:" << name);
-        if (name->getRefCount() > 1) {  // refcount == 1 guarantees no duplicates
+        if (!name.IsUnique()) {  // A unique handle guarantees no duplicates
             for (SizeType i = 0; i < o.size; ++i) {
                 trace("Comparing to " << i << " h:" << members[i].name);
                 if (name == members[i].name) {
@@ -2519,9 +2782,27 @@ private:
      * The 0'th index value member contains a pointer to the allocator for this hashtable. (See
      * rehash).
      *
+     * Tables with a capacity of at least hashTableFactors.minGroupedHTSize are "grouped": an array of
+     * control bytes follows the MemberHT vector in the same allocation, one byte per slot holding
+     * either HTGroup::kEmpty or 7 bits of the slot's handle hash (HTTag). Lookups probe the
+     * control bytes 16 at a time (see htgroup.h) and only compare the handles of matching slots.
+     * The slots, the probe order and the insertion-order list are the same as without control
+     * bytes, so iteration and removal don't care which layout a table has. The first 15 control
+     * bytes are mirrored after the last one, so that a group starting near the end of the table
+     * can be loaded without wrapping around. Whether a table is grouped is decided when it's
+     * constructed and recorded in the ListHead (IsGroupedHT).
+     *
      */
 
     MemberHT& ListHead() const { return GetMembersPointerHT()[0]; }
+    //
+    // The ListHead's value only holds the allocator in its first 8 bytes (see DoConstructMembersHT),
+    // the layout marker lives in the otherwise unused flags.
+    //
+    enum { kGroupedHTMarker = 1 };
+    bool IsGroupedHT() const { return ListHead().value.data_.f.flags == kGroupedHTMarker; }
+    uint8_t *CtrlBytes() const { return reinterpret_cast<uint8_t *>(GetMembersPointerHT() + data_.o.capacity + 1); }
+    static size_t CtrlBytesSize(SizeType capacity) { return capacity + internal::HTGroup::kWidth - 1; }
     ConstMemberIterator MemberBeginHT() const { return ConstMemberIterator(this, ListHead().next); }
     ConstMemberIterator MemberEndHT() const { return ConstMemberIterator(this, 0); }
     MemberIterator MemberBeginHT()          { return MemberIterator(this, ListHead().next); }
@@ -2544,13 +2825,21 @@ private:
         data_.f.flags = kObjectHTFlag;
         data_.o.size = 0;
         data_.o.capacity = capacity;
+        bool grouped = hashTableFactors.minGroupedHTSize != 0 && capacity >= hashTableFactors.minGroupedHTSize
+                && capacity >= SizeType(internal::HTGroup::kWidth);
         size_t memSize = sizeof(MemberHT) * (data_.o.capacity + 1);  // +1 for ListHead
-        void *mem = allocator.Malloc(memSize);
+        size_t ctrlSize = grouped ? CtrlBytesSize(capacity) : 0;
+        MemoryCategoryScope scope(MEMORY_CATEGORY_HASHTABLES);
+        void *mem = allocator.Malloc(memSize + ctrlSize);
         memset(mem, 0, memSize);                            // We actually care about the handles.
         MemberHT *m = reinterpret_cast<MemberHT*>(mem);
         SetMembersPointerHT(m);
 
         m[0].value.data_.n.u64 = reinterpret_cast<uint64_t>(&allocator);      // Cheat....
+        if (grouped) {
+            m[0].value.data_.f.flags = kGroupedHTMarker;
+            memset(CtrlBytes(), internal::HTGroup::kEmpty, ctrlSize);
+        }
     }
 
     void RehashHT(SizeType newCapacity, Allocator& allocator) {
@@ -2579,6 +2868,7 @@ private:
         //
         // Now kill the temp, don't use the destructor because we know all of the members are empty.
         //
+        MemoryCategoryScope scope(me.IsObjectHT() ? MEMORY_CATEGORY_HASHTABLES : MEMORY_CATEGORY_NODES);
         allocator.Free(me.IsObjectHT() ? me.GetMembersPointerHT() : me.GetMembersPointerVec());
         me.data_.f.flags = kNullFlag;
     }
@@ -2592,14 +2882,14 @@ private:
     // Compute the starting HashTable entry for this string
     // Don't forget to account for ListHead()
     //
-    // We only have 19-bits of hash in the KeyTable_Handle. When the hashtable size is less than
-    // 2^19, we just modulo that value directly. But when the table is larger, we use the full
-    // value stored in the keytable entry itself.
+    // We only have 18-bits of hash in the KeyTable_Handle. When the hashtable size is less than
+    // 2^18, we just modulo that value directly. But when the table is larger, we use the full
+    // value stored in the keytable entry itself, or computed from an inline handle.
     //
     SizeType HTIndex(KeyTable_Handle& h) const {
         size_t hsh = (data_.o.capacity < KeyTable_Handle::MAX_HASHCODE)
                 ? h.GetHashcode()
-                : h->getOriginalHash();
+                : h.GetOriginalHash();
         return (hsh % data_.o.capacity) + 1;
     }
 
@@ -2616,7 +2906,28 @@ private:
         return data_.o.size / float(data_.o.capacity);
     }
 
+    //
+    // Control byte of a handle: 7 bits of its hash that HTIndex doesn't use, whatever the capacity.
+    // A table handle's hashcode is the low bits of its hash, so take the top ones. An inline
+    // handle's hashcode is the top of its hash, so take the bits just below that.
+    //
+    static uint8_t HTTag(const KeyTable_Handle& h) {
+        size_t hsh = h.GetOriginalHash();
+        size_t shift = h.IsInline() ? 64 - KeyTable_Handle::HASHCODE_BITS - 7 : 64 - 7;
+        return static_cast<uint8_t>((hsh >> shift) & 0x7f);
+    }
+
+    //
+    // Set the control byte of slot ix (1-based, like the MemberHT vector), and its mirror
+    //
+    void SetCtrl(SizeType ix, uint8_t c) {
+        uint8_t *ctrl = CtrlBytes();
+        ctrl[ix - 1] = c;
+        if (ix - 1 < SizeType(internal::HTGroup::kWidth - 1)) ctrl[data_.o.capacity + ix - 1] = c;
+    }
+
     MemberIterator DoFindMemberHT(KeyTable_Handle& h, bool findInsertion) {
+        if (IsGroupedHT()) return DoFindMemberHTGrouped(h, findInsertion);
         SizeType ix = HTIndex(h);
         MemberHT* members = GetMembersPointerHT();
         //
@@ -2642,6 +2953,50 @@ private:
         RAPIDJSON_ASSERT(!findInsertion);
         return MemberEnd();
     }
+
+    //
+    // Same probe sequence as DoFindMemberHT, a group of control bytes at a time. Handles are
+    // only compared for matching tags before the first empty slot of the group, which is where
+    // the linear probe would have stopped.
+    //
+    MemberIterator DoFindMemberHTGrouped(KeyTable_Handle& h, bool findInsertion) {
+        typedef internal::HTGroup Group;
+        const SizeType capacity = data_.o.capacity;
+        const uint8_t tag = HTTag(h);
+        const uint8_t *ctrl = CtrlBytes();
+        MemberHT* members = GetMembersPointerHT();
+        SizeType pos = HTIndex(h) - 1;      // Control bytes are 0-based
+        trace("DoFindMemberHTGrouped(" <<(findInsertion?"Ins":"") << "): @ pos:" << pos << " : " << h);
+        for (SizeType probed = 0; probed < capacity; probed += Group::kWidth) {
+            Group g(ctrl + pos);
+            uint64_t match = g.Match(tag);
+            uint64_t empty = g.MatchEmpty();
+            if (empty) match &= (empty & (~empty + 1)) - 1;     // Only the lanes before the first empty one
+            for (; match; match &= match - 1) {
+                SizeType ix = pos + Group::Lane(match);
+                if (ix >= capacity) ix -= capacity;
+                if (h == members[ix + 1].name) {
+                    trace("found at ix " << ix + 1);
+                    return MemberIterator(this, ix + 1);
+                }
+            }
+            if (empty) {
+                if (!findInsertion) {
+                    trace("not found");
+                    return MemberEnd();
+                }
+                SizeType ix = pos + Group::Lane(empty);
+                if (ix >= capacity) ix -= capacity;
+                trace("InsertIx" << ix + 1);
+                return MemberIterator(this, ix + 1);
+            }
+            pos += Group::kWidth;
+            if (pos >= capacity) pos -= capacity;
+        }
+        trace("Full not found");
+        RAPIDJSON_ASSERT(!findInsertion);
+        return MemberEnd();
+    }
     //
     // Remove all members, but don't destruct the Object.
     //
@@ -2653,10 +3008,12 @@ private:
         }
         members[0].next = members[0].prev = 0;
         o.size = 0;
+        if (IsGroupedHT()) memset(CtrlBytes(), internal::HTGroup::kEmpty, CtrlBytesSize(o.capacity));
     }
     // Destructor call
     void DoFreeMembersHT() {
         DoClearMembersHT();
+        MemoryCategoryScope scope(MEMORY_CATEGORY_HASHTABLES);
         Allocator::Free(GetMembersPointerHT());
     }
 
@@ -2698,6 +3055,7 @@ private:
             m[endix].next = i.index;
             ListHead().prev = i.index;
             data_.o.size++;
+            if (IsGroupedHT()) SetCtrl(i.index, HTTag(name));
         }
     }
 
@@ -2734,6 +3092,8 @@ private:
         m[remove_entry.next].prev = remove_entry.prev;
         data_.o.size--;
         remove_entry.~MemberHT();
+        const bool grouped = IsGroupedHT();
+        if (grouped) SetCtrl(remove_ix, internal::HTGroup::kEmpty);
         //
         // Now, we need to scan from this ix until the next empty slot in case some other entries
         // need to be moved down (see Linear Probing)
@@ -2771,6 +3131,10 @@ private:
                 RAPIDJSON_ASSERT(m[thisEntry.next].prev == ix);
                 m[thisEntry.prev].next = empty_ix;
                 m[thisEntry.next].prev = empty_ix;
+                if (grouped) {
+                    SetCtrl(empty_ix, CtrlBytes()[ix - 1]);
+                    SetCtrl(ix, internal::HTGroup::kEmpty);
+                }
                 empty_ix = ix;
                 RAPIDJSON_ASSERT(!m[empty_ix].name);
             }
@@ -2868,6 +3232,19 @@ private:
                 }
             }
         }
+        //
+        // And the control bytes, if any, w.r.t. the handles
+        //
+        if (IsGroupedHT()) {
+            const uint8_t *ctrl = CtrlBytes();
+            for (size_t ix = 1; ix < vector_size; ++ix) {
+                uint8_t expected = m[ix].name ? HTTag(m[ix].name) : uint8_t(internal::HTGroup::kEmpty);
+                if (ctrl[ix - 1] != expected) os << "Bad control byte @ " << ix;
+            }
+            for (size_t ix = 0; ix < internal::HTGroup::kWidth - 1; ++ix) {
+                if (ctrl[data_.o.capacity + ix] != ctrl[ix]) os << "Bad mirrored control byte @ " << ix;
+            }
+        }
         return os.str();
     }
 
@@ -2888,6 +3265,24 @@ public:
             }
         }
     }
+    //
+    // For a grouped table: the number of slots that finding every member probes before its own, and
+    // how many of those have the member's control byte, i.e. would be compared for nothing
+    //
+    void getObjectTagMatches(size_t& probes, size_t& falseMatches) const {
+        probes = falseMatches = 0;
+        if (!IsGroupedHT()) return;
+        MemberHT *m = GetMembersPointerHT();
+        const uint8_t *ctrl = CtrlBytes();
+        for (SizeType ix = 1; ix < data_.o.capacity + 1; ++ix) {
+            if (!m[ix].name) continue;
+            const uint8_t tag = HTTag(m[ix].name);
+            for (SizeType p = HTIndex(m[ix].name); p != ix; IncrIndex(p)) {
+                probes++;
+                if (ctrl[p - 1] == tag) falseMatches++;
+            }
+        }
+    }
 private:
     // Initialize this value as array with initial data, without calling destructor.
     void SetArrayRaw(GenericValue* values, SizeType count, Allocator& allocator) {
@@ -2920,6 +3315,7 @@ private:
         } else {
             data_.f.flags = isdouble? kNumberDoubleFlag : kCopyStringFlag;
             data_.s.length = s.length;
+            MemoryCategoryScope scope(MEMORY_CATEGORY_STRINGS);
             str = static_cast<Ch *>(allocator.Malloc((s.length + 1) * sizeof(Ch)));
             SetStringPointer(str);
         }
@@ -2979,8 +3375,8 @@ public:
         } else if (IsObject()) {
             return GetMembersPointerVec(validate);
         } else if (IsArray()) {
-            return GetElementsPointer(validate);
-        } else if (IsDouble() && 0 == (data_.f.flags & kInlineStrFlag)) {
+            return GetElementsBuffer(GetElementsPointer(validate));
+        } else if (IsDouble() && !IsBinaryDouble() && 0 == (data_.f.flags & kInlineStrFlag)) {
             return GetDoubleString(validate);
         } else if (IsString() && (0 == (data_.f.flags & kInlineStrFlag))) {
             return GetStringPointer(validate);
@@ -3020,7 +3416,8 @@ public:
         \param stackAllocator   Optional allocator for allocating memory for stack.
     */
     explicit GenericDocument(Type type, Allocator* allocator = 0, size_t stackCapacity = kDefaultStackCapacity, StackAllocator* stackAllocator = 0) :
-            GenericValue<Encoding, Allocator>(type),  allocator_(allocator), ownAllocator_(0), stack_(stackAllocator, stackCapacity), parseResult_(), curDepth_(0), maxDepth_(0)
+            GenericValue<Encoding, Allocator>(type),  allocator_(allocator), ownAllocator_(0), stack_(stackAllocator, stackCapacity), parseResult_(), curDepth_(0), maxDepth_(0),
+            packedArrays_(0), packedElements_(0)
     {
         if (!allocator_)
             ownAllocator_ = allocator_ = RAPIDJSON_NEW(Allocator)();
@@ -3033,7 +3430,8 @@ public:
         \param stackAllocator   Optional allocator for allocating memory for stack.
     */
     GenericDocument(Allocator* allocator = 0, size_t stackCapacity = kDefaultStackCapacity, StackAllocator* stackAllocator = 0) :
-            allocator_(allocator), ownAllocator_(0), stack_(stackAllocator, stackCapacity), parseResult_(), curDepth_(0), maxDepth_(0)
+            allocator_(allocator), ownAllocator_(0), stack_(stackAllocator, stackCapacity), parseResult_(), curDepth_(0), maxDepth_(0),
+            packedArrays_(0), packedElements_(0)
     {
         if (!allocator_)
             ownAllocator_ = allocator_ = RAPIDJSON_NEW(Allocator)();
@@ -3048,7 +3446,9 @@ public:
           stack_(std::move(rhs.stack_)),
           parseResult_(rhs.parseResult_),
           curDepth_(rhs.curDepth_),
-          maxDepth_(rhs.maxDepth_)
+          maxDepth_(rhs.maxDepth_),
+          packedArrays_(rhs.packedArrays_),
+          packedElements_(rhs.packedElements_)
     {
         rhs.allocator_ = 0;
         rhs.ownAllocator_ = 0;
@@ -3084,6 +3484,8 @@ public:
         parseResult_ = rhs.parseResult_;
         curDepth_ = rhs.curDepth_;
         maxDepth_ = rhs.maxDepth_;
+        packedArrays_ = rhs.packedArrays_;
+        packedElements_ = rhs.packedElements_;
 
         rhs.allocator_ = 0;
         rhs.ownAllocator_ = 0;
@@ -3109,6 +3511,8 @@ public:
         internal::Swap(parseResult_, rhs.parseResult_);
         Swap(curDepth_, rhs.curDepth_);
         Swap(maxDepth_, rhs.maxDepth_);
+        Swap(packedArrays_, rhs.packedArrays_);
+        Swap(packedElements_, rhs.packedElements_);
         return *this;
     }
 
@@ -3160,6 +3564,7 @@ public:
     template <unsigned parseFlags, typename SourceEncoding, typename InputStream>
     GenericDocument& ParseStream(InputStream& is) {
         curDepth_ = maxDepth_ = 0;
+        packedArrays_ = packedElements_ = 0;
         GenericReader<SourceEncoding, Encoding, StackAllocator> reader(
             stack_.HasAllocator() ? &stack_.GetAllocator() : 0);
         ClearStackOnExit scope(*this);
@@ -3377,6 +3782,10 @@ public:
 
     size_t GetMaxDepth() const { return maxDepth_; }
 
+    //! Number of arrays packed by the last parse, and their elements, see PackNumbers.
+    size_t GetPackedArrays() const { return packedArrays_; }
+    size_t GetPackedElements() const { return packedElements_; }
+
     bool StartObject() { new (stack_.template Push<ValueType>()) ValueType(kObjectType); return IncrDepth(); }
 
     bool Key(const Ch* str, SizeType length, bool copy, bool noescape) {
@@ -3386,6 +3795,14 @@ public:
         return true;
     }
 
+    //
+    // Same as Key, but the caller already has a handle, ownership of the handle is transferred.
+    //
+    bool Key(KeyTable_Handle& h) {
+        new (stack_.template Push<ValueType>()) ValueType(h);
+        return true;
+    }
+
     bool EndObject(SizeType memberCount) {
         ValueType* members = stack_.template Pop<ValueType>(memberCount * 2); // Each member is two Values
         stack_.template Top<ValueType>()->SetObjectRaw(members, memberCount, GetAllocator());
@@ -3396,11 +3813,29 @@ public:
 
     bool EndArray(SizeType elementCount) {
         ValueType* elements = stack_.template Pop<ValueType>(elementCount);
+        if (elementCount >= RAPIDJSON_VALUE_PACKED_ARRAY_MIN_SIZE) PackNumbers(elements, elementCount);
         stack_.template Top<ValueType>()->SetArrayRaw(elements, elementCount, GetAllocator());
         return DecrDepth();
     }
 
 private:
+    //! Pack an array of numbers only: all of its doubles that can be are kept in binary.
+    /*! The array counts as packed if none of its elements is left with text on the heap.
+        This isn't a vector of raw int64/double, elements stay 16 byte values so that iterators and the API are
+        unchanged. For a 1536 float embedding that's 24KB, against 72KB as Python repr text and 12KB raw.
+    */
+    void PackNumbers(ValueType* elements, SizeType elementCount) {
+        for (SizeType i = 0; i < elementCount; ++i) {
+            if (!elements[i].IsNumber()) return;
+        }
+        bool packed = true;
+        for (SizeType i = 0; i < elementCount; ++i) packed &= elements[i].PackNumber();
+        if (packed) {
+            packedArrays_++;
+            packedElements_ += elementCount;
+        }
+    }
+
     //! Prohibit copying
     GenericDocument(const GenericDocument&);
     //! Prohibit assignment
@@ -3427,6 +3862,8 @@ private:
     ParseResult parseResult_;
     uint32_t curDepth_;
     uint32_t maxDepth_;
+    size_t packedArrays_;
+    size_t packedElements_;
 };
 
 //! GenericDocument with UTF8 encoding
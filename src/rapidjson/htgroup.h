@@ -0,0 +1,99 @@
+// Group probing of the control bytes of an object hashtable, see GenericValue::DoFindMemberHTGrouped.
+//
+// Large hashtables keep one control byte per slot next to their MemberHT entries: either kEmpty or a
+// 7-bit tag taken from the hashcode of the slot's KeyTable_Handle. Lookups compare the tag against 16
+// control bytes at once and only touch the MemberHT entries whose tag matches, instead of loading every
+// entry of the probe sequence.
+//
+// A match is a bit mask with one bit per matching byte, lowest byte first. Lanes are spaced 1 bit apart
+// with SSE2 and 4 bits apart with NEON, use Lane() to turn the lowest set bit into a byte offset.
+
+#ifndef RAPIDJSON_HTGROUP_H_
+#define RAPIDJSON_HTGROUP_H_
+
+#include <rapidjson/rapidjson.h>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2)
+#include <emmintrin.h>
+#elif defined(RAPIDJSON_NEON)
+#include <arm_neon.h>
+#endif
+
+RAPIDJSON_NAMESPACE_BEGIN
+namespace internal {
+
+//! 16 consecutive control bytes of a hashtable. Loads are unaligned.
+class HTGroup {
+public:
+    enum { kWidth = 16 };
+    static const uint8_t kEmpty = 0x80;       // Tags are 7 bits, so the high bit marks an empty slot
+
+    explicit HTGroup(const uint8_t* ctrl);
+    //! Bytes equal to tag
+    uint64_t Match(uint8_t tag) const;
+    //! Empty bytes
+    uint64_t MatchEmpty() const;
+    //! Byte offset of the lowest bit of a non-zero mask
+    static unsigned Lane(uint64_t mask);
+
+private:
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2)
+    __m128i v_;
+#elif defined(RAPIDJSON_NEON)
+    uint8x16_t v_;
+#else
+    const uint8_t* ctrl_;
+#endif
+};
+
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2)
+inline HTGroup::HTGroup(const uint8_t* ctrl) : v_(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+
+inline uint64_t HTGroup::Match(uint8_t tag) const {
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v_, _mm_set1_epi8(static_cast<char>(tag)))));
+}
+
+inline uint64_t HTGroup::MatchEmpty() const {
+    return static_cast<unsigned>(_mm_movemask_epi8(v_));    // The high bit of each byte
+}
+
+inline unsigned HTGroup::Lane(uint64_t mask) { return static_cast<unsigned>(__builtin_ctzll(mask)); }
+
+#elif defined(RAPIDJSON_NEON)
+inline HTGroup::HTGroup(const uint8_t* ctrl) : v_(vld1q_u8(ctrl)) {}
+
+// Narrow a byte mask to 4 bits per byte and keep one of them, so that clearing the lowest bit steps to the next lane
+inline uint64_t HTGroupNarrow(uint8x16_t x) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(x), 4)), 0) & 0x8888888888888888ull;
+}
+
+inline uint64_t HTGroup::Match(uint8_t tag) const { return HTGroupNarrow(vceqq_u8(v_, vdupq_n_u8(tag))); }
+
+inline uint64_t HTGroup::MatchEmpty() const { return HTGroupNarrow(vtstq_u8(v_, vdupq_n_u8(kEmpty))); }
+
+inline unsigned HTGroup::Lane(uint64_t mask) { return static_cast<unsigned>(__builtin_ctzll(mask) >> 2); }
+
+#else
+inline HTGroup::HTGroup(const uint8_t* ctrl) : ctrl_(ctrl) {}
+
+inline uint64_t HTGroup::Match(uint8_t tag) const {
+    uint64_t m = 0;
+    for (unsigned i = 0; i < kWidth; ++i) m |= uint64_t(ctrl_[i] == tag) << i;
+    return m;
+}
+
+inline uint64_t HTGroup::MatchEmpty() const {
+    uint64_t m = 0;
+    for (unsigned i = 0; i < kWidth; ++i) m |= uint64_t(ctrl_[i] >> 7) << i;
+    return m;
+}
+
+inline unsigned HTGroup::Lane(uint64_t mask) { return static_cast<unsigned>(__builtin_ctzll(mask)); }
+#endif
+
+} // namespace internal
+RAPIDJSON_NAMESPACE_END
+
+#endif // RAPIDJSON_HTGROUP_H_
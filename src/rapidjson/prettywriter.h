@@ -17,6 +17,7 @@
 
 #include <rapidjson/writer.h>
 #include "json/json.h"
+#include "json/util.h"
 
 #ifdef __GNUC__
 RAPIDJSON_DIAG_PUSH
@@ -367,8 +368,11 @@ private:
                 break;
             default:
                 RAPIDJSON_ASSERT(value.GetType() == kNumberType);
-                if (value.IsDouble()) { 
-                    Base::WriteDouble(value.GetDoubleString(), value.GetDoubleStringLength());
+                if (value.IsDouble()) {
+                    typename JValue::Ch buf[BUF_SIZE_DOUBLE_JSON];
+                    SizeType length;
+                    const typename JValue::Ch* str = value.GetDoubleString(buf, length);
+                    Base::WriteDouble(str, length);
                 }
                 else if (value.IsInt())       Base::WriteInt(value.GetInt());
                 else if (value.IsUint())      Base::WriteUint(value.GetUint());
@@ -26,6 +26,8 @@
 #include <rapidjson/internal/stack.h>
 #include <rapidjson/internal/strtod.h>
 #include <limits>
+#include <cstring>
+#include "scan.h"
 
 #if defined(RAPIDJSON_SIMD) && defined(_MSC_VER)
 #include <intrin.h>
@@ -1082,6 +1084,17 @@ private:
             // Do nothing for generic version
     }
 
+    // MemoryStream -> StackStream<char>, i.e., the rest of a string with escapes parsed by JParser::Parse
+    static RAPIDJSON_FORCEINLINE void ScanCopyUnescapedString(EncodedInputStream<UTF8<>, MemoryStream>& is,
+                                                              StackStream<char>& os) {
+        const char* p = is.is_.src_;
+        size_t n = internal::ScanUnescaped(p, is.is_.end_);
+        if (n) {
+            std::memcpy(os.Push(static_cast<SizeType>(n)), p, n);
+            is.is_.src_ += n;
+        }
+    }
+
     template<typename InputStream>
     static bool ParseUnescapedString(InputStream& is, SizeType& len) {
         InsituStringStream s(const_cast<char *>(is.is_.src_));
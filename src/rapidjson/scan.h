@@ -0,0 +1,120 @@
+// Vectorized scanning of JSON string contents, shared by the reader and the writer.
+//
+// A run of string characters can be copied verbatim up to the first double quote, backslash or control
+// character (< 0x20). The reader uses that to copy the rest of a string after an escape sequence, the
+// writer to copy everything between the characters that must be escaped.
+//
+// All loads are unaligned and bounded by the end of the input, so the functions never read past it.
+// SSE2 (x86_64) and NEON (aarch64) are baseline for the architectures we build for. AVX2 is selected
+// at run time, as the build targets nehalem.
+
+#ifndef RAPIDJSON_SCAN_H_
+#define RAPIDJSON_SCAN_H_
+
+#include <rapidjson/rapidjson.h>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2)
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__x86_64))
+#include <immintrin.h>
+#define RAPIDJSON_AVX2_DISPATCH 1
+#endif
+#elif defined(RAPIDJSON_NEON)
+#include <arm_neon.h>
+#endif
+
+RAPIDJSON_NAMESPACE_BEGIN
+namespace internal {
+
+//! Length of the prefix of [p, end) that needs no escaping, one character at a time.
+inline size_t ScanUnescapedScalar(const char* p, const char* end) {
+    const char* s = p;
+    while (s != end && *s != '"' && *s != '\\' && static_cast<unsigned char>(*s) >= 0x20)
+        ++s;
+    return static_cast<size_t>(s - p);
+}
+
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2)
+//! Length of the prefix of [p, end) that needs no escaping, 16 characters at a time.
+inline size_t ScanUnescaped16(const char* p, const char* end) {
+    const char* s = p;
+    const __m128i dq = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i sp = _mm_set1_epi8(0x1F);
+    for (; end - s >= 16; s += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+        const __m128i t1 = _mm_cmpeq_epi8(v, dq);
+        const __m128i t2 = _mm_cmpeq_epi8(v, bs);
+        const __m128i t3 = _mm_cmpeq_epi8(_mm_max_epu8(v, sp), sp);  // v < 0x20 <=> max(v, 0x1F) == 0x1F
+        const unsigned r = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(t1, t2), t3)));
+        if (RAPIDJSON_UNLIKELY(r != 0))
+            return static_cast<size_t>(s - p) + static_cast<size_t>(__builtin_ctz(r));
+    }
+    return static_cast<size_t>(s - p) + ScanUnescapedScalar(s, end);
+}
+#elif defined(RAPIDJSON_NEON)
+//! Length of the prefix of [p, end) that needs no escaping, 16 characters at a time.
+inline size_t ScanUnescaped16(const char* p, const char* end) {
+    const char* s = p;
+    const uint8x16_t dq = vmovq_n_u8('"');
+    const uint8x16_t bs = vmovq_n_u8('\\');
+    const uint8x16_t sp = vmovq_n_u8(0x20);
+    for (; end - s >= 16; s += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(s));
+        const uint8x16_t x = vorrq_u8(vorrq_u8(vceqq_u8(v, dq), vceqq_u8(v, bs)), vcltq_u8(v, sp));
+        // Narrow the byte mask to 4 bits per character
+        const uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(x), 4)), 0);
+        if (RAPIDJSON_UNLIKELY(m != 0))
+            return static_cast<size_t>(s - p) + static_cast<size_t>(__builtin_ctzll(m) >> 2);
+    }
+    return static_cast<size_t>(s - p) + ScanUnescapedScalar(s, end);
+}
+#endif
+
+#ifdef RAPIDJSON_AVX2_DISPATCH
+//! Length of the prefix of [p, end) that needs no escaping, 32 characters at a time. Requires AVX2.
+__attribute__((target("avx2")))
+inline size_t ScanUnescaped32(const char* p, const char* end) {
+    const char* s = p;
+    const __m256i dq = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i sp = _mm256_set1_epi8(0x1F);
+    for (; end - s >= 32; s += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+        const __m256i t1 = _mm256_cmpeq_epi8(v, dq);
+        const __m256i t2 = _mm256_cmpeq_epi8(v, bs);
+        const __m256i t3 = _mm256_cmpeq_epi8(_mm256_max_epu8(v, sp), sp);
+        const unsigned r = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(t1, t2), t3)));
+        if (RAPIDJSON_UNLIKELY(r != 0))
+            return static_cast<size_t>(s - p) + static_cast<size_t>(__builtin_ctz(r));
+    }
+    return static_cast<size_t>(s - p) + ScanUnescaped16(s, end);
+}
+
+inline bool DetectAVX2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+inline const bool cpuHasAVX2 = DetectAVX2();
+#endif
+
+//! Length of the prefix of [p, end) that can be copied without escaping or unescaping.
+inline size_t ScanUnescaped(const char* p, const char* end) {
+#ifdef RAPIDJSON_AVX2_DISPATCH
+    if (end - p >= 64 && cpuHasAVX2)
+        return ScanUnescaped32(p, end);
+#endif
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2) || defined(RAPIDJSON_NEON)
+    return ScanUnescaped16(p, end);
+#else
+    return ScanUnescapedScalar(p, end);
+#endif
+}
+
+}  // namespace internal
+RAPIDJSON_NAMESPACE_END
+
+#endif  // RAPIDJSON_SCAN_H_
@@ -0,0 +1,208 @@
+//
+// Value extraction API benchmark.
+//
+// Compares get_json_values_and_types, which serializes and copies the value at every path, with
+// get_json_values_batch, which walks a precompiled path set once and hands out views into the
+// document. The schema is the 20 indexed fields of a typical search index: numbers, strings,
+// booleans and tag arrays, at a few levels of nesting.
+//
+// usage: apiBench [-i iterations] [-k keys]
+//
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "json/dom.h"
+#include "json/stats.h"
+#include "json/memory.h"
+#include "json/json_api.h"
+#include "bench_common.h"
+
+extern ValkeyModuleType *DocumentType;
+
+//
+// A single key space of one key, whose value is whichever document is being indexed
+//
+static JDocument *currentDoc = nullptr;
+static char benchType, benchKey, benchString;
+
+static ValkeyModuleString *bench_CreateString(ValkeyModuleCtx *ctx, const char *ptr, size_t len) {
+    (void)ctx;
+    (void)ptr;
+    (void)len;
+    return reinterpret_cast<ValkeyModuleString *>(&benchString);
+}
+
+static void bench_FreeString(ValkeyModuleCtx *ctx, ValkeyModuleString *str) {
+    (void)ctx;
+    (void)str;
+}
+
+static ValkeyModuleKey *bench_OpenKey(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, int mode) {
+    (void)ctx;
+    (void)keyname;
+    (void)mode;
+    return reinterpret_cast<ValkeyModuleKey *>(&benchKey);
+}
+
+static void bench_CloseKey(ValkeyModuleKey *key) {
+    (void)key;
+}
+
+static int bench_KeyType(ValkeyModuleKey *key) {
+    (void)key;
+    return VALKEYMODULE_KEYTYPE_MODULE;
+}
+
+static ValkeyModuleType *bench_ModuleTypeGetType(ValkeyModuleKey *key) {
+    (void)key;
+    return DocumentType;
+}
+
+static void *bench_ModuleTypeGetValue(ValkeyModuleKey *key) {
+    (void)key;
+    return currentDoc;
+}
+
+static void setupBenchKeySpace() {
+    setupBenchPointers(true);
+    ValkeyModule_CreateString = bench_CreateString;
+    ValkeyModule_FreeString = bench_FreeString;
+    ValkeyModule_OpenKey = bench_OpenKey;
+    ValkeyModule_CloseKey = bench_CloseKey;
+    ValkeyModule_KeyType = bench_KeyType;
+    ValkeyModule_ModuleTypeGetType = bench_ModuleTypeGetType;
+    ValkeyModule_ModuleTypeGetValue = bench_ModuleTypeGetValue;
+    DocumentType = reinterpret_cast<ValkeyModuleType *>(&benchType);
+    setupBenchKeyTable();
+}
+
+static const char *schema[] = {
+    "$.id", "$.sku", "$.title", "$.brand", "$.price", "$.discount", "$.in_stock", "$.rating",
+    "$.reviews", "$.created", "$.category.name", "$.category.path", "$.seller.name", "$.seller.country",
+    "$.seller.rating", "$.shipping.weight", "$.shipping.free", "$.shipping.regions", "$.tags",
+    "$.attributes.color",
+};
+static const int numFields = sizeof(schema) / sizeof(schema[0]);
+
+static std::string makeDocument(size_t n) {
+    std::string id = std::to_string(n);
+    return "{\"id\":" + id + ",\"sku\":\"SKU-" + id + "\",\"title\":\"Stainless steel water bottle, 750 ml, model "
+           + id + "\",\"brand\":\"Acme\",\"price\":" + std::to_string(10 + n % 90) + ".99,\"discount\":0.15,"
+           "\"in_stock\":true,\"rating\":4.6,\"reviews\":" + std::to_string(n * 7 % 5000) + ","
+           "\"created\":1718000000,\"description\":\"Keeps drinks cold for 24 hours and hot for 12. Leak proof "
+           "lid, powder coated finish, dishwasher safe.\",\"category\":{\"name\":\"Kitchen\","
+           "\"path\":\"home/kitchen/drinkware\"},\"seller\":{\"name\":\"Acme Outlet\",\"country\":\"US\","
+           "\"rating\":4.8,\"since\":2011},\"shipping\":{\"weight\":0.45,\"free\":false,"
+           "\"regions\":[\"US\",\"CA\",\"MX\"]},\"tags\":[\"outdoor\",\"hydration\",\"steel\",\"gift\"],"
+           "\"attributes\":{\"color\":\"blue\",\"capacity\":750,\"material\":\"steel\"},"
+           "\"images\":[\"a.jpg\",\"b.jpg\",\"c.jpg\"]}";
+}
+
+struct Sink {
+    size_t bytes;
+    double numbers;
+};
+
+static void consume(void *arg, int path_index, const JsonValueView *value) {
+    (void)path_index;
+    Sink *sink = static_cast<Sink *>(arg);
+    switch (value->type) {
+        case JSON_VALUE_NUMBER: sink->numbers += value->number; break;
+        case JSON_VALUE_STRING: sink->bytes += value->len; break;
+        case JSON_VALUE_ARRAY: {
+            JsonArrayIterator it;
+            json_array_iterator_init(&it, value);
+            JsonValueView e;
+            while (json_array_iterator_next(&it, &e)) sink->bytes += e.len;
+            break;
+        }
+        default: sink->bytes++; break;
+    }
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-i iterations] [-k keys]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 200;
+    size_t numKeys = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:k:")) != -1) {
+        switch (opt) {
+            case 'i': iterations = strtoull(optarg, nullptr, 0); break;
+            case 'k': numKeys = strtoull(optarg, nullptr, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (iterations == 0 || numKeys == 0) usage(argv[0]);
+
+    setupBenchKeySpace();
+    if (jsonstats_init() != JSONUTIL_SUCCESS) return 1;
+
+    std::vector<JDocument *> docs;
+    for (size_t n = 0; n < numKeys; ++n) {
+        std::string json = makeDocument(n);
+        JDocument *doc;
+        if (dom_parse(nullptr, json.c_str(), json.length(), &doc) != JSONUTIL_SUCCESS) {
+            std::cerr << "Failed to parse synthetic document\n";
+            return 1;
+        }
+        docs.push_back(doc);
+    }
+    const double lookups = static_cast<double>(iterations) * numKeys;
+    std::cout << "fields:" << numFields << " keys:" << numKeys << " iterations:" << iterations << "\n";
+
+    Sink sink = {0, 0};
+    for (bool withTypes : {false, true}) {
+        benchAllocations = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t it = 0; it < iterations; ++it) {
+            for (JDocument *doc : docs) {
+                currentDoc = doc;
+                char **values, **types;
+                size_t *lengths, *typeLengths;
+                get_json_values_and_types(nullptr, "k", 1, schema, numFields, &values, &lengths,
+                                          withTypes ? &types : nullptr, withTypes ? &typeLengths : nullptr);
+                for (int i = 0; i < numFields; i++) {
+                    sink.bytes += lengths[i];
+                    free(values[i]);
+                    if (withTypes) free(types[i]);
+                }
+                free(values);
+                free(lengths);
+                if (withTypes) {
+                    free(types);
+                    free(typeLengths);
+                }
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (withTypes ? "get_json_values_and_types (with types): " : "get_json_values_and_types: ")
+                  << (lookups / seconds) << " keys/s, " << (benchAllocations / lookups) << " allocations/key\n";
+    }
+
+    JsonPathSet *set = json_path_set_create(schema, numFields);
+    benchAllocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t it = 0; it < iterations; ++it) {
+        for (JDocument *doc : docs) {
+            currentDoc = doc;
+            get_json_values_batch(nullptr, "k", 1, set, consume, &sink);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "get_json_values_batch: " << (lookups / seconds) << " keys/s, " << (benchAllocations / lookups)
+              << " allocations/key\n";
+    json_path_set_free(set);
+
+    for (JDocument *doc : docs) dom_free_doc(doc);
+    return sink.bytes == 0;  // Keep the loops from being optimized away
+}
@@ -0,0 +1,55 @@
+#include <malloc.h>
+#include <stdarg.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "json/memory.h"
+#include "bench_common.h"
+
+extern size_t hash_function(const char *, size_t);
+
+size_t benchAllocations = 0;
+size_t benchAllocatedBytes = 0;
+
+static void *bench_Alloc(size_t size) {
+    benchAllocations++;
+    benchAllocatedBytes += size;
+    return malloc(size);
+}
+
+static void *bench_Realloc(void *ptr, size_t size) {
+    benchAllocations++;
+    benchAllocatedBytes += size;
+    return realloc(ptr, size);
+}
+
+void bench_Log(ValkeyModuleCtx *ctx, const char *level, const char *fmt, ...) {
+    (void)ctx;
+    if (!strcmp(level, "debug") || !strcmp(level, "notice")) return;  // Keep the timed loop quiet
+    va_list arg;
+    va_start(arg, fmt);
+    fprintf(stderr, "Log(%s): ", level);
+    vfprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    va_end(arg);
+}
+
+void setupBenchPointers(bool countAllocations) {
+    setupValkeyModulePointers();
+    ValkeyModule_Alloc = countAllocations ? bench_Alloc : malloc;
+    ValkeyModule_Free = free;
+    ValkeyModule_Realloc = countAllocations ? bench_Realloc : realloc;
+    ValkeyModule_MallocSize = malloc_usable_size;
+    ValkeyModule_Log = bench_Log;
+    memory_traps_control(false);
+}
+
+void setupBenchKeyTable(size_t numShards) {
+    KeyTable::Config c;
+    c.malloc = dom_alloc;
+    c.free = dom_free;
+    c.hash = hash_function;
+    c.numShards = numShards;
+    keyTable = new KeyTable(c);
+}
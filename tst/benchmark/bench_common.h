@@ -0,0 +1,38 @@
+//
+// Setup shared by the benchmarks.
+//
+// Benchmarks run on the unit test module simulation, but with the plain C library allocator: the module_sim
+// allocator tracks every pointer in a std::map, which isn't thread safe and would be part of what's measured.
+//
+#ifndef VALKEYJSONMODULE_TST_BENCHMARK_BENCH_COMMON_H_
+#define VALKEYJSONMODULE_TST_BENCHMARK_BENCH_COMMON_H_
+
+#include <cstddef>
+
+#include "json/dom.h"
+#include "module_sim.h"
+
+//
+// Calls of ValkeyModule_Alloc and ValkeyModule_Realloc, and the bytes they asked for, if counted. Reset them
+// before the timed loop.
+//
+extern size_t benchAllocations;
+extern size_t benchAllocatedBytes;
+
+//
+// Warnings go to stderr, debug and notice lines would get in the way of the timed loops.
+//
+void bench_Log(ValkeyModuleCtx *ctx, const char *level, const char *fmt, ...);
+
+//
+// The module simulation with the C library allocator and bench_Log, and traps off.
+// countAllocations => allocations are counted in benchAllocations and benchAllocatedBytes.
+//
+void setupBenchPointers(bool countAllocations = false);
+
+//
+// A KeyTable with the hash function of the module and numShards shards.
+//
+void setupBenchKeyTable(size_t numShards = 1);
+
+#endif  // VALKEYJSONMODULE_TST_BENCHMARK_BENCH_COMMON_H_
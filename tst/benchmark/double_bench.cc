@@ -0,0 +1,117 @@
+//
+// Double formatting and parsing benchmark.
+//
+// Compares jsonutil_double_to_string (%.17g), jsonutil_double_to_string_rapidjson (Grisu2) and
+// jsonutil_double_to_string_shortest (std::to_chars) on the kind of doubles our documents hold:
+// prices, ratings, coordinates, the results of NUMINCRBY/NUMMULTBY and a few extremes. Then compares
+// strtod with jsonutil_string_to_double on the texts the legacy formatter produces.
+//
+// usage: doubleBench [-i iterations]
+//
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "json/util.h"
+#include "module_sim.h"
+
+static std::vector<double> makeValues() {
+    std::vector<double> values;
+    for (int i = 0; i < 1000; i++) {
+        values.push_back(10 + i % 90 + 0.99);                   // prices
+        values.push_back(1 + (i % 41) / 10.0);                  // ratings
+        values.push_back(-122.4194 + i / 10000.0);              // coordinates
+        values.push_back(0.1 * i + 0.2);                        // sums, e.g., NUMINCRBY 0.1
+        values.push_back(i / 7.0 * 1.15);                       // products, e.g., NUMMULTBY 1.15
+        values.push_back((i % 2 ? 1.5e-7 : 6.02e23) * (i + 1)); // exponents
+    }
+    return values;
+}
+
+template <typename F>
+static double timeFormat(const char *name, const std::vector<double> &values, size_t iterations, F format,
+                         size_t &chars) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t it = 0; it < iterations; ++it) {
+        for (double v : values) chars += format(v);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = iterations * values.size() / seconds;
+    std::cout << name << ": " << rate / 1e6 << " M doubles/s\n";
+    return rate;
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-i iterations]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 200;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        switch (opt) {
+            case 'i': iterations = strtoull(optarg, nullptr, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (iterations == 0) usage(argv[0]);
+
+    setupValkeyModulePointers();
+    std::vector<double> values = makeValues();
+    std::cout << "doubles:" << values.size() << " iterations:" << iterations << "\n";
+
+    // How much shorter the shortest texts are
+    size_t legacyChars = 0, shortestChars = 0;
+    for (double v : values) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        legacyChars += jsonutil_double_to_string(v, buf, sizeof(buf));
+        shortestChars += jsonutil_double_to_string_shortest(v, buf, sizeof(buf));
+        if (strtod(buf, nullptr) != v) {
+            std::cerr << "Shortest text " << buf << " doesn't read back\n";
+            return 1;
+        }
+    }
+    std::cout << "average length %.17g:" << double(legacyChars) / values.size()
+              << " shortest:" << double(shortestChars) / values.size() << "\n";
+
+    size_t chars = 0;
+    double legacy = timeFormat("jsonutil_double_to_string", values, iterations, [](double v) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        return jsonutil_double_to_string(v, buf, sizeof(buf));
+    }, chars);
+    timeFormat("jsonutil_double_to_string_rapidjson", values, iterations, [](double v) {
+        char buf[BUF_SIZE_DOUBLE_RAPID_JSON];
+        return jsonutil_double_to_string_rapidjson(v, buf, sizeof(buf));
+    }, chars);
+    double shortest = timeFormat("jsonutil_double_to_string_shortest", values, iterations, [](double v) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        return jsonutil_double_to_string_shortest(v, buf, sizeof(buf));
+    }, chars);
+    std::cout << "shortest/%.17g speedup: " << shortest / legacy << "x\n";
+
+    std::vector<std::string> texts;
+    for (double v : values) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        size_t len = jsonutil_double_to_string(v, buf, sizeof(buf));
+        texts.emplace_back(buf, len);
+    }
+    double sum = 0;
+    for (bool fast : {false, true}) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t it = 0; it < iterations; ++it) {
+            for (const std::string &t : texts) {
+                sum += fast ? jsonutil_string_to_double(t.c_str(), t.length()) : strtod(t.c_str(), nullptr);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (fast ? "jsonutil_string_to_double: " : "strtod: ")
+                  << iterations * texts.size() / seconds / 1e6 << " M doubles/s\n";
+    }
+    return chars == 0 || sum == 0;  // Keep the loops from being optimized away
+}
@@ -0,0 +1,90 @@
+//
+// Object hashtable benchmark.
+//
+// Compares the plain and the grouped (control byte) hashtable layouts on an object with many
+// members: inserts, lookups of members in random order, lookups of missing members and removals.
+//
+// usage: hashtableBench [-n members] [-r lookup rounds]
+//
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include "json/dom.h"
+#include "json/rapidjson_includes.h"
+#include "bench_common.h"
+
+static double mops(std::chrono::steady_clock::time_point start, size_t ops) {
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return ops / us;
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-n members] [-r lookup rounds]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t numMembers = 100000;
+    size_t lookupRounds = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': numMembers = strtoull(optarg, nullptr, 0); break;
+            case 'r': lookupRounds = strtoull(optarg, nullptr, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (numMembers == 0 || lookupRounds == 0) usage(argv[0]);
+
+    setupBenchPointers();
+    setupBenchKeyTable();
+    std::vector<std::string> keys, missing;
+    for (size_t i = 0; i < numMembers; ++i) {
+        keys.push_back("feature:" + std::to_string(i));
+        missing.push_back("missing:" + std::to_string(i));
+    }
+    std::vector<size_t> order(numMembers);
+    for (size_t i = 0; i < numMembers; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+    std::cout << "members:" << numMembers << " lookup rounds:" << lookupRounds << "\n";
+
+    rapidjson::hashTableFactors.minHTSize = 32;
+    size_t found = 0;
+    for (size_t minGrouped : {size_t(0), size_t(16)}) {
+        rapidjson::hashTableFactors.minGroupedHTSize = minGrouped;
+        const char *layout = minGrouped ? "grouped" : "plain";
+        JValue v;
+        v.SetObject();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < numMembers; ++i) {
+            v.AddMember(JValue(keys[i].c_str(), keys[i].size(), allocator), JValue(i), allocator);
+        }
+        std::cout << layout << " insert: " << mops(start, numMembers) << " Mops/s\n";
+
+        start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < lookupRounds; ++r) {
+            for (size_t i : order) found += v.FindMember(keys[i]) != v.MemberEnd();
+        }
+        std::cout << layout << " lookup hit: " << mops(start, lookupRounds * numMembers) << " Mops/s\n";
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i : order) found += v.FindMember(missing[i]) != v.MemberEnd();
+        std::cout << layout << " lookup miss: " << mops(start, numMembers) << " Mops/s\n";
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i : order) v.RemoveMember(keys[i]);
+        std::cout << layout << " delete: " << mops(start, numMembers) << " Mops/s\n";
+    }
+    if (found != 2 * lookupRounds * numMembers) {
+        std::cerr << "Found " << found << " members, expected " << 2 * lookupRounds * numMembers << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,727 @@
+//
+// In-process workload benchmark of the command handlers.
+//
+// Drives Command_JsonGet, Command_JsonMGet, Command_JsonSet, Command_JsonNumIncrBy and Command_JsonArrAppend
+// directly, against a simulated key space, so that a change to the selector, dom, KeyTable or reply paths can be
+// measured end to end without a server, a network or a client in the way. Nothing but the handlers is timed: the
+// argument vectors of every operation are built before the run.
+//
+// Documents have a fixed skeleton whose size and shape are configurable: the number of members of an object
+// (-m), the number of records of an array (-r) and the depth of a nested object (-l). Read paths come from one
+// class or all of them (-p): legacy paths, JSONPath paths, recursive descent and filter expressions.
+//
+// The operation mix is a YCSB workload (-w) or a custom mix of weighted operations (-x), e.g.,
+// "get:80,set:10,arrappend:10". Keys are picked with the zipfian, uniform or latest distribution (-d).
+//
+//   ycsb-a   get:50,set:50                  update heavy
+//   ycsb-b   get:95,set:5                   read mostly
+//   ycsb-c   get:100                        read only
+//   ycsb-d   get:95,insert:5                read latest, with -d latest
+//   ycsb-e   mget:95,insert:5               short scans, as an MGET of consecutive keys
+//   ycsb-f   get:50,numincrby:50            read-modify-write
+//
+// Prints a single line of JSON: throughput, latency percentiles in microseconds and allocations per operation,
+// overall and per operation, plus KeyTable counters. With -a, allocations are also broken down by memory category,
+// see JSON.DEBUG MEMORY-PROFILE.
+//
+// usage: json_bench [-w workload] [-x mix] [-d distribution] [-p paths] [-k keys] [-n operations]
+//                   [-m members] [-r records] [-l depth] [-s seed] [-a]
+//
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "json/dom.h"
+#include "json/json.h"
+#include "json/stats.h"
+#include "json/memory.h"
+#include "json/selector.h"
+#include "bench_common.h"
+
+extern size_t hash_function(const char *, size_t);
+extern ValkeyModuleType *DocumentType;
+extern void initKeyTable(unsigned numShards, KeyTable::Factors factors);
+extern void DocumentType_Free(void *value);
+
+extern int Command_JsonSet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc);
+extern int Command_JsonGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc);
+extern int Command_JsonMGet(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc);
+extern int Command_JsonNumIncrBy(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc);
+extern int Command_JsonArrAppend(ValkeyModuleCtx *ctx, ValkeyModuleString **argv, int argc);
+
+//
+// The key space. Strings and keys created by a command, and its pool allocations, live until the command returns,
+// as they would with automatic memory management.
+//
+struct BenchString {
+    std::string text;
+    int refs;
+};
+
+struct BenchKey {
+    std::string name;
+};
+
+static std::map<std::string, JDocument *> keySpace;
+static std::vector<BenchString *> commandStrings;
+static std::vector<BenchKey *> commandKeys;
+static std::vector<void *> commandPool;
+static char benchCtx, benchType;
+
+struct Replies {
+    size_t replies;
+    size_t bytes;
+    size_t errors;
+    std::string lastError;
+};
+static Replies replies = {0, 0, 0, ""};
+
+static ValkeyModuleCtx *benchContext() {
+    return reinterpret_cast<ValkeyModuleCtx *>(&benchCtx);
+}
+
+static BenchString *asBench(const ValkeyModuleString *str) {
+    return reinterpret_cast<BenchString *>(const_cast<ValkeyModuleString *>(str));
+}
+
+static BenchKey *asBench(ValkeyModuleKey *key) {
+    return reinterpret_cast<BenchKey *>(key);
+}
+
+static void endCommand() {
+    for (BenchString *s : commandStrings) {
+        if (s->refs <= 1) delete s;  // else retained beyond the command, which the handlers we drive don't do
+    }
+    for (BenchKey *k : commandKeys) delete k;
+    for (void *p : commandPool) free(p);
+    commandStrings.clear();
+    commandKeys.clear();
+    commandPool.clear();
+}
+
+static ValkeyModuleString *bench_CreateString(ValkeyModuleCtx *ctx, const char *ptr, size_t len) {
+    (void)ctx;
+    BenchString *s = new BenchString{std::string(ptr, len), 1};
+    commandStrings.push_back(s);
+    return reinterpret_cast<ValkeyModuleString *>(s);
+}
+
+static void bench_FreeString(ValkeyModuleCtx *ctx, ValkeyModuleString *str) {
+    (void)ctx;
+    (void)str;  // freed when the command returns
+}
+
+static void bench_RetainString(ValkeyModuleCtx *ctx, ValkeyModuleString *str) {
+    (void)ctx;
+    asBench(str)->refs++;
+}
+
+static const char *bench_StringPtrLen(const ValkeyModuleString *str, size_t *len) {
+    BenchString *s = asBench(str);
+    if (len) *len = s->text.length();
+    return s->text.c_str();
+}
+
+static int bench_StringToLongLong(const ValkeyModuleString *str, long long *ll) {
+    const std::string &text = asBench(str)->text;
+    char *end;
+    errno = 0;
+    *ll = strtoll(text.c_str(), &end, 10);
+    return (text.empty() || *end || errno) ? VALKEYMODULE_ERR : VALKEYMODULE_OK;
+}
+
+static ValkeyModuleKey *bench_OpenKey(ValkeyModuleCtx *ctx, ValkeyModuleString *keyname, int mode) {
+    (void)ctx;
+    (void)mode;
+    BenchKey *k = new BenchKey{asBench(keyname)->text};
+    commandKeys.push_back(k);
+    return reinterpret_cast<ValkeyModuleKey *>(k);
+}
+
+static void bench_CloseKey(ValkeyModuleKey *key) {
+    (void)key;
+}
+
+static int bench_KeyType(ValkeyModuleKey *key) {
+    return keySpace.count(asBench(key)->name) ? VALKEYMODULE_KEYTYPE_MODULE : VALKEYMODULE_KEYTYPE_EMPTY;
+}
+
+static ValkeyModuleType *bench_ModuleTypeGetType(ValkeyModuleKey *key) {
+    return keySpace.count(asBench(key)->name) ? DocumentType : nullptr;
+}
+
+static void *bench_ModuleTypeGetValue(ValkeyModuleKey *key) {
+    auto it = keySpace.find(asBench(key)->name);
+    return it == keySpace.end() ? nullptr : it->second;
+}
+
+static int bench_ModuleTypeSetValue(ValkeyModuleKey *key, ValkeyModuleType *mt, void *value) {
+    (void)mt;
+    JDocument *&doc = keySpace[asBench(key)->name];
+    if (doc != nullptr && doc != value) DocumentType_Free(doc);
+    doc = static_cast<JDocument *>(value);
+    return VALKEYMODULE_OK;
+}
+
+static int bench_DeleteKey(ValkeyModuleKey *key) {
+    auto it = keySpace.find(asBench(key)->name);
+    if (it != keySpace.end()) {
+        DocumentType_Free(it->second);
+        keySpace.erase(it);
+    }
+    return VALKEYMODULE_OK;
+}
+
+static void bench_AutoMemory(ValkeyModuleCtx *ctx) {
+    (void)ctx;
+}
+
+static void *bench_PoolAlloc(ValkeyModuleCtx *ctx, size_t bytes) {
+    (void)ctx;
+    void *p = malloc(bytes);
+    commandPool.push_back(p);
+    return p;
+}
+
+static int bench_GetContextFlags(ValkeyModuleCtx *ctx) {
+    (void)ctx;
+    return 0;
+}
+
+static int bench_ReplicateVerbatim(ValkeyModuleCtx *ctx) {
+    (void)ctx;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_Replicate(ValkeyModuleCtx *ctx, const char *cmdname, const char *fmt, ...) {
+    (void)ctx;
+    (void)cmdname;
+    (void)fmt;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_NotifyKeyspaceEvent(ValkeyModuleCtx *ctx, int type, const char *event, ValkeyModuleString *key) {
+    (void)ctx;
+    (void)type;
+    (void)event;
+    (void)key;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_IsKeysPositionRequest(ValkeyModuleCtx *ctx) {
+    (void)ctx;
+    return 0;
+}
+
+//
+// Replies are counted, not kept
+//
+static int bench_ReplyWithError(ValkeyModuleCtx *ctx, const char *err) {
+    (void)ctx;
+    replies.errors++;
+    replies.lastError = err;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_WrongArity(ValkeyModuleCtx *ctx) {
+    return bench_ReplyWithError(ctx, "ERR wrong number of arguments");
+}
+
+static int bench_ReplyWithLongLong(ValkeyModuleCtx *ctx, long long ll) {
+    (void)ctx;
+    replies.replies++;
+    replies.bytes += sizeof(ll);
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithDouble(ValkeyModuleCtx *ctx, double d) {
+    (void)ctx;
+    (void)d;
+    replies.replies++;
+    replies.bytes += sizeof(d);
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithBool(ValkeyModuleCtx *ctx, int b) {
+    (void)ctx;
+    (void)b;
+    replies.replies++;
+    replies.bytes++;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithStringBuffer(ValkeyModuleCtx *ctx, const char *buf, size_t len) {
+    (void)ctx;
+    (void)buf;
+    replies.replies++;
+    replies.bytes += len;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithBigNumber(ValkeyModuleCtx *ctx, const char *bignum, size_t len) {
+    return bench_ReplyWithStringBuffer(ctx, bignum, len);
+}
+
+static int bench_ReplyWithSimpleString(ValkeyModuleCtx *ctx, const char *msg) {
+    return bench_ReplyWithStringBuffer(ctx, msg, strlen(msg));
+}
+
+static int bench_ReplyWithNull(ValkeyModuleCtx *ctx) {
+    (void)ctx;
+    replies.replies++;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithEmptyArray(ValkeyModuleCtx *ctx) {
+    return bench_ReplyWithNull(ctx);
+}
+
+static int bench_ReplyWithArray(ValkeyModuleCtx *ctx, long len) {
+    (void)ctx;
+    (void)len;
+    replies.replies++;
+    return VALKEYMODULE_OK;
+}
+
+static int bench_ReplyWithMap(ValkeyModuleCtx *ctx, long len) {
+    return bench_ReplyWithArray(ctx, len);
+}
+
+static void bench_ReplySetArrayLength(ValkeyModuleCtx *ctx, long len) {
+    (void)ctx;
+    (void)len;
+}
+
+static void setupBenchKeySpace() {
+    setupBenchPointers(true);
+    ValkeyModule_CreateString = bench_CreateString;
+    ValkeyModule_FreeString = bench_FreeString;
+    ValkeyModule_RetainString = bench_RetainString;
+    ValkeyModule_StringPtrLen = bench_StringPtrLen;
+    ValkeyModule_StringToLongLong = bench_StringToLongLong;
+    ValkeyModule_OpenKey = bench_OpenKey;
+    ValkeyModule_CloseKey = bench_CloseKey;
+    ValkeyModule_KeyType = bench_KeyType;
+    ValkeyModule_ModuleTypeGetType = bench_ModuleTypeGetType;
+    ValkeyModule_ModuleTypeGetValue = bench_ModuleTypeGetValue;
+    ValkeyModule_ModuleTypeSetValue = bench_ModuleTypeSetValue;
+    ValkeyModule_DeleteKey = bench_DeleteKey;
+    ValkeyModule_AutoMemory = bench_AutoMemory;
+    ValkeyModule_PoolAlloc = bench_PoolAlloc;
+    ValkeyModule_GetContextFlags = bench_GetContextFlags;
+    ValkeyModule_ReplicateVerbatim = bench_ReplicateVerbatim;
+    ValkeyModule_Replicate = bench_Replicate;
+    ValkeyModule_NotifyKeyspaceEvent = bench_NotifyKeyspaceEvent;
+    ValkeyModule_IsKeysPositionRequest = bench_IsKeysPositionRequest;
+    ValkeyModule_ReplyWithError = bench_ReplyWithError;
+    ValkeyModule_WrongArity = bench_WrongArity;
+    ValkeyModule_ReplyWithLongLong = bench_ReplyWithLongLong;
+    ValkeyModule_ReplyWithDouble = bench_ReplyWithDouble;
+    ValkeyModule_ReplyWithBool = bench_ReplyWithBool;
+    ValkeyModule_ReplyWithStringBuffer = bench_ReplyWithStringBuffer;
+    ValkeyModule_ReplyWithBigNumber = bench_ReplyWithBigNumber;
+    ValkeyModule_ReplyWithSimpleString = bench_ReplyWithSimpleString;
+    ValkeyModule_ReplyWithNull = bench_ReplyWithNull;
+    ValkeyModule_ReplyWithEmptyArray = bench_ReplyWithEmptyArray;
+    ValkeyModule_ReplyWithArray = bench_ReplyWithArray;
+    ValkeyModule_ReplyWithMap = bench_ReplyWithMap;
+    ValkeyModule_ReplySetArrayLength = bench_ReplySetArrayLength;
+    DocumentType = reinterpret_cast<ValkeyModuleType *>(&benchType);
+
+    initKeyTable(KeyTable::MAX_SHARDS, KeyTable::Factors());
+    pathCache = new(memory_alloc(sizeof(PathCache))) PathCache(json_get_path_cache_size());
+}
+
+//
+// Documents and paths
+//
+struct Shape {
+    size_t members;  // members of $.attrs
+    size_t records;  // records of $.items
+    size_t depth;    // levels of $.meta
+};
+
+static std::string makeDocument(size_t n, const Shape &shape) {
+    std::string id = std::to_string(n);
+    std::string json = "{\"id\":" + id + ",\"name\":\"user " + id + "\",\"active\":" + (n % 2 ? "true" : "false")
+                       + ",\"score\":" + std::to_string(n % 1000) + ".5,\"tags\":[\"new\",\"gold\",\"eu\"],\"attrs\":{";
+    for (size_t i = 0; i < shape.members; i++) {
+        if (i) json += ",";
+        json += "\"attr_" + std::to_string(i) + "\":" + std::to_string((n + 1) * (i + 7) % 10007);
+    }
+    json += "},\"items\":[";
+    for (size_t i = 0; i < shape.records; i++) {
+        std::string r = std::to_string(i);
+        if (i) json += ",";
+        json += "{\"sku\":\"SKU-" + r + "\",\"qty\":" + std::to_string((n + i) % 10) + ",\"price\":"
+                + std::to_string(i % 50) + ".25}";
+    }
+    json += "],\"meta\":";
+    for (size_t i = 0; i < shape.depth; i++) json += "{\"level\":";
+    json += "{\"leaf\":" + id + "}";
+    json += std::string(shape.depth, '}');
+    return json + "}";
+}
+
+enum PathClass { PATHS_V1, PATHS_V2, PATHS_RECURSIVE, PATHS_FILTER, PATHS_MIXED };
+
+static const char *pathClassNames[] = {"v1", "v2", "recursive", "filter", "mixed"};
+
+// The i-th read path of a class, valid on every document of the shape
+static std::string readPath(PathClass pc, size_t i, const Shape &shape) {
+    if (pc == PATHS_MIXED) pc = PathClass(i % PATHS_MIXED);
+    std::string root = pc == PATHS_V1 ? "" : "$";
+    switch (pc) {
+        case PATHS_V1:
+        case PATHS_V2:
+            switch (i % 4) {
+                case 0: return root + ".name";
+                case 1: return root + ".attrs.attr_" + std::to_string(i % shape.members);
+                case 2: return root + ".items[" + std::to_string(i % shape.records) + "].qty";
+                default: {
+                    std::string path = root + ".meta";
+                    for (size_t l = 0; l < shape.depth; l++) path += ".level";
+                    return path + ".leaf";
+                }
+            }
+        case PATHS_RECURSIVE:
+            return i % 2 ? "$..leaf" : "$..qty";
+        default:
+            return i % 2 ? "$.items[?(@.qty>5)].sku" : "$.items[?(@.price<10 && @.qty>2)]";
+    }
+}
+
+//
+// Workloads
+//
+enum OpKind { OP_GET, OP_MGET, OP_SET, OP_INSERT, OP_NUMINCRBY, OP_ARRAPPEND, NUM_OPS };
+
+static const char *opNames[] = {"get", "mget", "set", "insert", "numincrby", "arrappend"};
+
+static const char *presets[][2] = {
+    {"ycsb-a", "get:50,set:50"},
+    {"ycsb-b", "get:95,set:5"},
+    {"ycsb-c", "get:100"},
+    {"ycsb-d", "get:95,insert:5"},
+    {"ycsb-e", "mget:95,insert:5"},
+    {"ycsb-f", "get:50,numincrby:50"},
+};
+
+static bool parseMix(const std::string &mix, std::vector<double> &weights) {
+    weights.assign(NUM_OPS, 0);
+    std::stringstream ss(mix);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) return false;
+        std::string name = item.substr(0, colon);
+        int op = 0;
+        while (op < NUM_OPS && name != opNames[op]) op++;
+        if (op == NUM_OPS) return false;
+        weights[op] = strtod(item.c_str() + colon + 1, nullptr);
+    }
+    for (double w : weights) if (w > 0) return true;
+    return false;
+}
+
+// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record synthetic databases"), constant 0.99
+class Zipfian {
+ public:
+    Zipfian(size_t items, double theta = 0.99) : items(items), theta(theta) {
+        zetan = zeta(items);
+        double zeta2 = zeta(2);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    size_t next(std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+        size_t n = static_cast<size_t>(items * std::pow(eta * u - eta + 1, alpha));
+        return std::min(n, items - 1);
+    }
+
+ private:
+    double zeta(size_t n) const {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) sum += 1 / std::pow(i + 1, theta);
+        return sum;
+    }
+    size_t items;
+    double theta, zetan, alpha, eta;
+};
+
+enum Distribution { DIST_ZIPFIAN, DIST_UNIFORM, DIST_LATEST };
+
+static const char *distributionNames[] = {"zipfian", "uniform", "latest"};
+
+struct Op {
+    OpKind kind;
+    std::vector<BenchString> args;
+    std::vector<ValkeyModuleString *> argv;
+};
+
+static std::string keyName(size_t n) {
+    return "key:" + std::to_string(n);
+}
+
+static void addArgs(Op &op, std::initializer_list<std::string> args) {
+    for (const std::string &a : args) op.args.push_back(BenchString{a, 1});
+}
+
+static std::vector<Op> makeOps(size_t numOps, size_t numKeys, const std::vector<double> &weights, Distribution dist,
+                               PathClass pc, const Shape &shape, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::discrete_distribution<int> pickOp(weights.begin(), weights.end());
+    Zipfian zipf(numKeys);
+    size_t keys = numKeys;  // grows with inserts
+    auto pickKey = [&]() -> size_t {
+        switch (dist) {
+            case DIST_UNIFORM: return std::uniform_int_distribution<size_t>(0, keys - 1)(rng);
+            case DIST_LATEST: return keys - 1 - std::min(zipf.next(rng), keys - 1);
+            default: {
+                // scrambled, so that the popular keys are spread over the key space
+                size_t rank = zipf.next(rng);
+                return hash_function(reinterpret_cast<const char *>(&rank), sizeof(rank)) % keys;
+            }
+        }
+    };
+    std::vector<Op> ops(numOps);
+    for (size_t i = 0; i < numOps; i++) {
+        Op &op = ops[i];
+        op.kind = OpKind(pickOp(rng));
+        std::string key = keyName(pickKey());
+        switch (op.kind) {
+            case OP_GET:
+                addArgs(op, {"JSON.GET", key, readPath(pc, i, shape)});
+                break;
+            case OP_MGET: {
+                size_t first = pickKey();
+                addArgs(op, {"JSON.MGET"});
+                for (size_t k = 0; k < 10; k++) addArgs(op, {keyName((first + k) % keys)});
+                addArgs(op, {pc == PATHS_V1 ? ".name" : "$.name"});
+                break;
+            }
+            case OP_SET:
+                addArgs(op, {"JSON.SET", key, (pc == PATHS_V1 ? ".attrs.attr_" : "$.attrs.attr_") +
+                             std::to_string(i % shape.members), std::to_string(i % 10007)});
+                break;
+            case OP_INSERT:
+                addArgs(op, {"JSON.SET", keyName(keys), ".", makeDocument(keys, shape)});
+                keys++;
+                break;
+            case OP_NUMINCRBY:
+                addArgs(op, {"JSON.NUMINCRBY", key, "$.items[" + std::to_string(i % shape.records) + "].qty", "1"});
+                break;
+            case OP_ARRAPPEND:
+                addArgs(op, {"JSON.ARRAPPEND", key, "$.tags", "\"t" + std::to_string(i % 100) + "\""});
+                break;
+            default:
+                break;
+        }
+        for (BenchString &a : op.args) op.argv.push_back(reinterpret_cast<ValkeyModuleString *>(&a));
+    }
+    return ops;
+}
+
+static int run(Op &op) {
+    int argc = static_cast<int>(op.argv.size());
+    switch (op.kind) {
+        case OP_GET: return Command_JsonGet(benchContext(), op.argv.data(), argc);
+        case OP_MGET: return Command_JsonMGet(benchContext(), op.argv.data(), argc);
+        case OP_NUMINCRBY: return Command_JsonNumIncrBy(benchContext(), op.argv.data(), argc);
+        case OP_ARRAPPEND: return Command_JsonArrAppend(benchContext(), op.argv.data(), argc);
+        default: return Command_JsonSet(benchContext(), op.argv.data(), argc);
+    }
+}
+
+//
+// Results
+//
+struct OpStats {
+    std::vector<uint64_t> nanos;
+    size_t allocations = 0;
+    size_t bytes = 0;
+    size_t errors = 0;
+};
+
+static double percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[i] / 1000.0;
+}
+
+static void printLatency(std::ostream &out, std::vector<uint64_t> &nanos) {
+    std::sort(nanos.begin(), nanos.end());
+    out << "\"p50_us\":" << percentile(nanos, 0.5) << ",\"p90_us\":" << percentile(nanos, 0.9)
+        << ",\"p99_us\":" << percentile(nanos, 0.99) << ",\"p999_us\":" << percentile(nanos, 0.999)
+        << ",\"max_us\":" << (nanos.empty() ? 0 : nanos.back() / 1000.0);
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-w workload] [-x mix] [-d distribution] [-p paths] [-k keys]"
+                 " [-n operations] [-m members] [-r records] [-l depth] [-s seed] [-a]\n"
+                 "  workload: ycsb-a, ycsb-b, ycsb-c, ycsb-d, ycsb-e or ycsb-f\n"
+                 "  mix: weighted operations, e.g., get:80,set:10,arrappend:10, of get, mget, set, insert,"
+                 " numincrby and arrappend\n"
+                 "  distribution: zipfian, uniform or latest\n"
+                 "  paths: v1, v2, recursive, filter or mixed\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    std::string workload = "ycsb-a", mix;
+    Distribution dist = DIST_ZIPFIAN;
+    bool distSet = false;
+    PathClass pc = PATHS_MIXED;
+    size_t numKeys = 10000;
+    size_t numOps = 200000;
+    Shape shape = {16, 8, 3};
+    uint64_t seed = 1;
+    bool profile = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:x:d:p:k:n:m:r:l:s:a")) != -1) {
+        switch (opt) {
+            case 'w': workload = optarg; break;
+            case 'x': mix = optarg; workload = "custom"; break;
+            case 'd': {
+                int d = 0;
+                while (d <= DIST_LATEST && strcmp(optarg, distributionNames[d])) d++;
+                if (d > DIST_LATEST) usage(argv[0]);
+                dist = Distribution(d);
+                distSet = true;
+                break;
+            }
+            case 'p': {
+                int p = 0;
+                while (p <= PATHS_MIXED && strcmp(optarg, pathClassNames[p])) p++;
+                if (p > PATHS_MIXED) usage(argv[0]);
+                pc = PathClass(p);
+                break;
+            }
+            case 'k': numKeys = strtoull(optarg, nullptr, 0); break;
+            case 'n': numOps = strtoull(optarg, nullptr, 0); break;
+            case 'm': shape.members = strtoull(optarg, nullptr, 0); break;
+            case 'r': shape.records = strtoull(optarg, nullptr, 0); break;
+            case 'l': shape.depth = strtoull(optarg, nullptr, 0); break;
+            case 's': seed = strtoull(optarg, nullptr, 0); break;
+            case 'a': profile = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (mix.empty()) {
+        for (auto &p : presets) if (workload == p[0]) mix = p[1];
+        if (workload == "ycsb-d" && !distSet) dist = DIST_LATEST;
+    }
+    std::vector<double> weights;
+    if (mix.empty() || !parseMix(mix, weights) || numKeys < 10 || numOps == 0 || shape.members == 0 ||
+        shape.records == 0) {
+        usage(argv[0]);
+    }
+
+    setupBenchKeySpace();
+    if (jsonstats_init() != JSONUTIL_SUCCESS) return 1;
+
+    // Load the key space through JSON.SET, untimed
+    for (size_t n = 0; n < numKeys; ++n) {
+        Op op;
+        op.kind = OP_INSERT;
+        addArgs(op, {"JSON.SET", keyName(n), ".", makeDocument(n, shape)});
+        for (BenchString &a : op.args) op.argv.push_back(reinterpret_cast<ValkeyModuleString *>(&a));
+        run(op);
+        endCommand();
+    }
+    if (replies.errors) {
+        std::cerr << "Failed to load synthetic documents: " << replies.lastError << "\n";
+        return 1;
+    }
+    std::vector<Op> ops = makeOps(numOps, numKeys, weights, dist, pc, shape, seed);
+
+    if (profile) {
+        memory_profile_reset();
+        memory_profile_control(true);
+    }
+    std::vector<OpStats> stats(NUM_OPS);
+    std::vector<uint64_t> all;
+    all.reserve(numOps);
+    size_t totalAllocations = 0, totalBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (Op &op : ops) {
+        size_t errors = replies.errors;
+        benchAllocations = 0;
+        benchAllocatedBytes = 0;
+        auto begin = std::chrono::steady_clock::now();
+        run(op);
+        uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        endCommand();
+        OpStats &s = stats[op.kind];
+        s.nanos.push_back(nanos);
+        s.allocations += benchAllocations;
+        s.bytes += benchAllocatedBytes;
+        s.errors += replies.errors - errors;
+        all.push_back(nanos);
+        totalAllocations += benchAllocations;
+        totalBytes += benchAllocatedBytes;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream out;
+    out << "{\"workload\":\"" << workload << "\",\"mix\":\"" << mix << "\",\"distribution\":\""
+        << distributionNames[dist] << "\",\"paths\":\"" << pathClassNames[pc] << "\",\"keys\":" << numKeys
+        << ",\"operations\":" << numOps << ",\"members\":" << shape.members << ",\"records\":" << shape.records
+        << ",\"depth\":" << shape.depth << ",\"seconds\":" << seconds << ",\"ops_per_sec\":" << numOps / seconds
+        << ",";
+    printLatency(out, all);
+    out << ",\"allocations_per_op\":" << double(totalAllocations) / numOps << ",\"bytes_per_op\":"
+        << double(totalBytes) / numOps << ",\"errors\":" << replies.errors << ",\"commands\":{";
+    bool first = true;
+    for (int k = 0; k < NUM_OPS; k++) {
+        OpStats &s = stats[k];
+        if (s.nanos.empty()) continue;
+        double n = s.nanos.size();
+        out << (first ? "" : ",") << "\"" << opNames[k] << "\":{\"ops\":" << s.nanos.size() << ",";
+        printLatency(out, s.nanos);
+        out << ",\"allocations_per_op\":" << s.allocations / n << ",\"bytes_per_op\":" << s.bytes / n
+            << ",\"errors\":" << s.errors << "}";
+        first = false;
+    }
+    out << "}";
+    if (profile) {
+        memory_profile_control(false);
+        out << ",\"memory_profile\":{";
+        for (int c = 0; c < MEMORY_NUM_CATEGORIES; c++) {
+            memoryProfile_t p;
+            memory_profile_get_category(memoryCategory_t(c), &p);
+            out << (c ? "," : "") << "\"" << memory_category_name(memoryCategory_t(c)) << "\":{\"allocations\":"
+                << p.allocations << ",\"bytes\":" << p.bytes << ",\"frees\":" << p.frees << "}";
+        }
+        out << "}";
+    }
+    KeyTable::Stats ks = keyTable->getStats();
+    out << ",\"keytable\":{\"size\":" << ks.size << ",\"handles\":" << ks.handles << ",\"inline_handles\":"
+        << ks.inlineHandles << ",\"rehashes\":" << ks.rehashes << "}";
+    out << ",\"reply_bytes\":" << replies.bytes << "}";
+    std::cout << out.str() << "\n";
+
+    if (replies.errors) {
+        std::cerr << replies.errors << " operations failed, last error: " << replies.lastError << "\n";
+        return 1;
+    }
+    for (auto &kv : keySpace) DocumentType_Free(kv.second);
+    return replies.replies == 0;  // Keep the loop from being optimized away
+}
@@ -0,0 +1,174 @@
+//
+// Multi-threaded document load benchmark.
+//
+// Builds N synthetic documents, saves them with dom_save into memory and then loads them back
+// with dom_load from T threads, i.e., the same path DocumentType_RdbLoad takes. Encoding version 3
+// goes through dom_parse, version 4 through the binary decoder.
+//
+// Reports documents/sec, KeyTable shard lock contention and object hashtable rehash counts.
+//
+// usage: loadBench [-n documents] [-t threads] [-m members] [-s shards] [-e encver]
+//
+#include <unistd.h>
+#include <stdarg.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "json/dom.h"
+#include "json/stats.h"
+#include "json/memory.h"
+#include "bench_common.h"
+
+//
+// In-memory stand-in for the RDB stream, one per document.
+//
+struct BenchIO {
+    std::string buffer;
+};
+
+static void bench_SaveStringBuffer(ValkeyModuleIO *io, const char *str, size_t len) {
+    reinterpret_cast<BenchIO *>(io)->buffer.append(str, len);
+}
+
+static char *bench_LoadStringBuffer(ValkeyModuleIO *io, size_t *len) {
+    const std::string& b = reinterpret_cast<BenchIO *>(io)->buffer;
+    char *result = static_cast<char *>(ValkeyModule_Alloc(b.length()));
+    memcpy(result, b.data(), b.length());
+    *len = b.length();
+    return result;
+}
+
+static void bench_LogIOError(ValkeyModuleIO *io, const char *level, const char *fmt, ...) {
+    (void)io;
+    va_list arg;
+    va_start(arg, fmt);
+    fprintf(stderr, "IOError(%s): ", level);
+    vfprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    va_end(arg);
+}
+
+//
+// dom_save and dom_load go through BenchIO
+//
+static void setupBenchIO(size_t numShards) {
+    setupBenchPointers();
+    ValkeyModule_SaveStringBuffer = bench_SaveStringBuffer;
+    ValkeyModule_LoadStringBuffer = bench_LoadStringBuffer;
+    ValkeyModule_LogIOError = bench_LogIOError;
+    setupBenchKeyTable(numShards);
+}
+
+//
+// Synthetic documents that look like our production data: a shared vocabulary of member names,
+// a few unique ones, and an array of small records.
+//
+static std::string makeDocument(size_t docNum, size_t members) {
+    std::string json = "{\"id\":" + std::to_string(docNum) + ",\"type\":\"order\",\"unique_" +
+                       std::to_string(docNum) + "\":true,\"attrs\":{";
+    for (size_t i = 0; i < members; ++i) {
+        if (i) json += ",";
+        json += "\"attr_" + std::to_string(i) + "\":" + std::to_string(docNum * i) + "." + std::to_string(i % 10);
+    }
+    json += "},\"items\":[";
+    for (size_t i = 0; i < 16; ++i) {
+        if (i) json += ",";
+        json += "{\"sku\":\"SKU-" + std::to_string(i) + "\",\"qty\":" + std::to_string(i) +
+                ",\"price\":" + std::to_string(i * 1.25) + ",\"tags\":[\"a\",\"b\",\"c\"]}";
+    }
+    json += "]}";
+    return json;
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-n documents] [-t threads] [-m members] [-s shards] [-e encver]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t numDocs = 100000;
+    size_t numThreads = std::thread::hardware_concurrency();
+    size_t members = 100;
+    size_t numShards = 32768;
+    int encver = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:m:s:e:")) != -1) {
+        switch (opt) {
+            case 'n': numDocs = strtoull(optarg, nullptr, 0); break;
+            case 't': numThreads = strtoull(optarg, nullptr, 0); break;
+            case 'm': members = strtoull(optarg, nullptr, 0); break;
+            case 's': numShards = strtoull(optarg, nullptr, 0); break;
+            case 'e': encver = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (numThreads == 0 || numDocs == 0 || (encver != 3 && encver != 4)) usage(argv[0]);
+
+    setupBenchIO(numShards);
+    if (jsonstats_init() != JSONUTIL_SUCCESS) return 1;
+
+    //
+    // Build the "RDB" images
+    //
+    std::vector<BenchIO> images(numDocs);
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < numDocs; ++i) {
+        std::string json = makeDocument(i, members);
+        JDocument *doc;
+        if (dom_parse(nullptr, json.c_str(), json.length(), &doc) != JSONUTIL_SUCCESS) {
+            std::cerr << "Failed to parse synthetic document " << i << "\n";
+            return 1;
+        }
+        dom_save(doc, reinterpret_cast<ValkeyModuleIO *>(&images[i]), encver);
+        totalBytes += images[i].buffer.length();
+        dom_free_doc(doc);
+    }
+
+    //
+    // Timed, parallel load
+    //
+    auto before = keyTable->getStats();
+    size_t rehashUp = rapidjson::hashTableStats.rehashUp;
+    size_t convertToHT = rapidjson::hashTableStats.convertToHT;
+    size_t reserveHT = rapidjson::hashTableStats.reserveHT;
+
+    std::vector<JDocument *> docs(numDocs, nullptr);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < numDocs; i += numThreads) {
+                if (dom_load(&docs[i], reinterpret_cast<ValkeyModuleIO *>(&images[i]), encver) != JSONUTIL_SUCCESS) {
+                    std::cerr << "Failed to load document " << i << "\n";
+                    exit(1);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto after = keyTable->getStats();
+    std::cout << "encver:" << encver << " documents:" << numDocs << " threads:" << numThreads
+              << " members:" << members << " shards:" << numShards << "\n";
+    std::cout << "load time: " << seconds << " s, " << (numDocs / seconds) << " docs/s, "
+              << (totalBytes / seconds / (1024 * 1024)) << " MB/s of RDB payload\n";
+    std::cout << "KeyTable: keys:" << after.size << " handles:" << after.handles
+              << " contended locks:" << (after.lockWaits - before.lockWaits)
+              << " lock wait:" << (after.lockWaitNanos - before.lockWaitNanos) / 1000000.0 << " ms"
+              << " avg/shard:" << (after.lockWaitNanos - before.lockWaitNanos) / 1000.0 / numShards << " us"
+              << " max shard (cumulative):" << after.maxShardLockWaitNanos / 1000.0 << " us"
+              << " rehashes:" << after.rehashes << "\n";
+    std::cout << "Object hashtables: rehashUp:" << (rapidjson::hashTableStats.rehashUp - rehashUp)
+              << " convertToHT:" << (rapidjson::hashTableStats.convertToHT - convertToHT)
+              << " reserveHT:" << (rapidjson::hashTableStats.reserveHT - reserveHT) << "\n";
+
+    for (auto doc : docs) dom_free_doc(doc);
+    return 0;
+}
@@ -0,0 +1,138 @@
+//
+// String scanning benchmark.
+//
+// Compares the scalar, 16-lane (SSE2/NEON) and, where the CPU has it, AVX2 versions of the string
+// scan the reader and the writer share, on the string contents of synthetic 1-64 KB documents.
+// Then reports end to end dom_parse and dom_serialize throughput for the same documents.
+//
+// usage: scanBench [-i iterations] [-e escape interval]
+//
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "json/dom.h"
+#include "json/stats.h"
+#include "json/memory.h"
+#include "json/rapidjson_includes.h"
+#include "rapidjson/scan.h"
+#include "bench_common.h"
+
+//
+// A document of roughly the given size: an array of records with a free text field, which is where
+// most of the bytes of our production documents are. Every escapeInterval characters of text
+// there's a character that needs escaping, 0 means none.
+//
+static std::string makeDocument(size_t size, size_t escapeInterval) {
+    static const char escapes[] = {'"', '\\', '\n', '\t'};
+    std::string json = "[";
+    for (size_t rec = 0; json.length() < size; ++rec) {
+        if (rec) json += ",";
+        json += "{\"id\":" + std::to_string(rec) + ",\"text\":\"";
+        for (size_t i = 0; i < 480; ++i) {
+            if (escapeInterval && (i % escapeInterval) == escapeInterval - 1) {
+                char c = escapes[(rec + i) % sizeof(escapes)];
+                json += '\\';
+                json += (c == '\n') ? 'n' : (c == '\t') ? 't' : c;
+            } else {
+                json += static_cast<char>('a' + (i % 26));
+            }
+        }
+        json += "\"}";
+    }
+    json += "]";
+    return json;
+}
+
+//
+// Time one scan function over the whole document, restarting after every character it stops on.
+//
+template<typename F>
+static double scanMBs(const std::string& json, size_t iterations, F scan, size_t &sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t it = 0; it < iterations; ++it) {
+        const char *p = json.data();
+        const char *end = p + json.length();
+        while (p < end) {
+            size_t n = scan(p, end);
+            sink += n;
+            p += n + 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return json.length() * iterations / seconds / (1024 * 1024);
+}
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [-i iterations] [-e escape interval]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 2000;
+    size_t escapeInterval = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:e:")) != -1) {
+        switch (opt) {
+            case 'i': iterations = strtoull(optarg, nullptr, 0); break;
+            case 'e': escapeInterval = strtoull(optarg, nullptr, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (iterations == 0) usage(argv[0]);
+
+    setupBenchPointers();
+    setupBenchKeyTable();
+    if (jsonstats_init() != JSONUTIL_SUCCESS) return 1;
+
+    size_t sink = 0;
+#ifdef RAPIDJSON_AVX2_DISPATCH
+    std::cout << "AVX2: " << (rapidjson::internal::cpuHasAVX2 ? "yes" : "no") << "\n";
+#endif
+    std::cout << "escape interval:" << escapeInterval << " iterations:" << iterations << "\n";
+    for (size_t size : {1024, 4 * 1024, 16 * 1024, 64 * 1024}) {
+        std::string json = makeDocument(size, escapeInterval);
+        std::cout << "document " << json.length() << " bytes: scan scalar "
+                  << scanMBs(json, iterations, rapidjson::internal::ScanUnescapedScalar, sink) << " MB/s";
+#if defined(RAPIDJSON_SSE42) || defined(RAPIDJSON_SSE2) || defined(RAPIDJSON_NEON)
+        std::cout << ", 16-lane " << scanMBs(json, iterations, rapidjson::internal::ScanUnescaped16, sink)
+                  << " MB/s";
+#endif
+#ifdef RAPIDJSON_AVX2_DISPATCH
+        if (rapidjson::internal::cpuHasAVX2)
+            std::cout << ", AVX2 " << scanMBs(json, iterations, rapidjson::internal::ScanUnescaped32, sink)
+                      << " MB/s";
+#endif
+        std::cout << "\n";
+
+        //
+        // End to end, with whatever ScanUnescaped dispatches to
+        //
+        double parseSeconds = 0, serializeSeconds = 0;
+        for (size_t it = 0; it < iterations; ++it) {
+            JDocument *doc;
+            auto start = std::chrono::steady_clock::now();
+            if (dom_parse(nullptr, json.c_str(), json.length(), &doc) != JSONUTIL_SUCCESS) {
+                std::cerr << "Failed to parse synthetic document\n";
+                return 1;
+            }
+            auto parsed = std::chrono::steady_clock::now();
+            rapidjson::StringBuffer oss;
+            dom_serialize(doc, nullptr, oss);
+            auto serialized = std::chrono::steady_clock::now();
+            sink += oss.GetLength();
+            dom_free_doc(doc);
+            parseSeconds += std::chrono::duration<double>(parsed - start).count();
+            serializeSeconds += std::chrono::duration<double>(serialized - parsed).count();
+        }
+        double mb = json.length() * iterations / (1024.0 * 1024);
+        std::cout << "    dom_parse " << (mb / parseSeconds) << " MB/s, dom_serialize "
+                  << (mb / serializeSeconds) << " MB/s\n";
+    }
+    return sink == 0;  // Keep the scans from being optimized away
+}
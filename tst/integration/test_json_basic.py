@@ -1,6 +1,6 @@
 from utils_json import DEFAULT_MAX_PATH_LIMIT, DEFAULT_MAX_DOCUMENT_SIZE, \
     DEFAULT_WIKIPEDIA_COMPACT_PATH, DEFAULT_WIKIPEDIA_PATH, \
-    JSON_INFO_METRICS_SECTION, JSON_INFO_NAMES
+    JSON_INFO_METRICS_SECTION, JSON_INFO_LATENCY_SECTION, JSON_INFO_NAMES, JSON_MODULE_NAME
 from valkey.exceptions import ResponseError, NoPermissionError
 from valkeytests.conftest import resource_port_tracker
 import pytest
@@ -10,6 +10,7 @@ import os
 import random
 import struct
 import json
+import time
 from math import isclose, isnan, isinf, frexp
 from json_test_case import JsonTestCase
 
@@ -342,6 +343,50 @@ class TestJsonBasic(JsonTestCase):
                 'JSON.SET', wikipedia, '.', '"bar"', 'a', 'b')
         assert str(e.value).find('wrong number of arguments') >= 0
 
+    def test_json_set_async_parse(self):
+        client = self.server.get_new_client()
+        value = json.dumps({'items': [{'id': i, 'name': f'item {i}', 'price': i * 1.5} for i in range(2000)]})
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.', value)
+        client.config_set('json.async-parse-min-size', 1000)
+        try:
+            # Large values are set once parsed, with the same results and sizes as in place
+            assert b'OK' == client.execute_command('JSON.SET', k1, '.', value)
+            assert client.execute_command('JSON.GET', k1) == client.execute_command('JSON.GET', k2)
+            assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) == \
+                client.execute_command('JSON.DEBUG', 'MEMORY', k2)
+            assert b'OK' == client.execute_command('JSON.SET', k1, '.copy', value)
+            assert b'OK' == client.execute_command('JSON.SET', k1, '$.items[0:3].copy', value)
+            assert 3 == len(json.loads(client.execute_command('JSON.GET', k1, '$.items[*].copy')))
+            assert b'OK' == client.execute_command('JSON.SET', k1, '.copy', value, 'XX')
+            assert None == client.execute_command('JSON.SET', k1, '.copy', value, 'NX')
+            assert None == client.execute_command('JSON.SET', k1, '.', value, 'NX')
+            assert b'OK' == client.execute_command('JSON.SET', k1, '.', value)
+            assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) == \
+                client.execute_command('JSON.DEBUG', 'MEMORY', k2)
+
+            # Errors are found when parsing, or when setting
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.SET', k1, '.', value[:-1])
+            assert self.error_class.is_syntax_error(str(e.value))
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.SET', foo, '.bar', value)
+            assert self.error_class.is_syntax_error(str(e.value))
+            client.set(foo, 'x')
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.SET', foo, '.', value)
+            assert self.error_class.is_wrongtype_error(str(e.value))
+            client.delete(foo)
+
+            # Within MULTI the value is parsed in place
+            pipe = client.pipeline(transaction=True)
+            pipe.execute_command('JSON.SET', k3, '.', value)
+            pipe.execute_command('JSON.GET', k3, '.items[1999].name')
+            assert [b'OK', b'"item 1999"'] == pipe.execute()
+        finally:
+            client.config_set('json.async-parse-min-size', 0)
+        client.execute_command('DEBUG', 'RELOAD')
+        assert client.execute_command('JSON.GET', k1) == client.execute_command('JSON.GET', k2)
+
     def test_json_set_ancestor_keys_should_not_be_overridden(self):
         client = self.server.get_new_client()
         with pytest.raises(ResponseError) as e:
@@ -1104,13 +1149,180 @@ class TestJsonBasic(JsonTestCase):
             assert [exp[0], exp[1], exp[2]] == client.execute_command(
                 'JSON.MGET', k4, k5, k6, path)
 
+    def test_json_mget_many_keys(self):
+        client = self.server.get_new_client()
+        keys = [f'mget_{i}' for i in range(500)]
+        for i, key in enumerate(keys):
+            if i % 3 != 0:
+                assert b'OK' == client.execute_command(
+                    'JSON.SET', key, '.', f'{{"id":{i},"tags":["t{i}"]}}')
+
+        # Missing keys are null, every other key is answered in order
+        exp = [None if i % 3 == 0 else str(i).encode() for i in range(500)]
+        assert exp == client.execute_command('JSON.MGET', *keys, '.id')
+        exp = [None if i % 3 == 0 else f'[["t{i}"]]'.encode() for i in range(500)]
+        assert exp == client.execute_command('JSON.MGET', *keys, '$.tags')
+        exp = [None if i % 3 == 0 else b'[]' for i in range(500)]
+        assert exp == client.execute_command('JSON.MGET', *keys, '$.nope')
+        assert [None] * 500 == client.execute_command('JSON.MGET', *keys, '.nope')
+
+        # A non-document key fails the whole command, even after other keys were selected
+        client.execute_command('SET', keys[498], 'not json')
+        with pytest.raises(ResponseError) as e:
+            client.execute_command('JSON.MGET', *keys, '.id')
+        assert str(e.value).startswith('WRONGTYPE')
+
+    def test_json_get_format_resp3(self):
+        client = self.server.get_new_client()
+        assert b'OK' == client.execute_command(
+            'JSON.SET', k1, '.', '{"a":[1,1.5,"x",null,true,false],"b":{"c":18446744073709551615}}')
+
+        # A RESP2 client gets the RESP2 downgrades: maps are flat arrays, booleans integers, doubles and big
+        # numbers bulk strings
+        a = [1, b'1.5', b'x', None, 1, 0]
+        b = [b'c', b'18446744073709551615']
+        assert [b'a', a, b'b', b] == client.execute_command('JSON.GET', k1, 'FORMAT', 'RESP3')
+        assert a == client.execute_command('JSON.GET', k1, '.a', 'FORMAT', 'resp3')
+        assert [a] == client.execute_command('JSON.GET', k1, 'FORMAT', 'RESP3', '$.a')
+        assert [] == client.execute_command('JSON.GET', k1, 'FORMAT', 'RESP3', '$.nope')
+        assert [b'.a', a, b'$.b', [b]] == client.execute_command(
+            'JSON.GET', k1, 'FORMAT', 'RESP3', '.a', '$.b')
+        assert [b'$.a[0]', [1], b'$.a[2]', [b'x']] == client.execute_command(
+            'JSON.GET', k1, '$.a[0]', 'FORMAT', 'RESP3', '$.a[2]')
+        assert b'"x"' == client.execute_command('JSON.GET', k1, 'FORMAT', 'STRING', '.a[2]')
+        assert None == client.execute_command('JSON.GET', foo, 'FORMAT', 'RESP3')
+
+        for args in [('FORMAT',), ('FORMAT', 'XML'), ('FORMAT', 'RESP3', 'INDENT', '  ')]:
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.GET', k1, *args)
+            assert self.error_class.is_syntax_error(str(e.value))
+        with pytest.raises(ResponseError) as e:
+            client.execute_command('JSON.GET', k1, 'FORMAT', 'RESP3', '.nope')
+        assert self.error_class.is_nonexistent_error(str(e.value))
+
+        # FORMAT is only an option of JSON.GET, every argument of JSON.MGET but the last one is a key
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.', '{"a":"y"}')
+        assert b'OK' == client.execute_command('JSON.SET', 'FORMAT', '.', '{"a":"z"}')
+        assert [b'"y"', b'"z"'] == client.execute_command('JSON.MGET', k2, 'FORMAT', '.a')
+        assert [k1.encode(), k2.encode(), b'FORMAT'] == client.execute_command(
+            'COMMAND', 'GETKEYS', 'JSON.MGET', k1, k2, 'FORMAT', 'RESP3')
+        assert 1 == client.execute_command('DEL', 'FORMAT')
+
+    def test_json_mset_command(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"a":1,"b":{"c":[1,2]}}')
+        num_docs = client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['num_documents']]
+        # New keys, single writes to existing documents, and several writes to the same key, which apply in order
+        assert b'OK' == client.execute_command('JSON.MSET', k1, '$.a', '10', k2, '.', '{"x":1}',
+                                               k3, '$', '{"y":[]}', k3, '$.y[0]', '5', k3, '$.z', '"zz"',
+                                               k2, '.x', '[true]', k1, '$.b.c[1]', '20')
+        assert b'{"a":10,"b":{"c":[1,20]}}' == client.execute_command('JSON.GET', k1)
+        assert b'{"x":[true]}' == client.execute_command('JSON.GET', k2)
+        assert b'{"y":[],"z":"zz"}' == client.execute_command('JSON.GET', k3)
+        assert b'OK' == client.execute_command('JSON.MSET', k3, '$.y', '[1]', k3, '$.y[0]', '2')
+        assert b'[[2]]' == client.execute_command('JSON.GET', k3, '$.y')
+
+        # Nothing is written unless every write is valid
+        for args in [(k1, '$.a', '11', k2, '$.x', '{bad'),
+                     (k1, '$.a', '11', k4, '$.new', '1'),
+                     (k1, '$.a', '11', k1, '$[', '1'),
+                     (k1, '$.a', '11', k1, '$.b', '2', k2, '.nope.deeper', '3')]:
+            with pytest.raises(ResponseError):
+                client.execute_command('JSON.MSET', *args)
+            assert b'{"a":10,"b":{"c":[1,20]}}' == client.execute_command('JSON.GET', k1)
+            assert b'{"x":[true]}' == client.execute_command('JSON.GET', k2)
+            assert 0 == client.exists(k4)
+
+        client.execute_command('SET', k5, 'not json')
+        with pytest.raises(ResponseError) as e:
+            client.execute_command('JSON.MSET', k1, '$.a', '12', k5, '.', '1')
+        assert str(e.value).startswith('WRONGTYPE')
+        assert b'[10]' == client.execute_command('JSON.GET', k1, '$.a')
+
+        for args in [(k1,), (k1, '$.a'), (k1, '$.a', '1', k2), (k1, '$.a', '1', k2, '$.x')]:
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.MSET', *args)
+            assert str(e.value).find('wrong number of arguments') >= 0
+
+        # The new documents are counted once, however many times they are written
+        assert num_docs + 2 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['num_documents']]
+
+        # A single write to an existing document is charged to it as JSON.SET would
+        value = json.dumps({'items': [{'name': 'item name %d' % i, 'qty': i} for i in range(100)]})
+        for k in [k6, k7]:
+            assert b'OK' == client.execute_command('JSON.SET', k, '.', '{"a":1}')
+        small = client.execute_command('JSON.DEBUG', 'MEMORY', k6)
+        assert b'OK' == client.execute_command('JSON.MSET', k6, '$.a', value)
+        assert b'OK' == client.execute_command('JSON.SET', k7, '$.a', value)
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k6) > small + 100 * 16
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k6) == client.execute_command('JSON.DEBUG', 'MEMORY', k7)
+        assert b'OK' == client.execute_command('JSON.MSET', k6, '$.a', '1')
+        assert small == client.execute_command('JSON.DEBUG', 'MEMORY', k6)
+
+    def test_json_merge_command(self):
+        client = self.server.get_new_client()
+        # The examples of RFC 7396
+        for target, patch, result in [('{"a":"b"}', '{"a":"c"}', '{"a":"c"}'),
+                                      ('{"a":"b"}', '{"b":"c"}', '{"a":"b","b":"c"}'),
+                                      ('{"a":"b"}', '{"a":null}', '{}'),
+                                      ('{"a":"b","b":"c"}', '{"a":null}', '{"b":"c"}'),
+                                      ('{"a":["b"]}', '{"a":"c"}', '{"a":"c"}'),
+                                      ('{"a":"c"}', '{"a":["b"]}', '{"a":["b"]}'),
+                                      ('{"a":{"b":"c"}}', '{"a":{"b":"d","c":null}}', '{"a":{"b":"d"}}'),
+                                      ('{"a":[{"b":"c"}]}', '{"a":[1]}', '{"a":[1]}'),
+                                      ('["a","b"]', '["c","d"]', '["c","d"]'),
+                                      ('{"a":"b"}', '["c"]', '["c"]'),
+                                      ('{"a":"foo"}', 'null', 'null'),
+                                      ('{"a":"foo"}', '"bar"', '"bar"'),
+                                      ('{"e":null}', '{"a":1}', '{"e":null,"a":1}'),
+                                      ('[1,2]', '{"a":"b","c":null}', '{"a":"b"}'),
+                                      ('{}', '{"a":{"bb":{"ccc":null}}}', '{"a":{"bb":{}}}')]:
+            client.execute_command('JSON.SET', k1, '.', target)
+            assert b'OK' == client.execute_command('JSON.MERGE', k1, '$', patch)
+            assert result.encode() == client.execute_command('JSON.GET', k1)
+
+        # Merging at a path, into every value it selects, creating it if it doesn't exist
+        client.execute_command('JSON.SET', k1, '.', '{"a":{"x":1,"y":2},"b":{"x":3},"c":[]}')
+        assert b'OK' == client.execute_command('JSON.MERGE', k1, '$.*', '{"x":null,"z":[null]}')
+        assert b'{"a":{"y":2,"z":[null]},"b":{"z":[null]},"c":{"z":[null]}}' == client.execute_command('JSON.GET', k1)
+        assert b'OK' == client.execute_command('JSON.MERGE', k1, '$.d', '{"e":{"f":null,"g":1}}')
+        assert b'{"e":{"g":1}}' == client.execute_command('JSON.GET', k1, '.d')
+        assert b'OK' == client.execute_command('JSON.MERGE', k1, '.a.y', '3')
+        assert b'3' == client.execute_command('JSON.GET', k1, '.a.y')
+        # A null patch at a path removes it
+        assert b'OK' == client.execute_command('JSON.MERGE', k1, '$.b', 'null')
+        assert b'OK' == client.execute_command('JSON.MERGE', k1, '$.nope', 'null')
+        assert b'{"a":{"y":3,"z":[null]},"c":{"z":[null]},"d":{"e":{"g":1}}}' == client.execute_command('JSON.GET', k1)
+
+        # New keys are created at the root only, without the nulls of the patch
+        assert b'OK' == client.execute_command('JSON.MERGE', k2, '$', '{"a":1,"b":null}')
+        assert b'{"a":1}' == client.execute_command('JSON.GET', k2)
+        with pytest.raises(ResponseError):
+            client.execute_command('JSON.MERGE', k3, '$.a', '1')
+        assert 0 == client.exists(k3)
+
+        for args in [(k1, '$', '{bad'), (k1, '$[', '{}'), (k1, '.', '[1,')]:
+            with pytest.raises(ResponseError):
+                client.execute_command('JSON.MERGE', *args)
+        assert b'{"a":{"y":3,"z":[null]},"c":{"z":[null]},"d":{"e":{"g":1}}}' == client.execute_command('JSON.GET', k1)
+
+        client.execute_command('SET', k5, 'not json')
+        with pytest.raises(ResponseError) as e:
+            client.execute_command('JSON.MERGE', k5, '$', '{}')
+        assert str(e.value).startswith('WRONGTYPE')
+
+        for args in [(k1,), (k1, '$'), (k1, '$', '{}', '{}')]:
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.MERGE', *args)
+            assert str(e.value).find('wrong number of arguments') >= 0
+
     def test_json_key_declaration(self):
         client = self.server.get_new_client()
         cmd_need_val = set(
-            'SET NUMMULTBY NUMINCRBY ARRAPPEND ARRINDEX STRAPPEND RESP'.split())
+            'SET MERGE NUMMULTBY NUMINCRBY ARRAPPEND ARRINDEX STRAPPEND RESP'.split())
 
         # These commands should only get the single key
-        for cmd in ('DEL', 'GET', 'SET', 'TYPE', 'NUMINCRBY', 'NUMMULTBY', 'TOGGLE', 'STRAPPEND', 'STRLEN',
+        for cmd in ('DEL', 'GET', 'SET', 'MERGE', 'TYPE', 'NUMINCRBY', 'NUMMULTBY', 'TOGGLE', 'STRAPPEND', 'STRLEN',
                     'ARRAPPEND', 'ARRINDEX', 'ARRLEN', 'ARRPOP', 'CLEAR', 'OBJKEYS',
                     'OBJLEN', 'FORGET', 'RESP'):
             if cmd not in cmd_need_val:
@@ -1133,9 +1345,11 @@ class TestJsonBasic(JsonTestCase):
             assert [k1] == client.execute_command(
                 'COMMAND GETKEYS', 'JSON.DEBUG', cmd, k1)
 
-        # JSON.MGET is the only multi-key command, so make sure it returns the right set of keys
+        # Multi-key commands, make sure they return the right set of keys
         assert [k1, k2, k3] == client.execute_command(
             'COMMAND GETKEYS', 'JSON.MGET', k1, k2, k3, '.')
+        assert [k1, k2, k1] == client.execute_command(
+            'COMMAND GETKEYS', 'JSON.MSET', k1, '.', '1', k2, '$.a', '2', k1, '$.b', '3')
 
     def __json_del_or_forget__(self, cmd):
         client = self.server.get_new_client()
@@ -2194,6 +2408,141 @@ class TestJsonBasic(JsonTestCase):
             assert exp_new_val == client.execute_command(
                 'JSON.GET', key, '.').decode()
 
+    def test_json_array_queue(self):
+        client = self.server.get_new_client()
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', '{"q":[]}')
+        for i in range(200):
+            client.execute_command('JSON.ARRAPPEND', k1, '.q', i)
+        # pop at the head, push at the tail, cap the length
+        for i in range(200, 2000):
+            assert str(i - 200).encode() == client.execute_command('JSON.ARRPOP', k1, '.q', 0)
+            assert 200 == client.execute_command('JSON.ARRAPPEND', k1, '.q', i)
+        assert 200 == client.execute_command('JSON.ARRTRIM', k1, '.q', 0, 199)
+        assert json.loads(client.execute_command('JSON.GET', k1, '.q')) == list(range(1800, 2000))
+        size = client.execute_command('JSON.DEBUG', 'MEMORY', k1)
+
+        # insert at the head, drop from the head and the tail
+        for i in range(1799, 1699, -1):
+            assert 2000 - i == client.execute_command('JSON.ARRINSERT', k1, '.q', 0, i)
+        assert [302] == client.execute_command('JSON.ARRINSERT', k1, '$.q', 0, '"a"', '"b"')
+        assert b'["a","b",1700]' == client.execute_command('JSON.GET', k1, '$.q[0:3]')
+        assert 250 == client.execute_command('JSON.ARRTRIM', k1, '.q', 2, 251)
+        assert json.loads(client.execute_command('JSON.GET', k1, '.q')) == list(range(1700, 1950))
+        assert b'[1700,1701]' == client.execute_command('JSON.GET', k1, '$.q[0:2]')
+        assert b'1949' == client.execute_command('JSON.GET', k1, '.q[-1]')
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) < 4 * size
+
+        # a copy, a save and a reload see the same array
+        assert 1 == client.execute_command('COPY', k1, k2)
+        client.execute_command('DEBUG', 'RELOAD')
+        assert json.loads(client.execute_command('JSON.GET', k1, '.q')) == list(range(1700, 1950))
+        assert client.execute_command('JSON.GET', k1) == client.execute_command('JSON.GET', k2)
+
+    def test_packed_numeric_array(self):
+        client = self.server.get_new_client()
+        # as repr and %.17g both print them, so their text survives being kept in binary
+        vector = [i / 7 for i in range(1, 65)]
+        text = '[' + ','.join('%.17g' % v for v in vector) + ']'
+        packed = client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['packed_arrays_parsed']]
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', '{"v":' + text + '}')
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.', '{"v":' + text[:-1] + ',"x"]}')
+        assert packed + 1 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['packed_arrays_parsed']]
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) + 64 * 16 <= \
+            client.execute_command('JSON.DEBUG', 'MEMORY', k2)
+
+        # reads see the same text and numbers
+        assert text.encode() == client.execute_command('JSON.GET', k1, '.v')
+        assert vector[3] == json.loads(client.execute_command('JSON.GET', k1, '.v[3]'))
+        assert vector[-3:] == json.loads(client.execute_command('JSON.GET', k1, '$.v[-3:]'))
+        assert [b'number'] == client.execute_command('JSON.TYPE', k1, '$.v[0]')
+        assert [3] == client.execute_command('JSON.ARRINDEX', k1, '$.v', '%.17g' % vector[3])
+        assert b'[1.5714285714285714]' == client.execute_command('JSON.NUMINCRBY', k1, '$.v[0]', '1.4285714285714286')
+
+        # so does the text of Python repr, i.e., the shortest that reads back
+        reprs = '[' + ','.join(repr(round(i / 7 * 0.003, 15)) for i in range(1, 65)) + ']'
+        assert b'OK' == client.execute_command('JSON.SET', k3, '.', reprs)
+        assert b'OK' == client.execute_command('JSON.SET', k4, '.', reprs[:-1] + ',"x"]')
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k3) + 48 * 16 <= \
+            client.execute_command('JSON.DEBUG', 'MEMORY', k4)
+        assert reprs.encode() == client.execute_command('JSON.GET', k3)
+
+        # it's still an array of anything
+        assert 65 == client.execute_command('JSON.ARRAPPEND', k1, '.v', '"x"')
+        assert b'"x"' == client.execute_command('JSON.ARRPOP', k1, '.v')
+
+        # it's a counter of parses: deletes don't take off, loads add on
+        assert packed + 2 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['packed_arrays_parsed']]
+        assert 1 == client.execute_command('JSON.DEL', k3)
+        assert packed + 2 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['packed_arrays_parsed']]
+        client.execute_command('DEBUG', 'RELOAD')
+        assert json.loads(client.execute_command('JSON.GET', k1, '.v'))[1:] == vector[1:]
+        assert packed + 3 <= client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['packed_arrays_parsed']]
+
+    def test_shortest_doubles(self):
+        client = self.server.get_new_client()
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', '{"a":0.05,"b":[0.1,0.2]}')
+        assert b'0.10000000000000001' == client.execute_command('JSON.NUMMULTBY', k1, '.a', 2)
+        client.config_set('json.shortest-doubles', 'yes')
+        try:
+            # doubles keep the text they were stored with, computed ones the format of when they were computed
+            assert b'{"a":0.10000000000000001,"b":[0.1,0.2]}' == client.execute_command('JSON.GET', k1)
+            assert b'0.2' == client.execute_command('JSON.NUMMULTBY', k1, '.a', 2)
+            assert b'[0.30000000000000004]' == client.execute_command('JSON.NUMINCRBY', k1, '$.b[0]', 0.2)
+            assert b'0.1' == client.execute_command('JSON.NUMMULTBY', k1, '.a', 0.5)
+        finally:
+            client.config_set('json.shortest-doubles', 'no')
+        assert b'0.1' == client.execute_command('JSON.GET', k1, '.a')
+
+    def test_cold_document_compression(self):
+        client = self.server.get_new_client()
+        value = json.dumps({'orders': [{'id': i, 'status': 'shipped', 'total': i * 2.5, 'items': ['a', 'b']}
+                                       for i in range(500)]})
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', value)
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.', value)
+        expected = client.execute_command('JSON.GET', k2)
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        compressed = info[JSON_INFO_NAMES['compressed_documents']]
+
+        # a compressed document is charged for its encoding, and reads the same
+        assert 1 == client.execute_command('JSON.DEBUG', 'COMPRESS', k1)
+        assert 0 == client.execute_command('JSON.DEBUG', 'COMPRESS', k1)
+        assert client.execute_command('MEMORY', 'USAGE', k1) * 2 < client.execute_command('MEMORY', 'USAGE', k2)
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        assert compressed + 1 == info[JSON_INFO_NAMES['compressed_documents']]
+        assert info[JSON_INFO_NAMES['compression_ratio']] > 2
+        assert client.execute_command('DEBUG', 'DIGEST-VALUE', k1) == \
+            client.execute_command('DEBUG', 'DIGEST-VALUE', k2)
+        inflated = info[JSON_INFO_NAMES['inflate_count']]
+        assert 500 == client.execute_command('JSON.ARRLEN', k1, '.orders')
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        assert compressed == info[JSON_INFO_NAMES['compressed_documents']]
+        assert inflated + 1 == info[JSON_INFO_NAMES['inflate_count']]
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) == client.execute_command('JSON.DEBUG', 'MEMORY', k2)
+
+        # copies and reloads of compressed documents
+        assert 1 == client.execute_command('JSON.DEBUG', 'COMPRESS', k1)
+        assert 1 == client.execute_command('COPY', k1, k3)
+        assert compressed + 2 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['compressed_documents']]
+        assert b'OK' == client.execute_command('JSON.SET', k3, '.orders[0].status', '"returned"')
+        assert expected == client.execute_command('JSON.GET', k1)
+        client.execute_command('DEBUG', 'RELOAD')
+        assert expected == client.execute_command('JSON.GET', k1)
+        assert b'"returned"' == client.execute_command('JSON.GET', k3, '.orders[0].status')
+
+        # the background scan compresses documents that are large enough and idle long enough
+        client.config_set('json.compress-idle-seconds', 0)
+        client.config_set('json.compress-min-size', 1000)
+        try:
+            for _ in range(100):
+                if client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['compressed_documents']] > 0:
+                    break
+                time.sleep(0.05)
+            assert client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['compressed_documents']] > 0
+        finally:
+            client.config_set('json.compress-min-size', 0)
+            client.config_set('json.compress-idle-seconds', 3600)
+        assert expected == client.execute_command('JSON.GET', k2)
+
     def test_json_arrinsert_command(self):
         client = self.server.get_new_client()
         # edge case: insert into an empty array
@@ -4031,12 +4380,449 @@ class TestJsonBasic(JsonTestCase):
         assert b'[]' == client.execute_command(
             'JSON.GET', key, path)
 
+    def test_keytable_rehash_info(self):
+        client = self.server.get_new_client()
+        # Enough unique keys to rehash the shards a few times, all too long to be inline
+        for i in range(20):
+            doc = {f'member_{i}_{j}': j for j in range(500)}
+            client.execute_command('JSON.SET', f'k{i}', '.', json.dumps(doc))
+
+        reply = client.execute_command('JSON.DEBUG', 'KEYTABLE')
+        stats = {reply[i].decode(): reply[i + 1] for i in range(0, len(reply), 2)}
+        assert stats['size'] >= 20 * 500
+        assert stats['rehash_in_progress'] <= stats['num_shards']
+        assert stats['max_rehash_pause_nanos'] > 0
+
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        assert info[JSON_INFO_NAMES['key_table_rehash_in_progress']] <= stats['num_shards']
+        assert info[JSON_INFO_NAMES['key_table_max_rehash_pause_nanos']] >= stats['max_rehash_pause_nanos']
+
+        # Deleting everything drains and shrinks the tables again, lookups keep working meanwhile
+        for i in range(20):
+            assert b'[499]' == client.execute_command('JSON.GET', f'k{i}', f'$.member_{i}_499')
+            assert 1 == client.execute_command('JSON.DEL', f'k{i}')
+        with pytest.raises(ResponseError):
+            client.execute_command('JSON.DEBUG', 'KEYTABLE', 'extra')
+
+    def test_keytable_inline_handles(self):
+        client = self.server.get_new_client()
+
+        def keytable_stats():
+            reply = client.execute_command('JSON.DEBUG', 'KEYTABLE')
+            return {reply[i].decode(): reply[i + 1] for i in range(0, len(reply), 2)}
+
+        before = keytable_stats()
+        # Names of up to 7 bytes are kept in the handles, longer ones in the table
+        client.execute_command('JSON.SET', 'k1', '.', '{"id":1,"price":2,"a\\"b":3,"1234567":4,"12345678":5}')
+        client.execute_command('JSON.SET', 'k2', '.', '{"id":1,"nested":{"id":2}}')
+        after = keytable_stats()
+        assert after['inline_handles'] - before['inline_handles'] == 7
+        assert after['handles'] - before['handles'] == 1
+        assert client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['key_table_inline_handles']] == \
+            after['inline_handles']
+
+        assert b'[4]' == client.execute_command('JSON.GET', 'k1', '$["1234567"]')
+        assert b'{"id":1,"price":2,"a\\"b":3,"1234567":4,"12345678":5}' == \
+            client.execute_command('JSON.GET', 'k1')
+        assert [b'id', b'nested'] == client.execute_command('JSON.OBJKEYS', 'k2')
+        client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+
+        assert 2 == client.execute_command('DEL', 'k1', 'k2')
+        assert keytable_stats()['inline_handles'] == before['inline_handles']
+
+    def test_keytable_check_shared_copies(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"firstname":"a","lastname":"b","location":{"postcode":1}}')
+        handles, names = client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+        # Copies share the tree of the source, and its handles, until they're written
+        assert 1 == client.execute_command('COPY', k1, k2)
+        assert 1 == client.execute_command('COPY', k2, k3)
+        assert [handles, names] == client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.location.postcode', '2')
+        assert [handles + 4, names] == client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+        assert 1 == client.execute_command('DEL', k1)
+        assert [handles + 4, names] == client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+        assert 2 == client.execute_command('DEL', k2, k3)
+
+    def test_memory_profile(self):
+        client = self.server.get_new_client()
+
+        def profile():
+            reply = client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE')
+            result = {reply[i].decode(): reply[i + 1] for i in range(0, len(reply), 2)}
+            for section in ['categories', 'commands']:
+                result[section] = {result[section][i].decode(): {
+                    result[section][i + 1][j].decode(): result[section][i + 1][j + 1]
+                    for j in range(0, len(result[section][i + 1]), 2)} for i in range(0, len(result[section]), 2)}
+            return result
+
+        assert profile()['enabled'] == 0
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'RESET')
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'ON')
+        doc = {f'member_{i}': 'a string that is too long to be inline ' * 2 for i in range(1000)}
+        client.execute_command('JSON.SET', k1, '.', json.dumps(doc))
+        client.execute_command('JSON.SET', k2, '.', '[1,2,3]')
+        p = profile()
+        assert p['enabled'] == 1
+        assert set(p['categories'].keys()) == {'other', 'nodes', 'strings', 'hashtables', 'keytable'}
+        for category in ['nodes', 'strings', 'hashtables', 'keytable']:
+            assert p['categories'][category]['allocations'] > 0
+        assert p['categories']['strings']['bytes'] >= 1000 * 80
+        for c in p['categories'].values():
+            assert c['overhead_bytes'] <= c['bytes']
+        assert p['commands']['set']['allocations'] > 0
+        assert p['commands']['set']['bytes'] >= p['categories']['strings']['bytes']
+
+        assert 1 == client.execute_command('DEL', k1)
+        assert profile()['categories']['strings']['frees'] >= 1000
+
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'OFF')
+        before = profile()
+        client.execute_command('JSON.SET', k1, '.', json.dumps(doc))
+        assert profile()['categories'] == before['categories']
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'RESET')
+        assert profile()['commands'] == {}
+
+        with pytest.raises(ResponseError):
+            client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'SOMETIMES')
+        with pytest.raises(ResponseError):
+            client.execute_command('JSON.DEBUG', 'MEMORY-PROFILE', 'ON', 'extra')
+
+    def test_max_key_scan_in_batches(self):
+        client = self.server.get_new_client()
+        # More keys than a single batch of the scan, plus a few that aren't JSON
+        for i in range(2500):
+            client.execute_command('JSON.SET', f'scan{i}', '.', '{"a":[1]}')
+        for i in range(10):
+            client.set(f'str{i}', 'x' * 1000)
+        client.execute_command('JSON.SET', 'deepest', '.', '{"a":{"b":{"c":{"d":[1]}}}}')
+        client.execute_command('JSON.SET', 'largest', '.', json.dumps({'text': 'y' * 10000}))
+
+        assert [5, b'deepest'] == client.execute_command('JSON.DEBUG', 'MAX-DEPTH-KEY')
+        size, key = client.execute_command('JSON.DEBUG', 'MAX-SIZE-KEY')
+        assert key == b'largest'
+        assert size > 10000
+
+        # Within MULTI the client can't be blocked, the scan runs in place with the same results
+        pipe = client.pipeline(transaction=True)
+        pipe.execute_command('JSON.DEBUG', 'MAX-DEPTH-KEY')
+        pipe.execute_command('JSON.DEBUG', 'MAX-SIZE-KEY')
+        depth_reply, size_reply = pipe.execute()
+        assert depth_reply == [5, b'deepest']
+        assert size_reply == [size, b'largest']
+
+    def test_path_cache_info(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"a":{"b":[1,2,3]}}')
+
+        def stats():
+            info = client.info(JSON_INFO_METRICS_SECTION)
+            return info[JSON_INFO_NAMES['path_cache_hits']], info[JSON_INFO_NAMES['path_cache_misses']]
+
+        assert b'[[1,2,3]]' == client.execute_command('JSON.GET', k1, '$.a.b')
+        hits, misses = stats()
+        assert misses > 0
+        for _ in range(3):
+            assert b'[[1,2,3]]' == client.execute_command('JSON.GET', k1, '$.a.b')
+        new_hits, new_misses = stats()
+        assert new_hits >= hits + 3
+        assert new_misses == misses
+
+        # Disabling the cache compiles every time, results don't change
+        client.config_set('json.path-cache-size', 0)
+        try:
+            assert b'[2]' == client.execute_command('JSON.GET', k1, '$.a.b[1]')
+            assert (new_hits, new_misses) == stats()
+        finally:
+            client.config_set('json.path-cache-size', 256)
+
+    def test_latency_info(self):
+        client = self.server.get_new_client()
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'RESET-STATS')
+        client.execute_command('JSON.SET', k1, '.', '{"a":[{"b":1},{"b":5}],"c":{"b":"x"}}')
+        assert b'[5]' == client.execute_command('JSON.GET', k1, '$.a[?(@.b>2)].b')
+        assert b'[1,5,"x"]' == client.execute_command('JSON.GET', k1, '$..b')
+        assert b'1' == client.execute_command('JSON.GET', k1, '.a[0].b')
+
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        assert info[JSON_INFO_NAMES['path_v1_count']] >= 2
+        assert info[JSON_INFO_NAMES['path_v2_count']] >= 2
+        assert info[JSON_INFO_NAMES['path_recursive_count']] >= 1
+        assert info[JSON_INFO_NAMES['path_filter_count']] >= 1
+
+        latency = client.info(JSON_INFO_LATENCY_SECTION)
+        buckets = json.loads(latency[JSON_MODULE_NAME + '_buckets_usec'].replace('INF', '-1'))
+        assert len(buckets) == 17
+        assert latency[JSON_MODULE_NAME + '_get_calls'] == 3
+        assert latency[JSON_MODULE_NAME + '_set_calls'] == 1
+        assert sum(json.loads(latency[JSON_MODULE_NAME + '_get_usec_hist'])) == 3
+        for phase in ['path_parse', 'traversal', 'serialization', 'reply', 'other']:
+            assert sum(json.loads(latency[f'{JSON_MODULE_NAME}_get_{phase}_usec_hist'])) == 3
+        assert sum(json.loads(latency[JSON_MODULE_NAME + '_set_input_parse_usec_hist'])) == 1
+        assert JSON_MODULE_NAME + '_arrlen_calls' not in latency
+
+        # Resetting clears the histograms and the counters
+        assert b'OK' == client.execute_command('JSON.DEBUG', 'RESET-STATS')
+        info = client.info(JSON_INFO_METRICS_SECTION)
+        for name in ['path_v1_count', 'path_v2_count', 'path_recursive_count', 'path_filter_count',
+                     'path_cache_hits', 'path_cache_misses', 'root_cache_hits', 'root_cache_misses']:
+            assert info[JSON_INFO_NAMES[name]] == 0
+        assert JSON_MODULE_NAME + '_get_calls' not in client.info(JSON_INFO_LATENCY_SECTION)
+        with pytest.raises(ResponseError):
+            client.execute_command('JSON.DEBUG', 'RESET-STATS', 'extra')
+
+    def test_root_cache(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"a":[1,2.5,"x"],"b":{"c":null}}')
+        uncached = client.execute_command('JSON.DEBUG', 'MEMORY', k1)
+        client.config_set('json.root-cache-min-size', 1)
+        try:
+            for _ in range(2):
+                assert b'{"a":[1,2.5,"x"],"b":{"c":null}}' == client.execute_command('JSON.GET', k1)
+                assert b'{"a":[1,2.5,"x"],"b":{"c":null}}' == client.execute_command('JSON.GET', k1, '.')
+                assert b'[{"a":[1,2.5,"x"],"b":{"c":null}}]' == client.execute_command('JSON.GET', k1, '$')
+            # The cache is charged to the document
+            assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) > uncached
+
+            # Formatted replies and sub-paths are not cached
+            assert b'\n' in client.execute_command('JSON.GET', k1, 'INDENT', ' ', 'NEWLINE', '\n', '.')
+            assert b'[2.5]' == client.execute_command('JSON.GET', k1, '$.a[1]')
+
+            # Every write releases the cache
+            for cmd, exp in [
+                (('JSON.NUMINCRBY', k1, '.a[0]', 1), b'{"a":[2,2.5,"x"],"b":{"c":null}}'),
+                (('JSON.STRAPPEND', k1, '.a[2]', '"y"'), b'{"a":[2,2.5,"xy"],"b":{"c":null}}'),
+                (('JSON.ARRAPPEND', k1, '.a', 'true'), b'{"a":[2,2.5,"xy",true],"b":{"c":null}}'),
+                (('JSON.TOGGLE', k1, '.a[3]'), b'{"a":[2,2.5,"xy",false],"b":{"c":null}}'),
+                (('JSON.ARRPOP', k1, '.a'), b'{"a":[2,2.5,"xy"],"b":{"c":null}}'),
+                (('JSON.DEL', k1, '.b.c'), b'{"a":[2,2.5,"xy"],"b":{}}'),
+                (('JSON.SET', k1, '.b.d', '1'), b'{"a":[2,2.5,"xy"],"b":{"d":1}}'),
+                (('JSON.CLEAR', k1, '.a'), b'{"a":[],"b":{"d":1}}'),
+            ]:
+                client.execute_command(*cmd)
+                assert exp == client.execute_command('JSON.GET', k1, '.')
+        finally:
+            client.config_set('json.root-cache-min-size', 0)
+        assert b'{"a":[],"b":{"d":1}}' == client.execute_command('JSON.GET', k1)
+
+    def test_doc_arena(self):
+        client = self.server.get_new_client()
+        client.config_set('json.doc-arena', 'yes')
+        try:
+            client.execute_command('JSON.SET', k1, '.', '{"a":[],"b":{},"c":"a string that is not short"}')
+            for i in range(200):
+                client.execute_command('JSON.ARRAPPEND', k1, '.a', i, '"str%d-padding-padding"' % i)
+                client.execute_command('JSON.SET', k1, '.b.m%d' % i, '{"x":[%d,1.5]}' % i)
+            assert 400 == client.execute_command('JSON.ARRLEN', k1, '.a')
+            assert 200 == client.execute_command('JSON.OBJLEN', k1, '.b')
+            for i in range(0, 200, 2):
+                assert 1 == client.execute_command('JSON.DEL', k1, '.b.m%d' % i)
+            client.execute_command('JSON.ARRTRIM', k1, '.a', 0, 9)
+            assert b'[0,"str0-padding-padding",1,"str1-padding-padding",2]' == \
+                client.execute_command('JSON.GET', k1, '$.a[0:5]')
+            assert b'{"x":[199,1.5]}' == client.execute_command('JSON.GET', k1, '.b.m199')
+            assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) > 0
+
+            # Copies, e.g., by defrag, and documents created before the config was enabled work the same
+            assert 1 == client.execute_command('COPY', k1, k2)
+            assert client.execute_command('JSON.GET', k1) == client.execute_command('JSON.GET', k2)
+        finally:
+            client.config_set('json.doc-arena', 'no')
+        client.execute_command('JSON.ARRAPPEND', k1, '.a', '"after"')
+        assert b'["after"]' == client.execute_command('JSON.GET', k1, '$.a[-1]')
+        assert 2 == client.execute_command('DEL', k1, k2)
+
+    def test_copy_on_write(self):
+        client = self.server.get_new_client()
+        big = '{"a":[%s],"b":{"c":"%s"}}' % (','.join('"element-%d"' % i for i in range(500)), 'x' * 1000)
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', big)
+        size = client.execute_command('JSON.DEBUG', 'MEMORY', k1)
+
+        # Copies share the tree of the source, which stays charged to it
+        assert 1 == client.execute_command('COPY', k1, k2)
+        assert 1 == client.execute_command('COPY', k2, k3)
+        assert size == client.execute_command('JSON.DEBUG', 'MEMORY', k1)
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k2) < size / 10
+        for key in [k2, k3]:
+            assert big.encode() == client.execute_command('JSON.GET', key)
+
+        # The first write to a copy gives it its own tree
+        assert b'OK' == client.execute_command('JSON.SET', k2, '.b.c', '"y"')
+        assert b'"y"' == client.execute_command('JSON.GET', k2, '.b.c')
+        assert ('"%s"' % ('x' * 1000)).encode() == client.execute_command('JSON.GET', k3, '.b.c')
+        assert ('"%s"' % ('x' * 1000)).encode() == client.execute_command('JSON.GET', k1, '.b.c')
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k2) > size / 2
+
+        # Deleting the source hands the charge of the tree on to a copy
+        assert 1 == client.execute_command('DEL', k1)
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k3) > size / 2
+        assert 500 == client.execute_command('JSON.ARRLEN', k3, '.a')
+        assert 501 == client.execute_command('JSON.ARRAPPEND', k3, '.a', '1')
+        assert 500 == client.execute_command('JSON.ARRLEN', k2, '.a')
+        assert 2 == client.execute_command('DEL', k2, k3)
+
+    def test_copy_on_write_flush_async(self):
+        client = self.server.get_new_client()
+        big = '{"a":[%s]}' % ','.join('"element-%d"' % i for i in range(500))
+        assert b'OK' == client.execute_command('JSON.SET', k1, '.', big)
+        assert 1 == client.execute_command('COPY', k1, k2, 'DB', 1)
+        assert 1 == client.execute_command('COPY', k1, k3)
+        # The lazyfree thread leaves the copy in database 1 to the main thread
+        assert b'OK' == client.execute_command('FLUSHDB', 'ASYNC')
+        client.execute_command('SELECT', 1)
+        assert 501 == client.execute_command('JSON.ARRAPPEND', k2, '.a', '1')
+        # Only the copy is left once the flushed documents are freed
+        for _ in range(100):
+            if client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['num_documents']] == 1:
+                break
+            time.sleep(0.05)
+        assert 1 == client.info(JSON_INFO_METRICS_SECTION)[JSON_INFO_NAMES['num_documents']]
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k2) > len(big)
+        client.execute_command('JSON.DEBUG', 'KEYTABLE-CHECK')
+        assert 1 == client.execute_command('DEL', k2)
+        client.execute_command('SELECT', 0)
+
+    def test_replicate_effects(self):
+        client = self.server.get_new_client()
+        client.config_set('json.replicate-effects', 'yes')
+        client.config_set('appendonly', 'yes')
+        try:
+            while client.info('persistence')['aof_rewrite_in_progress'] or \
+                    client.info('persistence')['aof_rewrite_scheduled']:
+                time.sleep(0.05)
+            client.execute_command('JSON.SET', k1, '.', '{"a":{"counter":1,"x":{"counter":2}},"we\\"ird\\\\":'
+                                   '{"counter":3},"list":[{"expired":true},{"expired":false},{"expired":true}]}')
+            client.execute_command('JSON.NUMINCRBY', k1, '$..counter', 1)
+            assert 2 == client.execute_command('JSON.DEL', k1, '$.list[?(@.expired==true)]')
+            client.execute_command('JSON.SET', k1, '$.a.x.*', '"v"')
+            client.execute_command('JSON.ARRAPPEND', k1, '$..list', 7)
+            client.execute_command('JSON.TOGGLE', k1, '$.list[*].expired')
+            client.execute_command('JSON.NUMMULTBY', k1, '.a.counter', 10)
+            expected = b'{"a":{"counter":20,"x":{"counter":"v"}},"we\\"ird\\\\":{"counter":4},' \
+                b'"list":[{"expired":true},7]}'
+            assert expected == client.execute_command('JSON.GET', k1)
+
+            # Replaying the effects gives the same document, without evaluating the paths again
+            aof = b''
+            aof_dir = os.path.join(client.config_get('dir')['dir'], client.config_get('appenddirname')['appenddirname'])
+            for name in glob.glob(os.path.join(aof_dir, '*.incr.aof')):
+                with open(name, 'rb') as f:
+                    aof += f.read()
+            assert aof.find(b'$..counter') < 0 and aof.find(b'expired==true') < 0
+            assert aof.find(b'$["list"][2]') >= 0 and aof.find(b'$["we\\u0022ird\\u005c"]["counter"]') >= 0
+            assert aof.find(b'.a.counter') >= 0
+            client.execute_command('DEBUG', 'LOADAOF')
+            assert expected == client.execute_command('JSON.GET', k1)
+        finally:
+            client.config_set('appendonly', 'no')
+            client.config_set('json.replicate-effects', 'no')
+
+    def test_chunked_aof_rewrite(self):
+        client = self.server.get_new_client()
+        doc = {'a': list(range(40)), 'b': {'k%d' % i: 'value-%d' % i for i in range(20)},
+               'c': {'n': None, 'x': [None, {'y': None}]}, 'd': 'a string longer than the chunk size' * 3,
+               'e': [list(range(30)), {'z': list(range(30)), 'w\\"': {}}, 'tail'], 'f': [], 'g': 1.5}
+        client.execute_command('JSON.SET', k1, '.', json.dumps(doc))
+        expected = {key: client.execute_command('JSON.GET', key) for key in (k1, wikipedia)}
+        client.config_set('json.aof-rewrite-chunk-size', 64)
+        client.config_set('aof-use-rdb-preamble', 'no')
+        client.config_set('appendonly', 'yes')
+        try:
+            def wait_for_rewrite():
+                while client.info('persistence')['aof_rewrite_in_progress'] or \
+                        client.info('persistence')['aof_rewrite_scheduled']:
+                    time.sleep(0.05)
+            wait_for_rewrite()
+            client.execute_command('BGREWRITEAOF')
+            wait_for_rewrite()
+
+            aof = b''
+            aof_dir = os.path.join(client.config_get('dir')['dir'], client.config_get('appenddirname')['appenddirname'])
+            for name in glob.glob(os.path.join(aof_dir, '*.base.aof')):
+                with open(name, 'rb') as f:
+                    aof += f.read()
+            for record in (b'JSON.MERGE', b'JSON.ARRAPPEND', b'$["b"]', b'$["d"]', b'$["e"][1]["z"]'):
+                assert aof.find(record) >= 0
+            assert aof.find(json.dumps(doc, separators=(',', ':')).encode()) < 0
+
+            client.execute_command('DEBUG', 'LOADAOF')
+            for key, value in expected.items():
+                assert value == client.execute_command('JSON.GET', key)
+        finally:
+            client.config_set('appendonly', 'no')
+            client.config_set('aof-use-rdb-preamble', 'yes')
+            client.config_set('json.aof-rewrite-chunk-size', 64 * 1024 * 1024)
+
+    def test_doc_index(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"orders":[{"id":1,"v":"a"},{"id":2,"v":"b"},{"id":1,"v":"c"}]}')
+        unindexed = client.execute_command('JSON.DEBUG', 'MEMORY', k1)
+        assert b'OK' == client.execute_command('JSON.INDEX', 'CREATE', k1, '$.orders', 'id')
+        assert b'OK' == client.execute_command('JSON.INDEX', 'CREATE', k1, '$.orders', 'id')
+        assert [[b'$.orders', b'id', 0, 2]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+        # The index is charged to the document
+        assert client.execute_command('JSON.DEBUG', 'MEMORY', k1) > unindexed
+
+        assert b'[{"id":1,"v":"a"},{"id":1,"v":"c"}]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)]')
+        client.execute_command('JSON.ARRAPPEND', k1, '$.orders', '{"id":1,"v":"d"}')
+        assert [[b'$.orders', b'id', 0, 2]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+        assert b'["a","c","d"]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)].v')
+
+        # Other writes make the index stale until the next query
+        client.execute_command('JSON.DEL', k1, '$.orders[0]')
+        client.execute_command('JSON.SET', k1, '$.orders[0].id', '3')
+        assert [[b'$.orders', b'id', 1, 0]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+        assert b'["c","d"]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)].v')
+        assert [[b'$.orders', b'id', 0, 2]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+
+        # Errors
+        client.execute_command('JSON.SET', k1, '$.obj', '{"id":1}')
+        for args, err in [(('CREATE', k1, '$.obj', 'id'), 'WRONGTYPE'), (('CREATE', k1, '$.foo', 'id'), 'NONEXISTENT'),
+                          (('CREATE', 'nosuchkey', '$.orders', 'id'), 'NONEXISTENT'), (('NOSUCHCMD', k1), 'unknown')]:
+            with pytest.raises(ResponseError) as e:
+                client.execute_command('JSON.INDEX', *args)
+            assert err.lower() in str(e.value).lower()
+        assert None == client.execute_command('JSON.INDEX', 'LIST', 'nosuchkey')
+
+        assert 0 == client.execute_command('JSON.INDEX', 'DROP', k1, '$.orders', 'v')
+        assert 1 == client.execute_command('JSON.INDEX', 'DROP', k1, '$.orders', 'id')
+        assert [] == client.execute_command('JSON.INDEX', 'LIST', k1)
+        assert b'["c","d"]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)].v')
+
+    def test_doc_index_sibling_writes(self):
+        client = self.server.get_new_client()
+        client.execute_command('JSON.SET', k1, '.', '{"a":1,"orders":[{"id":1}],"other":[{"id":5}]}')
+        assert b'OK' == client.execute_command('JSON.INDEX', 'CREATE', k1, '$.orders', 'id')
+
+        # Deleting a member before the array moves the arrays after it down, where another array may now be
+        assert 1 == client.execute_command('JSON.DEL', k1, '$.a')
+        assert [[b'$.orders', b'id', 1, 0]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+        assert b'[{"id":5}]' == client.execute_command('JSON.GET', k1, '$.other[?(@.id==5)]')
+        assert b'[{"id":1}]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)]')
+        assert [[b'$.orders', b'id', 0, 1]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+
+        # Inserting members, enough to turn the object into a hashtable and rehash it, moves every member
+        for i in range(40):
+            assert b'OK' == client.execute_command('JSON.SET', k1, f'$.m{i}', '[{"id":5}]')
+            assert [[b'$.orders', b'id', 1, 0]] == client.execute_command('JSON.INDEX', 'LIST', k1)
+            assert b'[{"id":5}]' == client.execute_command('JSON.GET', k1, f'$.m{i}[?(@.id==5)]')
+            assert b'[{"id":1}]' == client.execute_command('JSON.GET', k1, '$.orders[?(@.id==1)]')
+        assert b'[]' == client.execute_command('JSON.GET', k1, '$.other[?(@.id==1)]')
+
+        # Siblings of the array in an array
+        client.execute_command('JSON.SET', k2, '.', '[[{"id":1}],[{"id":2}],[{"id":3}]]')
+        assert b'OK' == client.execute_command('JSON.INDEX', 'CREATE', k2, '$[1]', 'id')
+        assert 1 == client.execute_command('JSON.DEL', k2, '$[0]')
+        assert b'[{"id":3}]' == client.execute_command('JSON.GET', k2, '$[1][?(@.id==3)]')
+        assert b'[]' == client.execute_command('JSON.GET', k2, '$[1][?(@.id==2)]')
+        assert b'[{"id":2}]' == client.execute_command('JSON.GET', k2, '$[0][?(@.id==2)]')
+
     def test_json_arity_per_command(self):
         client = self.server.get_new_client()
 
         # These commands should only get the single key
-        cmd_arity = [('SET', -4), ('GET', -2), ('MGET', -3), ('DEL', -2), ('FORGET', -2), ('NUMINCRBY', 4),
-                     ('NUMMULTBY', 4), ('STRLEN', -2), ('STRAPPEND', -
+        cmd_arity = [('SET', -4), ('GET', -2), ('MGET', -3), ('MSET', -4), ('DEL', -2), ('FORGET', -2),
+                     ('MERGE', 4), ('NUMINCRBY', 4), ('NUMMULTBY', 4), ('STRLEN', -2), ('STRAPPEND', -
                                                         3), ('TOGGLE', -2), ('OBJLEN', -2), ('OBJKEYS', -2),
                      ('ARRLEN', -2), ('ARRAPPEND', -4), ('ARRPOP', -
                                                          2), ('ARRINSERT', -5), ('ARRTRIM', 5), ('CLEAR', -2),
@@ -4048,8 +4834,8 @@ class TestJsonBasic(JsonTestCase):
 
         cmd_arity = [('MEMORY', -3), ('FIELDS', -3), ('DEPTH', 3), ('HELP', 2),
                      ('MAX-DEPTH-KEY', 2), ('MAX-SIZE-KEY',
-                                            2), ('KEYTABLE-CHECK', 2), ('KEYTABLE-CORRUPT', 3),
-                     ('KEYTABLE-DISTRIBUTION', 3)]
+                                            2), ('KEYTABLE', 2), ('KEYTABLE-CHECK', 2), ('KEYTABLE-CORRUPT', 3),
+                     ('KEYTABLE-DISTRIBUTION', 3), ('RESET-STATS', 2), ('MEMORY-PROFILE', -2)]
         subcmd_dict = {f'JSON.DEBUG|{cmd}': arity for cmd, arity in cmd_arity}
 
         output = client.execute_command(
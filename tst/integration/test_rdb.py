@@ -34,3 +34,45 @@ class TestRdb(JsonTestCase):
         assert True == client.execute_command('save')
         client.execute_command('FLUSHDB')
         assert b'OK' == client.execute_command('DEBUG', 'RELOAD', 'NOSAVE')
+
+    def test_rdb_binary_encoding_roundtrip(self):
+        """
+        Test that every value type survives a save/reload through the binary encoding
+        """
+        client = self.server.get_new_client()
+        big_object = '{' + ','.join('"k%d":%d' % (i, i) for i in range(200)) + '}'
+        docs = {
+            'scalars': '{"n":null,"t":true,"f":false,"i":-42,"z":0,"big":9223372036854775807,'
+                       '"min":-9223372036854775808,"u":18446744073709551615,"d":3.14159,"e":1e+300}',
+            'strings': '{"empty":"","esc":"a\\"b\\\\c\\n","uni":"\\u00e9\\u4e2d","long":"' + 'x' * 1000 + '"}',
+            'nested': '{"a":[1,[2,[3,{"b":{"c":[]}}]]],"o":{}}',
+            'big_object': big_object,
+            'root_array': '[1,"two",3.0,[],{}]',
+            'root_scalar': '"just a string"',
+        }
+        expected = {}
+        for key, value in docs.items():
+            assert b'OK' == client.execute_command('JSON.SET', key, '.', value)
+            expected[key] = client.execute_command('JSON.GET', key)
+        expected['store'] = client.execute_command('JSON.GET', 'store')
+
+        assert b'OK' == client.execute_command('DEBUG', 'RELOAD')
+        for key, value in expected.items():
+            assert value == client.execute_command('JSON.GET', key)
+
+    def test_rdb_key_dictionary_roundtrip(self):
+        """
+        Test that documents saved with the key dictionary reload correctly, including repeated member names
+        """
+        client = self.server.get_new_client()
+        client.config_set('json.rdb-key-dictionary', 'yes')
+        try:
+            repeated = '[' + ','.join('{"id":%d,"type":"t%d","tags":{"id":%d}}' % (i, i % 3, i) for i in range(100)) + ']'
+            assert b'OK' == client.execute_command('JSON.SET', 'repeated', '.', repeated)
+            assert b'OK' == client.execute_command('JSON.SET', 'nokeys', '.', '[1,2,3]')
+            expected = {key: client.execute_command('JSON.GET', key) for key in ['repeated', 'nokeys', 'store']}
+            assert b'OK' == client.execute_command('DEBUG', 'RELOAD')
+            for key, value in expected.items():
+                assert value == client.execute_command('JSON.GET', key)
+        finally:
+            client.config_set('json.rdb-key-dictionary', 'no')
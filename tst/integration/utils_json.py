@@ -17,6 +17,27 @@ JSON_INFO_NAMES = {
     'max_document_size_ever_seen':  JSON_MODULE_NAME + '_max_document_size_ever_seen',
     'total_malloc_bytes_used':      JSON_MODULE_NAME + "_total_malloc_bytes_used",
     'memory_traps_enabled':         JSON_MODULE_NAME + "_memory_traps_enabled",
+    'path_cache_hits':              JSON_MODULE_NAME + "_path_cache_hits",
+    'path_cache_misses':            JSON_MODULE_NAME + "_path_cache_misses",
+    'defrag_count':                 JSON_MODULE_NAME + "_defrag_count",
+    'defrag_bytes':                 JSON_MODULE_NAME + "_defrag_bytes",
+    'defrag_stopped':               JSON_MODULE_NAME + "_defrag_stopped",
+    'key_table_rehash_in_progress':     JSON_MODULE_NAME + "_key_table_rehash_in_progress",
+    'key_table_max_rehash_pause_nanos': JSON_MODULE_NAME + "_key_table_max_rehash_pause_nanos",
+    'key_table_inline_handles':         JSON_MODULE_NAME + "_key_table_inline_handles",
+    'path_v1_count':                JSON_MODULE_NAME + "_path_v1_count",
+    'path_v2_count':                JSON_MODULE_NAME + "_path_v2_count",
+    'path_recursive_count':         JSON_MODULE_NAME + "_path_recursive_count",
+    'path_filter_count':            JSON_MODULE_NAME + "_path_filter_count",
+    'root_cache_hits':              JSON_MODULE_NAME + "_root_cache_hits",
+    'root_cache_misses':            JSON_MODULE_NAME + "_root_cache_misses",
+    'packed_arrays_parsed':         JSON_MODULE_NAME + "_packed_arrays_parsed",
+    'compressed_documents':         JSON_MODULE_NAME + "_compressed_documents",
+    'compressed_bytes':             JSON_MODULE_NAME + "_compressed_bytes",
+    'compression_ratio':            JSON_MODULE_NAME + "_compression_ratio",
+    'inflate_count':                JSON_MODULE_NAME + "_inflate_count",
+    'inflate_avg_usec':             JSON_MODULE_NAME + "_inflate_avg_usec",
+    'inflate_max_usec':             JSON_MODULE_NAME + "_inflate_max_usec",
 }
 DEFAULT_MAX_DOCUMENT_SIZE = 64*1024*1024
 DEFAULT_MAX_PATH_LIMIT = 128
@@ -24,5 +45,6 @@ DEFAULT_WIKIPEDIA_PATH = 'data/wikipedia.json'
 DEFAULT_WIKIPEDIA_COMPACT_PATH = 'data/wikipedia_compact.json'
 DEFAULT_STORE_PATH = 'data/store.json'
 JSON_INFO_METRICS_SECTION = JSON_MODULE_NAME + '_core_metrics'
+JSON_INFO_LATENCY_SECTION = JSON_MODULE_NAME + '_latency'
 
 JSON_MODULE_NAME = 'json'
@@ -12,6 +12,8 @@
 #include <iostream>
 #include <unordered_map>
 #include <map>
+#include <vector>
+#include <thread>
 #include <gtest/gtest.h>
 #include "json/dom.h"
 #include "json/alloc.h"
@@ -53,6 +55,8 @@ size_t cobsize(ValkeyModuleCtx *) {
 }
 
 extern size_t hash_function(const char *, size_t);
+extern JDocument *create_doc(bool with_arena);
+extern JsonUtilCode parse_into_doc(ValkeyModuleCtx *ctx, const char *json_buf, const size_t buf_len, JDocument *doc);
 
 /* Since unit tests run outside of Valkey server, we need to map Valkey'
  * memory management functions to cstdlib functions. */
@@ -321,6 +325,626 @@ TEST_F(DomTest, testSerialize_CustomFormat) {
     EXPECT_STREQ(oss.GetString(), exp_json);
 }
 
+TEST_F(DomTest, testEstimateSerializedSize) {
+    PrintFormat format;
+    format.newline = "\n";
+    format.indent  = "\t";
+    format.space = "..";
+    for (const char *json : {"[]", "{}", "0", "-9223372036854775808", "18446744073709551615", "1.5e300", "true",
+                             "null", "\"abc\"", "[0,[1,[]],{}]", "{\"a\":{\"b\":[-1,2.25,false]},\"c\":\"\"}"}) {
+        JDocument *doc;
+        JsonUtilCode rc = dom_parse(nullptr, json, strlen(json), &doc);
+        EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+        EXPECT_EQ(dom_estimate_serialized_size(*doc, nullptr), strlen(json));
+
+        rapidjson::StringBuffer oss;
+        dom_serialize(doc, &format, oss);
+        EXPECT_EQ(dom_estimate_serialized_size(*doc, &format), oss.GetLength());
+        dom_free_doc(doc);
+    }
+
+    rapidjson::StringBuffer oss;
+    dom_serialize(doc1, nullptr, oss);
+    EXPECT_EQ(dom_estimate_serialized_size(*doc1, nullptr), oss.GetLength());
+
+    // Escaped characters are not counted
+    JDocument *doc;
+    const char *escaped = "[\"a\\\"b\"]";
+    EXPECT_EQ(dom_parse(nullptr, escaped, strlen(escaped), &doc), JSONUTIL_SUCCESS);
+    EXPECT_EQ(dom_estimate_serialized_size(*doc, nullptr), strlen(escaped) - 1);
+    dom_free_doc(doc);
+}
+
+TEST_F(DomTest, testStringScan) {
+    // The vectorized scan must stop where the scalar one does, at every alignment and run length
+    jsn::string buf(200, 'x');
+    for (char stop : {'"', '\\', '\n', '\x1f', '\0'}) {
+        for (size_t pos = 0; pos < 100; ++pos) {
+            buf[pos] = stop;
+            for (size_t start = 0; start <= pos; ++start) {
+                for (size_t len : {pos - start, pos - start + 1, buf.length() - start}) {
+                    const char *p = buf.data() + start;
+                    EXPECT_EQ(rapidjson::internal::ScanUnescaped(p, p + len),
+                              rapidjson::internal::ScanUnescapedScalar(p, p + len));
+                }
+            }
+            buf[pos] = 'x';
+        }
+    }
+    EXPECT_EQ(rapidjson::internal::ScanUnescaped(buf.data(), buf.data() + buf.length()), buf.length());
+    // Characters >= 0x80 need no escaping
+    jsn::string utf8(100, '\xc3');
+    EXPECT_EQ(rapidjson::internal::ScanUnescaped(utf8.data(), utf8.data() + utf8.length()), utf8.length());
+
+    // Escapes anywhere in long strings round trip through the parser and the writer
+    for (size_t pos = 0; pos < 80; ++pos) {
+        for (const char *escape : {"\\\"", "\\\\", "\\n", "\\u0001"}) {
+            jsn::string json = "[\"" + jsn::string(pos, 'a') + escape + jsn::string(pos, 'b') + escape + "c\"]";
+            JDocument *doc;
+            EXPECT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &doc), JSONUTIL_SUCCESS);
+            rapidjson::StringBuffer oss;
+            dom_serialize(doc, nullptr, oss);
+            EXPECT_STREQ(oss.GetString(), json.c_str());
+            dom_free_doc(doc);
+        }
+    }
+}
+
+TEST_F(DomTest, testSerializedRootCache) {
+    std::string expected = std::string("[") + json2 + "]";
+    EXPECT_EQ(doc2->ext, nullptr);  // Plain documents have no optional state
+    size_t before = jsonstats_get_used_mem();
+    size_t len;
+    const char *json = dom_get_serialized_root(doc2, len);
+    EXPECT_EQ(std::string(json, len), expected);
+    size_t cached = jsonstats_get_used_mem();
+    EXPECT_GT(cached, before);
+
+    // Served from the cache the second time
+    EXPECT_EQ(dom_get_serialized_root(doc2, len), json);
+    EXPECT_EQ(jsonstats_get_used_mem(), cached);
+
+    // Failed writes keep the cache, successful writes release it
+    size_t num_vals_deleted;
+    dom_delete_value(doc2, "$.nonexistent", num_vals_deleted);
+    EXPECT_EQ(num_vals_deleted, 0);
+    EXPECT_NE(doc2->GetSerializedRoot(), nullptr);
+    EXPECT_EQ(dom_set_value(nullptr, doc2, ".age", "28"), JSONUTIL_SUCCESS);
+    EXPECT_EQ(doc2->GetSerializedRoot(), nullptr);
+    EXPECT_EQ(doc2->ext, nullptr);  // Given back along with the cache
+    EXPECT_LT(jsonstats_get_used_mem(), cached);
+
+    json = dom_get_serialized_root(doc2, len);
+    EXPECT_NE(std::string(json, len).find("\"age\":28"), std::string::npos);
+    jsn::vector<size_t> vec;
+    bool is_v2_path;
+    EXPECT_EQ(dom_array_append(nullptr, doc2, "$.children", nullptr, nullptr, 0, vec, is_v2_path),
+              JSONUTIL_SUCCESS);
+    EXPECT_EQ(doc2->GetSerializedRoot(), nullptr);
+
+    // Freeing the document in TearDown also frees the cache
+    dom_get_serialized_root(doc2, len);
+}
+
+// The filter selects the same values with the index of the document as without it
+static void expect_same_filter_results(JDocument *doc, const char *path, size_t expected_count) {
+    Selector indexed, scanned;
+    ASSERT_EQ(indexed.getValues(*doc, path), JSONUTIL_SUCCESS);
+    ASSERT_EQ(scanned.getValues(doc->GetJValue(), path), JSONUTIL_SUCCESS);
+    ASSERT_EQ(indexed.getResultSet().size(), expected_count);
+    ASSERT_EQ(scanned.getResultSet().size(), expected_count);
+    for (size_t i = 0; i < expected_count; ++i) {
+        EXPECT_EQ(indexed.getResultSet()[i].first, scanned.getResultSet()[i].first);
+        EXPECT_EQ(indexed.getPath(indexed.getResultSet()[i]), scanned.getPath(scanned.getResultSet()[i]));
+    }
+}
+
+TEST_F(DomTest, testDocIndex) {
+    const char *json = "{\"orders\":[{\"id\":1,\"v\":\"a\"},{\"id\":2,\"v\":\"b\"},{\"id\":1.0,\"v\":\"c\"},"
+                       "{\"id\":\"1\"},3,{\"v\":\"d\"}],\"other\":{\"id\":1}}";
+    JDocument *doc;
+    int64_t begin_val = jsonstats_begin_track_mem();
+    ASSERT_EQ(dom_parse(nullptr, json, strlen(json), &doc), JSONUTIL_SUCCESS);
+    dom_set_doc_size(doc, jsonstats_end_track_mem(begin_val));
+
+    EXPECT_EQ(dom_index_create(doc, "$.other", "id"), JSONUTIL_JSON_ELEMENT_NOT_ARRAY);
+    EXPECT_EQ(dom_index_create(doc, "$.missing", "id"), JSONUTIL_JSON_PATH_NOT_EXIST);
+
+    // The index memory is charged to the document
+    size_t doc_size = dom_get_doc_size(doc);
+    size_t used_mem = jsonstats_get_used_mem();
+    EXPECT_EQ(dom_index_create(doc, "$.orders", "id"), JSONUTIL_SUCCESS);
+    EXPECT_GT(dom_get_doc_size(doc), doc_size);
+    EXPECT_EQ(dom_get_doc_size(doc) - doc_size, jsonstats_get_used_mem() - used_mem);
+    EXPECT_EQ(dom_index_create(doc, "$.orders", "id"), JSONUTIL_SUCCESS);  // already exists
+
+    jsn::vector<IndexInfo> infos;
+    dom_index_list(doc, infos);
+    ASSERT_EQ(infos.size(), 1);
+    EXPECT_EQ(infos[0].path, "$.orders");
+    EXPECT_EQ(infos[0].member, "id");
+    EXPECT_FALSE(infos[0].stale);
+    EXPECT_EQ(infos[0].distinct_values, 3);  // 1 and 1.0, 2, "1"
+
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 2);
+    expect_same_filter_results(doc, "$.orders[?(@.id==\"1\")]", 1);
+    expect_same_filter_results(doc, "$.orders[?(@.id==7)]", 0);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1 && @.v==\"c\")]", 1);
+
+    // Appending keeps the index fresh
+    const char *vals[] = {"{\"id\":1}", "{\"id\":8}"};
+    size_t lens[] = {strlen(vals[0]), strlen(vals[1])};
+    jsn::vector<size_t> vec;
+    bool is_v2_path;
+    EXPECT_EQ(dom_array_append(nullptr, doc, "$.orders", vals, lens, 2, vec, is_v2_path), JSONUTIL_SUCCESS);
+    dom_index_list(doc, infos);
+    EXPECT_FALSE(infos[0].stale);
+    EXPECT_EQ(infos[0].distinct_values, 4);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 3);
+    expect_same_filter_results(doc, "$.orders[?(@.id==8)]", 1);
+
+    // Other writes make it stale, and the next query rebuilds it
+    EXPECT_EQ(dom_set_value(nullptr, doc, "$.orders[0].id", "8"), JSONUTIL_SUCCESS);
+    dom_index_list(doc, infos);
+    EXPECT_TRUE(infos[0].stale);
+    expect_same_filter_results(doc, "$.orders[?(@.id==8)]", 2);
+    dom_index_list(doc, infos);
+    EXPECT_FALSE(infos[0].stale);
+
+    size_t num_vals_deleted;
+    EXPECT_EQ(dom_delete_value(doc, "$.orders[1]", num_vals_deleted), JSONUTIL_SUCCESS);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 2);
+    EXPECT_EQ(dom_array_insert(nullptr, doc, "$.orders", 0, vals, lens, 1, vec, is_v2_path), JSONUTIL_SUCCESS);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 3);
+    jsn::vector<rapidjson::StringBuffer> popped;
+    EXPECT_EQ(dom_array_pop(doc, "$.orders", 0, popped, is_v2_path), JSONUTIL_SUCCESS);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 2);
+
+    // Replacing the array: the index follows its path
+    EXPECT_EQ(dom_set_value(nullptr, doc, "$.orders", "[{\"id\":1},{\"id\":2},{\"id\":1}]"), JSONUTIL_SUCCESS);
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 2);
+
+    // Copies get the index definitions, to be built on first use
+    JDocument *copy = dom_copy(doc);
+    dom_index_list(copy, infos);
+    ASSERT_EQ(infos.size(), 1);
+    EXPECT_TRUE(infos[0].stale);
+    expect_same_filter_results(copy, "$.orders[?(@.id==2)]", 1);
+    dom_free_doc(copy);
+
+    // Dropping the index credits the document
+    doc_size = dom_get_doc_size(doc);
+    used_mem = jsonstats_get_used_mem();
+    EXPECT_FALSE(dom_index_drop(doc, "$.orders", "v"));
+    EXPECT_TRUE(dom_index_drop(doc, "$.orders", "id"));
+    EXPECT_LT(dom_get_doc_size(doc), doc_size);
+    EXPECT_EQ(doc_size - dom_get_doc_size(doc), used_mem - jsonstats_get_used_mem());
+    dom_index_list(doc, infos);
+    EXPECT_TRUE(infos.empty());
+    expect_same_filter_results(doc, "$.orders[?(@.id==1)]", 2);
+    dom_free_doc(doc);
+}
+
+TEST_F(DomTest, testCopyOnWrite) {
+    // Documents are charged and counted the way the JSON layer does it
+    auto parse = [](const char *json) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        JDocument *d;
+        EXPECT_EQ(dom_parse(nullptr, json, strlen(json), &d), JSONUTIL_SUCCESS);
+        dom_set_doc_size(d, jsonstats_end_track_mem(begin_val));
+        jsonstats_update_stats_on_insert(d, true, 0, dom_get_doc_size(d), dom_get_doc_size(d));
+        return d;
+    };
+    auto copy = [](JDocument *d) {
+        JDocument *c = dom_copy(d);
+        jsonstats_update_stats_on_insert(c, true, 0, dom_get_doc_size(c), dom_get_doc_size(c));
+        return c;
+    };
+    auto release = [](JDocument *d) {
+        jsonstats_update_stats_on_delete(d, true, dom_get_doc_size(d), 0, dom_get_doc_size(d));
+        dom_free_doc(d);
+    };
+    auto serialize = [](JDocument *d) {
+        rapidjson::StringBuffer oss;
+        dom_serialize(d, nullptr, oss);
+        return std::string(oss.GetString());
+    };
+
+    size_t before = jsonstats_get_used_mem();
+    JDocument *doc = parse(json1);
+    size_t doc_size = dom_get_doc_size(doc);
+    JDocument *copy1 = copy(doc);
+    JDocument *copy2 = copy(copy1);
+    auto charged = [&]() { return dom_get_doc_size(doc) + dom_get_doc_size(copy1) + dom_get_doc_size(copy2); };
+
+    // Copies alias the tree of the source, and are charged for what they own
+    EXPECT_TRUE(dom_is_shared(doc));
+    EXPECT_TRUE(dom_is_shared(copy2));
+    EXPECT_EQ(copy2->GetJValue()["address"]["street"].GetString(), doc->GetJValue()["address"]["street"].GetString());
+    EXPECT_EQ(dom_get_doc_size(doc), doc_size);
+    EXPECT_LT(dom_get_doc_size(copy1) + dom_get_doc_size(copy2), doc_size / 4);
+    EXPECT_EQ(charged(), jsonstats_get_used_mem() - before);
+
+    // Writing the source gives it a private tree, and hands the charge of the shared one on
+    jsn::vector<int> vec;
+    bool is_v2_path;
+    EXPECT_EQ(dom_toggle(doc, "$.isAlive", vec, is_v2_path), JSONUTIL_SUCCESS);
+    EXPECT_FALSE(dom_is_shared(doc));
+    EXPECT_TRUE(dom_is_shared(copy1));
+    EXPECT_NE(copy1->GetJValue()["address"]["street"].GetString(), doc->GetJValue()["address"]["street"].GetString());
+    EXPECT_TRUE(copy1->GetJValue()["isAlive"].GetBool());
+    EXPECT_GT(dom_get_doc_size(copy1), doc_size / 2);
+    EXPECT_EQ(charged(), jsonstats_get_used_mem() - before);
+
+    // The last two: one gets a private tree, the other one owns the shared tree
+    EXPECT_EQ(dom_toggle(copy2, "$.isAlive", vec, is_v2_path), JSONUTIL_SUCCESS);
+    EXPECT_FALSE(dom_is_shared(copy1));
+    EXPECT_FALSE(dom_is_shared(copy2));
+    EXPECT_EQ(charged(), jsonstats_get_used_mem() - before);
+
+    EXPECT_EQ(dom_set_value(nullptr, copy1, ".address.city", "\"Boston\"", false, false), JSONUTIL_SUCCESS);
+    EXPECT_EQ(serialize(copy1).find("New York"), std::string::npos);
+    EXPECT_NE(serialize(doc).find("New York"), std::string::npos);
+    EXPECT_EQ(serialize(doc), serialize(copy2));
+    release(copy1);
+    release(copy2);
+    release(doc);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+
+    // Freeing the source leaves the tree, and its charge, to the copy
+    doc = parse(json1);
+    doc_size = dom_get_doc_size(doc);
+    copy1 = copy(doc);
+    std::string json = serialize(doc);
+    release(doc);
+    EXPECT_FALSE(dom_is_shared(copy1));
+    EXPECT_GT(dom_get_doc_size(copy1), doc_size / 2);
+    EXPECT_EQ(dom_get_doc_size(copy1), jsonstats_get_used_mem() - before);
+    EXPECT_EQ(serialize(copy1), json);
+    release(copy1);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+}
+
+TEST_F(DomTest, testPackedNumbers) {
+    // Text as formatting a binary double gives it back
+    std::string vector;
+    for (int i = 1; i <= 16; i++) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        jsonutil_double_to_string(i / 7.0, buf, sizeof(buf));
+        vector += (i == 1 ? "[" : ",") + std::string(buf);
+    }
+    vector += "]";
+    auto parse = [](const std::string &json) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        JDocument *d;
+        EXPECT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &d), JSONUTIL_SUCCESS);
+        dom_set_doc_size(d, jsonstats_end_track_mem(begin_val));
+        return d;
+    };
+    auto serialize = [](JDocument *d) {
+        rapidjson::StringBuffer oss;
+        dom_serialize(d, nullptr, oss);
+        return std::string(oss.GetString());
+    };
+
+    size_t packed = logical_stats.packed_arrays_parsed;
+    JDocument *d1 = parse(vector);
+    EXPECT_EQ(logical_stats.packed_arrays_parsed, packed + 1);
+    for (auto &e : d1->GetJValue().GetArray()) EXPECT_TRUE(e.IsBinaryDouble());
+    EXPECT_EQ(serialize(d1), vector);
+    EXPECT_EQ(d1->GetJValue()[3].GetDouble(), 4 / 7.0);
+
+    // Not all numbers, or a double whose text would change: the array is left alone
+    std::string mixed = vector.substr(0, vector.length() - 1) + ",\"x\"]";
+    std::string text = vector.substr(0, vector.length() - 1) + ",1.2500000000000000]";
+    JDocument *d2 = parse(mixed);
+    JDocument *d3 = parse(text);
+    EXPECT_EQ(logical_stats.packed_arrays_parsed, packed + 1);
+    EXPECT_FALSE(d2->GetJValue()[0].IsBinaryDouble());
+    EXPECT_EQ(serialize(d2), mixed);
+    EXPECT_EQ(serialize(d3), text);
+    EXPECT_LT(dom_get_doc_size(d1) + 16 * 16, dom_get_doc_size(d2));
+
+    // Packed arrays are plain arrays, they take anything
+    const char *vals[] = {"\"x\""};
+    size_t lens[] = {3};
+    jsn::vector<size_t> vec;
+    bool is_v2_path;
+    EXPECT_EQ(dom_array_append(nullptr, d1, ".", vals, lens, 1, vec, is_v2_path), JSONUTIL_SUCCESS);
+    EXPECT_EQ(serialize(d1), mixed);
+    dom_free_doc(d1);
+    dom_free_doc(d2);
+    dom_free_doc(d3);
+}
+
+TEST_F(DomTest, testPackedEmbedding) {
+    // 1536 floats as Python repr prints them, i.e., shortest round trip text, and a few inline ones
+    std::string vector;
+    for (int i = 0; i < 1536; i++) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        double d = (i % 100 == 0) ? i / 1000.0 : std::sin(i) * 0.03;
+        jsonutil_double_to_string_shortest(d, buf, sizeof(buf));
+        vector += (i == 0 ? "[" : ",") + std::string(buf);
+    }
+    vector += "]";
+    std::string mixed = vector.substr(0, vector.length() - 1) + ",\"x\"]";
+    auto parse = [](const std::string &json) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        JDocument *d;
+        EXPECT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &d), JSONUTIL_SUCCESS);
+        dom_set_doc_size(d, jsonstats_end_track_mem(begin_val));
+        return d;
+    };
+
+    size_t packed = logical_stats.packed_arrays_parsed;
+    JDocument *d1 = parse(vector);
+    JDocument *d2 = parse(mixed);
+    EXPECT_EQ(logical_stats.packed_arrays_parsed, packed + 1);
+    EXPECT_TRUE(d1->GetJValue()[1].IsBinaryDouble());
+    EXPECT_FALSE(d1->GetJValue()[100].IsBinaryDouble());
+    rapidjson::StringBuffer oss;
+    dom_serialize(d1, nullptr, oss);
+    EXPECT_EQ(std::string(oss.GetString()), vector);
+    // Every text that isn't inline takes 16 bytes or more of heap
+    EXPECT_LT(dom_get_doc_size(d1) + 1500 * 16, dom_get_doc_size(d2));
+    dom_free_doc(d1);
+    dom_free_doc(d2);
+}
+
+TEST_F(DomTest, testBinaryDoublesKeepTheirFormat) {
+    // %.17g text, whose shortest form is mostly shorter, e.g., 0.51 for 0.51000000000000001
+    std::vector<double> values;
+    std::vector<std::string> texts;
+    for (int i = 1; i <= 16; i++) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        values.push_back(i / 10.0 + 0.01);
+        snprintf(buf, sizeof(buf), "%.17g", values.back());
+        texts.push_back(buf);
+    }
+    auto join = [](const std::vector<std::string> &t) {
+        std::string json;
+        for (const std::string &s : t) json += (json.empty() ? "[" : ",") + s;
+        return json + "]";
+    };
+    std::string vector = join(texts);
+    auto parse = [](const std::string &json) {
+        JDocument *d;
+        EXPECT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &d), JSONUTIL_SUCCESS);
+        return d;
+    };
+    auto serialize = [](JDocument *d) {
+        rapidjson::StringBuffer oss;
+        dom_serialize(d, nullptr, oss);
+        return std::string(oss.GetString());
+    };
+
+    // Packed under either config, printed the same under either config
+    JDocument *d1 = parse(vector);
+    EXPECT_TRUE(d1->GetJValue()[4].IsBinaryDouble());
+    json_set_shortest_doubles_enabled(true);
+    JDocument *d2 = parse(vector);
+    EXPECT_TRUE(d2->GetJValue()[4].IsBinaryDouble());
+    EXPECT_EQ(serialize(d1), vector);
+    EXPECT_EQ(serialize(d2), vector);
+    json_set_shortest_doubles_enabled(false);
+    EXPECT_EQ(serialize(d1), vector);
+    EXPECT_EQ(serialize(d2), vector);
+
+    // The result of arithmetic keeps the format of the config it was computed with
+    jsn::vector<double> res;
+    bool isV2Path;
+    JParser parser;
+    json_set_shortest_doubles_enabled(true);
+    EXPECT_EQ(dom_increment_by(d1, "$[4]", &parser.Parse("0.09", 4).GetJValue(), res, isV2Path), JSONUTIL_SUCCESS);
+    json_set_shortest_doubles_enabled(false);
+    EXPECT_EQ(dom_increment_by(d1, "$[5]", &parser.Parse("0.09", 4).GetJValue(), res, isV2Path), JSONUTIL_SUCCESS);
+    char buf[BUF_SIZE_DOUBLE_JSON];
+    jsonutil_double_to_string_shortest(values[4] + 0.09, buf, sizeof(buf));
+    texts[4] = buf;
+    snprintf(buf, sizeof(buf), "%.17g", values[5] + 0.09);
+    texts[5] = buf;
+    std::string expected = join(texts);
+    EXPECT_EQ(serialize(d1), expected);
+    json_set_shortest_doubles_enabled(true);
+    EXPECT_EQ(serialize(d1), expected);
+    json_set_shortest_doubles_enabled(false);
+    dom_free_doc(d1);
+    dom_free_doc(d2);
+}
+
+TEST_F(DomTest, testParseDetached) {
+    // Parsed on another thread, charged as if parsed in place
+    const char *value = "{\"name\":\"a long enough name\",\"tags\":[\"x\",\"y\",\"z\"],\"n\":1.25}";
+    ParsedValue *parsed = nullptr;
+    JsonUtilCode rc;
+    std::thread([&] { rc = dom_parse_detached(value, strlen(value), &parsed); }).join();
+    ASSERT_EQ(rc, JSONUTIL_SUCCESS);
+
+    auto set = [&](JDocument *d, ParsedValue *p) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        if (p) {
+            EXPECT_EQ(dom_set_parsed_value(nullptr, d, "$.a", p), JSONUTIL_SUCCESS);
+        } else {
+            EXPECT_EQ(dom_set_value(nullptr, d, "$.a", value), JSONUTIL_SUCCESS);
+        }
+        int64_t delta = jsonstats_end_track_mem(begin_val);
+        if (p) delta += dom_get_parsed_value_size(p);
+        return delta;
+    };
+    JDocument *d1, *d2;
+    ASSERT_EQ(dom_parse(nullptr, "{\"a\":[1,2,3]}", 13, &d1), JSONUTIL_SUCCESS);
+    ASSERT_EQ(dom_parse(nullptr, "{\"a\":[1,2,3]}", 13, &d2), JSONUTIL_SUCCESS);
+    EXPECT_EQ(set(d1, parsed), set(d2, nullptr));
+    dom_free_parsed_value(parsed);
+
+    rapidjson::StringBuffer oss1, oss2;
+    dom_serialize(d1, nullptr, oss1);
+    dom_serialize(d2, nullptr, oss2);
+    EXPECT_STREQ(oss1.GetString(), oss2.GetString());
+    dom_free_doc(d1);
+    dom_free_doc(d2);
+
+    // Errors are found by the parse, or when the value is set
+    EXPECT_EQ(dom_parse_detached("{\"a\":", 5, &parsed), JSONUTIL_JSON_PARSE_ERROR);
+    ASSERT_EQ(dom_parse_detached("1", 1, &parsed), JSONUTIL_SUCCESS);
+    ASSERT_EQ(dom_parse(nullptr, "[1]", 3, &d1), JSONUTIL_SUCCESS);
+    EXPECT_EQ(dom_set_parsed_value(nullptr, d1, "$[0]", parsed, true, false), JSONUTIL_NX_XX_CONDITION_NOT_SATISFIED);
+    EXPECT_EQ(dom_parse_from(nullptr, parsed, &d2), JSONUTIL_SUCCESS);
+    rapidjson::StringBuffer oss3;
+    dom_serialize(d2, nullptr, oss3);
+    EXPECT_STREQ(oss3.GetString(), "1");
+    dom_free_parsed_value(parsed);
+    dom_free_doc(d1);
+    dom_free_doc(d2);
+}
+
+TEST_F(DomTest, testCompressDoc) {
+    std::string json = "{\"orders\":[";
+    for (int i = 0; i < 100; i++) {
+        json += (i ? ",{\"id\":" : "{\"id\":") + std::to_string(i) + ",\"status\":\"shipped\",\"total\":" +
+                std::to_string(i) + ".5,\"items\":[\"a\",{\"deep\":[true,null]}]}";
+    }
+    json += "]}";
+    auto parse = [](const std::string &text) {
+        int64_t begin_val = jsonstats_begin_track_mem();
+        JDocument *d;
+        EXPECT_EQ(dom_parse(nullptr, text.c_str(), text.length(), &d), JSONUTIL_SUCCESS);
+        dom_set_doc_size(d, jsonstats_end_track_mem(begin_val));
+        jsonstats_update_stats_on_insert(d, true, 0, dom_get_doc_size(d), dom_get_doc_size(d));
+        return d;
+    };
+    auto release = [](JDocument *d) {
+        jsonstats_update_stats_on_delete(d, true, dom_get_doc_size(d), 0, dom_get_doc_size(d));
+        dom_free_doc(d);
+    };
+    auto serialize = [](JDocument *d) {
+        rapidjson::StringBuffer oss;
+        dom_serialize(d, nullptr, oss);
+        return std::string(oss.GetString());
+    };
+
+    size_t before = jsonstats_get_used_mem();
+    JDocument *doc = parse(json);
+    size_t doc_size = dom_get_doc_size(doc);
+    size_t depth;
+    dom_path_depth(doc, &depth);
+
+    // The document is charged for its encoding, which is all it holds
+    EXPECT_TRUE(dom_compress_doc(doc));
+    EXPECT_TRUE(dom_is_compressed(doc));
+    EXPECT_FALSE(dom_compress_doc(doc));
+    EXPECT_LT(dom_get_doc_size(doc), doc_size / 2);
+    EXPECT_EQ(dom_get_doc_size(doc), jsonstats_get_used_mem() - before);
+    EXPECT_EQ(jsonstats_get_compressed_docs(), 1);
+    size_t compressed_depth;
+    dom_path_depth(doc, &compressed_depth);
+    EXPECT_EQ(compressed_depth, depth);
+    EXPECT_TRUE(dom_is_compressed(doc));
+
+    // Copies are compressed too, inflating gives the tree back
+    JDocument *copy = dom_copy(doc);
+    EXPECT_TRUE(dom_is_compressed(copy));
+    EXPECT_EQ(dom_get_doc_size(copy), dom_get_doc_size(doc));
+    jsonstats_update_stats_on_insert(copy, true, 0, dom_get_doc_size(copy), dom_get_doc_size(copy));
+    EXPECT_EQ(jsonstats_get_compressed_docs(), 2);
+    dom_inflate_doc(doc);
+    EXPECT_FALSE(dom_is_compressed(doc));
+    EXPECT_EQ(serialize(doc), json);
+    EXPECT_EQ(dom_get_doc_size(doc) + dom_get_doc_size(copy), jsonstats_get_used_mem() - before);
+    EXPECT_EQ(jsonstats_get_inflate_count(), 1);
+    release(copy);
+    EXPECT_EQ(jsonstats_get_compressed_docs(), 0);
+
+    // Documents sharing their tree stay as they are
+    copy = dom_copy(doc);
+    jsonstats_update_stats_on_insert(copy, true, 0, dom_get_doc_size(copy), dom_get_doc_size(copy));
+    EXPECT_FALSE(dom_compress_doc(doc));
+    EXPECT_FALSE(dom_compress_doc(copy));
+    release(copy);
+    EXPECT_TRUE(dom_compress_doc(doc));
+    release(doc);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+
+    // Nothing to gain
+    doc = parse("1");
+    EXPECT_FALSE(dom_compress_doc(doc));
+    release(doc);
+}
+
+TEST_F(DomTest, testDocArena) {
+    size_t before = jsonstats_get_used_mem();
+    DocArena *arena = DocArena::create();
+    jsn::vector<void *> chunks;
+    for (size_t size = 1; size <= DocArena::kMaxChunkSize; ++size) {
+        void *p = arena->allocate(size);
+        ASSERT_NE(p, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 8, 0);
+        EXPECT_TRUE(arena->owns(p));
+        memset(p, 0xAB, size);
+        chunks.push_back(p);
+    }
+    EXPECT_EQ(arena->allocate(0), nullptr);
+    EXPECT_EQ(arena->allocate(DocArena::kMaxChunkSize + 1), nullptr);
+    EXPECT_FALSE(arena->owns(&before));
+    EXPECT_GT(arena->getNumBlocks(), 1);
+    EXPECT_LE(arena->getFootprint(), jsonstats_get_used_mem() - before);
+
+    // Freed chunks are reused for the same size
+    arena->free(chunks[99]);
+    EXPECT_EQ(arena->allocate(100), chunks[99]);
+
+    // Growing past the largest chunk moves the data out of the arena
+    void *p = arena->reallocate(chunks[9], 10000);
+    EXPECT_FALSE(arena->owns(p));
+    EXPECT_EQ(static_cast<unsigned char *>(p)[9], 0xAB);
+    dom_free(p);
+    DocArena::destroy(arena);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+
+    // A document in an arena behaves exactly like one that isn't. doc1 goes first, so that the KeyTable holds the
+    // same member names before and after the arena document.
+    auto edit = [](JDocument *d) {
+        size_t num_vals_deleted;
+        EXPECT_EQ(dom_delete_value(d, ".address", num_vals_deleted), JSONUTIL_SUCCESS);
+        EXPECT_EQ(dom_set_value(nullptr, d, ".children", "[\"a long string, not a short one\", 1.25, {\"x\":[]}]",
+                                false, false), JSONUTIL_SUCCESS);
+        jsn::vector<size_t> vec;
+        bool is_v2_path;
+        const char *vals[] = {"1", "\"another long string, not a short one\""};
+        size_t lens[] = {1, strlen(vals[1])};
+        for (int i = 0; i < 50; ++i) {
+            EXPECT_EQ(dom_array_append(nullptr, d, ".children", vals, lens, 2, vec, is_v2_path), JSONUTIL_SUCCESS);
+        }
+        EXPECT_EQ(dom_array_trim(d, ".children", 0, 4, vec, is_v2_path), JSONUTIL_SUCCESS);
+    };
+    edit(doc1);
+    before = jsonstats_get_used_mem();
+    JDocument *doc = create_doc(true);
+    EXPECT_EQ(parse_into_doc(nullptr, json1, strlen(json1), doc), JSONUTIL_SUCCESS);
+    EXPECT_GT(doc->GetArena()->getFootprint(), 0);
+    edit(doc);
+    rapidjson::StringBuffer oss1, oss2;
+    dom_serialize(doc, nullptr, oss1);
+    dom_serialize(doc1, nullptr, oss2);
+    EXPECT_STREQ(oss1.GetString(), oss2.GetString());
+
+    JDocument *copy = dom_copy(doc);
+    EXPECT_NE(copy->GetArena(), nullptr);
+    rapidjson::StringBuffer oss3;
+    dom_serialize(copy, nullptr, oss3);
+    EXPECT_STREQ(oss3.GetString(), oss1.GetString());
+    dom_free_doc(copy);
+    dom_free_doc(doc);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+
+    // Parse errors release the arena too
+    before = jsonstats_get_used_mem();
+    doc = create_doc(true);
+    EXPECT_NE(parse_into_doc(nullptr, "[1,2", 4, doc), JSONUTIL_SUCCESS);
+    dom_free_doc(doc);
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+}
+
 TEST_F(DomTest, testSetString) {
     const char *new_val = "\"Boston\"";
     JsonUtilCode rc = dom_set_value(nullptr, doc1, ".address.city", new_val, false, false);
@@ -369,6 +993,59 @@ TEST_F(DomTest, testSet_NX_XX_ErrorConditions) {
     EXPECT_EQ(rc, JSONUTIL_NX_XX_SHOULD_BE_MUTUALLY_EXCLUSIVE);
 }
 
+TEST_F(DomTest, testPreparedSet) {
+    PreparedSet *first, *second;
+    ASSERT_EQ(dom_prepare_set_value(nullptr, doc1, ".address.city", "\"Boston\"", 8, false, false, &first),
+              JSONUTIL_SUCCESS);
+    ASSERT_EQ(dom_prepare_set_value(nullptr, doc1, "$.nickname", "\"Jack\"", 6, false, false, &second),
+              JSONUTIL_SUCCESS);
+
+    // Nothing changes until a prepared set is committed
+    ReplyBuffer oss;
+    EXPECT_EQ(dom_get_value_as_str(doc1, ".address.city", nullptr, oss, false), JSONUTIL_SUCCESS);
+    EXPECT_STREQ(GetString(&oss), "\"New York\"");
+    dom_commit_set_value(first);
+    Clear(&oss);
+    EXPECT_EQ(dom_get_value_as_str(doc1, ".address.city", nullptr, oss, false), JSONUTIL_SUCCESS);
+    EXPECT_STREQ(GetString(&oss), "\"Boston\"");
+    dom_free_prepared_set(second);
+    Clear(&oss);
+    EXPECT_EQ(dom_get_value_as_str(doc1, ".nickname", nullptr, oss, false), JSONUTIL_JSON_PATH_NOT_EXIST);
+
+    // Errors are those of dom_set_value
+    PreparedSet *failed = nullptr;
+    EXPECT_EQ(dom_prepare_set_value(nullptr, doc1, ".age", "{bad", 4, false, false, &failed),
+              dom_set_value(nullptr, doc1, ".age", "{bad", false, false));
+    EXPECT_EQ(dom_prepare_set_value(nullptr, doc1, ".firstName", "1", 1, true, false, &failed),
+              JSONUTIL_NX_XX_CONDITION_NOT_SATISFIED);
+    EXPECT_EQ(failed, nullptr);
+}
+
+TEST_F(DomTest, testMergePatch) {
+    JDocument *doc;
+    const char *json = "{\"a\":{\"b\":1,\"c\":[1,2],\"d\":{\"e\":true}},\"f\":\"g\"}";
+    ASSERT_EQ(dom_parse(nullptr, json, strlen(json), &doc), JSONUTIL_SUCCESS);
+    const char *c_name = doc->GetJValue()["a"].FindMember("c")->name.GetString();
+
+    const char *patch = "{\"a\":{\"b\":null,\"c\":{\"x\":null},\"d\":{\"h\":{\"i\":null,\"j\":2}}},\"k\":[null]}";
+    EXPECT_EQ(dom_merge_value(nullptr, doc, "$", patch, strlen(patch)), JSONUTIL_SUCCESS);
+    rapidjson::StringBuffer oss;
+    dom_serialize(doc, nullptr, oss);
+    EXPECT_STREQ(oss.GetString(), "{\"a\":{\"c\":{},\"d\":{\"e\":true,\"h\":{\"j\":2}}},\"f\":\"g\",\"k\":[null]}");
+    // Merged members keep their names
+    EXPECT_EQ(doc->GetJValue()["a"].MemberBegin()->name.GetString(), c_name);
+
+    // A null patch removes the values at a path, merging at a path that doesn't exist creates it
+    EXPECT_EQ(dom_merge_value(nullptr, doc, "$.a.d", "null", 4), JSONUTIL_SUCCESS);
+    EXPECT_EQ(dom_merge_value(nullptr, doc, "$.l", "{\"m\":null}", 10), JSONUTIL_SUCCESS);
+    oss.Clear();
+    dom_serialize(doc, nullptr, oss);
+    EXPECT_STREQ(oss.GetString(), "{\"a\":{\"c\":{}},\"f\":\"g\",\"k\":[null],\"l\":{}}");
+
+    EXPECT_EQ(dom_merge_value(nullptr, doc, "$", "{bad", 4), JSONUTIL_JSON_PARSE_ERROR);
+    dom_free_doc(doc);
+}
+
 TEST_F(DomTest, testGet_ErrorConditions) {
     ReplyBuffer oss;
     JsonUtilCode rc = dom_get_value_as_str(doc1, ".bar", nullptr, oss, false);
@@ -420,6 +1097,37 @@ TEST_F(DomTest, testGetNull) {
     EXPECT_STREQ(GetString(&oss), "null");
 }
 
+TEST_F(DomTest, testSelectValues_ReusedSelector) {
+    Selector selector;
+    jsn::vector<JValue*> values;
+    ReplyBuffer oss;
+    for (const char *path : {".address.city", ".age"}) {
+        JsonUtilCode rc = dom_select_values(doc1, path, selector, values);
+        EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+        EXPECT_EQ(values.size(), 1);
+        Clear(&oss);
+        dom_serialize_selected_values(doc1, values, selector.isLegacyJsonPathSyntax(), nullptr, oss, false);
+        ReplyBuffer expected;
+        dom_get_value_as_str(doc1, path, nullptr, expected, false);
+        EXPECT_STREQ(GetString(&oss), GetString(&expected));
+    }
+    EXPECT_EQ(dom_select_values(doc1, ".bar", selector, values), JSONUTIL_JSON_PATH_NOT_EXIST);
+    EXPECT_TRUE(values.empty());
+
+    Selector v2selector;
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(dom_select_values(doc1, "$.phoneNumbers[*].type", v2selector, values), JSONUTIL_SUCCESS);
+        EXPECT_EQ(values.size(), 2);
+        Clear(&oss);
+        dom_serialize_selected_values(doc1, values, v2selector.isLegacyJsonPathSyntax(), nullptr, oss, false);
+        EXPECT_STREQ(GetString(&oss), "[\"home\",\"office\"]");
+    }
+    EXPECT_EQ(dom_select_values(doc1, "$.bar", v2selector, values), JSONUTIL_SUCCESS);
+    Clear(&oss);
+    dom_serialize_selected_values(doc1, values, v2selector.isLegacyJsonPathSyntax(), nullptr, oss, false);
+    EXPECT_STREQ(GetString(&oss), "[]");
+}
+
 TEST_F(DomTest, testGetObject) {
     ReplyBuffer oss;
     JsonUtilCode rc = dom_get_value_as_str(doc1, ".address", nullptr, oss, false);
@@ -460,6 +1168,48 @@ TEST_F(DomTest, testGet_multiPaths) {
     EXPECT_STREQ(GetString(&oss), exp_json);
 }
 
+TEST_F(DomTest, testGet_multiPathsSharedPrefixes) {
+    // v2: every path gets an array, legacy paths included, paths outside of the trie are interleaved in order
+    const char *paths[] = { "$.address.city", "$.address.zipcode", "$.phoneNumbers[*].type",
+                            ".phoneNumbers[*].number", "$..city", "$.phoneNumbers[0:1].type", "$.address.bogus",
+                            ".age.*", "$.address.city", "$.groups" };
+    ReplyBuffer oss;
+    JsonUtilCode rc = dom_get_values_as_str(doc1, paths, 10, nullptr, oss, false);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+    EXPECT_STREQ(GetString(&oss), "{\"$.address.city\":[\"New York\"],\"$.address.zipcode\":[\"10021-3100\"],"
+                 "\"$.phoneNumbers[*].type\":[\"home\",\"office\"],"
+                 "\".phoneNumbers[*].number\":[\"212 555-1234\",\"646 555-4567\"],\"$..city\":[\"New York\"],"
+                 "\"$.phoneNumbers[0:1].type\":[\"home\"],\"$.address.bogus\":[],\".age.*\":[],"
+                 "\"$.address.city\":[\"New York\"],\"$.groups\":[{}]}");
+
+    // Legacy: the first value of every path
+    const char *legacy[] = { ".address.city", "address.state", ".phoneNumbers[1].type", ".phoneNumbers[-1].number" };
+    Clear(&oss);
+    rc = dom_get_values_as_str(doc1, legacy, 4, nullptr, oss, false);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+    EXPECT_STREQ(GetString(&oss), "{\".address.city\":\"New York\",\"address.state\":\"NY\","
+                 "\".phoneNumbers[1].type\":\"office\",\".phoneNumbers[-1].number\":\"646 555-4567\"}");
+
+    // Legacy paths fail with the error of the first path that selects nothing, as on their own
+    const char *missing[] = { ".address.city", ".address.bogus", ".age.foo" };
+    Clear(&oss);
+    EXPECT_EQ(dom_get_values_as_str(doc1, missing, 3, nullptr, oss, false), JSONUTIL_JSON_PATH_NOT_EXIST);
+    const char *not_object[] = { ".address.city", ".age.foo", ".address.bogus" };
+    ReplyBuffer single;
+    JsonUtilCode expected = dom_get_value_as_str(doc1, ".age.foo", nullptr, single, false);
+    EXPECT_NE(expected, JSONUTIL_SUCCESS);
+    Clear(&oss);
+    EXPECT_EQ(dom_get_values_as_str(doc1, not_object, 3, nullptr, oss, false), expected);
+
+    // v2 syntax errors still fail the command
+    const char *bad[] = { "$.address.city", "$[" };
+    Clear(&single);
+    expected = dom_get_value_as_str(doc1, "$[", nullptr, single, false);
+    EXPECT_NE(expected, JSONUTIL_SUCCESS);
+    Clear(&oss);
+    EXPECT_EQ(dom_get_values_as_str(doc1, bad, 2, nullptr, oss, false), expected);
+}
+
 TEST_F(DomTest, testDelete) {
     size_t num_vals_deleted;
     JsonUtilCode rc = dom_delete_value(doc1, ".spouse", num_vals_deleted);
@@ -694,6 +1444,66 @@ TEST_F(DomTest, testNumIncrBy_double_overflow_negative) {
     EXPECT_FALSE(isV2Path);
 }
 
+// Text of a double, whether it's kept as text or in binary
+static std::string double_text(const JValue &v) {
+    char buf[BUF_SIZE_DOUBLE_JSON];
+    rapidjson::SizeType len;
+    const char *str = v.GetDoubleString(buf, len);
+    return std::string(str, len);
+}
+
+TEST_F(DomTest, testNumIncrBy_binaryDouble) {
+    JsonUtilCode rc = dom_set_value(nullptr, doc1, ".foo", "[0.1,2.5,1e300]", false, false);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    jsn::vector<double> res;
+    bool isV2Path;
+    JParser parser;
+    rc = dom_increment_by(doc1, "$.foo[*]", &parser.Parse("0.2", 3).GetJValue(), res, isV2Path);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+    rc = dom_multiply_by(doc1, "$.foo[2]", &parser.Parse("3.3", 3).GetJValue(), res, isV2Path);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    // The results are kept in binary and printed the way their text used to be stored
+    Selector selector;
+    rc = selector.getValues(*doc1, "$.foo");
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+    ASSERT_EQ(selector.getResultSet().size(), 1);
+    const JValue &foo = *selector.getResultSet()[0].first;
+    double expected_values[] = {0.1 + 0.2, 2.5 + 0.2, (1e300 + 0.2) * 3.3};
+    std::string expected = "[";
+    for (size_t i = 0; i < 3; ++i) {
+        char buf[BUF_SIZE_DOUBLE_JSON];
+        size_t len = jsonutil_double_to_string(expected_values[i], buf, sizeof(buf));
+        EXPECT_TRUE(foo[i].IsBinaryDouble());
+        EXPECT_EQ(foo[i].GetDouble(), expected_values[i]);
+        EXPECT_EQ(double_text(foo[i]), std::string(buf, len));
+        if (i > 0) expected += ",";
+        expected.append(buf, len);
+    }
+    expected += "]";
+    EXPECT_EQ(expected, "[0.30000000000000004,2.7000000000000002,3.2999999999999999e+300]");
+
+    rapidjson::StringBuffer oss;
+    dom_serialize_value(foo, nullptr, oss);
+    EXPECT_STREQ(oss.GetString(), expected.c_str());
+    EXPECT_EQ(dom_estimate_serialized_size(foo, nullptr), expected.length());
+    PrintFormat format;
+    format.newline = "\n";
+    format.indent = " ";
+    Clear(&oss);
+    dom_serialize_value(foo, &format, oss);
+    EXPECT_STREQ(oss.GetString(), "[\n 0.30000000000000004,\n 2.7000000000000002,\n 3.2999999999999999e+300\n]");
+
+    // Copies stay binary, filters compare the binary value
+    JValue copy(foo, allocator);
+    EXPECT_TRUE(copy[1].IsBinaryDouble());
+    EXPECT_TRUE(copy == foo);
+    rc = selector.getValues(*doc1, "$.foo[?(@>0.3 && @<3)]");
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+    EXPECT_EQ(selector.getResultSet().size(), 2);
+}
+
 TEST_F(DomTest, testNumIncrBy_string_value) {
     Selector selector;
     const char *new_val = "-1.5e308";
@@ -715,7 +1525,7 @@ TEST_F(DomTest, testNumIncrBy_string_value) {
     EXPECT_EQ(rc, JSONUTIL_SUCCESS);
     EXPECT_EQ(selector.getResultSet().size(), 1);
     // +0 is not a true no-op, because it will re-calculate and reformat a double
-    EXPECT_STREQ(selector.getResultSet()[0].first->GetDoubleString(), "-1.5e+308");
+    EXPECT_EQ(double_text(*selector.getResultSet()[0].first), "-1.5e+308");
 }
 
 TEST_F(DomTest, testNumIncrMultBy_string_value_overflow) {
@@ -738,7 +1548,7 @@ TEST_F(DomTest, testNumIncrMultBy_string_value_overflow) {
     rc = selector.getValues(*doc1, ".foo");
     EXPECT_EQ(rc, JSONUTIL_SUCCESS);
     EXPECT_EQ(selector.getResultSet().size(), 1);
-    EXPECT_STREQ(selector.getResultSet()[0].first->GetDoubleString(), "-1.6999999999999999e+308");
+    EXPECT_EQ(double_text(*selector.getResultSet()[0].first), "-1.6999999999999999e+308");
     //
     // should not overflow
     rc = dom_multiply_by(doc1, ".foo", &parser.Parse("0.5", 3).GetJValue(), res, isV2Path);
@@ -748,7 +1558,7 @@ TEST_F(DomTest, testNumIncrMultBy_string_value_overflow) {
     rc = selector.getValues(*doc1, ".foo");
     EXPECT_EQ(rc, JSONUTIL_SUCCESS);
     EXPECT_EQ(selector.getResultSet().size(), 1);
-    EXPECT_STREQ(selector.getResultSet()[0].first->GetDoubleString(), "-8.4999999999999997e+307");
+    EXPECT_EQ(double_text(*selector.getResultSet()[0].first), "-8.4999999999999997e+307");
 
     // should overflow
     rc = dom_multiply_by(doc1, ".foo", &parser.Parse("1.0e300", 7).GetJValue(), res, isV2Path);
@@ -1370,6 +2180,107 @@ TEST_F(DomTest, testArrInsert_v2path) {
     dom_free_doc(doc);
 }
 
+static JValue makeUintArray(size_t sz, size_t offset = 0) {
+    JValue j;
+    j.SetArray();
+    for (size_t i = 0; i < sz; ++i) {
+        j.PushBack(JValue(i + offset), allocator);
+    }
+    return j;
+}
+
+TEST_F(DomTest, testArrayFrontGap) {
+    size_t before = jsonstats_get_used_mem();
+    {
+        // A queue: pop at the front, push at the back. The front gap is reused, the buffer doesn't keep growing.
+        JValue q = makeUintArray(100);
+        rapidjson::SizeType capacity = q.Capacity();
+        for (size_t i = 100; i < 10000; ++i) {
+            q.Erase(q.Begin());
+            q.PushBack(JValue(i), allocator);
+            ASSERT_EQ(q.Size(), 100u);
+            ASSERT_EQ(q[0].GetUint64(), i - 99);
+            ASSERT_EQ(q[99].GetUint64(), i);
+        }
+        EXPECT_LE(q.Capacity(), 2 * capacity);
+        EXPECT_EQ(q, makeUintArray(100, 9900));
+
+        // Pushing at the front fills the gap left by pops, then opens a new one
+        for (size_t i = 0; i < 50; ++i) q.Erase(q.Begin());
+        for (size_t i = 9949; i >= 9900; --i) q.PushFront(JValue(i), allocator);
+        EXPECT_EQ(q, makeUintArray(100, 9900));
+        for (size_t i = 9899; i >= 9000; --i) q.PushFront(JValue(i), allocator);
+        EXPECT_EQ(q, makeUintArray(1000, 9000));
+
+        // Erasing near the front moves the front, erasing near the back moves the back, the result is the same
+        JValue r = makeUintArray(1000, 9000);
+        q.Erase(q.Begin() + 10, q.Begin() + 20);
+        r.Erase(r.Begin() + 10, r.Begin() + 20);
+        q.Erase(q.End() - 20, q.End() - 10);
+        r.Erase(r.End() - 20, r.End() - 10);
+        EXPECT_EQ(q, r);
+        EXPECT_EQ(JValue(q, allocator), r);
+
+        // Small arrays are just moved
+        JValue small = makeUintArray(3, 1);
+        small.PushFront(JValue(0), allocator);
+        EXPECT_EQ(small, makeUintArray(4));
+        small.Erase(small.Begin());
+        EXPECT_EQ(small, makeUintArray(3, 1));
+    }
+    {
+        // An empty range erases nothing, without a gap and with one
+        JValue a = makeUintArray(40);
+        EXPECT_EQ(a.Erase(a.Begin() + 5, a.Begin() + 5), a.Begin() + 5);
+        EXPECT_EQ(a.Erase(a.Begin(), a.Begin()), a.Begin());
+        EXPECT_EQ(a, makeUintArray(40));
+        a.Erase(a.Begin());
+        a.Erase(a.Begin(), a.Begin());
+        a.Erase(a.End(), a.End());
+        EXPECT_EQ(a, makeUintArray(39, 1));
+    }
+    {
+        // Erasing 4 in front leaves a gap of 3 slots, plus the one holding its size. PushFront uses the gap up
+        // exactly, the next one opens a new gap.
+        JValue a = makeUintArray(40);
+        a.Erase(a.Begin(), a.Begin() + 4);
+        for (size_t i = 3; i >= 1; --i) a.PushFront(JValue(i), allocator);
+        EXPECT_EQ(a, makeUintArray(39, 1));
+        a.PushFront(JValue(0), allocator);
+        EXPECT_EQ(a, makeUintArray(40));
+        a.Erase(a.Begin());
+        EXPECT_EQ(a, makeUintArray(39, 1));
+    }
+    {
+        // PushBack into a full array whose gap is at least half its size moves the elements back to the start of
+        // their buffer rather than growing it
+        JValue a = makeUintArray(40);
+        rapidjson::SizeType capacity = a.Capacity();
+        a.Erase(a.Begin(), a.Begin() + 30);
+        EXPECT_EQ(a.Capacity(), capacity - 30);
+        for (size_t i = 40; a.Size() < a.Capacity(); ++i) a.PushBack(JValue(i), allocator);
+        rapidjson::SizeType size = a.Size();
+        a.PushBack(JValue(static_cast<size_t>(size) + 30), allocator);
+        EXPECT_EQ(a.Capacity(), capacity);
+        EXPECT_EQ(a, makeUintArray(size + 1, 30));
+        a.PushFront(JValue(29), allocator);
+        EXPECT_EQ(a, makeUintArray(size + 2, 29));
+    }
+    {
+        // Reserve keeps the gap: the 7 slots in front are still there to push into, on top of the capacity
+        JValue a = makeUintArray(40);
+        a.Erase(a.Begin(), a.Begin() + 8);
+        a.Reserve(200, allocator);
+        EXPECT_EQ(a.Capacity(), 200u);
+        EXPECT_EQ(a, makeUintArray(32, 8));
+        for (size_t i = 7; i >= 1; --i) a.PushFront(JValue(i), allocator);
+        for (size_t i = 40; i <= 200; ++i) a.PushBack(JValue(i), allocator);
+        EXPECT_EQ(a.Capacity(), 207u);
+        EXPECT_EQ(a, makeUintArray(200, 1));
+    }
+    EXPECT_EQ(jsonstats_get_used_mem(), before);
+}
+
 TEST_F(DomTest, testClear) {
     const char *jsons[] = { "\"John\"", "\"Mary\"", "\"Tom\"" };
     size_t json_lens[] = { 6, 6, 5 };
@@ -2302,3 +3213,158 @@ TEST_F(HTTest, HTIngestTest) {
         EXPECT_EQ(keyTable->getStats().size, 0);
     }
 }
+
+/*
+ * Simulated Valkey defrag: every allocation handed to DefragAlloc is moved, and the time slice is up after every
+ * check, so that dom_defrag has to stop and resume many times.
+ */
+static size_t defrag_moves = 0;
+static unsigned long defrag_cursor = 0;
+
+static void *test_DefragAlloc(ValkeyModuleDefragCtx *, void *ptr) {
+    size_t size = ValkeyModule_MallocSize(ptr);
+    void *new_ptr = ValkeyModule_Alloc(size);
+    memcpy(new_ptr, ptr, size);
+    ValkeyModule_Free(ptr);
+    defrag_moves++;
+    return new_ptr;
+}
+
+static int test_DefragShouldStop(ValkeyModuleDefragCtx *) {
+    return 1;
+}
+
+static int test_DefragCursorSet(ValkeyModuleDefragCtx *, unsigned long cursor) {
+    defrag_cursor = cursor;
+    return VALKEYMODULE_OK;
+}
+
+static int test_DefragCursorGet(ValkeyModuleDefragCtx *, unsigned long *cursor) {
+    *cursor = defrag_cursor;
+    return VALKEYMODULE_OK;
+}
+
+class DomDefragTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        JsonUtilCode rc = jsonstats_init();
+        ASSERT_EQ(rc, JSONUTIL_SUCCESS);
+        setupValkeyModulePointers();
+        // Valkey moves the allocations it's given as they are, which doesn't work with the trap headers
+        ASSERT_TRUE(memory_traps_control(false));
+        KeyTable::Config c;
+        c.malloc = dom_alloc;
+        c.free = dom_free;
+        c.hash = hash_function;
+        c.numShards = 16;
+        keyTable = new KeyTable(c);
+        ValkeyModule_DefragAlloc = test_DefragAlloc;
+        ValkeyModule_DefragShouldStop = test_DefragShouldStop;
+        ValkeyModule_DefragCursorSet = test_DefragCursorSet;
+        ValkeyModule_DefragCursorGet = test_DefragCursorGet;
+        defrag_moves = 0;
+        defrag_cursor = 0;
+    }
+
+    void TearDown() override {
+        delete keyTable;
+        keyTable = nullptr;
+        memory_traps_control(true);
+    }
+};
+
+TEST_F(DomDefragTest, testIncrementalDefrag) {
+    // Long strings, doubles, arrays and objects large enough to be hashtables, at a few levels
+    std::ostringstream os;
+    os << "{\"records\":[";
+    for (int i = 0; i < 1000; ++i) {
+        if (i) os << ",";
+        os << "{\"id\":" << i << ",\"price\":" << i << ".25,\"name\":\"record number " << i
+           << ", a string too long to be stored inline\",\"tags\":[\"first tag of the record\",\"second tag\"]}";
+    }
+    os << "],\"index\":{";
+    for (int i = 0; i < 200; ++i) {
+        if (i) os << ",";
+        os << "\"key" << i << "\":[" << i << ".5,\"value string of key " << i << "\"]";
+    }
+    os << "}}";
+    std::string json = os.str();
+
+    JDocument *doc;
+    ASSERT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &doc), JSONUTIL_SUCCESS);
+    rapidjson::StringBuffer before;
+    dom_serialize(doc, nullptr, before);
+    size_t used_mem = jsonstats_get_used_mem();
+    size_t doc_size = dom_get_doc_size(doc);
+
+    // Every call does a slice of the document and hands back a cursor to resume from
+    size_t calls = 0, bytes_moved_total = 0;
+    bool done = false;
+    while (!done) {
+        size_t bytes_moved;
+        done = dom_defrag(nullptr, &doc, bytes_moved);
+        bytes_moved_total += bytes_moved;
+        calls++;
+        ASSERT_LT(calls, 10000u);
+        if (!done) EXPECT_NE(defrag_cursor, 0u);
+        // The document may change between slices
+        if (calls == 5) {
+            int64_t edit_begin = static_cast<int64_t>(jsonstats_get_used_mem());
+            size_t num_vals_deleted;
+            EXPECT_EQ(dom_set_value(nullptr, doc, ".records[0]", "{\"id\":0}", false, false), JSONUTIL_SUCCESS);
+            EXPECT_EQ(dom_delete_value(doc, ".records[1]", num_vals_deleted), JSONUTIL_SUCCESS);
+            // The saved resume path is charged to used_mem too, so only count the change done by the edits
+            used_mem += static_cast<int64_t>(jsonstats_get_used_mem()) - edit_begin;
+        }
+    }
+    EXPECT_GT(calls, 10u);
+    EXPECT_GT(defrag_moves, 3000u);
+    EXPECT_GT(bytes_moved_total, 0u);
+    EXPECT_EQ(jsonstats_get_used_mem(), used_mem);
+    EXPECT_EQ(dom_get_doc_size(doc), doc_size);
+
+    // Same content, except for the edits
+    rapidjson::StringBuffer after;
+    dom_serialize(doc, nullptr, after);
+    std::string expected = before.GetString();
+    std::string first = "{\"id\":0,\"price\":0.25,\"name\":\"record number 0, a string too long to be stored inline\","
+                        "\"tags\":[\"first tag of the record\",\"second tag\"]},";
+    size_t pos = expected.find(first);
+    ASSERT_NE(pos, std::string::npos);
+    expected.replace(pos, first.length(), "{\"id\":0},");
+    size_t second = expected.find(",{\"id\":2,");
+    expected.erase(expected.find("{\"id\":1,"), second + 1 - expected.find("{\"id\":1,"));
+    EXPECT_EQ(std::string(after.GetString()), expected);
+
+    // A fresh cursor restarts from the top
+    defrag_cursor = 0;
+    size_t moves = defrag_moves;
+    size_t bytes_moved;
+    EXPECT_FALSE(dom_defrag(nullptr, &doc, bytes_moved));
+    EXPECT_GT(defrag_moves, moves);
+    while (!dom_defrag(nullptr, &doc, bytes_moved)) {}
+    dom_free_doc(doc);
+}
+
+TEST_F(DomDefragTest, testDefragArrayFrontGap) {
+    // The buffer of an array with a front gap starts before its first element, it's moved as a whole
+    std::string json = "[";
+    for (int i = 0; i < 100; ++i) json += (i ? "," : "") + std::to_string(i);
+    json += "]";
+    JDocument *doc;
+    ASSERT_EQ(dom_parse(nullptr, json.c_str(), json.length(), &doc), JSONUTIL_SUCCESS);
+    JValue &a = doc->GetJValue();
+    a.Erase(a.Begin(), a.Begin() + 10);
+
+    size_t bytes_moved;
+    while (!dom_defrag(nullptr, &doc, bytes_moved)) {}
+    EXPECT_GT(defrag_moves, 0u);
+
+    // The gap survives the move: it's filled again, then the array is freed from the start of the new buffer
+    JValue &moved = doc->GetJValue();
+    for (int i = 9; i >= 0; --i) moved.PushFront(JValue(i), allocator);
+    rapidjson::StringBuffer oss;
+    dom_serialize(doc, nullptr, oss);
+    EXPECT_EQ(std::string(oss.GetString()), json);
+    dom_free_doc(doc);
+}
@@ -13,6 +13,8 @@
 #include <vector>
 #include <cmath>
 #include <utility>
+#include <algorithm>
+#include <iostream>
 #include <gtest/gtest.h>
 #include "json/dom.h"
 #include "json/alloc.h"
@@ -29,22 +31,31 @@ static size_t hash1(const char *ptr, size_t len) {
 class HashTableTest : public ::testing::Test {
  protected:
     void SetUp() override {
+        original_factors = rapidjson::hashTableFactors;
     }
     size_t original_malloced;
+    rapidjson::HashTableFactors original_factors;
     void TearDown() override {
+        rapidjson::hashTableFactors = original_factors;
+        Cleanup1();
+    }
+    void Cleanup1() {
         if (keyTable) {
             malloced = original_malloced;
             EXPECT_EQ(keyTable->validate(), "");
         }
         delete keyTable;
+        keyTable = nullptr;
     }
-    void Setup1(size_t numShards = 1, size_t htsize = 0, size_t (*h)(const char *, size_t) = hash1) {
+    void Setup1(size_t numShards = 1, size_t htsize = 0, size_t (*h)(const char *, size_t) = hash1,
+                bool inlineShortKeys = false) {
         setupValkeyModulePointers();
         KeyTable::Config c;
         c.malloc = dom_alloc;
         c.free = dom_free;
         c.hash = h;
         c.numShards = numShards;
+        c.inlineShortKeys = inlineShortKeys;
         keyTable = new KeyTable(c);
         rapidjson::hashTableFactors.minHTSize = htsize;
         original_malloced = malloced;
@@ -207,3 +218,90 @@ TEST_F(HashTableTest, DistributionTest) {
     ASSERT_NE(runs.size(), 0u);
     EXPECT_LT(runs.rbegin()->first, 0.0001 * TABLE_SIZE);
 }
+
+//
+// Tables with control bytes must behave exactly like the plain ones, including with long collision
+// chains (hash1 hashes keys by their length) that cross groups and wrap around the end of the table.
+//
+TEST_F(HashTableTest, GroupedLayout) {
+    extern size_t hash_function(const char *, size_t);
+    for (auto h : {hash1, hash_function}) {
+        for (size_t minGrouped : {size_t(0), size_t(16)}) {
+            Setup1(1, 5, h);
+            rapidjson::hashTableFactors.minGroupedHTSize = minGrouped;
+            size_t sz = h == hash1 ? 300 : 3000;
+            {
+                JValue v;
+                v.SetObject();
+                for (size_t i = 0; i < sz; ++i) {
+                    v.AddMember(makeKey(i), JValue(i), allocator);
+                    if (i % 97 == 0) EXPECT_EQ(v.Validate(), "");
+                }
+                EXPECT_EQ(v.Validate(), "");
+                EXPECT_EQ(v.MemberCount(), sz);
+                // Insertion order is kept
+                size_t expected = 0;
+                for (auto m = v.MemberBegin(); m != v.MemberEnd(); ++m) EXPECT_EQ(m->value.GetUint64(), expected++);
+                for (size_t i = 0; i < sz; ++i) EXPECT_EQ(v[makeKey(i)].GetUint64(), i);
+                EXPECT_FALSE(v.HasMember(makeKey(sz)));
+                // Replacing a member doesn't add one
+                v.AddMember(makeKey(0), JValue(0), allocator);
+                EXPECT_EQ(v.MemberCount(), sz);
+                // Remove the odd members in random order, which moves entries around
+                std::vector<size_t> odd;
+                for (size_t i = 1; i < sz; i += 2) odd.push_back(i);
+                std::shuffle(odd.begin(), odd.end(), std::mt19937(sz));
+                for (size_t n = 0; n < odd.size(); ++n) {
+                    EXPECT_TRUE(v.RemoveMember(makeKey(odd[n])));
+                    if (n % 97 == 0) EXPECT_EQ(v.Validate(), "");
+                }
+                EXPECT_EQ(v.Validate(), "");
+                EXPECT_EQ(v.MemberCount(), (sz + 1) / 2);
+                for (size_t i = 0; i < sz; ++i) EXPECT_EQ(v.HasMember(makeKey(i)), i % 2 == 0);
+                expected = 0;
+                for (auto m = v.MemberBegin(); m != v.MemberEnd(); ++m, expected += 2) {
+                    EXPECT_EQ(m->value.GetUint64(), expected);
+                }
+                v.RemoveAllMembers();
+                EXPECT_EQ(v.Validate(), "");
+                v.AddMember(makeKey(1), JValue(1), allocator);
+                EXPECT_EQ(v.Validate(), "");
+                EXPECT_EQ(v[makeKey(1)].GetUint64(), 1u);
+            }
+            EXPECT_EQ(keyTable->getStats().size, 0);
+            EXPECT_EQ(malloced, 0);
+            Cleanup1();
+        }
+    }
+}
+
+//
+// The control bytes must take hash bits the slot index doesn't, or the members of a probe sequence, which
+// tend to share their home slot's bits, share their tags too and lookups compare handles for nothing.
+// Both for keys in the KeyTable and inline keys.
+//
+TEST_F(HashTableTest, GroupedLayoutTags) {
+    extern size_t hash_function(const char *, size_t);
+    enum { NUM_MEMBERS = 64 * 1024 };
+    for (bool inlineKeys : {false, true}) {
+        Setup1(1, 32, hash_function, inlineKeys);
+        rapidjson::hashTableFactors.minGroupedHTSize = 16;
+        {
+            JValue v;
+            v.SetObject();
+            for (size_t i = 0; i < NUM_MEMBERS; ++i) {
+                std::string key = inlineKeys ? std::to_string(i) : "feature:" + std::to_string(i);
+                v.AddMember(JValue(key.c_str(), key.size(), allocator), JValue(i), allocator);
+            }
+            EXPECT_EQ(v.Validate(), "");
+            EXPECT_EQ(v.MemberBegin()->name.IsInline(), inlineKeys);
+            size_t probes, falseMatches;
+            v.getObjectTagMatches(probes, falseMatches);
+            // With independent 7-bit tags, one probe in 128 matches
+            EXPECT_GT(probes, size_t(NUM_MEMBERS / 8));
+            EXPECT_LT(falseMatches, probes / 32) << "probes:" << probes;
+        }
+        EXPECT_EQ(malloced, 0);
+        Cleanup1();
+    }
+}
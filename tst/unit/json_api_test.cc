@@ -0,0 +1,194 @@
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "json/dom.h"
+#include "json/json_api.h"
+#include "json/selector.h"
+
+extern void SetupAllocFuncs(size_t numShards);
+extern void json_path_set_evaluate(const JsonPathSet *set, JDocument *doc, JsonValueCallback callback, void *arg);
+
+class JsonApiTest : public ::testing::Test {
+ protected:
+    const char *profile = "{"
+                            "\"id\":42,"
+                            "\"name\":\"Ada\","
+                            "\"active\":true,"
+                            "\"manager\":null,"
+                            "\"profile\":{"
+                                "\"settings\":{\"theme\":\"dark\",\"volume\":7.5},"
+                                "\"tags\":[\"a\",\"bb\",\"ccc\"],"
+                                "\"scores\":[1,[2,3],4]"
+                            "},"
+                            "\"orders\":[{\"total\":10},{\"total\":25},{\"note\":\"none\"}]"
+                          "}";
+    JDocument *doc;
+
+    void SetUp() override {
+        SetupAllocFuncs(16);
+        JsonUtilCode rc = dom_parse(nullptr, profile, strlen(profile), &doc);
+        ASSERT_EQ(rc, JSONUTIL_SUCCESS);
+    }
+
+    void TearDown() override {
+        dom_free_doc(doc);
+        delete keyTable;
+        keyTable = nullptr;
+    }
+};
+
+struct Selected {
+    int path;
+    JsonValueView view;
+};
+
+static void collect(void *arg, int path_index, const JsonValueView *value) {
+    static_cast<std::vector<Selected> *>(arg)->push_back(Selected{path_index, *value});
+}
+
+static std::vector<Selected> evaluate(JDocument *doc, std::vector<const char *> paths) {
+    std::vector<Selected> selected;
+    JsonPathSet *set = json_path_set_create(paths.data(), static_cast<int>(paths.size()));
+    json_path_set_evaluate(set, doc, collect, &selected);
+    json_path_set_free(set);
+    return selected;
+}
+
+static std::vector<Selected> of_path(const std::vector<Selected> &selected, int path) {
+    std::vector<Selected> result;
+    for (auto &s : selected) {
+        if (s.path == path) result.push_back(s);
+    }
+    return result;
+}
+
+TEST_F(JsonApiTest, testTypedViews) {
+    auto selected = evaluate(doc, {"$.id", ".name", "$.active", "$.manager", "$.profile.settings.volume",
+                                   "$.profile.tags", "$.profile.settings"});
+    ASSERT_EQ(selected.size(), 7);
+    auto id = of_path(selected, 0);
+    ASSERT_EQ(id.size(), 1);
+    EXPECT_EQ(id[0].view.type, JSON_VALUE_NUMBER);
+    EXPECT_EQ(id[0].view.number, 42);
+
+    auto name = of_path(selected, 1);
+    ASSERT_EQ(name.size(), 1);
+    EXPECT_EQ(name[0].view.type, JSON_VALUE_STRING);
+    EXPECT_EQ(std::string(name[0].view.str, name[0].view.len), "Ada");
+    // A view into the document, not a copy
+    EXPECT_EQ(name[0].view.str, doc->GetJValue()["name"].GetString());
+
+    auto active = of_path(selected, 2);
+    ASSERT_EQ(active.size(), 1);
+    EXPECT_EQ(active[0].view.type, JSON_VALUE_BOOLEAN);
+    EXPECT_EQ(active[0].view.boolean, 1);
+
+    auto manager = of_path(selected, 3);
+    ASSERT_EQ(manager.size(), 1);
+    EXPECT_EQ(manager[0].view.type, JSON_VALUE_NULL);
+
+    auto volume = of_path(selected, 4);
+    ASSERT_EQ(volume.size(), 1);
+    EXPECT_EQ(volume[0].view.type, JSON_VALUE_NUMBER);
+    EXPECT_EQ(volume[0].view.number, 7.5);
+
+    auto tags = of_path(selected, 5);
+    ASSERT_EQ(tags.size(), 1);
+    EXPECT_EQ(tags[0].view.type, JSON_VALUE_ARRAY);
+    EXPECT_EQ(tags[0].view.len, 3);
+
+    auto settings = of_path(selected, 6);
+    ASSERT_EQ(settings.size(), 1);
+    EXPECT_EQ(settings[0].view.type, JSON_VALUE_OBJECT);
+    EXPECT_EQ(settings[0].view.len, 2);
+}
+
+TEST_F(JsonApiTest, testArrayIterator) {
+    auto selected = evaluate(doc, {"$.profile.scores"});
+    ASSERT_EQ(selected.size(), 1);
+    JsonArrayIterator it;
+    json_array_iterator_init(&it, &selected[0].view);
+    JsonValueView e;
+    std::vector<double> numbers;
+    size_t nested = 0;
+    while (json_array_iterator_next(&it, &e)) {
+        if (e.type == JSON_VALUE_NUMBER) {
+            numbers.push_back(e.number);
+        } else {
+            ASSERT_EQ(e.type, JSON_VALUE_ARRAY);
+            JsonArrayIterator inner;
+            json_array_iterator_init(&inner, &e);
+            JsonValueView ie;
+            while (json_array_iterator_next(&inner, &ie)) {
+                numbers.push_back(ie.number);
+                nested++;
+            }
+        }
+    }
+    EXPECT_EQ(numbers, std::vector<double>({1, 2, 3, 4}));
+    EXPECT_EQ(nested, 2);
+    EXPECT_EQ(json_array_iterator_next(&it, &e), 0);
+}
+
+TEST_F(JsonApiTest, testMultipleMatches) {
+    // v2 paths select every match, legacy paths the first one, as get_json_value does
+    auto selected = evaluate(doc, {"$.orders[*].total", ".orders[*].total", "$.profile.tags[-1]", "$.orders[5]"});
+    auto v2 = of_path(selected, 0);
+    ASSERT_EQ(v2.size(), 2);
+    EXPECT_EQ(v2[0].view.number, 10);
+    EXPECT_EQ(v2[1].view.number, 25);
+    auto legacy = of_path(selected, 1);
+    ASSERT_EQ(legacy.size(), 1);
+    EXPECT_EQ(legacy[0].view.number, 10);
+    auto last = of_path(selected, 2);
+    ASSERT_EQ(last.size(), 1);
+    EXPECT_EQ(std::string(last[0].view.str, last[0].view.len), "ccc");
+    EXPECT_TRUE(of_path(selected, 3).empty());
+}
+
+TEST_F(JsonApiTest, testPathsOutsideTheTrie) {
+    // Filters, slices and recursive descent are evaluated by a Selector, with the same results
+    const char *paths[] = {"$.orders[?(@.total>15)].total", "$.profile.tags[0:2]", "$..theme", "$.profile.bogus",
+                           "$[", "$.name"};
+    auto selected = evaluate(doc, std::vector<const char *>(std::begin(paths), std::end(paths)));
+    for (int i = 0; i < static_cast<int>(sizeof(paths) / sizeof(paths[0])); i++) {
+        Selector selector;
+        jsn::vector<JValue*> values;
+        auto matches = of_path(selected, i);
+        if (dom_select_values(doc, paths[i], selector, values) != JSONUTIL_SUCCESS) {
+            EXPECT_TRUE(matches.empty()) << paths[i];
+            continue;
+        }
+        ASSERT_EQ(matches.size(), values.size()) << paths[i];
+        for (size_t j = 0; j < values.size(); j++) EXPECT_EQ(matches[j].view.value, values[j]) << paths[i];
+    }
+    EXPECT_EQ(of_path(selected, 0).size(), 1);
+    EXPECT_EQ(of_path(selected, 1).size(), 2);
+    EXPECT_EQ(of_path(selected, 2).size(), 1);
+    EXPECT_TRUE(of_path(selected, 3).empty());
+    EXPECT_TRUE(of_path(selected, 4).empty());
+    EXPECT_EQ(of_path(selected, 5).size(), 1);
+}
+
+TEST_F(JsonApiTest, testSharedPrefixesMatchSelector) {
+    // Paths sharing prefixes, including duplicates, select the same values as separate Selectors do
+    const char *paths[] = {"$.profile.settings.theme", "$.profile.settings.volume", "$.profile.settings",
+                           "$.profile.tags[*]", "$.profile.tags[1]", "$.profile.settings.theme", "$", "$.*",
+                           "$.profile.*.theme", ".profile.settings.theme", "profile.tags[2]", "$.id.bogus"};
+    auto selected = evaluate(doc, std::vector<const char *>(std::begin(paths), std::end(paths)));
+    size_t total = 0;
+    for (int i = 0; i < static_cast<int>(sizeof(paths) / sizeof(paths[0])); i++) {
+        Selector selector;
+        jsn::vector<JValue*> values;
+        auto matches = of_path(selected, i);
+        if (dom_select_values(doc, paths[i], selector, values) != JSONUTIL_SUCCESS) values.clear();
+        ASSERT_EQ(matches.size(), values.size()) << paths[i];
+        for (size_t j = 0; j < values.size(); j++) EXPECT_EQ(matches[j].view.value, values[j]) << paths[i];
+        total += values.size();
+    }
+    EXPECT_EQ(selected.size(), total);
+}
@@ -11,6 +11,11 @@
 #include <limits>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
 #include <gtest/gtest.h>
 #include "json/dom.h"
 #include "json/alloc.h"
@@ -50,6 +55,8 @@ static size_t hash1(const char *ptr, size_t len) {
 }
 
 extern size_t MAX_FAST_TABLE_SIZE;      // in keytable.cc
+extern bool KEY_TABLE_LOCK_FREE;        // in keytable.cc
+extern size_t KEY_TABLE_REHASH_STEP;    // in keytable.cc
 
 class KeyTableTest : public ::testing::Test {
  protected:
@@ -181,6 +188,86 @@ TEST_F(KeyTableTest, testClone) {
     EXPECT_EQ(s.rehashes, 0);
 }
 
+TEST_F(KeyTableTest, testCountedHandle) {
+    std::string e = "Empty";
+    Setup1();
+    KeyTable_Handle h1 = t->makeHandle(e.c_str(), e.length(), false, 3);
+    EXPECT_TRUE(h1);
+    EXPECT_EQ(h1->getRefCount(), 3);
+    KeyTable_Handle h2 = t->makeHandle(e.c_str(), e.length(), false, 2);
+    EXPECT_EQ(h1, h2);
+    EXPECT_EQ(h1->getRefCount(), 5);
+    auto s = t->getStats();
+    EXPECT_EQ(s.size, 1);
+    EXPECT_EQ(s.handles, 5);
+    std::vector<KeyTable_Handle> splits;
+    for (size_t i = 0; i < 3; ++i) splits.push_back(t->splitHandle(h1));
+    EXPECT_EQ(h1->getRefCount(), 5);
+    for (auto& h : splits) t->destroyHandle(h);
+    t->destroyHandle(h1);
+    t->destroyHandle(h2);
+    EXPECT_EQ(t->validate(), "");
+    s = t->getStats();
+    EXPECT_EQ(s.size, 0);
+    EXPECT_EQ(s.handles, 0);
+}
+
+TEST_F(KeyTableTest, InlineShortKeys) {
+    setupValkeyModulePointers();
+    KeyTable::Config c;
+    c.malloc = dom_alloc;
+    c.free = dom_free;
+    c.hash = hash_function;
+    c.numShards = 1;
+    c.inlineShortKeys = true;
+    t = new KeyTable(c);
+    std::vector<KeyTable_Handle> handles;
+    for (std::string k : {"", "a", "id", "price", "a\"b", "1234567", "12345678"}) {
+        handles.push_back(t->makeHandle(k));
+        KeyTable_Handle& h = handles.back();
+        EXPECT_EQ(h.IsInline(), k.length() <= KeyTable_Handle::MAX_INLINE_LENGTH);
+        EXPECT_EQ(h.GetStringView(), k);
+        EXPECT_EQ(h.IsNoescape(), k.find('"') == std::string::npos);
+        EXPECT_LE(h.GetHashcode(), size_t(KeyTable_Handle::MAX_HASHCODE));
+        handles.push_back(t->makeHandle(k));
+        EXPECT_EQ(handles.back(), handles[handles.size() - 2]);
+        EXPECT_EQ(handles.back().GetOriginalHash(), handles[handles.size() - 2].GetOriginalHash());
+        handles.push_back(t->clone(handles.back()));
+        EXPECT_EQ(handles.back().GetIdentity(), handles[handles.size() - 2].GetIdentity());
+    }
+    EXPECT_NE(handles[3], handles[6]);   // "a" and "id"
+    EXPECT_NE(handles[15], handles[18]);  // Inline prefix of a table string
+    EXPECT_FALSE(handles[3].IsUnique());
+    auto s = t->getStats();
+    EXPECT_EQ(s.size, 1);
+    EXPECT_EQ(s.handles, 3);
+    EXPECT_EQ(s.inlineHandles, 18);
+    EXPECT_EQ(t->validate(), "");
+
+    KeyTable_Handle counted = t->makeHandle("id", 2, true, 3);
+    KeyTable_Handle split = t->splitHandle(counted);
+    EXPECT_EQ(split, handles[6]);
+    EXPECT_EQ(t->getStats().inlineHandles, 21);
+    t->destroyHandle(counted);
+    t->destroyHandle(split);
+    KeyTable_Handle last = t->splitHandle(handles[6]);  // The third reference of the counted handle
+    t->destroyHandle(last);
+    for (auto& h : handles) t->destroyHandle(h);
+    s = t->getStats();
+    EXPECT_EQ(s.size, 0);
+    EXPECT_EQ(s.handles, 0);
+    EXPECT_EQ(s.inlineHandles, 0);
+
+    // Counted per thread, handles made on one thread and destroyed on another add up
+    std::vector<KeyTable_Handle> made(1000);
+    std::thread maker([&] { for (auto& h : made) h = t->makeHandle("id", 2); });
+    maker.join();
+    EXPECT_EQ(t->getStats().inlineHandles, made.size());
+    std::thread destroyer([&] { for (auto& h : made) t->destroyHandle(h); });
+    destroyer.join();
+    EXPECT_EQ(t->getStats().inlineHandles, 0);
+}
+
 TEST_F(KeyTableTest, SimpleRehash) {
     Setup1(1);  // 4 element table is the minimum.
     auto f = t->getFactors();
@@ -391,3 +478,152 @@ TEST_F(KeyTableTest, BigShard) {
     EXPECT_EQ(s.handles, 0);
     EXPECT_GT(s.rehashes, TABLE_SIZE_BITS - 3);  // Minimum table size
 }
+
+//
+// Drain the old table a few slots at a time, with lookups, inserts and removals hitting both tables meanwhile
+//
+TEST_F(KeyTableTest, IncrementalRehash) {
+    memory_traps_control(false);
+    size_t savedStep = KEY_TABLE_REHASH_STEP;
+    KEY_TABLE_REHASH_STEP = 8;
+    for (bool lockFree : {false, true}) {
+        KEY_TABLE_LOCK_FREE = lockFree;
+        Setup1(1, hash_function);
+        auto f = t->getFactors();
+        f.grow = 0.5;           // Not a power of 2, old and new tables index differently
+        t->setFactors(f);
+        enum { NUM_KEYS = 20000 };
+        std::vector<KeyTable_Handle> h;
+        size_t inProgress = 0;
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            h.push_back(t->makeHandle(std::to_string(i)));
+            auto s = t->getStats();
+            if (s.rehashInProgress) {
+                inProgress++;
+                if (0 == (inProgress & 0x3F)) {
+                    ASSERT_EQ(t->validate(), "");
+                }
+                // Strings that weren't moved yet are found in the old table
+                KeyTable_Handle dup = t->makeHandle(std::to_string(i / 2));
+                ASSERT_EQ(dup, h[i / 2]);
+                t->destroyHandle(dup);
+            }
+        }
+        EXPECT_GT(inProgress, 0);
+        auto s = t->getStats();
+        EXPECT_EQ(s.size, NUM_KEYS);
+        EXPECT_EQ(s.handles, NUM_KEYS);
+        EXPECT_LE(s.rehashInProgress, 1);
+        EXPECT_GT(s.maxRehashNanos, 0);
+        //
+        // Shrink back down, removing strings from whichever table they're in
+        //
+        f.shrink = 0.3;
+        t->setFactors(f);
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            t->destroyHandle(h[(i * 7919) % NUM_KEYS]);
+            if (0 == (i & 0x3FF)) {
+                ASSERT_EQ(t->validate(), "");
+            }
+        }
+        s = t->getStats();
+        EXPECT_EQ(s.size, 0);
+        EXPECT_EQ(s.handles, 0);
+        EXPECT_EQ(t->validate(), "");
+        delete t;
+        t = nullptr;
+    }
+    KEY_TABLE_LOCK_FREE = true;
+    KEY_TABLE_REHASH_STEP = savedStep;
+}
+
+//
+// Keys that show up in most documents, looked up from several threads at once
+//
+static const char *hotKeys[] = {"id", "type", "name", "value", "created_at", "updated_at", "tags", "items"};
+enum { NUM_HOT_KEYS = sizeof(hotKeys) / sizeof(hotKeys[0]) };
+
+static size_t numTestThreads() {
+    return std::min(std::max(size_t(std::thread::hardware_concurrency()), size_t(2)), size_t(8));
+}
+
+//
+// Lock-free lookups of hot keys racing with inserts, removals to zero and rehashes of the same shards.
+// The table allocates from threads, so use the thread safe malloc rather than dom_alloc.
+//
+TEST_F(KeyTableTest, LockFreeChurn) {
+    setupValkeyModulePointers();
+    ASSERT_TRUE(memory_traps_control(false));   // The strings aren't allocated with traps
+    KeyTable::Config c;
+    c.malloc = malloc;
+    c.free = free;
+    c.hash = hash_function;
+    c.numShards = 2;
+    t = new KeyTable(c);
+    size_t savedStep = KEY_TABLE_REHASH_STEP;
+    KEY_TABLE_REHASH_STEP = 8;                  // Keep rehashes in progress while the threads run
+    std::vector<KeyTable_Handle> pinned;
+    for (const char *k : hotKeys) pinned.push_back(t->makeHandle(k, strlen(k)));
+
+    std::vector<std::thread> threads;
+    for (size_t tid = 0; tid < numTestThreads(); ++tid) {
+        threads.emplace_back([this, tid] {
+            std::vector<KeyTable_Handle> handles;
+            for (size_t round = 0; round < 50; ++round) {
+                for (size_t i = 0; i < 200; ++i) {
+                    std::string k = std::to_string(tid) + ":" + std::to_string(i);
+                    handles.push_back(t->makeHandle(k));
+                    const char *hot = hotKeys[i % NUM_HOT_KEYS];
+                    handles.push_back(t->makeHandle(hot, strlen(hot)));
+                    handles.push_back(t->clone(handles.back()));
+                    EXPECT_EQ(handles.back().GetStringView(), hot);
+                }
+                for (auto& h : handles) t->destroyHandle(h);
+                handles.clear();
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    EXPECT_EQ(t->validate(), "");
+    auto s = t->getStats();
+    EXPECT_EQ(s.size, size_t(NUM_HOT_KEYS));
+    EXPECT_EQ(s.handles, size_t(NUM_HOT_KEYS));
+    EXPECT_GT(s.rehashes, 0);
+    for (auto& h : pinned) t->destroyHandle(h);
+    KEY_TABLE_REHASH_STEP = savedStep;
+}
+
+//
+// Throughput of makeHandle/destroyHandle pairs on hot keys from several threads, with and without the lock-free
+// path. Not a pass/fail test, the numbers are printed for comparison.
+//
+TEST_F(KeyTableTest, LockContention) {
+    Setup1(4, hash_function);
+    enum { ITERATIONS = 200000 };
+    std::vector<KeyTable_Handle> pinned;
+    for (const char *k : hotKeys) pinned.push_back(t->makeHandle(k, strlen(k)));
+    size_t numThreads = numTestThreads();
+    for (bool lockFree : {false, true}) {
+        KEY_TABLE_LOCK_FREE = lockFree;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t tid = 0; tid < numThreads; ++tid) {
+            threads.emplace_back([this, tid] {
+                for (size_t i = 0; i < ITERATIONS; ++i) {
+                    const char *k = hotKeys[(i + tid) % NUM_HOT_KEYS];
+                    KeyTable_Handle h = t->makeHandle(k, strlen(k));
+                    t->destroyHandle(h);
+                }
+            });
+        }
+        for (auto& th : threads) th.join();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (lockFree ? "lock-free" : "locked") << " " << numThreads << " threads: "
+                  << numThreads * ITERATIONS / us << " Mops/s" << std::endl;
+        auto s = t->getStats();
+        EXPECT_EQ(s.handles, size_t(NUM_HOT_KEYS));
+        EXPECT_EQ(s.size, size_t(NUM_HOT_KEYS));
+    }
+    KEY_TABLE_LOCK_FREE = true;
+    for (auto& h : pinned) t->destroyHandle(h);
+}
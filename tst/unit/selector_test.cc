@@ -116,6 +116,8 @@ class SelectorTest : public ::testing::Test {
     }
 
     void TearDown() override {
+        delete pathCache;
+        pathCache = nullptr;
         delete keyTable;
         keyTable = nullptr;
     }
@@ -1342,3 +1344,262 @@ TEST_F(SelectorTest, test_delete_insert) {
 
     dom_free_doc(d1);
 }
+
+TEST_F(SelectorTest, test_compilePath) {
+    auto cp = CompiledPath::compile("$.store.books[0]['title']");
+    EXPECT_TRUE(cp->compiled);
+    EXPECT_TRUE(cp->isV2Path);
+    ASSERT_EQ(cp->steps.size(), 4);
+    EXPECT_EQ(cp->steps[0].type, CompiledPath::Step::MEMBER);
+    EXPECT_EQ(cp->steps[0].names[0], "store");
+    EXPECT_EQ(cp->steps[1].type, CompiledPath::Step::MEMBER);
+    EXPECT_EQ(cp->steps[1].names[0], "books");
+    EXPECT_EQ(cp->steps[2].type, CompiledPath::Step::INDEX);
+    EXPECT_EQ(cp->steps[2].indexes[0], 0);
+    EXPECT_EQ(cp->steps[3].type, CompiledPath::Step::MEMBER);
+    EXPECT_EQ(cp->steps[3].names[0], "title");
+
+    cp = CompiledPath::compile(".a[*][1:3]['x',\"y\"][0,-1].*");
+    EXPECT_TRUE(cp->compiled);
+    EXPECT_FALSE(cp->isV2Path);
+    ASSERT_EQ(cp->steps.size(), 6);
+    EXPECT_EQ(cp->steps[0].type, CompiledPath::Step::MEMBER);
+    EXPECT_EQ(cp->steps[1].type, CompiledPath::Step::WILDCARD);
+    EXPECT_EQ(cp->steps[2].type, CompiledPath::Step::SLICE);
+    EXPECT_EQ(cp->steps[2].start, 1);
+    EXPECT_TRUE(cp->steps[2].hasEnd);
+    EXPECT_EQ(cp->steps[2].end, 3);
+    EXPECT_EQ(cp->steps[2].step, 1);
+    EXPECT_EQ(cp->steps[3].type, CompiledPath::Step::UNION_OF_MEMBERS);
+    EXPECT_EQ(cp->steps[3].names.size(), 2);
+    EXPECT_EQ(cp->steps[3].names[1], "y");
+    EXPECT_EQ(cp->steps[4].type, CompiledPath::Step::UNION_OF_INDEXES);
+    EXPECT_EQ(cp->steps[4].indexes.size(), 2);
+    EXPECT_EQ(cp->steps[4].indexes[1], -1);
+    EXPECT_EQ(cp->steps[5].type, CompiledPath::Step::WILDCARD);
+
+    cp = CompiledPath::compile("$[::-2]");
+    EXPECT_TRUE(cp->compiled);
+    ASSERT_EQ(cp->steps.size(), 1);
+    EXPECT_EQ(cp->steps[0].type, CompiledPath::Step::SLICE);
+    EXPECT_EQ(cp->steps[0].start, 0);
+    EXPECT_FALSE(cp->steps[0].hasEnd);
+    EXPECT_EQ(cp->steps[0].step, -2);
+
+    for (auto path : {"", ".", "$"}) {
+        cp = CompiledPath::compile(path);
+        EXPECT_TRUE(cp->compiled) << path;
+        EXPECT_TRUE(cp->steps.empty()) << path;
+    }
+
+    // Left to the interpreter
+    for (auto path : {"$..a", "..a", "$.a[?(@.b>1)]", "$.*[?(@.b)]", "$.a[ 0 ]", "$['a\\'b']", "$[\"a\\u0041\"]",
+                      "$.a[1:2:0]", "$.", "$.a.", "$.a b", "$.a[", "$.a['b'", "$.a[1,]", "$.a[99999999999999999999]",
+                      "$a[0]b", "$.*a", "$.a.[0]"}) {
+        EXPECT_FALSE(CompiledPath::compile(path)->compiled) << path;
+    }
+}
+
+TEST_F(SelectorTest, test_compiledPathMatchesInterpreter) {
+    JDocument *d1;
+    JsonUtilCode rc = dom_parse(nullptr, store, strlen(store), &d1);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    // Whitespace in brackets isn't compiled, so the second path of each pair goes through the interpreter
+    const char *paths[][2] = {
+        {"$", "$"},
+        {"$.store.books[1].movies[0].title", "$.store.books[ 1 ].movies[ 0 ].title"},
+        {"$.store.books[-1].author", "$.store.books[ -1 ].author"},
+        {"$.store.books[*].price", "$.store.books[ * ].price"},
+        {"$.store.books[1:3].author", "$.store.books[ 1:3 ].author"},
+        {"$.store.books[-1:0:-1].title", "$.store.books[ -1:0:-1 ].title"},
+        {"$.store.books[::2].title", "$.store.books[ ::2 ].title"},
+        {"$.store.books[0,-1,7].title", "$.store.books[ 0, -1, 7 ].title"},
+        {"$.store['bicycle','books']", "$.store[ 'bicycle' , 'books' ]"},
+        {"$.*.bicycle.color", "$[ * ].bicycle.color"},
+        {"$.store.bicycle.*", "$.store.bicycle[ * ]"},
+        {"$.store.*.*.title", "$.store[ * ][ * ].title"},
+        {"$.budget.*", "$.budget[ * ]"},
+        {"$.store.books[0][0]", "$.store.books[ 0 ][ 0 ]"},
+        {"$.store.books[9]", "$.store.books[ 9 ]"},
+        {"$.store.books.title", "$.store[ 'books' ].title"},
+        {"$.nosuch.a", "$[ 'nosuch' ].a"},
+        {".store.bicycle", ".store[ 'bicycle' ]"},
+        {"store.books[2].isbn", "store.books[ 2 ].isbn"},
+        {".budget.*", ".budget[ * ]"},
+    };
+    for (auto &pair : paths) {
+        if (strcmp(pair[0], pair[1])) {
+            EXPECT_TRUE(CompiledPath::compile(pair[0])->compiled) << pair[0];
+            EXPECT_FALSE(CompiledPath::compile(pair[1])->compiled) << pair[1];
+        }
+        Selector compiled;
+        Selector interpreted;
+        EXPECT_EQ(compiled.getValues(*d1, pair[0]), interpreted.getValues(*d1, pair[1])) << pair[0];
+        EXPECT_EQ(compiled.isLegacyJsonPathSyntax(), interpreted.isLegacyJsonPathSyntax()) << pair[0];
+        EXPECT_TRUE(compiled.getResultSet() == interpreted.getResultSet()) << pair[0];
+    }
+
+    // Insert is only allowed at the last member
+    const char *writes[][2] = {
+        {"$.store.bicycle.gears", "$.store.bicycle[ 'gears' ]"},
+        {"$.store.nosuch.gears", "$.store[ 'nosuch' ].gears"},
+        {"$.store.books[*].isbn", "$.store.books[ * ].isbn"},
+    };
+    for (auto &pair : writes) {
+        Selector compiled;
+        Selector interpreted;
+        EXPECT_EQ(compiled.prepareSetValues(*d1, pair[0]), interpreted.prepareSetValues(*d1, pair[1])) << pair[0];
+        EXPECT_TRUE(compiled.getResultSet() == interpreted.getResultSet()) << pair[0];
+        EXPECT_EQ(compiled.hasInserts(), interpreted.hasInserts()) << pair[0];
+        EXPECT_EQ(compiled.getMaxPathDepth(), interpreted.getMaxPathDepth()) << pair[0];
+    }
+
+    dom_free_doc(d1);
+}
+
+TEST_F(SelectorTest, test_pathCache) {
+    const char *input = "{\"a\":1,\"b\":2,\"c\":3}";
+    JDocument *d1;
+    JsonUtilCode rc = dom_parse(nullptr, input, strlen(input), &d1);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    pathCache = new PathCache(2);
+    auto get = [&](const char *path) {
+        Selector selector;
+        EXPECT_EQ(selector.getValues(*d1, path), JSONUTIL_SUCCESS);
+        return selector.getResultSet().size();
+    };
+
+    EXPECT_EQ(get("$.a"), 1);
+    EXPECT_EQ(get("$.a"), 1);
+    auto s = pathCache->getStats();
+    EXPECT_EQ(s.entries, 1);
+    EXPECT_EQ(s.hits, 1);
+    EXPECT_EQ(s.misses, 1);
+
+    // "$.a" is the least recently used one
+    EXPECT_EQ(get("$.b"), 1);
+    EXPECT_EQ(get("$.c"), 1);
+    s = pathCache->getStats();
+    EXPECT_EQ(s.entries, 2);
+    EXPECT_EQ(s.misses, 3);
+    EXPECT_EQ(s.evictions, 1);
+    EXPECT_EQ(get("$.b"), 1);
+    EXPECT_EQ(get("$.a"), 1);
+    s = pathCache->getStats();
+    EXPECT_EQ(s.hits, 2);
+    EXPECT_EQ(s.misses, 4);
+    EXPECT_EQ(s.evictions, 2);
+
+    // Paths that don't compile are cached as well
+    EXPECT_EQ(get("$..c"), 1);
+    EXPECT_EQ(get("$..c"), 1);
+    s = pathCache->getStats();
+    EXPECT_EQ(s.hits, 3);
+    EXPECT_EQ(s.misses, 5);
+
+    pathCache->setCapacity(1);
+    EXPECT_EQ(pathCache->getStats().entries, 1);
+    pathCache->setCapacity(0);
+    EXPECT_EQ(get("$.a"), 1);
+    s = pathCache->getStats();
+    EXPECT_EQ(s.entries, 0);
+    EXPECT_EQ(s.hits, 3);
+    EXPECT_EQ(s.misses, 5);
+
+    delete pathCache;
+    pathCache = nullptr;
+    dom_free_doc(d1);
+}
+
+TEST_F(SelectorTest, test_resultPaths) {
+    JDocument *d1;
+    JsonUtilCode rc = dom_parse(nullptr, store, strlen(store), &d1);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    auto paths = [&](const char *path) {
+        Selector selector;
+        EXPECT_EQ(selector.getValues(*d1, path), JSONUTIL_SUCCESS);
+        std::vector<std::string> result;
+        for (auto &vInfo : selector.getResultSet()) result.push_back(std::string(selector.getPath(vInfo)));
+        return result;
+    };
+    EXPECT_EQ(paths("$"), std::vector<std::string>({""}));
+    EXPECT_EQ(paths(".store.bicycle.color"), std::vector<std::string>({"/store/bicycle/color"}));
+    EXPECT_EQ(paths("$..price"), std::vector<std::string>({"/store/books/0/price", "/store/books/1/price",
+                                                           "/store/books/2/price", "/store/books/3/price",
+                                                           "/store/bicycle/price"}));
+    EXPECT_EQ(paths("$.store.books[*].movies[0].realisator.last_name"),
+              std::vector<std::string>({"/store/books/1/movies/0/realisator/last_name"}));
+    EXPECT_EQ(paths("$.store.bicycle['color','price']"),
+              std::vector<std::string>({"/store/bicycle/color", "/store/bicycle/price"}));
+    EXPECT_EQ(paths("$.store.books[-1:]"), std::vector<std::string>({"/store/books/3"}));
+    EXPECT_EQ(paths("$.store.books[?(@.price<9)].title"), std::vector<std::string>({"/store/books/0/title"}));
+
+    // Paths of write operations go through the same steps
+    size_t numValsDeleted;
+    Selector selector;
+    EXPECT_EQ(selector.deleteValues(*d1, "$..isbn", numValsDeleted), JSONUTIL_SUCCESS);
+    EXPECT_EQ(numValsDeleted, 2);
+    EXPECT_TRUE(paths("$..isbn").empty());
+
+    dom_free_doc(d1);
+}
+
+TEST_F(SelectorTest, test_effectRecorder) {
+    JDocument *d1;
+    const char *json = "{\"a\":{\"x\":1,\"y\":[1,2,3]},\"we\\\"ird\\\\\":{\"0\":true}}";
+    JsonUtilCode rc = dom_parse(nullptr, json, strlen(json), &d1);
+    EXPECT_EQ(rc, JSONUTIL_SUCCESS);
+
+    EXPECT_TRUE(Selector::isDefinitePath("$"));
+    EXPECT_TRUE(Selector::isDefinitePath(".a.x"));
+    EXPECT_TRUE(Selector::isDefinitePath("$.a.y[-1]"));
+    EXPECT_FALSE(Selector::isDefinitePath("$..x"));
+    EXPECT_FALSE(Selector::isDefinitePath("$.a.*"));
+    EXPECT_FALSE(Selector::isDefinitePath("$.a.y[0:2]"));
+    EXPECT_FALSE(Selector::isDefinitePath("$.a.y[?(@>1)]"));
+
+    // Pointers are spelled as JSONPaths that select the same value
+    jsn::string path;
+    JValue *v = Selector::resolvePointer(*d1, "/a/y/1", path);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->GetInt(), 2);
+    EXPECT_STREQ(path.c_str(), "$[\"a\"][\"y\"][1]");
+    v = Selector::resolvePointer(*d1, "/we\"ird\\/0", path);
+    ASSERT_NE(v, nullptr);
+    EXPECT_STREQ(path.c_str(), "$[\"we\\u0022ird\\u005c\"][\"0\"]");
+    Selector selector;
+    EXPECT_EQ(selector.getValues(*d1, path.c_str()), JSONUTIL_SUCCESS);
+    ASSERT_EQ(selector.getResultSet().size(), 1);
+    EXPECT_EQ(selector.getResultSet()[0].first, v);
+    EXPECT_EQ(Selector::resolvePointer(*d1, "/a/nope", path), nullptr);
+    EXPECT_EQ(Selector::resolvePointer(*d1, "/a/y/3", path), nullptr);
+
+    {
+        JsonEffectRecorder recorder;
+        EXPECT_EQ(JsonEffectRecorder::current(), &recorder);
+        Selector s1;
+        EXPECT_EQ(s1.getValues(*d1, "$.a.y[*]"), JSONUTIL_SUCCESS);
+        EXPECT_EQ(recorder.updated, std::vector<std::string>({"/a/y/0", "/a/y/1", "/a/y/2"}));
+        {
+            // Nested recorders record nothing
+            JsonEffectRecorder inner;
+            Selector s2;
+            EXPECT_EQ(s2.prepareSetValues(*d1, "$.a.z"), JSONUTIL_SUCCESS);
+            EXPECT_TRUE(inner.updated.empty());
+        }
+        EXPECT_EQ(recorder.updated.back(), "/a/z");
+
+        // Deletes are recorded in the order they are applied
+        size_t numValsDeleted;
+        Selector s3;
+        EXPECT_EQ(s3.deleteValues(*d1, "$.a.y[0,2]", numValsDeleted), JSONUTIL_SUCCESS);
+        EXPECT_EQ(numValsDeleted, 2);
+        EXPECT_EQ(recorder.deleted, std::vector<std::string>({"$[\"a\"][\"y\"][2]", "$[\"a\"][\"y\"][0]"}));
+    }
+    EXPECT_EQ(JsonEffectRecorder::current(), nullptr);
+
+    dom_free_doc(d1);
+}
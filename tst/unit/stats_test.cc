@@ -1,3 +1,5 @@
+#include <cstdlib>
+#include <cstdint>
 #include <gtest/gtest.h>
 #include "json/stats.h"
 
@@ -30,3 +32,56 @@ TEST_F(StatsTest, testFindBucket) {
     EXPECT_EQ(jsonstats_find_bucket(90000000), 10);
     EXPECT_EQ(jsonstats_find_bucket(1024*1024*1024), 10);
 }
+
+TEST_F(StatsTest, testFindLatencyBucket) {
+    EXPECT_EQ(jsonstats_find_latency_bucket(0), 0);
+    EXPECT_EQ(jsonstats_find_latency_bucket(999), 0);
+    EXPECT_EQ(jsonstats_find_latency_bucket(1000), 1);
+    EXPECT_EQ(jsonstats_find_latency_bucket(1999), 1);
+    EXPECT_EQ(jsonstats_find_latency_bucket(2000), 2);
+    EXPECT_EQ(jsonstats_find_latency_bucket(3999), 2);
+    EXPECT_EQ(jsonstats_find_latency_bucket(4000), 3);
+    EXPECT_EQ(jsonstats_find_latency_bucket(8191999), 13);
+    EXPECT_EQ(jsonstats_find_latency_bucket(8192000), 14);
+    EXPECT_EQ(jsonstats_find_latency_bucket(16384000), 15);
+    EXPECT_EQ(jsonstats_find_latency_bucket(UINT64_MAX), 15);
+}
+
+// Number of durations in a latency histogram
+static unsigned long long latency_count(JsonStatsCommand cmd, JsonStatsPhase phase) {
+    char buf[512];
+    jsonstats_sprint_latency_hist(cmd, phase, buf, sizeof(buf));
+    unsigned long long count = 0;
+    for (char *p = buf + 1; *p != '\0'; p++) count += strtoull(p, &p, 10);
+    return count;
+}
+
+TEST_F(StatsTest, testCommandTimer) {
+    jsonstats_reset_command_stats();
+    {
+        JsonCommandTimer timer(JSONSTATS_CMD_GET);
+        {
+            JsonPhaseTimer phase(JSONSTATS_PHASE_TRAVERSAL);
+            // A nested command, e.g., a command run by a script, is part of the outer one
+            JsonCommandTimer nested(JSONSTATS_CMD_TYPE);
+            JsonPhaseTimer inner(JSONSTATS_PHASE_SERIALIZATION);
+        }
+    }
+    // Phase timers outside of a command count nothing
+    { JsonPhaseTimer phase(JSONSTATS_PHASE_REPLY); }
+
+    EXPECT_EQ(jsonstats_get_command_calls(JSONSTATS_CMD_GET), 1);
+    EXPECT_EQ(jsonstats_get_command_calls(JSONSTATS_CMD_TYPE), 0);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_NUM_PHASES), 1);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_TRAVERSAL), 1);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_SERIALIZATION), 1);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_OTHER), 1);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_PATH_PARSE), 0);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_INPUT_PARSE), 0);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_PHASE_REPLY), 0);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_TYPE, JSONSTATS_NUM_PHASES), 0);
+
+    jsonstats_reset_command_stats();
+    EXPECT_EQ(jsonstats_get_command_calls(JSONSTATS_CMD_GET), 0);
+    EXPECT_EQ(latency_count(JSONSTATS_CMD_GET, JSONSTATS_NUM_PHASES), 0);
+}
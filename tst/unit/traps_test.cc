@@ -152,6 +152,50 @@ TEST_F(TrapsTest, handle_corruption) {
     }
 }
 
+//
+// Test the attribution of allocations by the allocation profile
+//
+TEST_F(TrapsTest, memory_profile) {
+    memory_profile_reset();
+    memory_profile_control(true);
+    JValue *v = new JValue;
+    makeValue(v, JT_OBJECT_HT);
+    JValue *s = new JValue;
+    makeValue(s, JT_LONG_STRING);
+    memoryProfile_t nodes, strings, hashtables;
+    memory_profile_get_category(MEMORY_CATEGORY_NODES, &nodes);
+    memory_profile_get_category(MEMORY_CATEGORY_STRINGS, &strings);
+    memory_profile_get_category(MEMORY_CATEGORY_HASHTABLES, &hashtables);
+    EXPECT_GT(nodes.allocations, 0);
+    EXPECT_GT(strings.allocations, 0);
+    EXPECT_GT(hashtables.allocations, 0);
+    EXPECT_GE(hashtables.bytes, 1000 * sizeof(JValue));
+    EXPECT_LT(strings.overhead_bytes, strings.bytes);
+    size_t allocations, bytes;
+    memory_profile_get_command(JSONSTATS_NUM_COMMANDS, &allocations, &bytes);
+    EXPECT_GE(allocations, nodes.allocations + strings.allocations + hashtables.allocations);
+    EXPECT_GE(bytes, nodes.bytes + strings.bytes + hashtables.bytes);
+
+    delete s;
+    delete v;
+    memory_profile_get_category(MEMORY_CATEGORY_STRINGS, &strings);
+    memory_profile_get_category(MEMORY_CATEGORY_HASHTABLES, &hashtables);
+    EXPECT_GT(strings.frees, 0);
+    EXPECT_GT(hashtables.frees, 0);
+
+    // Nothing is counted while the profile is off
+    memory_profile_control(false);
+    memory_profile_get_category(MEMORY_CATEGORY_NODES, &nodes);
+    dom_free(dom_alloc(100));
+    memoryProfile_t after;
+    memory_profile_get_category(MEMORY_CATEGORY_NODES, &after);
+    EXPECT_EQ(after.allocations, nodes.allocations);
+    EXPECT_EQ(after.frees, nodes.frees);
+    memory_profile_reset();
+    memory_profile_get_category(MEMORY_CATEGORY_NODES, &after);
+    EXPECT_EQ(after.allocations, 0);
+}
+
 //
 // Test out the JValue validate and dump functions
 //
@@ -2,6 +2,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <utility>
 #include <gtest/gtest.h>
 #include "json/util.h"
 #include "json/dom.h"
@@ -41,6 +42,39 @@ TEST_F(UtilTest, testDoubleToString) {
     EXPECT_EQ(len, strlen(buf));
 }
 
+TEST_F(UtilTest, testDoubleToStringShortest) {
+    char buf[BUF_SIZE_DOUBLE_JSON];
+    std::pair<double, const char *> cases[] = {
+        {189.31, "189.31"}, {0.1, "0.1"}, {0.05 * 2, "0.1"}, {0.1 + 0.2, "0.30000000000000004"}, {-2.5, "-2.5"},
+        {3, "3"}, {0, "0"}, {200000, "200000"}, {1e16, "10000000000000000"}, {1e17, "1e+17"}, {1e21, "1e+21"},
+        {0.0001234, "0.0001234"}, {1.234e-5, "1.234e-05"}, {1.7976931348623157e308, "1.7976931348623157e+308"},
+        {5e-324, "5e-324"},
+    };
+    for (auto &c : cases) {
+        size_t len = jsonutil_double_to_string_shortest(c.first, buf, sizeof(buf));
+        EXPECT_STREQ(buf, c.second);
+        EXPECT_EQ(len, strlen(buf));
+    }
+    // Never longer than %.17g, and reads back as the same double
+    for (int i = 1; i < 10000; i++) {
+        double v = i / 7.0 * (i % 2 ? 1e-5 : 1e5);
+        size_t len = jsonutil_double_to_string_shortest(v, buf, sizeof(buf));
+        EXPECT_EQ(strtod(buf, nullptr), v) << buf;
+        char legacy[BUF_SIZE_DOUBLE_JSON];
+        EXPECT_LE(len, jsonutil_double_to_string(v, legacy, sizeof(legacy))) << buf << " " << legacy;
+    }
+}
+
+TEST_F(UtilTest, testStringToDouble) {
+    const char *cases[] = {"189.31", "0", "-0.0", "0.10000000000000001", "1e+21", "-1.5E-7", "123456789012345678901234",
+                           "2.2250738585072014e-308", "1e400", "-1e400", "1e-400"};
+    for (const char *c : cases) {
+        double v = jsonutil_string_to_double(c, strlen(c));
+        double expected = strtod(c, nullptr);
+        EXPECT_EQ(memcmp(&v, &expected, sizeof(double)), 0) << c;
+    }
+}
+
 TEST_F(UtilTest, testDoubleToStringRapidJson) {
     double v = 189.31;
     char buf[BUF_SIZE_DOUBLE_RAPID_JSON];